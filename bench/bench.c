@@ -0,0 +1,395 @@
+/**
+ * @file bench.c
+ * @brief Compile-time benchmarks over synthetic IR.
+ *
+ * Every generator builds a function of roughly the requested number of
+ * instructions. Building, `rs_analyze_lifetimes` and `rs_generate_to` are
+ * timed separately at sizes from 10 up to a maximum, by default 10^6, and the
+ * results are written to stdout as JSON. Each phase reports the median and
+ * median absolute deviation of its samples and the bytes it allocated, which
+ * can be saved as a baseline and compared against later, see compare.c.
+ *
+ * Usage: bench [--save FILE | --compare FILE] [max-instructions] [O0|O1|O2]
+ */
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Operands name virtual registers with a byte, so generators pass values
+ * through memory and start numbering again before reaching this many.
+ */
+#define BENCH_VREGS 192
+
+/** Values live at once in the register pressure kernel. */
+#define BENCH_PRESSURE_WIDTH 48
+
+/** Instructions in each arm of a diamond. */
+#define BENCH_DIAMOND_WIDTH 16
+
+/** Depth of each loop nest. */
+#define BENCH_LOOP_DEPTH 8
+
+/** Instructions timed per size across all of its samples. */
+#define BENCH_BUDGET 100000
+
+/** Fewest samples of a size, so that its deviation means something. */
+#define BENCH_MIN_SAMPLES 5
+
+/** Most samples of a size. */
+#define BENCH_MAX_SAMPLES 50
+
+/** Memory the generated code addresses. It is never run. */
+static int64_t cells[BENCH_LOOP_DEPTH + 2];
+
+#define CELL(i) RS_OPERAND_ADDR((uintptr_t)&cells[i])
+
+// Hands back `value`, spilled and reloaded if the registers ran out.
+static rs_operand_t recycle(rs_t *rs, rs_operand_t value) {
+  if (rs->next_dst_vreg < BENCH_VREGS)
+    return value;
+  rs_build_store(rs, value, CELL(0));
+  rs->next_dst_vreg = 0;
+  return rs_build_load(rs, CELL(0));
+}
+
+static size_t append_block(rs_t *rs) {
+  size_t block = rs_append_basic_block(rs, NULL);
+  rs_position_at_basic_block(rs, block);
+  return block;
+}
+
+// A single block of dependent arithmetic.
+static void gen_chain(rs_t *rs, size_t size) {
+  append_block(rs);
+  rs_operand_t x = rs_build_load(rs, CELL(0));
+  for (size_t i = 0; i < size / 2; i++) {
+    x = rs_build_add(rs, x, RS_OPERAND_INT64((int64_t)i));
+    x = recycle(rs, rs_build_mult(rs, x, RS_OPERAND_INT64(3)));
+  }
+  rs_build_ret(rs, x);
+}
+
+// A sequence of if-else diamonds with long arms.
+static void gen_diamonds(rs_t *rs, size_t size) {
+  append_block(rs);
+  rs_operand_t x = rs_build_load(rs, CELL(0));
+  size_t count = size / (2 * BENCH_DIAMOND_WIDTH + 6) + 1;
+  for (size_t d = 0; d < count; d++) {
+    size_t then_bb = rs_append_basic_block(rs, NULL);
+    size_t else_bb = rs_append_basic_block(rs, NULL);
+    size_t join_bb = rs_append_basic_block(rs, NULL);
+    rs_operand_t c = rs_build_cmp_lt(rs, x, RS_OPERAND_INT64((int64_t)d));
+    rs_build_br_if(rs, c, RS_OPERAND_BB(then_bb), RS_OPERAND_BB(else_bb));
+
+    size_t arms[] = {then_bb, else_bb};
+    for (size_t a = 0; a < 2; a++) {
+      rs_position_at_basic_block(rs, arms[a]);
+      rs_operand_t y = x;
+      for (size_t i = 0; i < BENCH_DIAMOND_WIDTH; i++)
+        y = rs_build_add(rs, y, RS_OPERAND_INT64((int64_t)(a + i)));
+      rs_build_store(rs, y, CELL(1));
+      rs_build_br(rs, RS_OPERAND_BB(join_bb));
+    }
+
+    rs_position_at_basic_block(rs, join_bb);
+    x = recycle(rs, rs_build_load(rs, CELL(1)));
+  }
+  rs_build_ret(rs, x);
+}
+
+// Nests of counted loops, with the counters in memory.
+static void gen_loops(rs_t *rs, size_t size) {
+  append_block(rs);
+  size_t nests = size / (9 * BENCH_LOOP_DEPTH + 2) + 1;
+  for (size_t n = 0; n < nests; n++) {
+    size_t headers[BENCH_LOOP_DEPTH], exits[BENCH_LOOP_DEPTH];
+    for (size_t d = 0; d < BENCH_LOOP_DEPTH; d++) {
+      rs_build_store(rs, RS_OPERAND_INT64(0), CELL(d + 1));
+      headers[d] = rs_append_basic_block(rs, NULL);
+      size_t body = rs_append_basic_block(rs, NULL);
+      exits[d] = rs_append_basic_block(rs, NULL);
+      rs_build_br(rs, RS_OPERAND_BB(headers[d]));
+
+      rs_position_at_basic_block(rs, headers[d]);
+      rs_operand_t i = rs_build_load(rs, CELL(d + 1));
+      rs_operand_t c = rs_build_cmp_lt(rs, i, RS_OPERAND_INT64(10));
+      rs_build_br_if(rs, c, RS_OPERAND_BB(body), RS_OPERAND_BB(exits[d]));
+      rs_position_at_basic_block(rs, body);
+    }
+
+    rs_operand_t x = rs_build_load(rs, CELL(0));
+    rs_build_store(rs, rs_build_add(rs, x, RS_OPERAND_INT64(1)), CELL(0));
+    for (size_t d = BENCH_LOOP_DEPTH; d-- > 0;) {
+      rs_operand_t i = rs_build_load(rs, CELL(d + 1));
+      rs_build_store(rs, rs_build_add(rs, i, RS_OPERAND_INT64(1)),
+                     CELL(d + 1));
+      rs_build_br(rs, RS_OPERAND_BB(headers[d]));
+      rs_position_at_basic_block(rs, exits[d]);
+    }
+    rs->next_dst_vreg = 0;
+  }
+  rs_build_ret(rs, rs_build_load(rs, CELL(0)));
+}
+
+// A switch lowered to a cascade of equality tests.
+static void gen_cascade(rs_t *rs, size_t size) {
+  append_block(rs);
+  rs_operand_t x = rs_build_load(rs, CELL(0));
+  size_t join_bb = rs_append_basic_block(rs, NULL);
+  size_t cases = size / 5 + 1;
+  for (size_t k = 0; k < cases; k++) {
+    size_t case_bb = rs_append_basic_block(rs, NULL);
+    size_t next_bb = rs_append_basic_block(rs, NULL);
+    rs_operand_t c = rs_build_cmp_eq(rs, x, RS_OPERAND_INT64((int64_t)k));
+    rs_build_br_if(rs, c, RS_OPERAND_BB(case_bb), RS_OPERAND_BB(next_bb));
+
+    rs_position_at_basic_block(rs, case_bb);
+    rs_build_store(rs, RS_OPERAND_INT64((int64_t)k), CELL(1));
+    rs_build_br(rs, RS_OPERAND_BB(join_bb));
+    rs_position_at_basic_block(rs, next_bb);
+    x = recycle(rs, x);
+  }
+  rs_build_br(rs, RS_OPERAND_BB(join_bb));
+  rs_position_at_basic_block(rs, join_bb);
+  rs_build_ret(rs, rs_build_load(rs, CELL(1)));
+}
+
+// Kernels keeping more values live than there are registers.
+static void gen_pressure(rs_t *rs, size_t size) {
+  append_block(rs);
+  rs_operand_t sum = rs_build_load(rs, CELL(0));
+  size_t kernels = size / (3 * BENCH_PRESSURE_WIDTH + 1) + 1;
+  for (size_t k = 0; k < kernels; k++) {
+    rs_operand_t values[BENCH_PRESSURE_WIDTH];
+    for (size_t i = 0; i < BENCH_PRESSURE_WIDTH; i++)
+      values[i] = rs_build_add(rs, sum, RS_OPERAND_INT64((int64_t)i));
+    for (size_t i = 0; i < BENCH_PRESSURE_WIDTH; i++)
+      values[i] = rs_build_mult(rs, values[i],
+                                values[BENCH_PRESSURE_WIDTH - 1 - i]);
+    for (size_t i = 0; i < BENCH_PRESSURE_WIDTH; i++)
+      sum = rs_build_add(rs, sum, values[i]);
+
+    rs_build_store(rs, sum, CELL(0));
+    rs->next_dst_vreg = 0;
+    sum = rs_build_load(rs, CELL(0));
+  }
+  rs_build_ret(rs, sum);
+}
+
+typedef struct {
+  const char *name;
+  void (*generate)(rs_t *rs, size_t size);
+} generator_t;
+
+static const generator_t generators[] = {
+    {"chain", gen_chain},     {"diamonds", gen_diamonds},
+    {"loops", gen_loops},     {"cascade", gen_cascade},
+    {"pressure", gen_pressure},
+};
+
+static void build(rs_t *rs, const generator_t *generator, size_t size,
+                  rs_opt_level_t level) {
+  rs_init(rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(rs, level);
+  generator->generate(rs, size);
+}
+
+/** Phases timed directly, followed by the passes `rs_generate` runs. */
+enum { PHASE_BUILD, PHASE_LIFETIMES, PHASE_GENERATE, PHASE_PASSES };
+#define PHASE_COUNT (PHASE_PASSES + RS_PASS_STATS_COUNT)
+
+typedef struct {
+  const char *name;
+  uint64_t ns[BENCH_MAX_SAMPLES];
+  uint64_t bytes; // Allocated by the last sample, they all allocate alike.
+  bool ran;
+} phase_t;
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t median(uint64_t *values, size_t count) {
+  qsort(values, count, sizeof(uint64_t), compare_u64);
+  return count % 2 ? values[count / 2]
+                   : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Summarizes the samples of a phase by their median and the median absolute
+// deviation from it, neither of which an outlier can drag far.
+static void summarize(const phase_t *phase, size_t samples,
+                      bench_record_t *record) {
+  uint64_t values[BENCH_MAX_SAMPLES];
+  memcpy(values, phase->ns, samples * sizeof(uint64_t));
+  record->median_ns = median(values, samples);
+  for (size_t i = 0; i < samples; i++)
+    values[i] = phase->ns[i] > record->median_ns
+                    ? phase->ns[i] - record->median_ns
+                    : record->median_ns - phase->ns[i];
+  record->mad_ns = median(values, samples);
+  record->bytes = phase->bytes;
+}
+
+static void sample(const generator_t *generator, size_t size,
+                   rs_opt_level_t level, phase_t *phases, size_t s,
+                   size_t *instructions, size_t *blocks) {
+  rs_t rs;
+  rs_alloc_stats_t alloc = rs_get_thread_alloc_stats();
+  uint64_t start = rs_trace_now();
+  build(&rs, generator, size, level);
+  phases[PHASE_BUILD].ns[s] = rs_trace_now() - start;
+  phases[PHASE_BUILD].bytes = rs_get_thread_alloc_stats().bytes - alloc.bytes;
+
+  *blocks = cvector_size(rs.basic_blocks);
+  *instructions = 0;
+  for (size_t b = 0; b < *blocks; b++)
+    *instructions += cvector_size(rs.basic_blocks[b]->instructions);
+
+  rs_finalize(&rs);
+  alloc = rs_get_thread_alloc_stats();
+  start = rs_trace_now();
+  rs_analyze_lifetimes(&rs);
+  phases[PHASE_LIFETIMES].ns[s] = rs_trace_now() - start;
+  phases[PHASE_LIFETIMES].bytes =
+      rs_get_thread_alloc_stats().bytes - alloc.bytes;
+  rs_reset_pass_stats(&rs);
+
+  rs_emitter_t out;
+  rs_emitter_init_buffer(&out);
+  alloc = rs_get_thread_alloc_stats();
+  start = rs_trace_now();
+  rs_generate_to(&rs, &out);
+  phases[PHASE_GENERATE].ns[s] = rs_trace_now() - start;
+  phases[PHASE_GENERATE].bytes =
+      rs_get_thread_alloc_stats().bytes - alloc.bytes;
+  rs_emitter_free(&out);
+
+  size_t count;
+  const rs_pass_stats_t *stats = rs_get_pass_stats(&rs, &count);
+  for (size_t i = 0; i < count; i++) {
+    phases[PHASE_PASSES + i].ns[s] = stats[i].nanoseconds;
+    phases[PHASE_PASSES + i].bytes = stats[i].allocated_bytes;
+    phases[PHASE_PASSES + i].ran = stats[i].runs > 0;
+  }
+  rs_free(&rs);
+}
+
+// Samples one size, writing its JSON unless `json` is NULL.
+static void run(const generator_t *generator, size_t size,
+                rs_opt_level_t level, bench_records_t *records, FILE *json,
+                bool first) {
+  size_t samples = BENCH_BUDGET / size;
+  samples = samples < BENCH_MIN_SAMPLES ? BENCH_MIN_SAMPLES : samples;
+  samples = samples > BENCH_MAX_SAMPLES ? BENCH_MAX_SAMPLES : samples;
+  size_t instructions = 0, blocks = 0;
+  phase_t *phases = calloc(PHASE_COUNT, sizeof(phase_t));
+  phases[PHASE_BUILD] = (phase_t){.name = "build", .ran = true};
+  phases[PHASE_LIFETIMES] = (phase_t){.name = "analyze_lifetimes",
+                                      .ran = true};
+  phases[PHASE_GENERATE] = (phase_t){.name = "generate", .ran = true};
+
+  // The first run warms the caches and the heap and is thrown away.
+  sample(generator, size, level, phases, 0, &instructions, &blocks);
+  for (size_t s = 0; s < samples; s++)
+    sample(generator, size, level, phases, s, &instructions, &blocks);
+
+  size_t count;
+  char pass_names[RS_PASS_STATS_COUNT][BENCH_NAME_LENGTH];
+  rs_t names;
+  rs_init(&names, RS_TARGET_X86_64_LINUX_NASM);
+  const rs_pass_stats_t *stats = rs_get_pass_stats(&names, &count);
+  for (size_t i = 0; i < count; i++) {
+    snprintf(pass_names[i], sizeof(pass_names[i]), "pass.%s", stats[i].name);
+    phases[PHASE_PASSES + i].name = pass_names[i];
+  }
+
+  if (json)
+    fprintf(json,
+            "%s\n    {\"generator\": \"%s\", \"size\": %zu, "
+            "\"instructions\": %zu, \"blocks\": %zu, \"samples\": %zu,\n"
+            "     \"phases\": {",
+            first ? "" : ",", generator->name, size, instructions, blocks,
+            samples);
+  bool first_phase = true;
+  for (size_t p = 0; p < PHASE_COUNT; p++) {
+    if (!phases[p].ran)
+      continue;
+
+    bench_record_t record;
+    snprintf(record.generator, sizeof(record.generator), "%s",
+             generator->name);
+    snprintf(record.phase, sizeof(record.phase), "%s", phases[p].name);
+    record.size = size;
+    summarize(&phases[p], samples, &record);
+    cvector_push_back(*records, record);
+
+    if (json)
+      fprintf(json,
+              "%s\n       \"%s\": {\"median_ns\": %llu, \"mad_ns\": %llu, "
+              "\"bytes\": %llu}",
+              first_phase ? "" : ",", record.phase,
+              (unsigned long long)record.median_ns,
+              (unsigned long long)record.mad_ns,
+              (unsigned long long)record.bytes);
+    first_phase = false;
+  }
+  if (json) {
+    fprintf(json, "}}");
+    fflush(json);
+  }
+  rs_free(&names);
+  free(phases);
+}
+
+int main(int argc, char **argv) {
+  const char *save = NULL, *baseline = NULL;
+  int arg = 1;
+  if (arg + 1 < argc && strcmp(argv[arg], "--save") == 0) {
+    save = argv[arg + 1];
+    arg += 2;
+  } else if (arg + 1 < argc && strcmp(argv[arg], "--compare") == 0) {
+    baseline = argv[arg + 1];
+    arg += 2;
+  }
+
+  size_t max_size = arg < argc ? strtoul(argv[arg], NULL, 10) : 1000000;
+  rs_opt_level_t level = RS_OPT_O1;
+  arg++;
+  if (arg < argc && strlen(argv[arg]) == 2 && argv[arg][0] == 'O' &&
+      argv[arg][1] >= '0' && argv[arg][1] <= '2')
+    level = (rs_opt_level_t)(argv[arg][1] - '0');
+
+  // A comparison prints its table instead of the JSON.
+  FILE *json = baseline ? NULL : stdout;
+  if (json)
+    fprintf(json,
+            "{\n  \"target\": \"x86_64_linux_nasm\",\n  \"opt_level\": %d,\n"
+            "  \"results\": [",
+            level);
+  bench_records_t records = NULL;
+  bool first = true;
+  for (size_t g = 0; g < sizeof(generators) / sizeof(generators[0]); g++) {
+    for (size_t size = 10; size <= max_size; size *= 10) {
+      run(&generators[g], size, level, &records, json, first);
+      first = false;
+    }
+  }
+  if (json)
+    fprintf(json, "\n  ]\n}\n");
+
+  // The baseline is only read now, so that it does not change the heap the
+  // benchmarks ran on.
+  int status = 0;
+  bench_records_t previous = NULL;
+  if (save && !bench_save(save, records))
+    status = 2;
+  else if (baseline && !bench_load(baseline, &previous))
+    status = 2;
+  else if (baseline && bench_compare(previous, records, stdout) > 0)
+    status = 1;
+  cvector_free(records);
+  cvector_free(previous);
+  return status;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file bench.h
+ * @brief Benchmark results and their comparison against a baseline.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../lib/runestone.h"
+#include <stdio.h>
+
+/** Longest generator or phase name, with its terminator. */
+#define BENCH_NAME_LENGTH 32
+
+/**
+ * @struct bench_record_t
+ * @brief The summary of one phase of one benchmark.
+ */
+typedef struct {
+  char generator[BENCH_NAME_LENGTH]; /**< IR generator that was compiled. */
+  size_t size;                       /**< Requested instruction count. */
+  char phase[BENCH_NAME_LENGTH];     /**< Phase or pass that was timed. */
+  uint64_t median_ns;                /**< Median time of its samples. */
+  uint64_t mad_ns; /**< Median absolute deviation of its samples. */
+  uint64_t bytes;  /**< Bytes it allocated. */
+} bench_record_t;
+
+typedef cvector(bench_record_t) bench_records_t;
+
+/**
+ * @brief Writes records to a baseline file.
+ * @param[in] path The baseline file.
+ * @param[in] records The records to write.
+ * @return True if the file was written.
+ */
+bool bench_save(const char *path, const bench_records_t records);
+
+/**
+ * @brief Reads the records of a baseline file.
+ * @param[in] path The baseline file.
+ * @param[out] records The records read, appended.
+ * @return True if the file was read.
+ */
+bool bench_load(const char *path, bench_records_t *records);
+
+/**
+ * @brief Prints how every phase changed since a baseline.
+ *
+ * A phase is slower when its median grew by more than `BENCH_TOLERANCE` and
+ * by more than `BENCH_SIGMAS` standard deviations, estimated from the larger
+ * of the two median absolute deviations, and at least `BENCH_MIN_NS`. It
+ * allocates more when its bytes grew by more than `BENCH_MEMORY_TOLERANCE`.
+ * Phases missing from the baseline are listed as new and never count against
+ * it. Phases in the baseline that the current run no longer measured are
+ * listed as missing and do, so a dropped phase cannot hide a regression.
+ *
+ * @param[in] baseline The stored records.
+ * @param[in] current The records just measured.
+ * @param[in] fp Where the table is printed.
+ * @return The number of phases that got slower, allocate more or are
+ *         missing.
+ */
+size_t bench_compare(const bench_records_t baseline,
+                     const bench_records_t current, FILE *fp);
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * @file compare.c
+ * @brief Baseline files and the regression check against them.
+ *
+ * A baseline holds one record per line: the generator, size and phase
+ * followed by the median, median absolute deviation and allocated bytes.
+ * Lines starting with `#` are comments.
+ */
+#include "../lib/cvector_utils.h"
+#include "bench.h"
+#include <errno.h>
+#include <string.h>
+
+/** Relative slowdown under which timing noise dominates. */
+#define BENCH_TOLERANCE 0.25
+
+/** Slowdown in nanoseconds under which timer resolution dominates. */
+#define BENCH_MIN_NS 1000
+
+/** Standard deviations a slowdown has to exceed. */
+#define BENCH_SIGMAS 3.0
+
+/** Scales a median absolute deviation to a normal standard deviation. */
+#define BENCH_MAD_SCALE 1.4826
+
+/** Relative growth in allocated bytes, which are deterministic. */
+#define BENCH_MEMORY_TOLERANCE 0.01
+
+bool bench_save(const char *path, const bench_records_t records) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+            "Failed to open baseline '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+
+  fprintf(fp, "# generator size phase median_ns mad_ns bytes\n");
+  bench_record_t *record_it;
+  cvector_for_each_in(record_it, records) {
+    fprintf(fp, "%s %zu %s %llu %llu %llu\n", record_it->generator,
+            record_it->size, record_it->phase,
+            (unsigned long long)record_it->median_ns,
+            (unsigned long long)record_it->mad_ns,
+            (unsigned long long)record_it->bytes);
+  }
+  return fclose(fp) == 0;
+}
+
+bool bench_load(const char *path, bench_records_t *records) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+            "Failed to open baseline '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char line[256];
+  size_t line_number = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), fp)) {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    bench_record_t record;
+    unsigned long long median_ns, mad_ns, bytes;
+    if (sscanf(line, "%31s %zu %31s %llu %llu %llu", record.generator,
+               &record.size, record.phase, &median_ns, &mad_ns,
+               &bytes) != 6) {
+      fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+              "Malformed baseline record at %s:%zu\n", path, line_number);
+      ok = false;
+      break;
+    }
+    record.median_ns = median_ns;
+    record.mad_ns = mad_ns;
+    record.bytes = bytes;
+    cvector_push_back(*records, record);
+  }
+  fclose(fp);
+  return ok;
+}
+
+static const bench_record_t *find(const bench_records_t records,
+                                  const bench_record_t *key) {
+  bench_record_t *record_it;
+  cvector_for_each_in(record_it, records) {
+    if (record_it->size == key->size &&
+        strcmp(record_it->generator, key->generator) == 0 &&
+        strcmp(record_it->phase, key->phase) == 0)
+      return record_it;
+  }
+  return NULL;
+}
+
+static double change(uint64_t before, uint64_t after) {
+  return before ? ((double)after - (double)before) / (double)before : 0.0;
+}
+
+size_t bench_compare(const bench_records_t baseline,
+                     const bench_records_t current, FILE *fp) {
+  size_t regressions = 0;
+  fprintf(fp, "%-10s %8s %-20s %12s %12s %8s %8s\n", "generator", "size",
+          "phase", "base us", "now us", "time", "bytes");
+
+  bench_record_t *record_it;
+  cvector_for_each_in(record_it, current) {
+    const bench_record_t *base = find(baseline, record_it);
+    fprintf(fp, "%-10s %8zu %-20s", record_it->generator, record_it->size,
+            record_it->phase);
+    if (!base) {
+      fprintf(fp, " %12s %12.1f %8s %8s  new\n", "-",
+              record_it->median_ns / 1e3, "-", "-");
+      continue;
+    }
+
+    double time = change(base->median_ns, record_it->median_ns);
+    double bytes = change(base->bytes, record_it->bytes);
+    uint64_t mad = base->mad_ns > record_it->mad_ns ? base->mad_ns
+                                                    : record_it->mad_ns;
+    double noise = BENCH_SIGMAS * BENCH_MAD_SCALE * (double)mad;
+    noise = noise > BENCH_MIN_NS ? noise : BENCH_MIN_NS;
+    bool slower =
+        time > BENCH_TOLERANCE &&
+        (double)record_it->median_ns - (double)base->median_ns > noise;
+    bool bigger = bytes > BENCH_MEMORY_TOLERANCE;
+
+    fprintf(fp, " %12.1f %12.1f %+7.1f%% %+7.1f%%%s%s\n",
+            base->median_ns / 1e3, record_it->median_ns / 1e3, time * 100,
+            bytes * 100, slower ? "  SLOWER" : "",
+            bigger ? "  MORE MEMORY" : "");
+    regressions += slower || bigger;
+  }
+
+  size_t missing = 0;
+  cvector_for_each_in(record_it, baseline) {
+    if (find(current, record_it))
+      continue;
+    fprintf(fp, "%-10s %8zu %-20s %12.1f %12s %8s %8s  MISSING\n",
+            record_it->generator, record_it->size, record_it->phase,
+            record_it->median_ns / 1e3, "-", "-", "-");
+    missing++;
+  }
+
+  fprintf(fp, "%zu of %zu phases regressed, %zu missing\n", regressions,
+          cvector_size(current), missing);
+  return regressions + missing;
+}
@@ -0,0 +1,266 @@
+/**
+ * @file runtime.c
+ * @brief Runtime benchmarks of the code the x86-64 backend generates.
+ *
+ * Every program of the corpus is compiled with `rs_jit_compile` at each
+ * optimization level, checked against its known result and timed with
+ * `rdtsc`. The fastest run of each is reported in cycles per iteration of its
+ * innermost loop, as JSON on stdout. Only Linux x86-64 hosts can run it.
+ *
+ * Usage: bench_runtime [runs]
+ */
+#include "../lib/runestone.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Runs of each program at each level, of which the fastest counts. */
+#define RUNTIME_RUNS 5
+
+/** Elements of the arrays the programs read. */
+#define RUNTIME_ARRAY 65536
+
+/** Iterations of the outer and inner loop of the nested program. */
+#define RUNTIME_NEST 1000
+
+/** Loops keep their state in memory, since values cannot cross blocks. */
+static int64_t counters[2], accumulators[2];
+static int64_t array[RUNTIME_ARRAY];
+static int64_t *array_base = array;
+
+#define CELL(cell) RS_OPERAND_ADDR((uintptr_t) & (cell))
+
+// Loads the address of element `i` of the array. The base comes from memory
+// rather than an immediate, since O0 does not materialize wide constants.
+static rs_operand_t element(rs_t *rs, rs_operand_t i) {
+  return rs_build_add(rs, rs_build_load(rs, CELL(array_base)),
+                      rs_build_mult(rs, i, RS_OPERAND_INT64(8)));
+}
+
+static uint64_t rdtsc(void) {
+#if defined(__x86_64__)
+  uint32_t lo, hi;
+  __asm__ volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi)::"memory");
+  return (uint64_t)hi << 32 | lo;
+#else
+  return 0;
+#endif
+}
+
+typedef struct {
+  size_t header, body, exit;
+} loop_t;
+
+// Starts `for (counter = 0; counter < limit; counter++)`, positioned in the
+// body.
+static loop_t begin_loop(rs_t *rs, int64_t *counter, int64_t limit) {
+  loop_t loop;
+  loop.header = rs_append_basic_block(rs, NULL);
+  loop.body = rs_append_basic_block(rs, NULL);
+  loop.exit = rs_append_basic_block(rs, NULL);
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(*counter));
+  rs_build_br(rs, RS_OPERAND_BB(loop.header));
+
+  rs_position_at_basic_block(rs, loop.header);
+  rs_operand_t i = rs_build_load(rs, CELL(*counter));
+  rs_operand_t c = rs_build_cmp_lt(rs, i, RS_OPERAND_INT64(limit));
+  rs_build_br_if(rs, c, RS_OPERAND_BB(loop.body), RS_OPERAND_BB(loop.exit));
+  rs_position_at_basic_block(rs, loop.body);
+  return loop;
+}
+
+// Increments the counter and branches back, positioned after the loop.
+static void end_loop(rs_t *rs, int64_t *counter, loop_t loop) {
+  rs_operand_t i = rs_build_load(rs, CELL(*counter));
+  rs_build_store(rs, rs_build_add(rs, i, RS_OPERAND_INT64(1)),
+                 CELL(*counter));
+  rs_build_br(rs, RS_OPERAND_BB(loop.header));
+  rs_position_at_basic_block(rs, loop.exit);
+}
+
+// Adds `value` to an accumulator.
+static void accumulate(rs_t *rs, int64_t *accumulator, rs_operand_t value) {
+  rs_operand_t sum = rs_build_load(rs, CELL(*accumulator));
+  rs_build_store(rs, rs_build_add(rs, sum, value), CELL(*accumulator));
+}
+
+static void begin_function(rs_t *rs) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  rs_position_at_basic_block(rs, entry);
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(accumulators[0]));
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(accumulators[1]));
+}
+
+// Sums the counter of a loop.
+static void build_sum(rs_t *rs) {
+  begin_function(rs);
+  loop_t loop = begin_loop(rs, &counters[0], RUNTIME_ARRAY * 16);
+  accumulate(rs, &accumulators[0], rs_build_load(rs, CELL(counters[0])));
+  end_loop(rs, &counters[0], loop);
+  rs_build_ret(rs, rs_build_load(rs, CELL(accumulators[0])));
+}
+
+static int64_t expect_sum(void) {
+  int64_t n = RUNTIME_ARRAY * 16;
+  return n * (n - 1) / 2;
+}
+
+// Sums an array through a scaled index.
+static void build_reduce(rs_t *rs) {
+  begin_function(rs);
+  loop_t loop = begin_loop(rs, &counters[0], RUNTIME_ARRAY);
+  rs_operand_t i = rs_build_load(rs, CELL(counters[0]));
+  accumulate(rs, &accumulators[0], rs_build_load(rs, element(rs, i)));
+  end_loop(rs, &counters[0], loop);
+  rs_build_ret(rs, rs_build_load(rs, CELL(accumulators[0])));
+}
+
+static int64_t expect_reduce(void) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < RUNTIME_ARRAY; i++)
+    sum += array[i];
+  return sum;
+}
+
+// Classifies array elements with data-dependent branches.
+static void build_branchy(rs_t *rs) {
+  begin_function(rs);
+  loop_t loop = begin_loop(rs, &counters[0], RUNTIME_ARRAY);
+  size_t low = rs_append_basic_block(rs, NULL);
+  size_t high = rs_append_basic_block(rs, NULL);
+  size_t very_high = rs_append_basic_block(rs, NULL);
+  size_t latch = rs_append_basic_block(rs, NULL);
+
+  rs_operand_t i = rs_build_load(rs, CELL(counters[0]));
+  rs_operand_t value = rs_build_load(rs, element(rs, i));
+  rs_operand_t c = rs_build_cmp_lt(rs, value, RS_OPERAND_INT64(500));
+  rs_build_br_if(rs, c, RS_OPERAND_BB(low), RS_OPERAND_BB(high));
+
+  rs_position_at_basic_block(rs, low);
+  i = rs_build_load(rs, CELL(counters[0]));
+  accumulate(rs, &accumulators[0], rs_build_load(rs, element(rs, i)));
+  rs_build_br(rs, RS_OPERAND_BB(latch));
+
+  rs_position_at_basic_block(rs, high);
+  i = rs_build_load(rs, CELL(counters[0]));
+  value = rs_build_load(rs, element(rs, i));
+  c = rs_build_cmp_gt(rs, value, RS_OPERAND_INT64(900));
+  rs_build_br_if(rs, c, RS_OPERAND_BB(very_high), RS_OPERAND_BB(latch));
+
+  rs_position_at_basic_block(rs, very_high);
+  accumulate(rs, &accumulators[1], RS_OPERAND_INT64(1));
+  rs_build_br(rs, RS_OPERAND_BB(latch));
+
+  rs_position_at_basic_block(rs, latch);
+  end_loop(rs, &counters[0], loop);
+  rs_operand_t high_count = rs_build_load(rs, CELL(accumulators[1]));
+  rs_build_ret(rs, rs_build_add(rs, rs_build_load(rs, CELL(accumulators[0])),
+                                rs_build_mult(rs, high_count,
+                                              RS_OPERAND_INT64(1000000))));
+}
+
+static int64_t expect_branchy(void) {
+  int64_t low = 0, very_high = 0;
+  for (size_t i = 0; i < RUNTIME_ARRAY; i++) {
+    if (array[i] < 500)
+      low += array[i];
+    else if (array[i] > 900)
+      very_high++;
+  }
+  return low + very_high * 1000000;
+}
+
+// Sums the products of two nested counters.
+static void build_nested(rs_t *rs) {
+  begin_function(rs);
+  loop_t outer = begin_loop(rs, &counters[0], RUNTIME_NEST);
+  loop_t inner = begin_loop(rs, &counters[1], RUNTIME_NEST);
+  rs_operand_t i = rs_build_load(rs, CELL(counters[0]));
+  rs_operand_t j = rs_build_load(rs, CELL(counters[1]));
+  accumulate(rs, &accumulators[0], rs_build_mult(rs, i, j));
+  end_loop(rs, &counters[1], inner);
+  end_loop(rs, &counters[0], outer);
+  rs_build_ret(rs, rs_build_load(rs, CELL(accumulators[0])));
+}
+
+static int64_t expect_nested(void) {
+  int64_t n = RUNTIME_NEST, triangle = n * (n - 1) / 2;
+  return triangle * triangle;
+}
+
+typedef struct {
+  const char *name;
+  void (*build)(rs_t *rs);
+  int64_t (*expected)(void);
+  int64_t iterations; // Of the innermost loop.
+} program_t;
+
+static const program_t programs[] = {
+    {"sum", build_sum, expect_sum, RUNTIME_ARRAY * 16},
+    {"reduce", build_reduce, expect_reduce, RUNTIME_ARRAY},
+    {"branchy", build_branchy, expect_branchy, RUNTIME_ARRAY},
+    {"nested", build_nested, expect_nested, RUNTIME_NEST * RUNTIME_NEST},
+};
+
+// Times one program at one level, returning false if it was wrong.
+static bool run(const program_t *program, rs_opt_level_t level, size_t runs,
+                bool first) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  program->build(&rs);
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  rs_free(&rs);
+
+  int64_t expected = program->expected(), result = 0;
+  uint64_t best = UINT64_MAX;
+  for (size_t r = 0; fn && r < runs; r++) {
+    uint64_t start = rdtsc();
+    result = fn();
+    uint64_t cycles = rdtsc() - start;
+    best = cycles < best ? cycles : best;
+  }
+  rs_jit_free(fn);
+
+  bool ok = fn && result == expected;
+  printf("%s\n    {\"program\": \"%s\", \"opt_level\": %d, \"iterations\": "
+         "%lld, \"ok\": %s, \"cycles_per_iteration\": %.3f}",
+         first ? "" : ",", program->name, level,
+         (long long)program->iterations, ok ? "true" : "false",
+         ok ? (double)best / (double)program->iterations : 0.0);
+  if (fn && !ok)
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+            "%s at O%d returned %lld instead of %lld\n",
+            program->name, level, (long long)result, (long long)expected);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+#if !defined(__x86_64__) || !defined(__linux__)
+  (void)argc;
+  (void)argv;
+  fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                  "The runtime benchmarks need a Linux x86-64 host\n");
+  return 2;
+#else
+  size_t runs = argc > 1 ? strtoul(argv[1], NULL, 10) : RUNTIME_RUNS;
+
+  // A fixed linear congruential sequence, so every run sees the same data.
+  uint64_t seed = 1;
+  for (size_t i = 0; i < RUNTIME_ARRAY; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    array[i] = (int64_t)((seed >> 33) % 1000);
+  }
+
+  printf("{\n  \"target\": \"x86_64_linux_nasm\",\n  \"results\": [");
+  bool ok = true, first = true;
+  for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+    for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+      ok &= run(&programs[p], (rs_opt_level_t)level, runs, first);
+      first = false;
+    }
+  }
+  printf("\n  ]\n}\n");
+  return ok ? 0 : 1;
+#endif
+}
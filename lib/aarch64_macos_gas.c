@@ -1,151 +1,283 @@
 #include "cvector_utils.h"
 #include "runestone.h"
-#include <assert.h>
+#include <stdlib.h>
 
-void rs_generate_aarch64_macos_gas(rs_t *rs, FILE *fp) {
-  fprintf(fp, ".text\n");
-  fprintf(fp, ".global _start\n");
-  fprintf(fp, "_start:\n");
+/**
+ * The `RS_TARGETS` count of allocatable registers, then the reserved ones.
+ */
+#define AARCH64_REGS(X)                                                        \
+  X(x9) X(x10) X(x11) X(x12) X(x13) X(x14) X(x15) X(x19) X(x20) X(x21) X(x22)  \
+  X(x23) X(x24) X(x25) X(x26) X(x27) X(x28) X(sp) X(x0) X(x16) X(x17) X(x1)
 
-  rs_basic_block_t **bb_it;
-  cvector_for_each_in(bb_it, rs->basic_blocks) {
-    fprintf(fp, ".%s:\n", (*bb_it)->name);
+#define X(name) #name,
+const char *rs_target_aarch64_macos_gas_reg_names[] = {AARCH64_REGS(X)};
+#undef X
 
-    rs_instr_t *instr_it;
-    cvector_for_each_in(instr_it, (*bb_it)->instructions) {
-      rs_generate_instr_aarch64_macos_gas(rs, fp, *instr_it);
-    }
+// Name lengths, so that emitting a register needs no strlen.
+#define X(name) sizeof(#name) - 1,
+static const uint8_t aarch64_reg_name_lengths[] = {AARCH64_REGS(X)};
+#undef X
+
+/** Index of `sp` in `rs_target_aarch64_macos_gas_reg_names`. */
+#define AARCH64_SP 17
+
+/** Register or 12-bit unsigned immediate source. */
+#define AARCH64_RI (RS_KIND_REG | RS_KIND_IMM12)
+/** Operand that can be dereferenced without materializing it. */
+#define AARCH64_ADDRESS (RS_KIND_REG | RS_KIND_MEM)
+
+/**
+ * @brief Three-operand arithmetic, loading the immediates that do not fit
+ *        into the instruction into the `x16` scratch register.
+ */
+#define AARCH64_BINARY_PATTERNS(P, opcode, mnemonic, src2_kinds)               \
+  P(opcode, (RS_KIND_REG, RS_KIND_REG, src2_kinds, RS_KIND_NULL), NONE, 1,     \
+    mnemonic " $d, $1, $2")                                                    \
+  P(opcode, (RS_KIND_REG, RS_KIND_REG, RS_KIND_IMM, RS_KIND_NULL), NONE, 2,    \
+    "ldr x16, =$2\n" mnemonic " $d, $1, x16")                                  \
+  P(opcode, (RS_KIND_REG, RS_KIND_IMM, RS_KIND_REG, RS_KIND_NULL), NONE, 2,    \
+    "ldr x16, =$1\n" mnemonic " $d, x16, $2")
+
+/**
+ * @brief Comparison patterns, materializing the flag or branching on it.
+ */
+#define AARCH64_CMP_PATTERNS(P, F, opcode, cc)                                 \
+  P(opcode, (RS_KIND_REG, RS_KIND_REG, AARCH64_RI, RS_KIND_NULL), NONE, 2,     \
+    "cmp $1, $2\ncset $d, " cc)                                                \
+  P(opcode, (RS_KIND_REG, RS_KIND_REG, RS_KIND_IMM, RS_KIND_NULL), NONE, 3,    \
+    "ldr x16, =$2\ncmp $1, x16\ncset $d, " cc)                                 \
+  P(opcode, (RS_KIND_REG, RS_KIND_IMM, AARCH64_RI, RS_KIND_NULL), NONE, 3,     \
+    "ldr x16, =$1\ncmp x16, $2\ncset $d, " cc)                                 \
+  F(opcode, (RS_KIND_REG, RS_KIND_REG, AARCH64_RI, RS_KIND_NULL), BR_IF,       \
+    (RS_KIND_NULL, RS_KIND_LINK, RS_KIND_BB, RS_KIND_BB), NONE, 3,             \
+    "cmp $f1, $f2\nb." cc " $2\nb $3")
+
+/**
+ * @brief The AArch64 instruction selection patterns.
+ *
+ * `P` declares a pattern covering one instruction and `F` one fusing two, see
+ * `RS_PATTERN` and `RS_FUSED_PATTERN`. The cheapest matching pattern wins,
+ * and the first one listed among equally cheap ones.
+ */
+#define AARCH64_PATTERNS(P, F)                                                 \
+  P(MOVE, (RS_KIND_REG, RS_KIND_REG, RS_KIND_NULL, RS_KIND_NULL), TIED_SRC1,   \
+    0, "")                                                                     \
+  P(MOVE,                                                                      \
+    (RS_KIND_REG, RS_KIND_REG | RS_KIND_IMM, RS_KIND_NULL, RS_KIND_NULL),      \
+    NONE, 1, "mov $d, $1")                                                     \
+  P(MOVE, (RS_KIND_REG, RS_KIND_ADDR, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,    \
+    "ldr $d, =$1")                                                             \
+  P(LOAD, (RS_KIND_REG, RS_KIND_IMM, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,     \
+    "mov $d, $1")                                                              \
+  P(LOAD, (RS_KIND_REG, AARCH64_ADDRESS, RS_KIND_NULL, RS_KIND_NULL), NONE, 1, \
+    "ldr $d, [$1]")                                                            \
+  P(LOAD, (RS_KIND_REG, RS_KIND_ADDR, RS_KIND_NULL, RS_KIND_NULL), NONE, 2,    \
+    "ldr $d, =$1\nldr $d, [$d]")                                               \
+  P(STORE, (RS_KIND_NULL, RS_KIND_REG, AARCH64_ADDRESS, RS_KIND_NULL), NONE,   \
+    1, "str $1, [$2]")                                                         \
+  P(STORE, (RS_KIND_NULL, RS_KIND_REG, RS_KIND_ADDR, RS_KIND_NULL), NONE, 2,   \
+    "ldr x16, =$2\nstr $1, [x16]")                                             \
+  P(STORE, (RS_KIND_NULL, RS_KIND_IMM, AARCH64_ADDRESS, RS_KIND_NULL), NONE,   \
+    2, "ldr x17, =$1\nstr x17, [$2]")                                          \
+  P(STORE, (RS_KIND_NULL, RS_KIND_IMM, RS_KIND_ADDR, RS_KIND_NULL), NONE, 3,   \
+    "ldr x16, =$2\nldr x17, =$1\nstr x17, [x16]")                              \
+  AARCH64_BINARY_PATTERNS(P, ADD, "add", AARCH64_RI)                           \
+  P(ADD, (RS_KIND_REG, RS_KIND_IMM12, RS_KIND_REG, RS_KIND_NULL), NONE, 1,     \
+    "add $d, $2, $1")                                                          \
+  AARCH64_BINARY_PATTERNS(P, SUB, "sub", AARCH64_RI)                           \
+  AARCH64_BINARY_PATTERNS(P, MULT, "mul", RS_KIND_REG)                         \
+  AARCH64_BINARY_PATTERNS(P, DIV, "sdiv", RS_KIND_REG)                         \
+  P(RET, (RS_KIND_NULL, RS_KIND_NULL, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,    \
+    "?add sp, sp, $F\nret")                                                    \
+  P(RET,                                                                       \
+    (RS_KIND_NULL, RS_KIND_REG | RS_KIND_IMM, RS_KIND_NULL, RS_KIND_NULL),     \
+    NONE, 2, "mov x0, $1\n?add sp, sp, $F\nret")                               \
+  P(BR, (RS_KIND_NULL, RS_KIND_BB, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,       \
+    "b $1")                                                                    \
+  P(BR_IF, (RS_KIND_NULL, RS_KIND_REG, RS_KIND_BB, RS_KIND_BB), NONE, 2,       \
+    "cbnz $1, $2\nb $3")                                                       \
+  AARCH64_CMP_PATTERNS(P, F, CMP_EQ, "eq")                                     \
+  AARCH64_CMP_PATTERNS(P, F, CMP_LT, "lt")                                     \
+  AARCH64_CMP_PATTERNS(P, F, CMP_GT, "gt")                                     \
+  P(SPILL, (RS_KIND_NULL, RS_KIND_REG, RS_KIND_SLOT, RS_KIND_NULL), NONE, 1,   \
+    "str $1, $2")                                                              \
+  P(RELOAD, (RS_KIND_REG, RS_KIND_SLOT, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,  \
+    "ldr $d, $1")                                                              \
+  P(PARAM, (RS_KIND_REG, RS_KIND_SLOT, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,   \
+    "ldr $d, $1")
+
+static const rs_pattern_t aarch64_patterns[] = {
+    AARCH64_PATTERNS(RS_PATTERN, RS_FUSED_PATTERN)};
+
+const rs_isel_t rs_isel_aarch64_macos_gas = {
+    aarch64_patterns,
+    sizeof(aarch64_patterns) / sizeof(aarch64_patterns[0]),
+    rs_target_aarch64_macos_gas_reg_names,
+    sizeof(rs_target_aarch64_macos_gas_reg_names) /
+        sizeof(rs_target_aarch64_macos_gas_reg_names[0]),
+    NULL,
+    AARCH64_SP,
+    16,
+    "?sub sp, sp, $F\n1str x0, [sp]\n2str x1, [sp, 8]",
+    NULL,
+    0,
+    "ldr x16, =$1\nldr x17, [x16]\nadd x17, x17, 1\nstr x17, [x16]",
+    "ldr x16, =$1\nmov x17, 1\nstadd x17, [x16]"};
+
+static void emit_reg(rs_emitter_t *out, uint8_t reg) {
+  rs_emit(out, rs_target_aarch64_macos_gas_reg_names[reg],
+          aarch64_reg_name_lengths[reg]);
+}
+
+// GAS labels are global to the file, so the blocks of module functions are
+// qualified with the function's symbol.
+static void emit_label(rs_t *rs, rs_emitter_t *out, size_t block_id) {
+  rs_emit_char(out, '.');
+  if (rs->symbol) {
+    rs_emit_str(out, rs->symbol);
+    rs_emit_char(out, '.');
   }
+  rs_emit_str(out, rs->basic_blocks[block_id]->name);
 }
 
-void rs_generate_instr_aarch64_macos_gas(rs_t *rs, FILE *fp, rs_instr_t instr) {
-  fprintf(fp, "  ; ");
-  rs_dump_instr(rs, fp, instr);
-  fprintf(fp, "\n");
-  switch (instr.opcode) {
-  case RS_OPCODE_MOVE:
-    assert(false && "unimplemented");
+static void print_moperand(rs_t *rs, rs_emitter_t *out,
+                           rs_moperand_t operand) {
+  switch (operand.type) {
+  case RS_MOPERAND_NONE:
     break;
-
-  case RS_OPCODE_COPY:
-    assert(false && "unimplemented");
+  case RS_MOPERAND_REG:
+  case RS_MOPERAND_REG8:
+    emit_reg(out, operand.reg);
     break;
-
-  case RS_OPCODE_LOAD:
-    fprintf(fp, "  mov ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.dest, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, true);
-    fprintf(fp, "\n");
+  case RS_MOPERAND_IMM:
+    rs_emit_char(out, '#');
+    rs_emit_int(out, operand.imm);
     break;
-
-  case RS_OPCODE_STORE:
-    assert(false && "unimplemented");
+  case RS_MOPERAND_POOL:
+    rs_emit_char(out, '=');
+    rs_emit_int(out, operand.imm);
     break;
-
-  case RS_OPCODE_ADD:
-    fprintf(fp, "  add ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.dest, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
+  case RS_MOPERAND_MEM:
+    // Only the forms accepted by rs_target_supports_address reach here.
+    rs_emit_char(out, '[');
+    emit_reg(out, operand.mem.base);
+    if (operand.mem.index != RS_NO_MREG) {
+      rs_emit(out, ", ", 2);
+      emit_reg(out, operand.mem.index);
+      if (operand.mem.scale == 8)
+        rs_emit(out, ", lsl #3", 8);
+    } else if (operand.mem.disp != 0) {
+      rs_emit(out, ", #", 3);
+      rs_emit_int(out, operand.mem.disp);
+    }
+    rs_emit_char(out, ']');
     break;
-
-  case RS_OPCODE_SUB:
-  case RS_OPCODE_MULT:
-  case RS_OPCODE_DIV:
-    assert(false && "unimplemented");
+  case RS_MOPERAND_LABEL:
+    emit_label(rs, out, operand.label);
+    break;
+  case RS_MOPERAND_SYMBOL:
+    rs_emit_str(out, operand.symbol);
     break;
+  case RS_MOPERAND_LITERAL:
+    rs_emit(out, operand.literal.text, operand.literal.length);
+    break;
+  }
+}
 
-  case RS_OPCODE_RET:
-    if (instr.src1.type != RS_OPERAND_TYPE_NULL) {
-      fprintf(fp, "  mov x0, ");
-      rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-      fprintf(fp, "\n");
+static void print_minstrs(rs_t *rs, rs_emitter_t *out, rs_minstrs_t minstrs) {
+  rs_minstr_t *minstr_it;
+  cvector_for_each_in(minstr_it, minstrs) {
+    rs_emit(out, "  ", 2);
+    rs_emit_str(out, minstr_it->mnemonic);
+    for (size_t i = 0; i < minstr_it->operand_count; i++) {
+      if (i == 0)
+        rs_emit_char(out, ' ');
+      else
+        rs_emit(out, ", ", 2);
+      print_moperand(rs, out, minstr_it->operands[i]);
     }
-    fprintf(fp, "  ret\n");
-    break;
+    rs_emit_char(out, '\n');
+  }
+}
 
-  case RS_OPCODE_BR:
-    fprintf(fp, "  b ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-    fprintf(fp, "\n");
-    break;
+static void generate_template(rs_t *rs, rs_emitter_t *out,
+                              const char *template, const rs_instr_t *instrs,
+                              size_t count) {
+  rs_minstrs_t minstrs = NULL;
+  rs_render_template(rs, template, instrs, count, &minstrs);
+  print_minstrs(rs, out, minstrs);
+  cvector_free(minstrs);
+}
 
-  case RS_OPCODE_BR_IF:
-    fprintf(fp, "  cbnz ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
-    fprintf(fp, "  b ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src3, false);
-    fprintf(fp, "\n");
-    break;
+static void generate_pattern(rs_t *rs, rs_emitter_t *out,
+                             const rs_pattern_t *pattern,
+                             const rs_instr_t *instrs, size_t count) {
+  // Rendering allocates the registers the comments may describe.
+  rs_minstrs_t minstrs = NULL;
+  if (pattern)
+    rs_render_template(rs, pattern->template, instrs, count, &minstrs);
 
-  case RS_OPCODE_CMP_EQ:
-    fprintf(fp, "  cmp ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
-    fprintf(fp, "  cset ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.dest, false);
-    fprintf(fp, ", eq\n");
-    break;
+  for (size_t i = 0; i < count; i++)
+    rs_emit_comment(rs, out, "  ; ", instrs[i]);
 
-  case RS_OPCODE_CMP_LT:
-    fprintf(fp, "  cmp ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
-    fprintf(fp, "  cset ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.dest, false);
-    fprintf(fp, ", lt\n");
-    break;
+  if (!pattern) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "No AArch64 pattern matches '");
+    rs_dump_instr(rs, stderr, instrs[0]);
+    fprintf(stderr, "'\n");
+    return;
+  }
+  print_minstrs(rs, out, minstrs);
+  cvector_free(minstrs);
+}
 
-  case RS_OPCODE_CMP_GT:
-    fprintf(fp, "  cmp ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src1, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
-    fprintf(fp, "  cset ");
-    rs_generate_operand_aarch64_macos_gas(rs, fp, instr.dest, false);
-    fprintf(fp, ", gt\n");
-    break;
+static void generate_block(rs_t *rs, rs_emitter_t *out, const void *def_use,
+                           size_t block_id) {
+  emit_label(rs, out, block_id);
+  rs_emit(out, ":\n", 2);
 
-  case RS_OPCODE_COUNT:
-    assert(false && "unreachable");
-    break;
+  rs_minstrs_t counter = NULL;
+  rs_render_block_counter(rs, block_id, &counter);
+  print_minstrs(rs, out, counter);
+  cvector_free(counter);
+
+  rs_instructions_t instrs = rs->basic_blocks[block_id]->instructions;
+  for (size_t i = 0; i < cvector_size(instrs);) {
+    size_t length;
+    const rs_pattern_t *pattern = rs_select_pattern(
+        rs, def_use, &instrs[i], cvector_size(instrs) - i, &length);
+    generate_pattern(rs, out, pattern, &instrs[i], length);
+    i += length;
+  }
+}
+
+void rs_generate_aarch64_macos_gas(rs_t *rs, rs_emitter_t *out) {
+  // A streamed function gets its header with the first window only.
+  if (rs->window_begin == 0) {
+    rs_emit_str(out, ".text\n"
+                     ".global ");
+    rs_emit_str(out, rs_get_symbol(rs));
+    rs_emit_char(out, '\n');
+    rs_emit_str(out, rs_get_symbol(rs));
+    rs_emit(out, ":\n", 2);
+    generate_template(rs, out, rs_isel_aarch64_macos_gas.prologue, NULL, 0);
   }
+
+  // O0 skips the analysis, and with it instruction fusion.
+  const rs_def_use_t *def_use =
+      rs->opt_level == RS_OPT_O0 ? NULL : rs_get_def_use(rs);
+  rs_emit_blocks(rs, out, generate_block, def_use);
+}
+
+void rs_generate_instr_aarch64_macos_gas(rs_t *rs, rs_emitter_t *out,
+                                         rs_instr_t instr) {
+  size_t length;
+  generate_pattern(rs, out, rs_select_pattern(rs, NULL, &instr, 1, &length),
+                   &instr, 1);
 }
 
-void rs_generate_operand_aarch64_macos_gas(rs_t *rs, FILE *fp,
+void rs_generate_operand_aarch64_macos_gas(rs_t *rs, rs_emitter_t *out,
                                            rs_operand_t operand,
                                            bool dereference) {
-  switch (operand.type) {
-  case RS_OPERAND_TYPE_NULL:
-    break;
-  case RS_OPERAND_TYPE_INT64:
-    fprintf(fp, "#%lld", operand.int64);
-    break;
-  case RS_OPERAND_TYPE_ADDR:
-    fprintf(fp, "%zu", operand.addr);
-    break;
-  case RS_OPERAND_TYPE_REG:
-    fprintf(
-        fp, "%s%s%s", dereference ? "[" : "",
-        rs_get_register_names(rs->target)[rs_get_register(rs, operand.vreg)],
-        dereference ? "]" : "");
-    break;
-  case RS_OPERAND_TYPE_BB:
-    fprintf(fp, ".%s", rs->basic_blocks[operand.bb_id]->name);
-    break;
-  case RS_OPERAND_TYPE_COUNT:
-    break;
-  }
+  print_moperand(rs, out, rs_lower_operand(rs, operand, dereference));
 }
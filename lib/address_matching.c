@@ -0,0 +1,269 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+
+bool rs_target_supports_address(rs_target_t target, rs_operand_t operand) {
+  if (operand.type != RS_OPERAND_TYPE_MEM)
+    return false;
+
+  bool has_index = operand.mem.index != RS_INVALID_VREG;
+  uint8_t scale = operand.mem.scale;
+  if (has_index && scale != 1 && scale != 2 && scale != 4 && scale != 8)
+    return false;
+
+  switch (target) {
+  // [base + index * scale + disp32]
+  case RS_TARGET_X86_64_LINUX_NASM:
+    return true;
+
+  // [xN, #imm] with a scaled unsigned or unscaled signed offset, or
+  // [xN, xM, lsl #3] for 64-bit accesses.
+  case RS_TARGET_AARCH64_MACOS_GAS:
+    if (operand.mem.base == RS_INVALID_VREG)
+      return false;
+    if (has_index)
+      return operand.mem.disp == 0 && (scale == 1 || scale == 8);
+    return (operand.mem.disp >= -256 && operand.mem.disp <= 255) ||
+           (operand.mem.disp >= 0 && operand.mem.disp <= 32760 &&
+            operand.mem.disp % 8 == 0);
+
+  case RS_TARGET_COUNT:
+    break;
+  }
+  return false;
+}
+
+static bool const_operand(rs_operand_t operand, int64_t *value) {
+  if (operand.type != RS_OPERAND_TYPE_INT64)
+    return false;
+  *value = operand.int64;
+  return true;
+}
+
+static bool reg_operand(rs_operand_t operand, uint8_t *vreg) {
+  if (operand.type != RS_OPERAND_TYPE_REG ||
+      operand.vreg == RS_TEMPORARY_VREG)
+    return false;
+  *vreg = operand.vreg;
+  return true;
+}
+
+static bool add_disp(rs_operand_t *mem, int64_t delta) {
+  int64_t disp = (int64_t)mem->mem.disp + delta;
+  if (disp < INT32_MIN || disp > INT32_MAX)
+    return false;
+  mem->mem.disp = (int32_t)disp;
+  return true;
+}
+
+// Absorbs the definition of the base register, if it is address arithmetic.
+static bool absorb_base(rs_t *rs, const rs_def_use_t *def_use,
+                        rs_operand_t mem, rs_operand_t *out) {
+  rs_instr_t *def = rs_unique_def(rs, def_use, mem.mem.base);
+  if (!def)
+    return false;
+
+  int64_t c;
+  uint8_t x, y;
+  *out = mem;
+
+  switch (def->opcode) {
+  case RS_OPCODE_ADD:
+    if (reg_operand(def->src1, &x) && const_operand(def->src2, &c)) {
+      out->mem.base = x;
+      return add_disp(out, c);
+    }
+    if (const_operand(def->src1, &c) && reg_operand(def->src2, &x)) {
+      out->mem.base = x;
+      return add_disp(out, c);
+    }
+    if (mem.mem.index == RS_INVALID_VREG && reg_operand(def->src1, &x) &&
+        reg_operand(def->src2, &y)) {
+      // Prefer the scaled term as the index so it can be absorbed next.
+      rs_instr_t *x_def = rs_unique_def(rs, def_use, x);
+      bool x_scaled = x_def && x_def->opcode == RS_OPCODE_MULT;
+      out->mem.base = x_scaled ? y : x;
+      out->mem.index = x_scaled ? x : y;
+      out->mem.scale = 1;
+      return true;
+    }
+    return false;
+
+  case RS_OPCODE_SUB:
+    if (reg_operand(def->src1, &x) && const_operand(def->src2, &c) &&
+        c != INT64_MIN) {
+      out->mem.base = x;
+      return add_disp(out, -c);
+    }
+    return false;
+
+  default:
+    return false;
+  }
+}
+
+// Absorbs the definition of the index register, if it is a scale or offset.
+static bool absorb_index(rs_t *rs, const rs_def_use_t *def_use,
+                         rs_operand_t mem, rs_operand_t *out) {
+  rs_instr_t *def = rs_unique_def(rs, def_use, mem.mem.index);
+  if (!def)
+    return false;
+
+  int64_t c;
+  uint8_t x;
+  *out = mem;
+
+  switch (def->opcode) {
+  case RS_OPCODE_MULT:
+    if (!((reg_operand(def->src1, &x) && const_operand(def->src2, &c)) ||
+          (const_operand(def->src1, &c) && reg_operand(def->src2, &x))))
+      return false;
+    if (c != 1 && c != 2 && c != 4 && c != 8)
+      return false;
+    if (mem.mem.scale * c > 8)
+      return false;
+    out->mem.index = x;
+    out->mem.scale = mem.mem.scale * c;
+    return true;
+
+  case RS_OPCODE_ADD:
+    if (!((reg_operand(def->src1, &x) && const_operand(def->src2, &c)) ||
+          (const_operand(def->src1, &c) && reg_operand(def->src2, &x))))
+      return false;
+    if (c > INT32_MAX || c < INT32_MIN)
+      return false;
+    out->mem.index = x;
+    return add_disp(out, c * mem.mem.scale);
+
+  default:
+    return false;
+  }
+}
+
+static rs_operand_t *address_operand(rs_instr_t *instr) {
+  switch (instr->opcode) {
+  case RS_OPCODE_LOAD:
+    return &instr->src1;
+  case RS_OPCODE_STORE:
+    return &instr->src2;
+  default:
+    return NULL;
+  }
+}
+
+// The absorbed registers are read at the memory access instead of at the
+// arithmetic, which is only safe if nothing redefines them in between.
+static bool is_legal(rs_t *rs, const rs_def_use_t *def_use,
+                     rs_operand_t candidate) {
+  if (candidate.mem.base != RS_INVALID_VREG &&
+      def_use->def_count[candidate.mem.base] > 1)
+    return false;
+  if (candidate.mem.index != RS_INVALID_VREG &&
+      def_use->def_count[candidate.mem.index] > 1)
+    return false;
+  return rs_target_supports_address(rs->target, candidate);
+}
+
+static bool match_address(rs_t *rs, const rs_def_use_t *def_use,
+                          rs_operand_t *address) {
+  rs_operand_t mem;
+  if (address->type == RS_OPERAND_TYPE_MEM)
+    mem = *address;
+  else if (address->type == RS_OPERAND_TYPE_REG &&
+           address->vreg != RS_TEMPORARY_VREG)
+    mem = RS_OPERAND_MEM(address->vreg, 0);
+  else
+    return false;
+
+  bool matched = false, progress = true;
+  while (progress) {
+    progress = false;
+    rs_operand_t candidate;
+
+    if (mem.mem.base != RS_INVALID_VREG &&
+        absorb_base(rs, def_use, mem, &candidate) &&
+        is_legal(rs, def_use, candidate)) {
+      mem = candidate;
+      progress = matched = true;
+    }
+
+    if (mem.mem.index != RS_INVALID_VREG &&
+        absorb_index(rs, def_use, mem, &candidate) &&
+        is_legal(rs, def_use, candidate)) {
+      mem = candidate;
+      progress = matched = true;
+    }
+  }
+
+  if (matched)
+    *address = mem;
+  return matched;
+}
+
+static bool is_pure(rs_opcode_t opcode) {
+  return opcode == RS_OPCODE_ADD || opcode == RS_OPCODE_SUB ||
+         opcode == RS_OPCODE_MULT || opcode == RS_OPCODE_MOVE;
+}
+
+void rs_match_addresses(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  const rs_def_use_t *def_use = rs_get_def_use(rs);
+  if (!def_use)
+    return;
+
+  size_t matched = 0;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, bb->instructions) {
+      rs_operand_t *address = address_operand(instr_it);
+      if (address && match_address(rs, def_use, address)) {
+        matched++;
+        trace_log("Matched address in block '%s': base %d, index %d, scale "
+                  "%d, disp %d",
+                  bb->name, address->mem.base, address->mem.index,
+                  address->mem.scale, address->mem.disp);
+      }
+    }
+  }
+
+  // Delete the address arithmetic that no longer has any users. Removing one
+  // instruction can orphan the ones feeding it, so repeat until stable.
+  size_t removed = 0;
+  bool changed = matched > 0;
+  while (changed) {
+    changed = false;
+    rs_invalidate_analyses(rs, RS_ANALYSIS_BIT(DEF_USE));
+    def_use = rs_get_def_use(rs);
+
+    for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+         block_id++) {
+      rs_basic_block_t *bb = rs->basic_blocks[block_id];
+      for (size_t i = 0; i < cvector_size(bb->instructions);) {
+        uint8_t def;
+        rs_instr_t instr = bb->instructions[i];
+        if (is_pure(instr.opcode) && rs_instr_def(instr, &def) &&
+            def_use->use_count[def] == 0) {
+          cvector_erase(bb->instructions, i);
+          changed = true;
+          removed++;
+          continue;
+        }
+        i++;
+      }
+    }
+  }
+
+  debug_log("Matched %zu addresses, removed %zu instructions", matched,
+            removed);
+}
@@ -0,0 +1,26 @@
+#include "runestone.h"
+#include <stdlib.h>
+
+// Each thread counts its own allocations, so concurrent compilations do not
+// contend or mix their counts.
+static __thread rs_alloc_stats_t thread_stats;
+
+void *rs_malloc(size_t size) {
+  thread_stats.count++;
+  thread_stats.bytes += size;
+  return malloc(size);
+}
+
+void *rs_calloc(size_t count, size_t size) {
+  thread_stats.count++;
+  thread_stats.bytes += count * size;
+  return calloc(count, size);
+}
+
+void *rs_realloc(void *ptr, size_t size) {
+  thread_stats.count++;
+  thread_stats.bytes += size;
+  return realloc(ptr, size);
+}
+
+rs_alloc_stats_t rs_get_thread_alloc_stats(void) { return thread_stats; }
@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+static void free_report(void *ptr) {
+  rs_alloc_report_t *report = ptr;
+  free(report->name);
+  cvector_free(report->blocks);
+}
+
+void rs_alloc_report_enable(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  rs->alloc_report = true;
+  if (!rs->alloc_reports)
+    cvector_init(rs->alloc_reports, 1, free_report);
+}
+
+const rs_alloc_report_t *rs_get_alloc_report(const rs_t *rs, size_t *count) {
+  *count = cvector_size(rs->alloc_reports);
+  return rs->alloc_reports;
+}
+
+void rs_reset_alloc_report(rs_t *rs) {
+  if (rs->alloc_reports)
+    cvector_clear(rs->alloc_reports);
+}
+
+rs_regalloc_stats_t *rs_alloc_report_block(rs_t *rs, size_t block_id) {
+  if (!rs->alloc_report || cvector_size(rs->alloc_reports) == 0)
+    return NULL;
+
+  rs_alloc_report_t *report = cvector_back(rs->alloc_reports);
+  if (block_id < report->first_block ||
+      block_id - report->first_block >= cvector_size(report->blocks))
+    return NULL;
+  return &report->blocks[block_id - report->first_block];
+}
+
+void rs_alloc_report_begin(rs_t *rs) {
+  if (!rs->alloc_report)
+    return;
+
+  // A streamed window continues the function of the previous one.
+  if (rs->window_begin == 0 || cvector_size(rs->alloc_reports) == 0) {
+    rs_alloc_report_t report;
+    memset(&report, 0, sizeof(report));
+    report.name = strdup(rs_get_symbol(rs));
+    report.first_block = rs->window_begin;
+    cvector_push_back(rs->alloc_reports, report);
+  }
+
+  rs_alloc_report_t *report = cvector_back(rs->alloc_reports);
+  rs_regalloc_stats_t empty;
+  memset(&empty, 0, sizeof(empty));
+  while (report->first_block + cvector_size(report->blocks) < rs->window_end)
+    cvector_push_back(report->blocks, empty);
+}
+
+// Checks whether a copy from `src` to `dst` got a single register.
+static bool same_register(rs_t *rs, uint8_t dst, uint8_t src) {
+  return rs_regmap_contains(&rs->register_map, dst) &&
+         rs_regmap_contains(&rs->register_map, src) &&
+         rs_regmap_get(&rs->register_map, dst) ==
+             rs_regmap_get(&rs->register_map, src);
+}
+
+static void count_block(rs_t *rs, const rs_basic_block_t *bb,
+                        rs_regalloc_stats_t *stats) {
+  rs_instr_t *instr_it;
+  cvector_for_each_in(instr_it, bb->instructions) {
+    rs_instr_t instr = *instr_it;
+    if (instr.opcode == RS_OPCODE_SPILL)
+      stats->spills++;
+    else if (instr.opcode == RS_OPCODE_RELOAD)
+      stats->reloads++;
+
+    uint8_t def;
+    bool is_copy =
+        rs_instr_def(instr, &def) && instr.src1.type == RS_OPERAND_TYPE_REG &&
+        (instr.opcode == RS_OPCODE_MOVE ||
+         (rs_opcode_is_two_address(instr.opcode) &&
+          rs->tied[def] == instr.src1.vreg));
+    if (is_copy && same_register(rs, def, instr.src1.vreg))
+      stats->coalesced_moves++;
+    else if (is_copy)
+      stats->moves++;
+  }
+}
+
+void rs_alloc_report_end(rs_t *rs) {
+  if (!rs->alloc_report || cvector_size(rs->alloc_reports) == 0)
+    return;
+
+  const rs_pressure_t *pressure = rs_get_pressure(rs);
+  if (!pressure)
+    return;
+
+  rs_alloc_report_t *report = cvector_back(rs->alloc_reports);
+  report->regalloc = rs->regalloc;
+  report->frame_size = rs->stack_size;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_regalloc_stats_t *stats = rs_alloc_report_block(rs, block_id);
+    stats->max_pressure =
+        rs_pressure_block_max(pressure, block_id - rs->window_begin);
+    count_block(rs, rs->basic_blocks[block_id], stats);
+
+    rs_regalloc_stats_t *total = &report->total;
+    if (stats->max_pressure > total->max_pressure)
+      total->max_pressure = stats->max_pressure;
+    total->spills += stats->spills;
+    total->reloads += stats->reloads;
+    total->remats += stats->remats;
+    total->coalesced_moves += stats->coalesced_moves;
+    total->moves += stats->moves;
+  }
+
+  debug_log("Function '%s': %zu spills, %zu reloads, %zu moves left",
+            report->name, report->total.spills, report->total.reloads,
+            report->total.moves);
+}
+
+static void write_stats(FILE *fp, const rs_regalloc_stats_t *stats) {
+  fprintf(fp,
+          "\"max_pressure\":%zu,\"spills\":%zu,\"reloads\":%zu,"
+          "\"remats\":%zu,\"coalesced_moves\":%zu,\"moves\":%zu",
+          stats->max_pressure, stats->spills, stats->reloads, stats->remats,
+          stats->coalesced_moves, stats->moves);
+}
+
+bool rs_alloc_report_write_json(const rs_t *rs, FILE *fp) {
+  if (!rs || !fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state or file\n");
+    return false;
+  }
+
+  static const char *regalloc_names[] = {"linear", "graph", "stack"};
+  fputs("{\"functions\":[", fp);
+  for (size_t f = 0; f < cvector_size(rs->alloc_reports); f++) {
+    const rs_alloc_report_t *report = &rs->alloc_reports[f];
+    fputs(f == 0 ? "\n{\"name\":" : ",\n{\"name\":", fp);
+    rs_json_write_string(fp, report->name);
+    fprintf(fp, ",\"regalloc\":\"%s\",\"frame_size\":%zu,",
+            regalloc_names[report->regalloc], report->frame_size);
+    write_stats(fp, &report->total);
+    fputs(",\"blocks\":[", fp);
+    for (size_t b = 0; b < cvector_size(report->blocks); b++) {
+      fprintf(fp, "%s{\"id\":%zu,", b == 0 ? "" : ",",
+              report->first_block + b);
+      write_stats(fp, &report->blocks[b]);
+      fputc('}', fp);
+    }
+    fputs("]}", fp);
+  }
+  fputs("\n]}\n", fp);
+  return !ferror(fp);
+}
@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+/** Upper bound on the workers of one batch. */
+#define RS_BATCH_MAX_THREADS 256
+
+/** Runs of blocks per worker, so that uneven blocks balance out. */
+#define RS_EMIT_CHUNKS_PER_THREAD 4
+
+// Items a worker has left. The owner takes from the back and thieves from
+// the front, so they only contend over the last item.
+typedef struct {
+  pthread_mutex_t lock;
+  size_t head;
+  size_t tail;
+} deque_t;
+
+typedef struct {
+  rs_batch_item_t *items;
+  rs_emitter_t *outputs;
+  bool *results;
+  deque_t *deques;
+  size_t worker_count;
+} pool_t;
+
+typedef struct {
+  pool_t *pool;
+  size_t id;
+  pthread_t thread;
+  bool started;
+} worker_t;
+
+static bool pop(deque_t *deque, size_t *item) {
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->head < deque->tail;
+  if (found)
+    *item = --deque->tail;
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static bool steal(deque_t *deque, size_t *item) {
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->head < deque->tail;
+  if (found)
+    *item = deque->head++;
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static void compile(pool_t *pool, size_t index) {
+  rs_batch_item_t *item = &pool->items[index];
+  rs_emitter_t *out = &pool->outputs[index];
+  if (item->rs) {
+    pool->results[index] = rs_generate_to(item->rs, out);
+  } else if (item->module) {
+    pool->results[index] = rs_module_generate_to(item->module, out);
+  } else {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Batch item %zu has nothing to compile\n",
+            index);
+    pool->results[index] = false;
+  }
+}
+
+static void *run_worker(void *arg) {
+  worker_t *worker = arg;
+  pool_t *pool = worker->pool;
+  size_t compiled = 0, stolen = 0;
+
+  for (;;) {
+    size_t item;
+    if (!pop(&pool->deques[worker->id], &item)) {
+      // No item is ever added, so once every deque is empty we are done.
+      bool found = false;
+      for (size_t i = 1; i < pool->worker_count && !found; i++)
+        found = steal(&pool->deques[(worker->id + i) % pool->worker_count],
+                      &item);
+      if (!found)
+        break;
+      stolen++;
+    }
+    compile(pool, item);
+    compiled++;
+  }
+
+  debug_log("Worker %zu compiled %zu items, %zu of them stolen", worker->id,
+            compiled, stolen);
+  return NULL;
+}
+
+static size_t default_threads(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t)cpus : 1;
+}
+
+bool rs_compile_batch(rs_batch_item_t *items, size_t count, size_t threads,
+                      rs_emitter_t *out) {
+  if ((!items && count > 0) || !out) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL batch items or emitter\n");
+    return false;
+  }
+  if (count == 0)
+    return rs_emitter_flush(out);
+
+  if (threads == 0)
+    threads = default_threads();
+  if (threads > count)
+    threads = count;
+  if (threads > RS_BATCH_MAX_THREADS)
+    threads = RS_BATCH_MAX_THREADS;
+
+  pool_t pool = {
+      .items = items,
+      .outputs = rs_calloc(count, sizeof(rs_emitter_t)),
+      .results = rs_calloc(count, sizeof(bool)),
+      .deques = rs_calloc(threads, sizeof(deque_t)),
+      .worker_count = threads,
+  };
+  worker_t *workers = rs_calloc(threads, sizeof(worker_t));
+  if (!pool.outputs || !pool.results || !pool.deques || !workers) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to allocate batch state\n");
+    free(pool.outputs);
+    free(pool.results);
+    free(pool.deques);
+    free(workers);
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    rs_emitter_init_buffer(&pool.outputs[i]);
+
+  // Hand out contiguous ranges, so neighbouring items start on one worker.
+  for (size_t i = 0; i < threads; i++) {
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.deques[i].head = count * i / threads;
+    pool.deques[i].tail = count * (i + 1) / threads;
+    workers[i].pool = &pool;
+    workers[i].id = i;
+  }
+
+  debug_log("Compiling %zu items on %zu workers", count, threads);
+
+  // The calling thread is worker 0. Workers that fail to start leave their
+  // items to be stolen.
+  for (size_t i = 1; i < threads; i++)
+    workers[i].started = pthread_create(&workers[i].thread, NULL, run_worker,
+                                        &workers[i]) == 0;
+  run_worker(&workers[0]);
+  for (size_t i = 1; i < threads; i++) {
+    if (workers[i].started)
+      pthread_join(workers[i].thread, NULL);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    ok &= pool.results[i];
+    rs_emit(out, pool.outputs[i].data, pool.outputs[i].length);
+    rs_emitter_free(&pool.outputs[i]);
+  }
+
+  for (size_t i = 0; i < threads; i++)
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  free(pool.outputs);
+  free(pool.results);
+  free(pool.deques);
+  free(workers);
+  return rs_emitter_flush(out) && ok;
+}
+
+typedef struct {
+  rs_t *rs;
+  rs_block_emitter_t emit_block;
+  const void *context;
+  rs_emitter_t *chunks;
+  size_t chunk_count;
+  size_t chunk_blocks;
+  pthread_mutex_t lock;
+  size_t next_chunk;
+} blocks_t;
+
+static void *run_block_worker(void *arg) {
+  blocks_t *blocks = arg;
+  rs_t *rs = blocks->rs;
+  for (;;) {
+    pthread_mutex_lock(&blocks->lock);
+    size_t chunk = blocks->next_chunk++;
+    pthread_mutex_unlock(&blocks->lock);
+    if (chunk >= blocks->chunk_count)
+      break;
+
+    size_t begin = rs->window_begin + chunk * blocks->chunk_blocks;
+    size_t end = begin + blocks->chunk_blocks;
+    if (end > rs->window_end)
+      end = rs->window_end;
+    for (size_t block_id = begin; block_id < end; block_id++)
+      blocks->emit_block(rs, &blocks->chunks[chunk], blocks->context,
+                         block_id);
+  }
+  return NULL;
+}
+
+static bool is_mapped(const bool *mapped, rs_operand_t operand) {
+  if (operand.type == RS_OPERAND_TYPE_REG)
+    return mapped[operand.vreg];
+  if (operand.type != RS_OPERAND_TYPE_MEM)
+    return true;
+  return (operand.mem.base == RS_INVALID_VREG || mapped[operand.mem.base]) &&
+         (operand.mem.index == RS_INVALID_VREG || mapped[operand.mem.index]);
+}
+
+// Whether rendering the window only reads the register map.
+static bool registers_assigned(rs_t *rs) {
+  bool mapped[RS_MAX_REGS] = {false};
+  rs_map_entry_t *entry_it;
+  cvector_for_each_in(entry_it, rs->register_map.entries) {
+    mapped[entry_it->key] = true;
+  }
+
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, rs->basic_blocks[block_id]->instructions) {
+      if (!is_mapped(mapped, instr_it->dest) ||
+          !is_mapped(mapped, instr_it->src1) ||
+          !is_mapped(mapped, instr_it->src2) ||
+          !is_mapped(mapped, instr_it->src3))
+        return false;
+    }
+  }
+  return true;
+}
+
+void rs_emit_blocks(rs_t *rs, rs_emitter_t *out, rs_block_emitter_t emit_block,
+                    const void *context) {
+  size_t block_count = rs->window_end - rs->window_begin;
+  size_t threads = rs->emit_threads ? rs->emit_threads : default_threads();
+  if (threads > RS_BATCH_MAX_THREADS)
+    threads = RS_BATCH_MAX_THREADS;
+
+  size_t chunk_blocks = block_count / (threads * RS_EMIT_CHUNKS_PER_THREAD);
+  if (chunk_blocks < RS_EMIT_CHUNK_BLOCKS)
+    chunk_blocks = RS_EMIT_CHUNK_BLOCKS;
+  size_t chunk_count = (block_count + chunk_blocks - 1) / chunk_blocks;
+  if (threads > chunk_count)
+    threads = chunk_count;
+
+  blocks_t blocks = {
+      .rs = rs,
+      .emit_block = emit_block,
+      .context = context,
+      .chunks = NULL,
+      .chunk_count = chunk_count,
+      .chunk_blocks = chunk_blocks,
+      .next_chunk = 0,
+  };
+  pthread_t *workers = NULL;
+  if (threads > 1 && registers_assigned(rs)) {
+    blocks.chunks = rs_calloc(chunk_count, sizeof(rs_emitter_t));
+    workers = rs_calloc(threads, sizeof(pthread_t));
+  }
+  if (!blocks.chunks || !workers) {
+    free(blocks.chunks);
+    free(workers);
+    for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+         block_id++)
+      emit_block(rs, out, context, block_id);
+    return;
+  }
+
+  debug_log("Rendering %zu blocks in %zu runs on %zu workers", block_count,
+            chunk_count, threads);
+  for (size_t i = 0; i < chunk_count; i++)
+    rs_emitter_init_buffer(&blocks.chunks[i]);
+  pthread_mutex_init(&blocks.lock, NULL);
+
+  // The calling thread is the first worker.
+  size_t started = 1;
+  while (started < threads &&
+         pthread_create(&workers[started], NULL, run_block_worker, &blocks) ==
+             0)
+    started++;
+  run_block_worker(&blocks);
+  for (size_t i = 1; i < started; i++)
+    pthread_join(workers[i], NULL);
+
+  for (size_t i = 0; i < chunk_count; i++) {
+    rs_emit(out, blocks.chunks[i].data, blocks.chunks[i].length);
+    out->failed |= blocks.chunks[i].failed;
+    rs_emitter_free(&blocks.chunks[i]);
+  }
+
+  pthread_mutex_destroy(&blocks.lock);
+  free(blocks.chunks);
+  free(workers);
+}
@@ -0,0 +1,281 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+/** Fused-domain micro-ops issued per cycle. */
+#define X86_64_ISSUE_WIDTH 4
+/** Cycles from a load's address to its data, or from a forwarded store. */
+#define X86_64_LOAD_LATENCY 5
+/** Recent stores a load is checked against for forwarding. */
+#define X86_64_STORE_WINDOW 16
+/** Index of the flags in the ready times, after the machine registers. */
+#define X86_64_FLAGS 16
+
+/** Port masks. */
+#define P0156 0x63
+#define P0 0x01
+#define P06 0x41
+#define P15 0x22
+#define P1 0x02
+#define P6 0x40
+#define P23 0x0c
+#define P4 0x10
+#define P237 0x8c
+
+/**
+ * @brief How an instruction uses its operands.
+ */
+typedef enum {
+  FORM_MOVE,    /**< Writes the first operand from the second, and is a
+                   plain load or store when either is memory. */
+  FORM_WRITE,   /**< Writes the first operand, reads the others. */
+  FORM_RMW,     /**< Reads and writes the first operand, reads the others. */
+  FORM_READ,    /**< Reads every operand. */
+  FORM_ADDRESS, /**< Writes the first operand from the second's address. */
+  FORM_PUSH,    /**< Stores the operand on the stack. */
+  FORM_POP,     /**< Loads the operand from the stack. */
+  FORM_CALL,    /**< Pushes the return address and jumps. */
+  FORM_RET,     /**< Pops the return address and jumps. */
+} form_t;
+
+/**
+ * @brief Mnemonic, whether it is a prefix, form, latency, arithmetic ports,
+ *        and whether it reads and writes the flags.
+ *
+ * `jmp` precedes the `j` prefix of the conditional jumps.
+ */
+#define X86_64_COSTS(X)                                                        \
+  X("mov", false, MOVE, 1, P0156, false, false)                                \
+  X("movzx", false, WRITE, 1, P0156, false, false)                             \
+  X("lea", false, ADDRESS, 1, P15, false, false)                               \
+  X("add", false, RMW, 1, P0156, false, true)                                  \
+  X("sub", false, RMW, 1, P0156, false, true)                                  \
+  X("and", false, RMW, 1, P0156, false, true)                                  \
+  X("neg", false, RMW, 1, P0156, false, true)                                  \
+  X("inc", false, RMW, 1, P0156, false, true)                                  \
+  X("imul", false, RMW, 3, P1, false, true)                                    \
+  X("cqo", false, WRITE, 1, P06, false, false)                                 \
+  X("idiv", false, READ, 42, P0, false, true)                                  \
+  X("cmp", false, READ, 1, P0156, false, true)                                 \
+  X("test", false, READ, 1, P0156, false, true)                                \
+  X("push", false, PUSH, 0, 0, false, false)                                   \
+  X("pop", false, POP, 0, 0, false, false)                                     \
+  X("call", false, CALL, 1, P6, false, false)                                  \
+  X("ret", false, RET, 1, P6, false, false)                                    \
+  X("jmp", false, READ, 1, P6, false, false)                                   \
+  X("set", true, WRITE, 1, P06, true, false)                                   \
+  X("j", true, READ, 1, P06, true, false)
+
+typedef struct {
+  const char *mnemonic;
+  bool prefix;
+  form_t form;
+  uint8_t latency;
+  uint8_t ports;
+  bool reads_flags;
+  bool writes_flags;
+} instr_cost_t;
+
+static const instr_cost_t x86_64_costs[] = {
+#define X(mnemonic, prefix, form, latency, ports, reads, writes)               \
+  {mnemonic, prefix, FORM_##form, latency, ports, reads, writes},
+    X86_64_COSTS(X)
+#undef X
+};
+
+/** Anything else counts as one simple arithmetic instruction. */
+static const instr_cost_t default_cost = {"", false, FORM_WRITE, 1, P0156,
+                                          false, false};
+
+/** A locked read-modify-write drains the store buffer, whatever it modifies. */
+static const instr_cost_t locked_cost = {"lock", false, FORM_RMW, 18, P0156,
+                                         false, true};
+
+static const instr_cost_t *lookup(const char *mnemonic) {
+  for (size_t i = 0; i < sizeof(x86_64_costs) / sizeof(x86_64_costs[0]);
+       i++) {
+    const instr_cost_t *cost = &x86_64_costs[i];
+    if (cost->prefix ? strncmp(mnemonic, cost->mnemonic,
+                               strlen(cost->mnemonic)) == 0
+                     : strcmp(mnemonic, cost->mnemonic) == 0)
+      return cost;
+  }
+  return &default_cost;
+}
+
+typedef struct {
+  size_t ready[X86_64_FLAGS + 1]; /**< Cycle each register is available. */
+  rs_moperand_t stores[X86_64_STORE_WINDOW]; /**< Recent store addresses. */
+  size_t stored[X86_64_STORE_WINDOW];        /**< When their data is ready. */
+  size_t store_count;                        /**< Stores recorded so far. */
+} state_t;
+
+static bool same_address(rs_moperand_t a, rs_moperand_t b) {
+  return a.mem.base == b.mem.base && a.mem.index == b.mem.index &&
+         (a.mem.index == RS_NO_MREG || a.mem.scale == b.mem.scale) &&
+         a.mem.disp == b.mem.disp;
+}
+
+// Adds a micro-op to the least busy port that can run it.
+static void issue(rs_block_cost_t *cost, uint8_t ports) {
+  size_t best = RS_COST_PORTS;
+  for (size_t p = 0; p < RS_COST_PORTS; p++) {
+    if (((ports >> p) & 1) &&
+        (best == RS_COST_PORTS || cost->ports[p] < cost->ports[best]))
+      best = p;
+  }
+  cost->ports[best] += 1;
+}
+
+static size_t max_size(size_t a, size_t b) { return a > b ? a : b; }
+
+static bool is_reg(rs_moperand_t operand) {
+  return operand.type == RS_MOPERAND_REG || operand.type == RS_MOPERAND_REG8;
+}
+
+static void cost_minstr(const rs_minstr_t *minstr, state_t *state,
+                        rs_block_cost_t *cost) {
+  const instr_cost_t *info =
+      minstr->lock ? &locked_cost : lookup(minstr->mnemonic);
+  form_t form = info->form;
+  if (form == FORM_RMW && minstr->operand_count == 3)
+    form = FORM_WRITE; // imul dest, src, imm
+
+  // When the inputs are ready, and which operand touches memory.
+  size_t start = info->reads_flags ? state->ready[X86_64_FLAGS] : 0;
+  const rs_moperand_t *memory = NULL;
+  bool pool = false;
+  for (size_t i = 0; i < minstr->operand_count; i++) {
+    rs_moperand_t operand = minstr->operands[i];
+    if (is_reg(operand) &&
+        (i > 0 || form == FORM_RMW || form == FORM_READ || form == FORM_PUSH))
+      start = max_size(start, state->ready[operand.reg]);
+    if (operand.type == RS_MOPERAND_MEM) {
+      memory = &minstr->operands[i];
+      if (operand.mem.base != RS_NO_MREG)
+        start = max_size(start, state->ready[operand.mem.base]);
+      if (operand.mem.index != RS_NO_MREG)
+        start = max_size(start, state->ready[operand.mem.index]);
+    }
+    pool |= operand.type == RS_MOPERAND_POOL;
+  }
+
+  bool writes_memory = memory == &minstr->operands[0] && form != FORM_READ;
+  bool reads_memory =
+      form == FORM_POP || form == FORM_RET || pool ||
+      (memory && form != FORM_ADDRESS &&
+       (memory != &minstr->operands[0] || form != FORM_MOVE));
+  if (form == FORM_PUSH || form == FORM_CALL)
+    writes_memory = true;
+
+  size_t data = start;
+  if (reads_memory) {
+    size_t forwarded = 0;
+    size_t kept = state->store_count < X86_64_STORE_WINDOW
+                      ? state->store_count
+                      : X86_64_STORE_WINDOW;
+    for (size_t i = 0; memory && i < kept; i++) {
+      if (same_address(state->stores[i], *memory))
+        forwarded = max_size(forwarded, state->stored[i]);
+    }
+    data = max_size(start, forwarded) + X86_64_LOAD_LATENCY;
+    issue(cost, P23);
+  }
+
+  // A move that touches memory is nothing but the load or store.
+  size_t result = data;
+  if (info->ports && !(form == FORM_MOVE && (reads_memory || writes_memory))) {
+    result = data + info->latency;
+    issue(cost, info->ports);
+  }
+
+  if (writes_memory) {
+    issue(cost, P237);
+    issue(cost, P4);
+    if (memory) {
+      size_t slot = state->store_count % X86_64_STORE_WINDOW;
+      state->stores[slot] = *memory;
+      state->stored[slot] = result;
+      state->store_count++;
+    }
+  }
+
+  bool writes_dest = form == FORM_MOVE || form == FORM_WRITE ||
+                     form == FORM_RMW || form == FORM_ADDRESS ||
+                     form == FORM_POP;
+  if (writes_dest && minstr->operand_count > 0 && is_reg(minstr->operands[0]))
+    state->ready[minstr->operands[0].reg] = result;
+  if (info->writes_flags)
+    state->ready[X86_64_FLAGS] = result;
+
+  cost->instructions++;
+  cost->uops += 1 + (reads_memory && writes_memory && form == FORM_RMW) +
+                (form == FORM_CALL);
+  cost->latency = max_size(cost->latency, result);
+}
+
+void rs_x86_64_minstrs_cost(const rs_minstr_t *minstrs, size_t count,
+                            rs_block_cost_t *cost) {
+  memset(cost, 0, sizeof(*cost));
+  state_t state;
+  memset(&state, 0, sizeof(state));
+  for (size_t i = 0; i < count; i++)
+    cost_minstr(&minstrs[i], &state, cost);
+
+  cost->throughput = (double)cost->uops / X86_64_ISSUE_WIDTH;
+  for (size_t p = 0; p < RS_COST_PORTS; p++) {
+    if (cost->ports[p] > cost->throughput)
+      cost->throughput = cost->ports[p];
+  }
+}
+
+bool rs_x86_64_block_cost(rs_t *rs, const rs_def_use_t *def_use,
+                          size_t block_id, rs_block_cost_t *cost) {
+  rs_instructions_t instrs = rs->basic_blocks[block_id]->instructions;
+  rs_minstrs_t minstrs = NULL;
+  rs_render_block_counter(rs, block_id, &minstrs);
+  bool ok = true;
+  for (size_t i = 0; i < cvector_size(instrs);) {
+    size_t length;
+    const rs_pattern_t *pattern = rs_select_pattern(
+        rs, def_use, &instrs[i], cvector_size(instrs) - i, &length);
+    if (!pattern) {
+      ok = false;
+      break;
+    }
+    rs_render_template(rs, pattern->template, &instrs[i], length, &minstrs);
+    i += length;
+  }
+
+  rs_x86_64_minstrs_cost(minstrs, cvector_size(minstrs), cost);
+  cvector_free(minstrs);
+  return ok;
+}
+
+bool rs_estimate_block_cost(rs_t *rs, size_t block_id, rs_block_cost_t *cost) {
+  if (!rs || !cost || block_id >= cvector_size(rs->basic_blocks)) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Invalid basic block at index %zu\n",
+            block_id);
+    return false;
+  }
+
+  if (rs->target != RS_TARGET_X86_64_LINUX_NASM) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "No cost model for target %d\n",
+            rs->target);
+    return false;
+  }
+
+  // Lower the block the way the backend does.
+  const rs_def_use_t *def_use =
+      rs->opt_level == RS_OPT_O0 ? NULL : rs_get_def_use(rs);
+  bool ok = rs_x86_64_block_cost(rs, def_use, block_id, cost);
+  debug_log("Block '%s': %zu uops, latency %zu, throughput %.2f",
+            rs->basic_blocks[block_id]->name, cost->uops, cost->latency,
+            cost->throughput);
+  return ok;
+}
@@ -0,0 +1,327 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+#define RS_ELF_HEADER_SIZE 64
+#define RS_ELF_SECTION_HEADER_SIZE 64
+#define RS_ELF_SYMBOL_SIZE 24
+#define RS_ELF_RELA_SIZE 24
+
+#define RS_ELF_MACHINE_X86_64 62
+#define RS_ELF_R_X86_64_PLT32 4
+
+#define RS_ELF_SHT_PROGBITS 1
+#define RS_ELF_SHT_SYMTAB 2
+#define RS_ELF_SHT_STRTAB 3
+#define RS_ELF_SHT_RELA 4
+
+#define RS_ELF_SHF_ALLOC 0x2
+#define RS_ELF_SHF_EXECINSTR 0x4
+#define RS_ELF_SHF_INFO_LINK 0x40
+
+#define RS_ELF_STB_LOCAL 0
+#define RS_ELF_STB_GLOBAL 1
+#define RS_ELF_STT_NOTYPE 0
+#define RS_ELF_STT_FUNC 2
+#define RS_ELF_STT_SECTION 3
+#define RS_ELF_STT_FILE 4
+#define RS_ELF_SHN_ABS 0xFFF1
+
+/** Section header indices, in file order. */
+enum {
+  SECTION_NULL,
+  SECTION_TEXT,
+  SECTION_RELA_TEXT,
+  SECTION_SYMTAB,
+  SECTION_STRTAB,
+  SECTION_SHSTRTAB,
+  SECTION_NOTE_GNU_STACK,
+  SECTION_COUNT
+};
+
+// ELF fields are little-endian on x86-64, independently of the host.
+static void put(rs_buffer_t *buf, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    cvector_push_back(*buf, (uint8_t)(value >> (8 * i)));
+}
+
+static void pad(rs_buffer_t *buf, size_t alignment) {
+  while (cvector_size(*buf) % alignment)
+    cvector_push_back(*buf, 0);
+}
+
+static uint32_t add_string(rs_buffer_t *strtab, const char *str) {
+  uint32_t offset = (uint32_t)cvector_size(*strtab);
+  for (const char *c = str; *c; c++)
+    cvector_push_back(*strtab, (uint8_t)*c);
+  cvector_push_back(*strtab, 0);
+  return offset;
+}
+
+static void add_symbol(rs_buffer_t *symtab, uint32_t name, uint8_t bind,
+                       uint8_t type, uint16_t section, uint64_t value,
+                       uint64_t size) {
+  put(symtab, name, 4);
+  put(symtab, (uint64_t)(bind << 4 | type), 1);
+  put(symtab, 0, 1); // st_other: default visibility.
+  put(symtab, section, 2);
+  put(symtab, value, 8);
+  put(symtab, size, 8);
+}
+
+static void add_section_header(rs_buffer_t *buf, uint32_t name, uint32_t type,
+                               uint64_t flags, uint64_t offset, uint64_t size,
+                               uint32_t link, uint32_t info, uint64_t align,
+                               uint64_t entry_size) {
+  put(buf, name, 4);
+  put(buf, type, 4);
+  put(buf, flags, 8);
+  put(buf, 0, 8); // sh_addr: relocatable objects are not loaded.
+  put(buf, offset, 8);
+  put(buf, size, 8);
+  put(buf, link, 4);
+  put(buf, info, 4);
+  put(buf, align, 8);
+  put(buf, entry_size, 8);
+}
+
+/** An object file under construction. */
+typedef struct {
+  rs_buffer_t text;
+  rs_buffer_t strtab;
+  rs_buffer_t locals;  // Local symbols, which must precede the globals.
+  rs_buffer_t globals; // Defined functions, then the undefined symbols.
+  cvector(const char *) functions;
+  cvector(size_t) function_offsets;
+  rs_relocations_t relocations;
+} object_t;
+
+static void object_init(object_t *obj) {
+  memset(obj, 0, sizeof(*obj));
+  add_string(&obj->strtab, "");
+  add_symbol(&obj->locals, 0, RS_ELF_STB_LOCAL, RS_ELF_STT_NOTYPE, 0, 0, 0);
+  add_symbol(&obj->locals, add_string(&obj->strtab, "runestone"),
+             RS_ELF_STB_LOCAL, RS_ELF_STT_FILE, RS_ELF_SHN_ABS, 0, 0);
+  add_symbol(&obj->locals, 0, RS_ELF_STB_LOCAL, RS_ELF_STT_SECTION,
+             SECTION_TEXT, 0, 0);
+}
+
+static void object_free(object_t *obj) {
+  cvector_free(obj->text);
+  cvector_free(obj->strtab);
+  cvector_free(obj->locals);
+  cvector_free(obj->globals);
+  cvector_free(obj->functions);
+  cvector_free(obj->function_offsets);
+  cvector_free(obj->relocations);
+}
+
+static bool check_target(rs_t *rs) {
+  if (rs->target == RS_TARGET_X86_64_LINUX_NASM)
+    return true;
+  fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+          "Error: " RS_COLOR_RESET "No object writer for target %d\n",
+          rs->target);
+  return false;
+}
+
+// Encodes the function at the end of .text and adds its symbols.
+static bool add_function(object_t *obj, rs_t *rs) {
+  if (!rs_run_passes(rs))
+    return false;
+
+  size_t block_count = cvector_size(rs->basic_blocks);
+  size_t *block_offsets = rs_calloc(block_count + 1, sizeof(size_t));
+  size_t start = cvector_size(obj->text);
+  if (!rs_encode_x86_64(rs, &obj->text, block_offsets, &obj->relocations)) {
+    free(block_offsets);
+    return false;
+  }
+
+  // Blocks are named like the NASM local labels `<function>.<block>`.
+  const char *name = rs_get_symbol(rs);
+  for (size_t block_id = 0; block_id < block_count; block_id++) {
+    const char *block_name = rs->basic_blocks[block_id]->name;
+    size_t length = strlen(name) + strlen(block_name) + 2;
+    char *label = rs_malloc(length);
+    snprintf(label, length, "%s.%s", name, block_name);
+    add_symbol(&obj->locals, add_string(&obj->strtab, label),
+               RS_ELF_STB_LOCAL, RS_ELF_STT_NOTYPE, SECTION_TEXT,
+               start + block_offsets[block_id], 0);
+    free(label);
+  }
+  free(block_offsets);
+
+  add_symbol(&obj->globals, add_string(&obj->strtab, name), RS_ELF_STB_GLOBAL,
+             RS_ELF_STT_FUNC, SECTION_TEXT, start,
+             cvector_size(obj->text) - start);
+  cvector_push_back(obj->functions, name);
+  cvector_push_back(obj->function_offsets, start);
+  return true;
+}
+
+static bool write_object(object_t *obj, FILE *fp) {
+  // Calls between the object's functions are PC-relative within .text. The
+  // remaining ones go through the PLT of their undefined symbol.
+  for (size_t i = 0; i < cvector_size(obj->functions); i++)
+    rs_resolve_x86_64(obj->text, &obj->relocations, obj->functions[i],
+                      obj->function_offsets[i]);
+
+  uint32_t first_global =
+      (uint32_t)(cvector_size(obj->locals) / RS_ELF_SYMBOL_SIZE);
+  cvector(const char *) undefined = NULL;
+  rs_buffer_t rela = NULL;
+  rs_relocation_t *relocation_it;
+  cvector_for_each_in(relocation_it, obj->relocations) {
+    size_t index = 0;
+    while (index < cvector_size(undefined) &&
+           strcmp(undefined[index], relocation_it->symbol) != 0)
+      index++;
+    if (index == cvector_size(undefined)) {
+      cvector_push_back(undefined, relocation_it->symbol);
+      add_symbol(&obj->globals,
+                 add_string(&obj->strtab, relocation_it->symbol),
+                 RS_ELF_STB_GLOBAL, RS_ELF_STT_NOTYPE, 0, 0, 0);
+    }
+
+    uint64_t symbol = first_global + cvector_size(obj->functions) + index;
+    put(&rela, relocation_it->offset, 8);
+    put(&rela, symbol << 32 | RS_ELF_R_X86_64_PLT32, 8);
+    put(&rela, (uint64_t)-4, 8); // The rel32 is relative to its end.
+  }
+  cvector_free(undefined);
+
+  rs_buffer_t symtab = NULL;
+  for (size_t i = 0; i < cvector_size(obj->locals); i++)
+    cvector_push_back(symtab, obj->locals[i]);
+  for (size_t i = 0; i < cvector_size(obj->globals); i++)
+    cvector_push_back(symtab, obj->globals[i]);
+  rs_buffer_t text = obj->text, strtab = obj->strtab;
+
+  rs_buffer_t shstrtab = NULL;
+  uint32_t section_names[SECTION_COUNT];
+  section_names[SECTION_NULL] = add_string(&shstrtab, "");
+  section_names[SECTION_TEXT] = add_string(&shstrtab, ".text");
+  section_names[SECTION_RELA_TEXT] = add_string(&shstrtab, ".rela.text");
+  section_names[SECTION_SYMTAB] = add_string(&shstrtab, ".symtab");
+  section_names[SECTION_STRTAB] = add_string(&shstrtab, ".strtab");
+  section_names[SECTION_SHSTRTAB] = add_string(&shstrtab, ".shstrtab");
+  section_names[SECTION_NOTE_GNU_STACK] =
+      add_string(&shstrtab, ".note.GNU-stack");
+
+  // Lay out the section contents after the ELF header.
+  rs_buffer_t file = NULL;
+  rs_buffer_t empty = NULL;
+  rs_buffer_t *contents[SECTION_COUNT] = {NULL,    &text,     &rela,  &symtab,
+                                          &strtab, &shstrtab, &empty};
+  size_t alignments[SECTION_COUNT] = {0, 16, 8, 8, 1, 1, 1};
+  size_t offsets[SECTION_COUNT] = {0};
+  for (size_t i = 0; i < RS_ELF_HEADER_SIZE; i++)
+    cvector_push_back(file, 0);
+  for (size_t i = SECTION_TEXT; i < SECTION_COUNT; i++) {
+    pad(&file, alignments[i]);
+    offsets[i] = cvector_size(file);
+    for (size_t b = 0; b < cvector_size(*contents[i]); b++)
+      cvector_push_back(file, (*contents[i])[b]);
+  }
+  pad(&file, 8);
+  size_t section_headers = cvector_size(file);
+
+  add_section_header(&file, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  add_section_header(&file, section_names[SECTION_TEXT], RS_ELF_SHT_PROGBITS,
+                     RS_ELF_SHF_ALLOC | RS_ELF_SHF_EXECINSTR,
+                     offsets[SECTION_TEXT], cvector_size(text), 0, 0, 16, 0);
+  add_section_header(&file, section_names[SECTION_RELA_TEXT], RS_ELF_SHT_RELA,
+                     RS_ELF_SHF_INFO_LINK, offsets[SECTION_RELA_TEXT],
+                     cvector_size(rela), SECTION_SYMTAB, SECTION_TEXT, 8,
+                     RS_ELF_RELA_SIZE);
+  add_section_header(&file, section_names[SECTION_SYMTAB], RS_ELF_SHT_SYMTAB,
+                     0, offsets[SECTION_SYMTAB], cvector_size(symtab),
+                     SECTION_STRTAB, first_global, 8, RS_ELF_SYMBOL_SIZE);
+  add_section_header(&file, section_names[SECTION_STRTAB], RS_ELF_SHT_STRTAB,
+                     0, offsets[SECTION_STRTAB], cvector_size(strtab), 0, 0, 1,
+                     0);
+  add_section_header(&file, section_names[SECTION_SHSTRTAB],
+                     RS_ELF_SHT_STRTAB, 0, offsets[SECTION_SHSTRTAB],
+                     cvector_size(shstrtab), 0, 0, 1, 0);
+  // Without this note linkers assume the code needs an executable stack.
+  add_section_header(&file, section_names[SECTION_NOTE_GNU_STACK],
+                     RS_ELF_SHT_PROGBITS, 0, offsets[SECTION_NOTE_GNU_STACK],
+                     0, 0, 0, 1, 0);
+
+  // Fill in the ELF header now that the section header offset is known.
+  rs_buffer_t header = NULL;
+  static const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2 /* 64-bit */,
+                                    1 /* little-endian */, 1 /* version */};
+  for (size_t i = 0; i < sizeof(ident); i++)
+    cvector_push_back(header, ident[i]);
+  put(&header, 1, 2); // e_type: ET_REL.
+  put(&header, RS_ELF_MACHINE_X86_64, 2);
+  put(&header, 1, 4); // e_version.
+  put(&header, 0, 8); // e_entry.
+  put(&header, 0, 8); // e_phoff.
+  put(&header, section_headers, 8);
+  put(&header, 0, 4); // e_flags.
+  put(&header, RS_ELF_HEADER_SIZE, 2);
+  put(&header, 0, 2); // e_phentsize.
+  put(&header, 0, 2); // e_phnum.
+  put(&header, RS_ELF_SECTION_HEADER_SIZE, 2);
+  put(&header, SECTION_COUNT, 2);
+  put(&header, SECTION_SHSTRTAB, 2);
+  memcpy(file, header, RS_ELF_HEADER_SIZE);
+
+  bool ok = fwrite(file, 1, cvector_size(file), fp) == cvector_size(file);
+  if (!ok)
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to write the object file\n");
+  debug_log("Wrote %zu byte object with %zu bytes of code", cvector_size(file),
+            cvector_size(text));
+
+  cvector_free(header);
+  cvector_free(file);
+  cvector_free(shstrtab);
+  cvector_free(rela);
+  cvector_free(symtab);
+  return ok;
+}
+
+bool rs_generate_object(rs_t *rs, FILE *fp) {
+  if (!rs || !fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state or file\n");
+    return false;
+  }
+  if (!check_target(rs))
+    return false;
+
+  object_t obj;
+  object_init(&obj);
+  bool ok = add_function(&obj, rs) && write_object(&obj, fp);
+  object_free(&obj);
+  return ok;
+}
+
+bool rs_module_generate_object(rs_module_t *module, FILE *fp) {
+  if (!module || !fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL module or file\n");
+    return false;
+  }
+  if (!check_target(&module->rs))
+    return false;
+
+  ptrdiff_t current = module->current_function;
+  object_t obj;
+  object_init(&obj);
+  bool ok = true;
+  for (size_t i = 0; ok && i < cvector_size(module->functions); i++)
+    ok = add_function(&obj, rs_module_position_at_function(module, i));
+  ok = ok && write_object(&obj, fp);
+  object_free(&obj);
+  if (current >= 0)
+    rs_module_position_at_function(module, (size_t)current);
+  return ok;
+}
@@ -0,0 +1,132 @@
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Bytes staged before a file or fd sink is written to. */
+#define RS_EMITTER_CAPACITY (64 * 1024)
+
+static void init(rs_emitter_t *out, rs_sink_t sink) {
+  memset(out, 0, sizeof(*out));
+  out->sink = sink;
+  out->fd = -1;
+  out->capacity = RS_EMITTER_CAPACITY;
+  out->data = rs_malloc(out->capacity);
+  if (!out->data) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to allocate emitter buffer\n");
+    out->capacity = 0;
+    out->failed = true;
+  }
+}
+
+void rs_emitter_init_file(rs_emitter_t *out, FILE *fp) {
+  init(out, RS_SINK_FILE);
+  out->fp = fp;
+}
+
+void rs_emitter_init_buffer(rs_emitter_t *out) { init(out, RS_SINK_BUFFER); }
+
+void rs_emitter_init_fd(rs_emitter_t *out, int fd) {
+  init(out, RS_SINK_FD);
+  out->fd = fd;
+}
+
+bool rs_emitter_flush(rs_emitter_t *out) {
+  if (out->sink == RS_SINK_BUFFER || out->failed)
+    return !out->failed;
+
+  size_t written = 0;
+  if (out->sink == RS_SINK_FILE) {
+    written = fwrite(out->data, 1, out->length, out->fp);
+  } else {
+    while (written < out->length) {
+      ssize_t n = write(out->fd, out->data + written, out->length - written);
+      if (n <= 0)
+        break;
+      written += (size_t)n;
+    }
+  }
+
+  if (written != out->length) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to write emitted code\n");
+    out->failed = true;
+  }
+  out->length = 0;
+  return !out->failed;
+}
+
+bool rs_emitter_free(rs_emitter_t *out) {
+  bool ok = rs_emitter_flush(out);
+  free(out->data);
+  out->data = NULL;
+  out->length = out->capacity = 0;
+  return ok;
+}
+
+// Makes room for `length` more bytes, flushing or growing the buffer.
+static bool reserve(rs_emitter_t *out, size_t length) {
+  if (out->failed)
+    return false;
+  if (out->length + length <= out->capacity)
+    return true;
+
+  if (out->sink != RS_SINK_BUFFER) {
+    rs_emitter_flush(out);
+    if (length <= out->capacity)
+      return !out->failed;
+  }
+
+  size_t capacity = out->capacity ? out->capacity : RS_EMITTER_CAPACITY;
+  while (capacity < out->length + length)
+    capacity *= 2;
+  char *data = rs_realloc(out->data, capacity);
+  if (!data) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to grow emitter buffer\n");
+    out->failed = true;
+    return false;
+  }
+  out->data = data;
+  out->capacity = capacity;
+  return true;
+}
+
+void rs_emit(rs_emitter_t *out, const char *text, size_t length) {
+  if (!reserve(out, length))
+    return;
+  memcpy(out->data + out->length, text, length);
+  out->length += length;
+}
+
+void rs_emit_str(rs_emitter_t *out, const char *text) {
+  rs_emit(out, text, strlen(text));
+}
+
+void rs_emit_char(rs_emitter_t *out, char c) {
+  if (!reserve(out, 1))
+    return;
+  out->data[out->length++] = c;
+}
+
+void rs_emit_uint(rs_emitter_t *out, uint64_t value, unsigned base) {
+  static const char digits[] = "0123456789abcdef";
+  char text[64];
+  size_t i = sizeof(text);
+  do {
+    text[--i] = digits[value % base];
+    value /= base;
+  } while (value);
+  rs_emit(out, text + i, sizeof(text) - i);
+}
+
+void rs_emit_int(rs_emitter_t *out, int64_t value) {
+  if (value < 0) {
+    rs_emit_char(out, '-');
+    // Negate in unsigned arithmetic so INT64_MIN does not overflow.
+    rs_emit_uint(out, 0 - (uint64_t)value, 10);
+    return;
+  }
+  rs_emit_uint(out, (uint64_t)value, 10);
+}
@@ -0,0 +1,248 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+
+static bool fits_imm32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool takes_folded_source(rs_opcode_t opcode) {
+  switch (opcode) {
+  case RS_OPCODE_ADD:
+  case RS_OPCODE_SUB:
+  case RS_OPCODE_MULT:
+  case RS_OPCODE_CMP_EQ:
+  case RS_OPCODE_CMP_LT:
+  case RS_OPCODE_CMP_GT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The opcode that computes the same result with the sources swapped, or
+// RS_OPCODE_COUNT if there is none.
+static rs_opcode_t swapped_opcode(rs_opcode_t opcode) {
+  switch (opcode) {
+  case RS_OPCODE_ADD:
+  case RS_OPCODE_MULT:
+  case RS_OPCODE_CMP_EQ:
+    return opcode;
+  case RS_OPCODE_CMP_LT:
+    return RS_OPCODE_CMP_GT;
+  case RS_OPCODE_CMP_GT:
+    return RS_OPCODE_CMP_LT;
+  default:
+    return RS_OPCODE_COUNT;
+  }
+}
+
+static void swap_sources(rs_instr_t *instr) {
+  rs_operand_t tmp = instr->src1;
+  instr->src1 = instr->src2;
+  instr->src2 = tmp;
+  instr->opcode = swapped_opcode(instr->opcode);
+}
+
+static bool is_compare(rs_opcode_t opcode) {
+  return opcode == RS_OPCODE_CMP_EQ || opcode == RS_OPCODE_CMP_LT ||
+         opcode == RS_OPCODE_CMP_GT;
+}
+
+static bool writes_memory(rs_opcode_t opcode) {
+  return opcode == RS_OPCODE_STORE || opcode == RS_OPCODE_COPY ||
+         opcode == RS_OPCODE_CALL;
+}
+
+typedef struct {
+  rs_t *rs;
+  const rs_def_use_t *def_use;
+  size_t *block_offset; // Index of each block's first instruction.
+  bool *deleted;        // Indexed by block_offset + instruction index.
+} fold_t;
+
+// Computes what the single-use register in `operand` can be replaced with
+// when used by instruction `use_index` of block `block_id`.
+static bool fold_source(fold_t *f, size_t block_id, size_t use_index,
+                        rs_operand_t operand, rs_operand_t *folded) {
+  if (operand.type != RS_OPERAND_TYPE_REG ||
+      operand.vreg == RS_TEMPORARY_VREG)
+    return false;
+
+  uint8_t vreg = operand.vreg;
+  rs_instr_t *def_instr = rs_unique_def(f->rs, f->def_use, vreg);
+  if (!def_instr || f->def_use->use_count[vreg] != 1)
+    return false;
+
+  size_t def_block = f->def_use->def_block[vreg];
+  size_t def_index = f->def_use->def_index[vreg];
+  if (f->deleted[f->block_offset[def_block] + def_index])
+    return false;
+  rs_instr_t def = *def_instr;
+
+  // Immediates are constant, so they fold regardless of where the def is.
+  if ((def.opcode == RS_OPCODE_LOAD || def.opcode == RS_OPCODE_MOVE) &&
+      def.src1.type == RS_OPERAND_TYPE_INT64) {
+    if (!fits_imm32(def.src1.int64))
+      return false;
+    *folded = def.src1;
+    goto fold;
+  }
+
+  if (def.opcode != RS_OPCODE_LOAD)
+    return false;
+
+  switch (def.src1.type) {
+  case RS_OPERAND_TYPE_ADDR:
+    if (def.src1.addr > INT32_MAX)
+      return false;
+    *folded = RS_OPERAND_MEM(RS_INVALID_VREG, (int32_t)def.src1.addr);
+    break;
+  case RS_OPERAND_TYPE_REG:
+    if (def.src1.vreg == RS_TEMPORARY_VREG)
+      return false;
+    *folded = RS_OPERAND_MEM(def.src1.vreg, 0);
+    break;
+  case RS_OPERAND_TYPE_MEM:
+    *folded = def.src1;
+    break;
+  default:
+    return false;
+  }
+
+  // Moving a load down to its use is only valid within the block, with no
+  // store in between and the address registers left untouched.
+  if (def_block != block_id || def_index > use_index)
+    return false;
+
+  rs_basic_block_t *bb = f->rs->basic_blocks[block_id];
+  for (size_t i = def_index + 1; i < use_index; i++) {
+    rs_instr_t between = bb->instructions[i];
+    if (writes_memory(between.opcode))
+      return false;
+
+    uint8_t redefined;
+    if (rs_instr_def(between, &redefined) &&
+        (redefined == folded->mem.base || redefined == folded->mem.index))
+      return false;
+  }
+
+fold:
+  f->deleted[f->block_offset[def_block] + def_index] = true;
+  trace_log("Folded vreg %d into its use in block '%s' at %zu", vreg,
+            f->rs->basic_blocks[block_id]->name, use_index);
+  return true;
+}
+
+static void fold_instr(fold_t *f, size_t block_id, size_t index) {
+  rs_instr_t *instr = &f->rs->basic_blocks[block_id]->instructions[index];
+
+  // x86 has no compare with an immediate on the left.
+  if (is_compare(instr->opcode) && instr->src1.type == RS_OPERAND_TYPE_INT64 &&
+      instr->src2.type != RS_OPERAND_TYPE_INT64)
+    swap_sources(instr);
+
+  if (!takes_folded_source(instr->opcode))
+    return;
+
+  rs_operand_t folded;
+  if (fold_source(f, block_id, index, instr->src2, &folded)) {
+    instr->src2 = folded;
+  } else if (swapped_opcode(instr->opcode) != RS_OPCODE_COUNT &&
+             instr->src2.type == RS_OPERAND_TYPE_REG &&
+             fold_source(f, block_id, index, instr->src1, &folded)) {
+    swap_sources(instr);
+    instr->src2 = folded;
+  }
+}
+
+static bool needs_materializing(rs_instr_t instr, rs_operand_t operand) {
+  if (operand.type != RS_OPERAND_TYPE_INT64)
+    return false;
+
+  // mov accepts a full 64-bit immediate, everything else sign-extends 32.
+  switch (instr.opcode) {
+  case RS_OPCODE_MOVE:
+  case RS_OPCODE_LOAD:
+  case RS_OPCODE_RET:
+  case RS_OPCODE_CALL:
+    return false;
+  default:
+    return !fits_imm32(operand.int64);
+  }
+}
+
+void rs_fold_operands(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  fold_t *f = rs_calloc(1, sizeof(fold_t));
+  size_t instr_count = 0;
+  f->rs = rs;
+  f->block_offset = rs_calloc(rs->window_end + 1, sizeof(size_t));
+
+  f->def_use = rs_get_def_use(rs);
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    f->block_offset[block_id] = instr_count;
+    instr_count += cvector_size(rs->basic_blocks[block_id]->instructions);
+  }
+  f->deleted = rs_calloc(instr_count + 1, sizeof(bool));
+
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    for (size_t i = 0; i < cvector_size(bb->instructions); i++)
+      fold_instr(f, block_id, i);
+  }
+
+  // Rebuild the blocks without the folded definitions, materializing the
+  // immediates that are too wide to be encoded in place.
+  size_t folded = 0, materialized = 0;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    rs_instructions_t rewritten = NULL;
+    cvector_init(rewritten, cvector_capacity(bb->instructions), NULL);
+
+    for (size_t i = 0; i < cvector_size(bb->instructions); i++) {
+      if (f->deleted[f->block_offset[block_id] + i]) {
+        folded++;
+        continue;
+      }
+
+      rs_instr_t instr = bb->instructions[i];
+      rs_operand_t *sources[] = {&instr.src1, &instr.src2, &instr.src3};
+      for (size_t s = 0; s < 3; s++) {
+        if (!needs_materializing(instr, *sources[s]) ||
+            rs->next_dst_vreg >= RS_TEMPORARY_VREG)
+          continue;
+
+        rs_operand_t temp = RS_OPERAND_REG(rs->next_dst_vreg++);
+        rs_instr_t move = {RS_OPCODE_MOVE, temp, *sources[s], RS_OPERAND_NULL,
+                           RS_OPERAND_NULL};
+        cvector_push_back(rewritten, move);
+        *sources[s] = temp;
+        materialized++;
+      }
+
+      cvector_push_back(rewritten, instr);
+    }
+
+    cvector_free(bb->instructions);
+    bb->instructions = rewritten;
+  }
+
+  debug_log("Folded %zu operands, materialized %zu wide immediates", folded,
+            materialized);
+  free(f->deleted);
+  free(f->block_offset);
+  free(f);
+}
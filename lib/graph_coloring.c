@@ -0,0 +1,860 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+
+/** Graphs with up to this many nodes keep an adjacency bit matrix. */
+#define RS_IG_MATRIX_MAX_NODES 128
+/** Maximum number of spill-and-retry rounds before giving up. */
+#define RS_COLOR_MAX_ROUNDS 16
+/** How many times more often a loop body is assumed to run than its header's
+ * surroundings, when no profile was loaded. */
+#define RS_LOOP_WEIGHT 8
+/** Deepest loop nesting the assumed block weights tell apart. */
+#define RS_LOOP_MAX_DEPTH 5
+
+typedef enum {
+  NODE_UNUSED,
+  NODE_INITIAL,
+  NODE_SIMPLIFY,
+  NODE_FREEZE,
+  NODE_SPILL,
+  NODE_SPILLED,
+  NODE_COALESCED,
+  NODE_COLORED,
+  NODE_SELECT,
+} node_state_t;
+
+typedef enum {
+  MOVE_WORKLIST,
+  MOVE_ACTIVE,
+  MOVE_COALESCED,
+  MOVE_CONSTRAINED,
+  MOVE_FROZEN,
+} move_state_t;
+
+typedef struct {
+  uint8_t dst;
+  uint8_t src;
+  move_state_t state;
+} move_t;
+
+typedef struct {
+  rs_t *rs;
+  size_t k; // Number of colors (physical registers).
+
+  node_state_t state[RS_MAX_REGS];
+  size_t node_count;
+
+  // Adjacency lists are always kept; the bit matrix is only used for small
+  // graphs and is indexed by dense node numbers.
+  cvector(uint8_t) adj_list[RS_MAX_REGS];
+  size_t degree[RS_MAX_REGS];
+  uint64_t *matrix;
+  size_t dense[RS_MAX_REGS];
+
+  cvector(move_t) moves;
+  cvector(size_t) move_list[RS_MAX_REGS];
+
+  uint8_t alias[RS_MAX_REGS];
+  rs_register_t color[RS_MAX_REGS];
+  uint64_t occurrences[RS_MAX_REGS]; // Uses and defs, weighted by frequency.
+
+  uint8_t select_stack[RS_MAX_REGS];
+  size_t select_count;
+} coloring_t;
+
+static bool adj_contains(coloring_t *c, uint8_t u, uint8_t v) {
+  if (c->matrix) {
+    size_t bit = c->dense[u] * c->node_count + c->dense[v];
+    return (c->matrix[bit / 64] >> (bit % 64)) & 1;
+  }
+
+  // Search the shorter of the two lists.
+  uint8_t from = cvector_size(c->adj_list[u]) <= cvector_size(c->adj_list[v])
+                     ? u
+                     : v;
+  uint8_t to = from == u ? v : u;
+  uint8_t *it;
+  cvector_for_each_in(it, c->adj_list[from]) {
+    if (*it == to)
+      return true;
+  }
+  return false;
+}
+
+static void add_edge(coloring_t *c, uint8_t u, uint8_t v) {
+  if (u == v || adj_contains(c, u, v))
+    return;
+
+  if (c->matrix) {
+    size_t uv = c->dense[u] * c->node_count + c->dense[v];
+    size_t vu = c->dense[v] * c->node_count + c->dense[u];
+    c->matrix[uv / 64] |= (uint64_t)1 << (uv % 64);
+    c->matrix[vu / 64] |= (uint64_t)1 << (vu % 64);
+  }
+
+  cvector_push_back(c->adj_list[u], v);
+  cvector_push_back(c->adj_list[v], u);
+  c->degree[u]++;
+  c->degree[v]++;
+}
+
+static bool is_adjacent_active(coloring_t *c, uint8_t node) {
+  return c->state[node] != NODE_SELECT && c->state[node] != NODE_COALESCED;
+}
+
+static bool move_is_pending(move_t *move) {
+  return move->state == MOVE_ACTIVE || move->state == MOVE_WORKLIST;
+}
+
+static bool move_related(coloring_t *c, uint8_t node) {
+  size_t *it;
+  cvector_for_each_in(it, c->move_list[node]) {
+    if (move_is_pending(&c->moves[*it]))
+      return true;
+  }
+  return false;
+}
+
+static uint8_t get_alias(coloring_t *c, uint8_t node) {
+  while (c->state[node] == NODE_COALESCED)
+    node = c->alias[node];
+  return node;
+}
+
+static void enable_moves(coloring_t *c, uint8_t node) {
+  size_t *it;
+  cvector_for_each_in(it, c->move_list[node]) {
+    if (c->moves[*it].state == MOVE_ACTIVE)
+      c->moves[*it].state = MOVE_WORKLIST;
+  }
+}
+
+static void decrement_degree(coloring_t *c, uint8_t node) {
+  size_t degree = c->degree[node]--;
+  if (degree != c->k)
+    return;
+
+  enable_moves(c, node);
+  uint8_t *it;
+  cvector_for_each_in(it, c->adj_list[node]) {
+    if (is_adjacent_active(c, *it))
+      enable_moves(c, *it);
+  }
+
+  if (c->state[node] == NODE_SPILL)
+    c->state[node] = move_related(c, node) ? NODE_FREEZE : NODE_SIMPLIFY;
+}
+
+static void add_work_list(coloring_t *c, uint8_t node) {
+  if (c->state[node] == NODE_FREEZE && !move_related(c, node) &&
+      c->degree[node] < c->k)
+    c->state[node] = NODE_SIMPLIFY;
+}
+
+// Briggs' conservative test: the merged node is safe to simplify later if it
+// has fewer than k neighbours of significant degree.
+static bool conservative(coloring_t *c, uint8_t u, uint8_t v) {
+  rs_regset_t seen;
+  memset(&seen, 0, sizeof(seen));
+  size_t significant = 0;
+
+  uint8_t pair[] = {u, v};
+  for (size_t i = 0; i < 2; i++) {
+    uint8_t *it;
+    cvector_for_each_in(it, c->adj_list[pair[i]]) {
+      if (!is_adjacent_active(c, *it) || rs_regset_contains(&seen, *it))
+        continue;
+      rs_regset_add(&seen, *it);
+      if (c->degree[*it] >= c->k)
+        significant++;
+    }
+  }
+
+  return significant < c->k;
+}
+
+static void combine(coloring_t *c, uint8_t u, uint8_t v) {
+  c->state[v] = NODE_COALESCED;
+  c->alias[v] = u;
+
+  size_t *move_it;
+  cvector_for_each_in(move_it, c->move_list[v]) {
+    cvector_push_back(c->move_list[u], *move_it);
+  }
+  enable_moves(c, v);
+
+  uint8_t *adj_it;
+  cvector_for_each_in(adj_it, c->adj_list[v]) {
+    if (!is_adjacent_active(c, *adj_it))
+      continue;
+    add_edge(c, *adj_it, u);
+    decrement_degree(c, *adj_it);
+  }
+
+  if (c->degree[u] >= c->k && c->state[u] == NODE_FREEZE)
+    c->state[u] = NODE_SPILL;
+}
+
+static void freeze_moves(coloring_t *c, uint8_t u) {
+  size_t *it;
+  cvector_for_each_in(it, c->move_list[u]) {
+    move_t *move = &c->moves[*it];
+    if (!move_is_pending(move))
+      continue;
+
+    uint8_t x = get_alias(c, move->src);
+    uint8_t y = get_alias(c, move->dst);
+    uint8_t v = y == get_alias(c, u) ? x : y;
+    move->state = MOVE_FROZEN;
+
+    if (c->state[v] == NODE_FREEZE && !move_related(c, v) &&
+        c->degree[v] < c->k)
+      c->state[v] = NODE_SIMPLIFY;
+  }
+}
+
+static bool simplify(coloring_t *c) {
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    if (c->state[n] != NODE_SIMPLIFY)
+      continue;
+
+    c->state[n] = NODE_SELECT;
+    c->select_stack[c->select_count++] = n;
+
+    uint8_t *it;
+    cvector_for_each_in(it, c->adj_list[n]) {
+      if (is_adjacent_active(c, *it))
+        decrement_degree(c, *it);
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool coalesce(coloring_t *c) {
+  move_t *move;
+  cvector_for_each_in(move, c->moves) {
+    if (move->state != MOVE_WORKLIST)
+      continue;
+
+    uint8_t u = get_alias(c, move->dst);
+    uint8_t v = get_alias(c, move->src);
+
+    if (u == v) {
+      move->state = MOVE_COALESCED;
+      add_work_list(c, u);
+    } else if (adj_contains(c, u, v)) {
+      move->state = MOVE_CONSTRAINED;
+      add_work_list(c, u);
+      add_work_list(c, v);
+    } else if (conservative(c, u, v)) {
+      move->state = MOVE_COALESCED;
+      combine(c, u, v);
+      add_work_list(c, u);
+      trace_log("Coalesced vreg %d into vreg %d", v, u);
+    } else {
+      move->state = MOVE_ACTIVE;
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool freeze(coloring_t *c) {
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    if (c->state[n] != NODE_FREEZE)
+      continue;
+
+    c->state[n] = NODE_SIMPLIFY;
+    freeze_moves(c, n);
+    return true;
+  }
+  return false;
+}
+
+static bool select_spill(coloring_t *c, const bool *no_spill) {
+  ptrdiff_t best = -1;
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    if (c->state[n] != NODE_SPILL)
+      continue;
+
+    // Cheapest spill per unit of degree relieved; temporaries introduced by
+    // earlier spills are only chosen as a last resort.
+    if (best == -1 || (no_spill[best] && !no_spill[n]) ||
+        (no_spill[best] == no_spill[n] &&
+         c->occurrences[n] * c->degree[best] <
+             c->occurrences[best] * c->degree[n]))
+      best = n;
+  }
+
+  if (best == -1)
+    return false;
+
+  trace_log("Potential spill of vreg %td (degree %zu)", best,
+            c->degree[best]);
+  c->state[best] = NODE_SIMPLIFY;
+  freeze_moves(c, best);
+  return true;
+}
+
+static size_t assign_colors(coloring_t *c) {
+  size_t spilled = 0;
+
+  while (c->select_count > 0) {
+    uint8_t n = c->select_stack[--c->select_count];
+
+    bool used[RS_MAX_REGS] = {false};
+    uint8_t *it;
+    cvector_for_each_in(it, c->adj_list[n]) {
+      uint8_t w = get_alias(c, *it);
+      if (c->state[w] == NODE_COLORED)
+        used[c->color[w]] = true;
+    }
+
+    c->state[n] = NODE_SPILLED;
+    for (size_t reg = 0; reg < c->k; reg++) {
+      if (!used[reg]) {
+        c->state[n] = NODE_COLORED;
+        c->color[n] = reg;
+        break;
+      }
+    }
+
+    if (c->state[n] == NODE_SPILLED)
+      spilled++;
+  }
+
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    if (c->state[n] == NODE_COALESCED)
+      c->color[n] = c->color[get_alias(c, n)];
+  }
+
+  return spilled;
+}
+
+static void add_node(coloring_t *c, uint8_t vreg, uint64_t weight) {
+  c->occurrences[vreg] += weight;
+  if (c->state[vreg] != NODE_UNUSED)
+    return;
+  c->state[vreg] = NODE_INITIAL;
+  c->node_count++;
+}
+
+static bool dominates(const size_t *idom, size_t begin, size_t dominator,
+                      size_t block_id) {
+  while (block_id != dominator && block_id != SIZE_MAX)
+    block_id = idom[block_id - begin];
+  return block_id == dominator;
+}
+
+// Assumes each block of the window runs `RS_LOOP_WEIGHT` times more often per
+// natural loop around it. A loop's header dominates the sources of its back
+// edges, and its body is every block reaching them without passing through
+// the header. Returns the weights by local block index, or NULL on failure.
+static uint64_t *loop_weights(rs_t *rs) {
+  const rs_cfg_t *cfg = rs_get_cfg(rs);
+  const size_t *idom = rs_get_dominators(rs);
+  if (!cfg || !idom)
+    return NULL;
+
+  size_t begin = rs->window_begin, block_count = cvector_size(*cfg);
+  size_t *depth = rs_calloc(block_count + 1, sizeof(size_t));
+  size_t *stack = rs_calloc(block_count + 1, sizeof(size_t));
+  bool *in_loop = rs_calloc(block_count + 1, sizeof(bool));
+  uint64_t *weights = rs_calloc(block_count + 1, sizeof(uint64_t));
+  if (!depth || !stack || !in_loop || !weights) {
+    free(depth);
+    free(stack);
+    free(in_loop);
+    free(weights);
+    return NULL;
+  }
+
+  for (size_t header = 0; header < block_count; header++) {
+    bool is_header = false;
+    size_t top = 0;
+    size_t *predecessor_it;
+    cvector_for_each_in(predecessor_it, (*cfg)[header].predecessors) {
+      if (!dominates(idom, begin, begin + header, *predecessor_it))
+        continue;
+      if (!is_header) {
+        memset(in_loop, 0, block_count * sizeof(bool));
+        in_loop[header] = is_header = true;
+      }
+      if (!in_loop[*predecessor_it - begin]) {
+        in_loop[*predecessor_it - begin] = true;
+        stack[top++] = *predecessor_it - begin;
+      }
+    }
+    if (!is_header)
+      continue;
+
+    while (top > 0) {
+      size_t local = stack[--top];
+      cvector_for_each_in(predecessor_it, (*cfg)[local].predecessors) {
+        if (!in_loop[*predecessor_it - begin]) {
+          in_loop[*predecessor_it - begin] = true;
+          stack[top++] = *predecessor_it - begin;
+        }
+      }
+    }
+    for (size_t local = 0; local < block_count; local++)
+      depth[local] += in_loop[local];
+  }
+
+  for (size_t local = 0; local < block_count; local++) {
+    weights[local] = 1;
+    for (size_t d = 0; d < depth[local] && d < RS_LOOP_MAX_DEPTH; d++)
+      weights[local] *= RS_LOOP_WEIGHT;
+  }
+  free(depth);
+  free(stack);
+  free(in_loop);
+  return weights;
+}
+
+static bool build(coloring_t *c, const uint64_t *weights) {
+  rs_t *rs = c->rs;
+
+  // Discover nodes first so the bit matrix can be sized. Occurrences in
+  // blocks that run more often, as profiled or as assumed from loop nesting,
+  // cost more to spill.
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    uint64_t weight = weights ? weights[block_id - rs->window_begin]
+                              : rs_get_block_frequency(rs, block_id);
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, rs->basic_blocks[block_id]->instructions) {
+      uint8_t regs[RS_INSTR_MAX_USES];
+      size_t count = rs_instr_uses(*instr_it, regs);
+      for (size_t i = 0; i < count; i++)
+        add_node(c, regs[i], weight);
+      if (rs_instr_def(*instr_it, regs))
+        add_node(c, regs[0], weight);
+    }
+  }
+
+  if (c->node_count <= RS_IG_MATRIX_MAX_NODES) {
+    size_t next = 0;
+    for (size_t n = 0; n < RS_MAX_REGS; n++) {
+      if (c->state[n] != NODE_UNUSED)
+        c->dense[n] = next++;
+    }
+    size_t bits = c->node_count * c->node_count;
+    c->matrix = rs_calloc((bits + 63) / 64 + 1, sizeof(uint64_t));
+  }
+  debug_log("Building interference graph with %zu nodes (%s)", c->node_count,
+            c->matrix ? "bit matrix" : "adjacency lists");
+
+  // Without liveness there are no edges, and every node would get one color.
+  const rs_liveness_t *liveness = rs_get_liveness(rs);
+  if (!liveness) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                               "Failed to compute liveness\n");
+    return false;
+  }
+
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    rs_regset_t live = liveness->live_out[block_id - rs->window_begin];
+
+    for (size_t i = cvector_size(bb->instructions); i-- > 0;) {
+      rs_instr_t instr = bb->instructions[i];
+      uint8_t uses[RS_INSTR_MAX_USES];
+      size_t use_count = rs_instr_uses(instr, uses);
+      uint8_t def;
+      bool has_def = rs_instr_def(instr, &def);
+
+      bool is_move = instr.opcode == RS_OPCODE_MOVE && has_def &&
+                     use_count == 1 && instr.src1.type == RS_OPERAND_TYPE_REG;
+
+      // A tied two-address source behaves like a copy into the destination:
+      // coalescing them saves the copy the backend would otherwise emit.
+      bool is_tied = rs_opcode_is_two_address(instr.opcode) && has_def &&
+                     instr.src1.type == RS_OPERAND_TYPE_REG &&
+                     rs->tied[def] == instr.src1.vreg;
+
+      if (is_move || is_tied) {
+        if (is_move)
+          rs_regset_remove(&live, uses[0]);
+        move_t move = {.dst = def, .src = instr.src1.vreg,
+                       .state = MOVE_WORKLIST};
+        cvector_push_back(c->move_list[def], cvector_size(c->moves));
+        cvector_push_back(c->move_list[instr.src1.vreg],
+                          cvector_size(c->moves));
+        cvector_push_back(c->moves, move);
+      }
+
+      if (has_def) {
+        rs_regset_add(&live, def);
+        for (size_t w = 0; w < RS_REGSET_WORDS; w++) {
+          for (size_t b = 0; b < 64 && live.words[w] >> b; b++) {
+            if ((live.words[w] >> b) & 1)
+              add_edge(c, def, w * 64 + b);
+          }
+        }
+
+        // Backends lower three-address operations into two-address
+        // sequences that write the destination before reading the other
+        // source, so keep the destination apart from all of its sources.
+        if (!is_move) {
+          for (size_t u = 0; u < use_count; u++) {
+            if (!is_tied || uses[u] != instr.src1.vreg)
+              add_edge(c, def, uses[u]);
+          }
+        }
+        rs_regset_remove(&live, def);
+      }
+
+      for (size_t u = 0; u < use_count; u++)
+        rs_regset_add(&live, uses[u]);
+    }
+  }
+  return true;
+}
+
+static void make_worklist(coloring_t *c) {
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    if (c->state[n] != NODE_INITIAL)
+      continue;
+
+    if (c->degree[n] >= c->k)
+      c->state[n] = NODE_SPILL;
+    else if (move_related(c, n))
+      c->state[n] = NODE_FREEZE;
+    else
+      c->state[n] = NODE_SIMPLIFY;
+  }
+}
+
+static void coloring_free(coloring_t *c) {
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    cvector_free(c->adj_list[n]);
+    cvector_free(c->move_list[n]);
+  }
+  cvector_free(c->moves);
+  free(c->matrix);
+}
+
+typedef struct {
+  uint8_t of[RS_MAX_REGS];              // Temporary of each spilled vreg.
+  uint8_t pool[RS_MAX_REGS];            // Temporaries of the round.
+  size_t pool_count;                    // Temporaries in the pool.
+  uint8_t taken[RS_INSTR_MAX_USES + 1]; // Spilled vregs of the instruction.
+  size_t used;                          // Temporaries the instruction took.
+  bool free_vregs[RS_MAX_REGS];         // Retired vregs nothing refers to.
+} spill_temps_t;
+
+// Hands out a spill temporary, preferring a vreg an earlier round retired.
+static uint8_t new_spill_temp(rs_t *rs, bool *free_vregs, bool *no_spill) {
+  uint8_t vreg = RS_INVALID_VREG;
+  for (size_t n = 0; n < rs->next_dst_vreg; n++) {
+    if (free_vregs[n]) {
+      free_vregs[n] = false;
+      vreg = (uint8_t)n;
+      break;
+    }
+  }
+  if (vreg == RS_INVALID_VREG) {
+    if (rs->next_dst_vreg >= RS_TEMPORARY_VREG)
+      return RS_INVALID_VREG;
+    vreg = (uint8_t)rs->next_dst_vreg++;
+  }
+  no_spill[vreg] = true;
+  rs->tied[vreg] = RS_INVALID_VREG;
+  return vreg;
+}
+
+static bool is_spilled(const coloring_t *c, rs_operand_t operand) {
+  return operand.type == RS_OPERAND_TYPE_REG &&
+         operand.vreg != RS_TEMPORARY_VREG &&
+         c->state[operand.vreg] == NODE_SPILLED;
+}
+
+// Finds the constant a spilled register holds, if its only definition moves
+// one in, so that it can be recomputed where it is used instead.
+static rs_operand_t find_constant(rs_t *rs, const rs_def_use_t *def_use,
+                                  uint8_t vreg) {
+  rs_instr_t *def = rs_unique_def(rs, def_use, vreg);
+  if (def && def->opcode == RS_OPCODE_MOVE &&
+      (def->src1.type == RS_OPERAND_TYPE_INT64 ||
+       def->src1.type == RS_OPERAND_TYPE_ADDR))
+    return def->src1;
+  return RS_OPERAND_NULL;
+}
+
+// Marks the vregs the window refers to.
+static void find_referenced(rs_t *rs, bool *referenced) {
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, rs->basic_blocks[block_id]->instructions) {
+      uint8_t regs[RS_INSTR_MAX_USES];
+      size_t count = rs_instr_uses(*instr_it, regs);
+      for (size_t i = 0; i < count; i++)
+        referenced[regs[i]] = true;
+      if (rs_instr_def(*instr_it, regs))
+        referenced[regs[0]] = true;
+    }
+  }
+}
+
+// Gets the temporary standing in for a spilled register in the current
+// instruction. Temporaries die with the instruction that reads or writes
+// them, so every instruction draws its own from a pool the round shares.
+static uint8_t operand_temp(rs_t *rs, spill_temps_t *temps, uint8_t spilled,
+                          bool *no_spill) {
+  if (temps->of[spilled] != RS_INVALID_VREG)
+    return temps->of[spilled];
+  if (temps->used == temps->pool_count) {
+    uint8_t temp = new_spill_temp(rs, temps->free_vregs, no_spill);
+    if (temp == RS_INVALID_VREG)
+      return RS_INVALID_VREG;
+    temps->pool[temps->pool_count++] = temp;
+  }
+  temps->taken[temps->used] = spilled;
+  temps->of[spilled] = temps->pool[temps->used++];
+  return temps->of[spilled];
+}
+
+// Rewrites a block so that every spilled register lives in a temporary that
+// is reloaded before each use and spilled after each def. Spilled constants
+// are rematerialized instead, and need no slot.
+static bool rewrite_block(rs_t *rs, const coloring_t *c, size_t block_id,
+                          const size_t *slots, const rs_operand_t *constants,
+                          spill_temps_t *temps, bool *no_spill,
+                          rs_instructions_t *rewritten) {
+  rs_basic_block_t *bb = rs->basic_blocks[block_id];
+  rs_regalloc_stats_t *stats = rs_alloc_report_block(rs, block_id);
+  cvector_init(*rewritten, cvector_capacity(bb->instructions), NULL);
+
+  rs_instr_t *instr_it;
+  cvector_for_each_in(instr_it, bb->instructions) {
+    rs_instr_t instr = *instr_it;
+    uint8_t *refs[RS_INSTR_MAX_USES];
+    size_t ref_count = rs_instr_use_refs(&instr, refs);
+
+    if (is_spilled(c, instr.dest) &&
+        constants[instr.dest.vreg].type != RS_OPERAND_TYPE_NULL)
+      continue;
+
+    for (size_t t = 0; t < temps->used; t++)
+      temps->of[temps->taken[t]] = RS_INVALID_VREG;
+    temps->used = 0;
+    for (size_t i = 0; i < ref_count; i++) {
+      uint8_t spilled = *refs[i];
+      if (c->state[spilled] != NODE_SPILLED)
+        continue;
+
+      // A register read twice by one instruction is loaded once.
+      bool loaded = temps->of[spilled] != RS_INVALID_VREG;
+      uint8_t temp = operand_temp(rs, temps, spilled, no_spill);
+      if (temp == RS_INVALID_VREG)
+        return false;
+      *refs[i] = temp;
+      if (loaded)
+        continue;
+      if (constants[spilled].type != RS_OPERAND_TYPE_NULL) {
+        rs_instr_t remat = {RS_OPCODE_MOVE, RS_OPERAND_REG(temp),
+                            constants[spilled], RS_OPERAND_NULL,
+                            RS_OPERAND_NULL};
+        cvector_push_back(*rewritten, remat);
+        if (stats)
+          stats->remats++;
+        continue;
+      }
+
+      rs_instr_t reload = {RS_OPCODE_RELOAD, RS_OPERAND_REG(temp),
+                           RS_OPERAND_SLOT(slots[spilled]), RS_OPERAND_NULL,
+                           RS_OPERAND_NULL};
+      cvector_push_back(*rewritten, reload);
+    }
+
+    bool spill_def = is_spilled(c, instr.dest);
+    uint8_t spilled = instr.dest.vreg;
+    if (spill_def) {
+      uint8_t temp = operand_temp(rs, temps, spilled, no_spill);
+      if (temp == RS_INVALID_VREG)
+        return false;
+      instr.dest = RS_OPERAND_REG(temp);
+    }
+
+    cvector_push_back(*rewritten, instr);
+
+    if (spill_def) {
+      rs_instr_t spill = {RS_OPCODE_SPILL, RS_OPERAND_NULL, instr.dest,
+                          RS_OPERAND_SLOT(slots[spilled]), RS_OPERAND_NULL};
+      cvector_push_back(*rewritten, spill);
+    }
+  }
+  return true;
+}
+
+// Rewrites the window around the spilled registers, changing nothing unless
+// every block can be rewritten. `retired` marks the vregs earlier rounds
+// replaced, which may be reused as temporaries once nothing refers to them.
+static bool rewrite_program(rs_t *rs, const coloring_t *c, size_t *slots,
+                            bool *no_spill, bool *retired) {
+  const rs_def_use_t *def_use = rs_get_def_use(rs);
+  if (!def_use)
+    return false;
+
+  rs_operand_t constants[RS_MAX_REGS];
+  for (size_t n = 0; n < RS_MAX_REGS; n++) {
+    constants[n] = c->state[n] == NODE_SPILLED
+                       ? find_constant(rs, def_use, (uint8_t)n)
+                       : RS_OPERAND_NULL;
+    if (constants[n].type != RS_OPERAND_TYPE_NULL) {
+      trace_log("Rematerializing vreg %zu", n);
+      continue;
+    }
+    if (c->state[n] == NODE_SPILLED && slots[n] == SIZE_MAX) {
+      slots[n] = rs->stack_size / 8;
+      rs->stack_size += 8;
+      trace_log("Spilling vreg %zu to slot %zu", n, slots[n]);
+    }
+  }
+
+  spill_temps_t *temps = rs_calloc(1, sizeof(spill_temps_t));
+  size_t block_count = rs->window_end - rs->window_begin;
+  rs_instructions_t *rewritten =
+      rs_calloc(block_count + 1, sizeof(rs_instructions_t));
+  if (!temps || !rewritten) {
+    free(temps);
+    free(rewritten);
+    return false;
+  }
+
+  memset(temps->of, RS_INVALID_VREG, sizeof(temps->of));
+  bool referenced[RS_MAX_REGS] = {false};
+  find_referenced(rs, referenced);
+  for (size_t n = 0; n < RS_MAX_REGS; n++)
+    temps->free_vregs[n] = retired[n] && !referenced[n];
+
+  size_t next_dst_vreg = rs->next_dst_vreg;
+  bool ok = true;
+  for (size_t b = 0; ok && b < block_count; b++)
+    ok = rewrite_block(rs, c, rs->window_begin + b, slots, constants, temps,
+                       no_spill, &rewritten[b]);
+
+  for (size_t b = 0; b < block_count; b++) {
+    if (!ok) {
+      cvector_free(rewritten[b]);
+      continue;
+    }
+    rs_basic_block_t *bb = rs->basic_blocks[rs->window_begin + b];
+    cvector_free(bb->instructions);
+    bb->instructions = rewritten[b];
+  }
+
+  if (ok) {
+    for (size_t n = 0; n < RS_MAX_REGS; n++)
+      retired[n] |= c->state[n] == NODE_SPILLED;
+    for (size_t t = 0; t < temps->pool_count; t++)
+      retired[temps->pool[t]] = true;
+  } else {
+    rs->next_dst_vreg = next_dst_vreg;
+  }
+  debug_log("Rewrote spills with %zu temporaries", temps->pool_count);
+  free(temps);
+  free(rewritten);
+  return ok;
+}
+
+void rs_color_registers(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  debug_log("Starting graph coloring register allocation");
+
+  size_t slots[RS_MAX_REGS];
+  bool no_spill[RS_MAX_REGS] = {false};
+  bool retired[RS_MAX_REGS] = {false};
+  for (size_t n = 0; n < RS_MAX_REGS; n++)
+    slots[n] = SIZE_MAX;
+  rs->stack_size = rs->param_count * 8;
+
+  // A loaded profile knows better than the loop nesting.
+  uint64_t *weights = rs->block_frequencies ? NULL : loop_weights(rs);
+  coloring_t *c = NULL;
+  for (size_t round = 0; round < RS_COLOR_MAX_ROUNDS; round++) {
+    c = rs_calloc(1, sizeof(coloring_t));
+    if (!c) {
+      fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                                 "Out of memory\n");
+      rs->failed = true;
+      free(weights);
+      return;
+    }
+    c->rs = rs;
+    c->k = rs_get_register_count(rs->target);
+
+    if (!build(c, weights)) {
+      rs->failed = true;
+      coloring_free(c);
+      free(c);
+      free(weights);
+      return;
+    }
+    make_worklist(c);
+
+    while (simplify(c) || coalesce(c) || freeze(c) || select_spill(c, no_spill))
+      ;
+
+    size_t spilled = assign_colors(c);
+    debug_log("Coloring round %zu: %zu nodes, %zu moves, %zu spilled", round,
+              c->node_count, cvector_size(c->moves), spilled);
+    if (spilled == 0)
+      break;
+
+    if (round + 1 == RS_COLOR_MAX_ROUNDS ||
+        !rewrite_program(rs, c, slots, no_spill, retired)) {
+      fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+              "Error: " RS_COLOR_RESET
+              "Graph coloring failed to resolve spills\n");
+      rs->failed = true;
+      coloring_free(c);
+      free(c);
+      free(weights);
+      return;
+    }
+    rs_invalidate_analyses(rs, RS_ANALYSIS_BIT(DEF_USE) |
+                                   RS_ANALYSIS_BIT(LIVENESS));
+
+    coloring_free(c);
+    free(c);
+    c = NULL;
+  }
+  free(weights);
+
+  rs_regmap_free(&rs->register_map);
+  rs_regmap_init(&rs->register_map);
+  memset(rs->register_pool, 0, cvector_size(rs->register_pool) * sizeof(bool));
+
+  for (size_t n = 0; c && n < RS_MAX_REGS; n++) {
+    rs->lifetimes[n].reg = RS_REG_SPILL;
+    if (c->state[n] != NODE_COLORED && c->state[n] != NODE_COALESCED)
+      continue;
+
+    rs_register_t reg = c->color[n];
+    rs->lifetimes[n].vreg = n;
+    rs->lifetimes[n].reg = reg;
+    rs->register_pool[reg] = true;
+    rs_regmap_insert(&rs->register_map, n, reg);
+  }
+
+  debug_log("Graph coloring complete, frame size %zu", rs->stack_size);
+  if (c) {
+    coloring_free(c);
+    free(c);
+  }
+}
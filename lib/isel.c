@@ -0,0 +1,500 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+
+const rs_isel_t *rs_get_isel(rs_target_t target) {
+  switch (target) {
+#define RS_TARGET(lower, upper, ...)                                           \
+  case RS_TARGET_##upper:                                                      \
+    return &rs_isel_##lower;
+    RS_TARGETS
+#undef RS_TARGET
+  case RS_TARGET_COUNT:
+    break;
+  }
+  return NULL;
+}
+
+size_t rs_frame_size(rs_t *rs) {
+  size_t alignment = rs_get_isel(rs->target)->frame_alignment;
+  return (rs->stack_size + alignment - 1) / alignment * alignment;
+}
+
+static uint16_t operand_kinds(rs_operand_t operand, uint8_t link) {
+  switch (operand.type) {
+  case RS_OPERAND_TYPE_NULL:
+    return RS_KIND_NULL;
+  case RS_OPERAND_TYPE_INT64: {
+    uint16_t kinds = RS_KIND_IMM;
+    if (operand.int64 >= INT32_MIN && operand.int64 <= INT32_MAX)
+      kinds |= RS_KIND_IMM32;
+    if (operand.int64 >= 0 && operand.int64 <= 4095)
+      kinds |= RS_KIND_IMM12;
+    return kinds;
+  }
+  case RS_OPERAND_TYPE_ADDR:
+    return operand.addr <= INT32_MAX ? RS_KIND_ADDR | RS_KIND_ADDR32
+                                     : RS_KIND_ADDR;
+  case RS_OPERAND_TYPE_REG:
+    // The fused register is never written, so it may only appear where the
+    // template reads the first instruction's operands instead.
+    return operand.vreg == link ? RS_KIND_LINK : RS_KIND_REG;
+  case RS_OPERAND_TYPE_BB:
+    return RS_KIND_BB;
+  case RS_OPERAND_TYPE_SLOT:
+    return RS_KIND_SLOT;
+  case RS_OPERAND_TYPE_MEM:
+    return RS_KIND_MEM;
+  case RS_OPERAND_TYPE_SYM:
+    return RS_KIND_SYM;
+  default:
+    return 0;
+  }
+}
+
+static bool match_kinds(const uint16_t kinds[4], rs_instr_t instr,
+                        uint8_t link) {
+  rs_operand_t operands[] = {instr.dest, instr.src1, instr.src2, instr.src3};
+  for (size_t i = 0; i < 4; i++) {
+    if (!(operand_kinds(operands[i], link) & kinds[i]))
+      return false;
+  }
+  return true;
+}
+
+static bool same_register(rs_t *rs, rs_operand_t a, rs_operand_t b) {
+  return a.type == RS_OPERAND_TYPE_REG && b.type == RS_OPERAND_TYPE_REG &&
+         rs_get_register(rs, a.vreg) == rs_get_register(rs, b.vreg);
+}
+
+static bool reads_register(rs_t *rs, rs_operand_t operand, rs_operand_t reg) {
+  if (reg.type != RS_OPERAND_TYPE_REG)
+    return false;
+  if (operand.type == RS_OPERAND_TYPE_MEM) {
+    rs_register_t r = rs_get_register(rs, reg.vreg);
+    return (operand.mem.base != RS_INVALID_VREG &&
+            rs_get_register(rs, operand.mem.base) == r) ||
+           (operand.mem.index != RS_INVALID_VREG &&
+            rs_get_register(rs, operand.mem.index) == r);
+  }
+  return same_register(rs, operand, reg);
+}
+
+static bool match_predicate(rs_t *rs, rs_pattern_predicate_t predicate,
+                            rs_instr_t instr) {
+  switch (predicate) {
+  case RS_PATTERN_NONE:
+    return true;
+  case RS_PATTERN_TIED_SRC1:
+    return same_register(rs, instr.dest, instr.src1);
+  case RS_PATTERN_TIED_SRC2:
+    return same_register(rs, instr.dest, instr.src2);
+  case RS_PATTERN_DEST_FREE1:
+    return !reads_register(rs, instr.src1, instr.dest);
+  case RS_PATTERN_DEST_FREE2:
+    return !reads_register(rs, instr.src2, instr.dest);
+  case RS_PATTERN_NEGATABLE_SRC2:
+    return instr.src2.type == RS_OPERAND_TYPE_INT64 &&
+           -instr.src2.int64 >= INT32_MIN && -instr.src2.int64 <= INT32_MAX;
+  }
+  return false;
+}
+
+static const rs_pattern_t *select_single(rs_t *rs, const rs_isel_t *isel,
+                                         rs_instr_t instr) {
+  const rs_pattern_t *best = NULL;
+  for (size_t i = 0; i < isel->pattern_count; i++) {
+    const rs_pattern_t *pattern = &isel->patterns[i];
+    if (pattern->opcodes[0] != RS_OPCODE_COUNT ||
+        pattern->opcodes[1] != instr.opcode)
+      continue;
+    if (best && pattern->cost >= best->cost)
+      continue;
+    if (match_kinds(pattern->kinds[1], instr, RS_INVALID_VREG) &&
+        match_predicate(rs, pattern->predicate, instr))
+      best = pattern;
+  }
+  return best;
+}
+
+static const rs_pattern_t *select_fused(rs_t *rs, const rs_isel_t *isel,
+                                        const rs_def_use_t *def_use,
+                                        rs_instr_t first, rs_instr_t root) {
+  uint8_t link;
+  if (!rs_instr_def(first, &link) || def_use->use_count[link] != 1 ||
+      def_use->def_count[link] != 1)
+    return NULL;
+
+  const rs_pattern_t *best = NULL;
+  for (size_t i = 0; i < isel->pattern_count; i++) {
+    const rs_pattern_t *pattern = &isel->patterns[i];
+    if (pattern->opcodes[0] != first.opcode ||
+        pattern->opcodes[1] != root.opcode)
+      continue;
+    if (best && pattern->cost >= best->cost)
+      continue;
+    if (match_kinds(pattern->kinds[0], first, RS_INVALID_VREG) &&
+        match_kinds(pattern->kinds[1], root, link) &&
+        match_predicate(rs, pattern->predicate, root))
+      best = pattern;
+  }
+  return best;
+}
+
+const rs_pattern_t *rs_select_pattern(rs_t *rs, const rs_def_use_t *def_use,
+                                      const rs_instr_t *instrs, size_t count,
+                                      size_t *length) {
+  const rs_isel_t *isel = rs_get_isel(rs->target);
+  *length = 1;
+  if (!isel || count == 0)
+    return NULL;
+
+  const rs_pattern_t *single = select_single(rs, isel, instrs[0]);
+  if (!def_use || count < 2)
+    return single;
+
+  const rs_pattern_t *fused =
+      select_fused(rs, isel, def_use, instrs[0], instrs[1]);
+  if (!fused)
+    return single;
+
+  const rs_pattern_t *next = select_single(rs, isel, instrs[1]);
+  if (single && next && single->cost + next->cost <= fused->cost)
+    return single;
+
+  trace_log("Fused %s and %s", rs_opcode_to_str(instrs[0].opcode),
+            rs_opcode_to_str(instrs[1].opcode));
+  *length = 2;
+  return fused;
+}
+
+rs_moperand_t rs_lower_operand(rs_t *rs, rs_operand_t operand,
+                               bool dereference) {
+  rs_moperand_t m = {.type = RS_MOPERAND_NONE};
+  rs_moperand_t mem = {.type = RS_MOPERAND_MEM};
+  mem.mem.base = RS_NO_MREG;
+  mem.mem.index = RS_NO_MREG;
+  mem.mem.scale = 1;
+  mem.mem.disp = 0;
+
+  switch (operand.type) {
+  case RS_OPERAND_TYPE_NULL:
+    break;
+  case RS_OPERAND_TYPE_INT64:
+    m.type = RS_MOPERAND_IMM;
+    m.imm = operand.int64;
+    break;
+  case RS_OPERAND_TYPE_ADDR:
+    if (dereference) {
+      mem.mem.disp = (int64_t)operand.addr;
+      return mem;
+    }
+    m.type = RS_MOPERAND_IMM;
+    m.imm = (int64_t)operand.addr;
+    break;
+  case RS_OPERAND_TYPE_REG:
+    if (dereference) {
+      mem.mem.base = rs_get_register(rs, operand.vreg);
+      return mem;
+    }
+    m.type = RS_MOPERAND_REG;
+    m.reg = rs_get_register(rs, operand.vreg);
+    break;
+  case RS_OPERAND_TYPE_BB:
+    m.type = RS_MOPERAND_LABEL;
+    m.label = operand.bb_id;
+    break;
+  case RS_OPERAND_TYPE_SLOT:
+    mem.mem.base = rs_get_isel(rs->target)->stack_reg;
+    mem.mem.disp = (int64_t)operand.slot * 8;
+    return mem;
+  case RS_OPERAND_TYPE_MEM:
+    if (operand.mem.base != RS_INVALID_VREG)
+      mem.mem.base = rs_get_register(rs, operand.mem.base);
+    if (operand.mem.index != RS_INVALID_VREG)
+      mem.mem.index = rs_get_register(rs, operand.mem.index);
+    mem.mem.scale = operand.mem.scale;
+    mem.mem.disp = operand.mem.disp;
+    return mem;
+  case RS_OPERAND_TYPE_SYM:
+    m.type = RS_MOPERAND_SYMBOL;
+    m.symbol = operand.symbol;
+    break;
+  default:
+    break;
+  }
+  return m;
+}
+
+typedef struct {
+  rs_t *rs;
+  const rs_isel_t *isel;
+  const rs_instr_t *root;
+  const rs_instr_t *first;
+  uint8_t saved; // Caller-saved register of the current `<` or `>` line.
+} render_t;
+
+static bool token_is(const char *token, size_t length, const char *str) {
+  return strlen(str) == length && strncmp(token, str, length) == 0;
+}
+
+static bool find_register(const rs_isel_t *isel, const char *token,
+                          size_t length, uint8_t *reg) {
+  for (size_t i = 0; i < isel->reg_count; i++) {
+    if (token_is(token, length, isel->reg_names[i])) {
+      *reg = (uint8_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static rs_moperand_t parse_placeholder(render_t *r, const char *token,
+                                       size_t length) {
+  rs_moperand_t m = {.type = RS_MOPERAND_NONE};
+  if (length == 2 && token[1] == 'F') {
+    m.type = RS_MOPERAND_IMM;
+    m.imm = (int64_t)rs_frame_size(r->rs);
+    return m;
+  }
+
+  if (length == 2 && token[1] == 'r') {
+    m.type = RS_MOPERAND_REG;
+    m.reg = r->saved;
+    return m;
+  }
+
+  bool through_saves = false;
+  if (length >= 3 && token[1] == 'a') {
+    through_saves = true;
+    token++;
+    length--;
+  }
+
+  const rs_instr_t *instr = r->root;
+  if (length >= 3 && token[1] == 'f') {
+    instr = r->first;
+    token++;
+    length--;
+  }
+
+  if (!instr || length != 2) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Bad template placeholder '%.*s'\n",
+            (int)length, token);
+    return m;
+  }
+
+  switch (token[1]) {
+  case 'd':
+    m = rs_lower_operand(r->rs, instr->dest, false);
+    break;
+  case '1':
+    m = rs_lower_operand(r->rs, instr->src1, false);
+    break;
+  case '2':
+    m = rs_lower_operand(r->rs, instr->src2, false);
+    break;
+  case '3':
+    m = rs_lower_operand(r->rs, instr->src3, false);
+    break;
+  case 'b':
+    m = rs_lower_operand(r->rs, instr->dest, false);
+    m.type = RS_MOPERAND_REG8;
+    return m;
+  default:
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Bad template placeholder '%.*s'\n",
+            (int)length, token);
+    return m;
+  }
+
+  if (!through_saves || m.type != RS_MOPERAND_REG)
+    return m;
+
+  // The `<` lines push the caller-saved registers in order, so the last one
+  // pushed is on top of the stack.
+  for (size_t i = 0; i < r->isel->caller_saved_count; i++) {
+    if (r->isel->caller_saved[i] != m.reg)
+      continue;
+    rs_moperand_t slot = {.type = RS_MOPERAND_MEM};
+    slot.mem.base = r->isel->stack_reg;
+    slot.mem.index = RS_NO_MREG;
+    slot.mem.scale = 1;
+    slot.mem.disp = (int64_t)(r->isel->caller_saved_count - 1 - i) * 8;
+    return slot;
+  }
+  return m;
+}
+
+// Parses a register, placeholder or integer.
+static rs_moperand_t parse_value(render_t *r, const char *token,
+                                 size_t length) {
+  rs_moperand_t m = {.type = RS_MOPERAND_LITERAL};
+  if (token[0] == '$')
+    return parse_placeholder(r, token, length);
+  if (find_register(r->isel, token, length, &m.reg)) {
+    m.type = RS_MOPERAND_REG;
+    return m;
+  }
+  if (isdigit((unsigned char)token[token[0] == '-' && length > 1])) {
+    m.type = RS_MOPERAND_IMM;
+    m.imm = strtoll(token, NULL, 10);
+    return m;
+  }
+  m.literal.text = token;
+  m.literal.length = length;
+  return m;
+}
+
+static void add_term(rs_moperand_t *mem, rs_moperand_t term, bool negate) {
+  switch (term.type) {
+  case RS_MOPERAND_REG:
+    if (mem->mem.base == RS_NO_MREG)
+      mem->mem.base = term.reg;
+    else
+      mem->mem.index = term.reg;
+    break;
+  case RS_MOPERAND_IMM:
+    mem->mem.disp += negate ? -term.imm : term.imm;
+    break;
+  case RS_MOPERAND_MEM:
+    if (mem->mem.base == RS_NO_MREG) {
+      mem->mem.base = term.mem.base;
+      mem->mem.index = term.mem.index;
+      mem->mem.scale = term.mem.scale;
+    } else {
+      mem->mem.index = term.mem.base;
+    }
+    mem->mem.disp += term.mem.disp;
+    break;
+  default:
+    break;
+  }
+}
+
+static rs_moperand_t parse_memory(render_t *r, const char *token,
+                                  size_t length) {
+  rs_moperand_t mem = {.type = RS_MOPERAND_MEM};
+  mem.mem.base = RS_NO_MREG;
+  mem.mem.index = RS_NO_MREG;
+  mem.mem.scale = 1;
+  mem.mem.disp = 0;
+
+  // Skip the brackets and sum the terms in between.
+  const char *p = token + 1, *end = token + length - 1;
+  bool negate = false;
+  while (p < end) {
+    while (p < end && *p == ' ')
+      p++;
+    const char *term = p;
+    while (p < end && *p != ' ' && *p != '+' && *p != '-')
+      p++;
+    if (p > term) {
+      rs_moperand_t value = parse_value(r, term, (size_t)(p - term));
+      if (value.type == RS_MOPERAND_IMM || value.type == RS_MOPERAND_REG ||
+          value.type == RS_MOPERAND_MEM)
+        add_term(&mem, value, negate);
+    }
+    while (p < end && *p == ' ')
+      p++;
+    if (p < end) {
+      negate = *p == '-';
+      p++;
+    }
+  }
+  return mem;
+}
+
+static rs_moperand_t parse_operand(render_t *r, const char *token,
+                                   size_t length) {
+  if (token[0] == '[')
+    return parse_memory(r, token, length);
+
+  if (token[0] == '=') {
+    rs_moperand_t m = parse_value(r, token + 1, length - 1);
+    m.type = RS_MOPERAND_POOL;
+    return m;
+  }
+  return parse_value(r, token, length);
+}
+
+// Parses one template line into a machine instruction.
+static void render_line(render_t *r, const char *p, const char *line_end,
+                        rs_minstrs_t *out) {
+  rs_minstr_t minstr;
+  memset(&minstr, 0, sizeof(minstr));
+  size_t length = 0;
+  while (p < line_end && *p != ' ') {
+    if (length + 1 < sizeof(minstr.mnemonic))
+      minstr.mnemonic[length++] = *p;
+    p++;
+    // A prefix is a flag of the mnemonic it modifies, as in `lock inc`.
+    if (p < line_end && *p == ' ' && strcmp(minstr.mnemonic, "lock") == 0) {
+      minstr.lock = true;
+      memset(minstr.mnemonic, 0, sizeof(minstr.mnemonic));
+      length = 0;
+      p++;
+    }
+  }
+
+  // Operands are separated by commas outside of brackets.
+  while (p < line_end && minstr.operand_count < RS_MINSTR_MAX_OPERANDS) {
+    while (p < line_end && (*p == ' ' || *p == ','))
+      p++;
+    const char *token = p;
+    int depth = 0;
+    while (p < line_end && (depth > 0 || *p != ',')) {
+      depth += (*p == '[') - (*p == ']');
+      p++;
+    }
+    const char *token_end = p;
+    while (token_end > token && token_end[-1] == ' ')
+      token_end--;
+    if (token_end > token)
+      minstr.operands[minstr.operand_count++] =
+          parse_operand(r, token, (size_t)(token_end - token));
+  }
+
+  if (length > 0)
+    cvector_push_back(*out, minstr);
+}
+
+void rs_render_template(rs_t *rs, const char *template,
+                        const rs_instr_t *instrs, size_t count,
+                        rs_minstrs_t *out) {
+  render_t r = {rs, rs_get_isel(rs->target),
+                count > 0 ? &instrs[count - 1] : NULL,
+                count > 1 ? &instrs[0] : NULL, RS_NO_MREG};
+
+  const char *p = template;
+  while (*p) {
+    const char *line_end = strchr(p, '\n');
+    if (!line_end)
+      line_end = p + strlen(p);
+
+    if (*p == '?') {
+      if (rs_frame_size(rs) > 0)
+        render_line(&r, p + 1, line_end, out);
+    } else if (isdigit((unsigned char)*p)) {
+      if (rs->param_count >= (size_t)(*p - '0'))
+        render_line(&r, p + 1, line_end, out);
+    } else if (*p == '<' || *p == '>') {
+      size_t n = r.isel->caller_saved_count;
+      for (size_t i = 0; i < n; i++) {
+        r.saved = r.isel->caller_saved[*p == '<' ? i : n - 1 - i];
+        render_line(&r, p + 1, line_end, out);
+      }
+    } else {
+      render_line(&r, p, line_end, out);
+    }
+    p = *line_end ? line_end + 1 : line_end;
+  }
+}
@@ -0,0 +1,128 @@
+#if defined(__linux__) && defined(__x86_64__)
+#define _DEFAULT_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+#define RS_JIT_SUPPORTED 1
+#endif
+
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+/** Bytes reserved ahead of the code to remember the mapping size. */
+#define RS_JIT_HEADER_SIZE 16
+
+#ifdef RS_JIT_SUPPORTED
+
+// Copies the code into fresh executable pages, returning its address.
+static uint8_t *map_code(rs_buffer_t code) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = RS_JIT_HEADER_SIZE + cvector_size(code);
+  size = (size + page_size - 1) / page_size * page_size;
+
+  // The pages are never writable and executable at the same time.
+  uint8_t *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to map %zu bytes for JIT code\n",
+            size);
+    return NULL;
+  }
+
+  memcpy(base, &size, sizeof(size));
+  memcpy(base + RS_JIT_HEADER_SIZE, code, cvector_size(code));
+  if (mprotect(base, size, PROT_READ | PROT_EXEC) != 0) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to make JIT code executable\n");
+    munmap(base, size);
+    return NULL;
+  }
+
+  debug_log("Compiled %zu bytes of JIT code at %p", cvector_size(code),
+            (void *)(base + RS_JIT_HEADER_SIZE));
+  return base + RS_JIT_HEADER_SIZE;
+}
+
+rs_jit_fn_t rs_jit_compile(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return NULL;
+  }
+
+  rs_buffer_t code = NULL;
+  if (!rs_generate_binary(rs, &code)) {
+    cvector_free(code);
+    return NULL;
+  }
+
+  uint8_t *entry = map_code(code);
+  cvector_free(code);
+  return entry ? (rs_jit_fn_t)(uintptr_t)entry : NULL;
+}
+
+bool rs_jit_compile_module(rs_module_t *module, rs_jit_fn_t *functions) {
+  if (!module || !functions) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL module or functions pointer\n");
+    return false;
+  }
+
+  size_t function_count = cvector_size(module->functions);
+  size_t *offsets = rs_calloc(function_count + 1, sizeof(size_t));
+  rs_buffer_t code = NULL;
+  rs_relocations_t relocations = NULL;
+  bool ok = rs_module_generate_binary(module, &code, offsets, &relocations);
+  if (ok && cvector_size(relocations) > 0) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Undefined symbol '%s'\n",
+            relocations[0].symbol);
+    ok = false;
+  }
+
+  uint8_t *base = ok ? map_code(code) : NULL;
+  for (size_t i = 0; base && i < function_count; i++)
+    functions[i] = (rs_jit_fn_t)(uintptr_t)(base + offsets[i]);
+
+  cvector_free(relocations);
+  cvector_free(code);
+  free(offsets);
+  return base != NULL;
+}
+
+void rs_jit_free(rs_jit_fn_t fn) {
+  if (!fn)
+    return;
+
+  uint8_t *base = (uint8_t *)(uintptr_t)fn - RS_JIT_HEADER_SIZE;
+  size_t size;
+  memcpy(&size, base, sizeof(size));
+  munmap(base, size);
+}
+
+#else
+
+rs_jit_fn_t rs_jit_compile(rs_t *rs) {
+  (void)rs;
+  fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+          "Error: " RS_COLOR_RESET "JIT is only supported on Linux x86-64\n");
+  return NULL;
+}
+
+bool rs_jit_compile_module(rs_module_t *module, rs_jit_fn_t *functions) {
+  (void)module;
+  (void)functions;
+  fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+          "Error: " RS_COLOR_RESET "JIT is only supported on Linux x86-64\n");
+  return false;
+}
+
+void rs_jit_free(rs_jit_fn_t fn) { (void)fn; }
+
+#endif
@@ -0,0 +1,300 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+static bool is_tracked_vreg(rs_operand_t operand) {
+  return operand.type == RS_OPERAND_TYPE_REG &&
+         operand.vreg != RS_TEMPORARY_VREG;
+}
+
+size_t rs_instr_use_refs(rs_instr_t *instr,
+                         uint8_t *refs[RS_INSTR_MAX_USES]) {
+  size_t count = 0;
+  rs_operand_t *operands[] = {&instr->dest, &instr->src1, &instr->src2,
+                              &instr->src3};
+  for (size_t i = 0; i < 4; i++) {
+    rs_operand_t *operand = operands[i];
+    if (operand->type == RS_OPERAND_TYPE_MEM) {
+      if (operand->mem.base != RS_INVALID_VREG)
+        refs[count++] = &operand->mem.base;
+      if (operand->mem.index != RS_INVALID_VREG)
+        refs[count++] = &operand->mem.index;
+    } else if (i > 0 && is_tracked_vreg(*operand)) {
+      refs[count++] = &operand->vreg;
+    }
+  }
+  return count;
+}
+
+size_t rs_instr_uses(rs_instr_t instr, uint8_t uses[RS_INSTR_MAX_USES]) {
+  uint8_t *refs[RS_INSTR_MAX_USES];
+  size_t count = rs_instr_use_refs(&instr, refs);
+  for (size_t i = 0; i < count; i++)
+    uses[i] = *refs[i];
+  return count;
+}
+
+bool rs_instr_def(rs_instr_t instr, uint8_t *vreg) {
+  if (!is_tracked_vreg(instr.dest))
+    return false;
+  *vreg = instr.dest.vreg;
+  return true;
+}
+
+size_t rs_instr_successors(rs_instr_t instr, size_t successors[2]) {
+  switch (instr.opcode) {
+  case RS_OPCODE_BR:
+    if (instr.src1.type != RS_OPERAND_TYPE_BB)
+      return 0;
+    successors[0] = instr.src1.bb_id;
+    return 1;
+
+  case RS_OPCODE_BR_IF: {
+    size_t count = 0;
+    if (instr.src2.type == RS_OPERAND_TYPE_BB)
+      successors[count++] = instr.src2.bb_id;
+    if (instr.src3.type == RS_OPERAND_TYPE_BB)
+      successors[count++] = instr.src3.bb_id;
+    return count;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+void rs_compute_def_use(rs_t *rs, rs_def_use_t *def_use) {
+  memset(def_use, 0, sizeof(*def_use));
+
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    for (size_t i = 0; i < cvector_size(bb->instructions); i++) {
+      uint8_t regs[RS_INSTR_MAX_USES];
+      size_t count = rs_instr_uses(bb->instructions[i], regs);
+      for (size_t u = 0; u < count; u++)
+        def_use->use_count[regs[u]]++;
+
+      if (rs_instr_def(bb->instructions[i], regs)) {
+        def_use->def_count[regs[0]]++;
+        def_use->def_block[regs[0]] = block_id;
+        def_use->def_index[regs[0]] = i;
+      }
+    }
+  }
+}
+
+rs_instr_t *rs_unique_def(rs_t *rs, const rs_def_use_t *def_use,
+                          uint8_t vreg) {
+  if (vreg == RS_TEMPORARY_VREG || def_use->def_count[vreg] != 1)
+    return NULL;
+  return &rs->basic_blocks[def_use->def_block[vreg]]
+              ->instructions[def_use->def_index[vreg]];
+}
+
+void rs_compute_liveness(rs_t *rs, rs_liveness_t *liveness) {
+  size_t begin = rs->window_begin;
+  size_t block_count = rs->window_end - begin;
+  rs_regset_t empty;
+  memset(&empty, 0, sizeof(empty));
+
+  liveness->live_in = NULL;
+  liveness->live_out = NULL;
+  cvector_init(liveness->live_in, block_count, NULL);
+  cvector_init(liveness->live_out, block_count, NULL);
+
+  // Upward-exposed uses and definitions of every block.
+  rs_regsets_t gen = NULL, kill = NULL;
+  cvector_init(gen, block_count, NULL);
+  cvector_init(kill, block_count, NULL);
+
+  for (size_t local = 0; local < block_count; local++) {
+    cvector_push_back(liveness->live_in, empty);
+    cvector_push_back(liveness->live_out, empty);
+    cvector_push_back(gen, empty);
+    cvector_push_back(kill, empty);
+
+    rs_basic_block_t *bb = rs->basic_blocks[begin + local];
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, bb->instructions) {
+      uint8_t uses[RS_INSTR_MAX_USES];
+      size_t use_count = rs_instr_uses(*instr_it, uses);
+      for (size_t i = 0; i < use_count; i++) {
+        if (!rs_regset_contains(&kill[local], uses[i]))
+          rs_regset_add(&gen[local], uses[i]);
+      }
+
+      uint8_t def;
+      if (rs_instr_def(*instr_it, &def))
+        rs_regset_add(&kill[local], def);
+    }
+  }
+
+  // Iterate to a fixed point, visiting blocks in reverse since most edges
+  // point forward. Successors outside the window contribute nothing.
+  bool changed = true;
+  size_t iterations = 0;
+  while (changed) {
+    changed = false;
+    iterations++;
+
+    for (size_t local = block_count; local-- > 0;) {
+      rs_basic_block_t *bb = rs->basic_blocks[begin + local];
+      rs_regset_t *out = &liveness->live_out[local];
+
+      if (cvector_size(bb->instructions) > 0) {
+        size_t successors[2];
+        size_t successor_count = rs_instr_successors(
+            bb->instructions[cvector_size(bb->instructions) - 1], successors);
+        for (size_t i = 0; i < successor_count; i++) {
+          if (successors[i] >= begin && successors[i] < rs->window_end)
+            rs_regset_union(out, &liveness->live_in[successors[i] - begin]);
+        }
+      }
+
+      rs_regset_t in = gen[local];
+      for (size_t i = 0; i < RS_REGSET_WORDS; i++)
+        in.words[i] |= out->words[i] & ~kill[local].words[i];
+
+      changed |= rs_regset_union(&liveness->live_in[local], &in);
+    }
+  }
+
+  cvector_free(gen);
+  cvector_free(kill);
+  debug_log("Liveness converged after %zu iterations over %zu blocks",
+            iterations, block_count);
+}
+
+void rs_liveness_free(rs_liveness_t *liveness) {
+  if (!liveness)
+    return;
+
+  cvector_free(liveness->live_in);
+  cvector_free(liveness->live_out);
+  liveness->live_in = NULL;
+  liveness->live_out = NULL;
+}
+
+// Opens the interval of a register at instruction `index`, or extends it.
+static void touch(size_t vreg, size_t index, size_t stamp, size_t *seen,
+                  size_t *first, size_t *last) {
+  if (seen[vreg] != stamp) {
+    seen[vreg] = stamp;
+    first[vreg] = index;
+    last[vreg] = index;
+  } else if (index > last[vreg]) {
+    last[vreg] = index;
+  }
+}
+
+bool rs_compute_pressure(rs_t *rs, const rs_liveness_t *liveness,
+                         rs_pressure_t *pressure) {
+  size_t begin = rs->window_begin;
+  size_t block_count = rs->window_end - begin;
+  size_t total = 0, longest = 0;
+  for (size_t local = 0; local < block_count; local++) {
+    size_t count = cvector_size(rs->basic_blocks[begin + local]->instructions);
+    total += count;
+    longest = count > longest ? count : longest;
+  }
+
+  pressure->points = NULL;
+  pressure->block_start = NULL;
+  pressure->max = 0;
+  cvector_init(pressure->points, total, NULL);
+  cvector_init(pressure->block_start, block_count + 1, NULL);
+  cvector_resize(pressure->points, total, 0);
+
+  // The first and last occurrence of each register, valid when its stamp
+  // matches the block's.
+  size_t seen[RS_MAX_REGS] = {0}, first[RS_MAX_REGS], last[RS_MAX_REGS];
+  uint8_t touched[RS_MAX_REGS];
+  size_t *ends = rs_calloc(longest + 1, sizeof(size_t));
+  if (!ends) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to allocate pressure events\n");
+    rs_pressure_free(pressure);
+    return false;
+  }
+
+  size_t start = 0;
+  for (size_t local = 0; local < block_count; local++) {
+    cvector_push_back(pressure->block_start, start);
+    rs_basic_block_t *bb = rs->basic_blocks[begin + local];
+    size_t count = cvector_size(bb->instructions);
+    if (count == 0)
+      continue;
+
+    size_t stamp = local + 1, touched_count = 0;
+    for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++) {
+      if (!rs_regset_contains(&liveness->live_in[local], vreg))
+        continue;
+      touch(vreg, 0, stamp, seen, first, last);
+      touched[touched_count++] = (uint8_t)vreg;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      uint8_t regs[RS_INSTR_MAX_USES + 1];
+      size_t reg_count = rs_instr_uses(bb->instructions[i], regs);
+      reg_count += rs_instr_def(bb->instructions[i], &regs[reg_count]);
+      for (size_t r = 0; r < reg_count; r++) {
+        if (seen[regs[r]] != stamp)
+          touched[touched_count++] = regs[r];
+        touch(regs[r], i, stamp, seen, first, last);
+      }
+    }
+
+    for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++) {
+      if (!rs_regset_contains(&liveness->live_out[local], vreg))
+        continue;
+      if (seen[vreg] != stamp)
+        touched[touched_count++] = (uint8_t)vreg;
+      touch(vreg, count - 1, stamp, seen, first, last);
+    }
+
+    // Bucket the start and end events by instruction, then sweep.
+    size_t *starts = &pressure->points[start];
+    for (size_t t = 0; t < touched_count; t++) {
+      starts[first[touched[t]]]++;
+      ends[last[touched[t]]]++;
+    }
+    size_t live = 0;
+    for (size_t i = 0; i < count; i++) {
+      live += starts[i];
+      starts[i] = live;
+      if (live > pressure->max)
+        pressure->max = live;
+      live -= ends[i];
+      ends[i] = 0;
+    }
+    start += count;
+  }
+  cvector_push_back(pressure->block_start, start);
+  free(ends);
+
+  debug_log("Pressure profile of %zu instructions, max %zu", total,
+            pressure->max);
+  return true;
+}
+
+void rs_pressure_free(rs_pressure_t *pressure) {
+  if (!pressure)
+    return;
+
+  cvector_free(pressure->points);
+  cvector_free(pressure->block_start);
+  pressure->points = NULL;
+  pressure->block_start = NULL;
+}
+
+size_t rs_pressure_block_max(const rs_pressure_t *pressure, size_t local) {
+  size_t max = 0;
+  for (size_t i = pressure->block_start[local];
+       i < pressure->block_start[local + 1]; i++)
+    max = pressure->points[i] > max ? pressure->points[i] : max;
+  return max;
+}
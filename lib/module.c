@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+/** Initial block capacity of a function, which grows on demand. */
+#define RS_FUNCTION_INIT_BLOCKS 16
+
+static void free_function(void *ptr) {
+  rs_function_t *fn = *(rs_function_t **)ptr;
+  if (!fn)
+    return;
+
+  debug_log("Freeing function '%s' with %zu blocks", fn->name,
+            cvector_size(fn->basic_blocks));
+  cvector_free(fn->basic_blocks);
+  free(fn->name);
+  free(fn);
+}
+
+// Moves the selected function's state out of the shared `rs_t`.
+static void save_function(rs_module_t *module) {
+  if (module->current_function < 0)
+    return;
+
+  rs_function_t *fn = module->functions[module->current_function];
+  fn->basic_blocks = module->rs.basic_blocks;
+  fn->current_basic_block = module->rs.current_basic_block;
+  fn->next_dst_vreg = module->rs.next_dst_vreg;
+  fn->param_count = module->rs.param_count;
+  fn->opt_level = module->rs.opt_level;
+  fn->regalloc = module->rs.regalloc;
+  module->rs.basic_blocks = NULL;
+  module->current_function = -1;
+  rs_invalidate_analyses(&module->rs, RS_ANALYSIS_ALL);
+}
+
+void rs_module_init(rs_module_t *module, rs_target_t target) {
+  if (!module) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL module pointer\n");
+    return;
+  }
+
+  memset(module, 0, sizeof(*module));
+  rs_init(&module->rs, target);
+  // Every function brings its own blocks.
+  cvector_free(module->rs.basic_blocks);
+  module->rs.basic_blocks = NULL;
+
+  module->functions = NULL;
+  cvector_init(module->functions, RS_FUNCTION_INIT_BLOCKS, free_function);
+  module->current_function = -1;
+}
+
+void rs_module_free(rs_module_t *module) {
+  if (!module)
+    return;
+
+  save_function(module);
+  rs_free(&module->rs);
+  cvector_free(module->functions);
+  memset(module, 0, sizeof(*module));
+}
+
+size_t rs_module_add_function(rs_module_t *module, const char *name) {
+  if (!module || !name) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL module or function name\n");
+    return SIZE_MAX;
+  }
+
+  rs_function_t *fn = rs_calloc(1, sizeof(rs_function_t));
+  if (!fn || !(fn->name = strdup(name))) {
+    fprintf(stderr, "Failed to allocate memory for function: %s\n",
+            strerror(errno));
+    free(fn);
+    return SIZE_MAX;
+  }
+
+  fn->basic_blocks = NULL;
+  cvector_init(fn->basic_blocks, RS_FUNCTION_INIT_BLOCKS, rs_free_basic_block);
+  fn->current_basic_block = -1;
+  fn->next_dst_vreg = 0;
+  fn->opt_level = module->rs.opt_level;
+  fn->regalloc = module->rs.regalloc;
+
+  debug_log("Adding function '%s'", fn->name);
+  cvector_push_back(module->functions, fn);
+  return cvector_size(module->functions) - 1;
+}
+
+rs_t *rs_module_position_at_function(rs_module_t *module, size_t function_id) {
+  if (!module || function_id >= cvector_size(module->functions)) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Invalid function at index %zu\n",
+            function_id);
+    return NULL;
+  }
+
+  if (module->current_function == (ptrdiff_t)function_id)
+    return &module->rs;
+
+  save_function(module);
+  rs_function_t *fn = module->functions[function_id];
+  rs_t *rs = &module->rs;
+  rs->basic_blocks = fn->basic_blocks;
+  rs->current_basic_block = fn->current_basic_block;
+  rs->next_dst_vreg = fn->next_dst_vreg;
+  rs->param_count = fn->param_count;
+  rs->opt_level = fn->opt_level;
+  rs->regalloc = fn->regalloc;
+  rs->symbol = fn->name;
+  rs->window_begin = 0;
+  rs->window_end = cvector_size(fn->basic_blocks);
+  module->current_function = (ptrdiff_t)function_id;
+  return rs;
+}
+
+bool rs_module_generate_to(rs_module_t *module, rs_emitter_t *out) {
+  ptrdiff_t current = module->current_function;
+  bool ok = true;
+  for (size_t i = 0; i < cvector_size(module->functions); i++)
+    ok &= rs_generate_to(rs_module_position_at_function(module, i), out);
+  if (current >= 0)
+    rs_module_position_at_function(module, (size_t)current);
+  return ok;
+}
+
+void rs_module_generate(rs_module_t *module, FILE *fp) {
+  rs_emitter_t out;
+  rs_emitter_init_file(&out, fp);
+  rs_module_generate_to(module, &out);
+  rs_emitter_free(&out);
+}
+
+bool rs_module_generate_binary(rs_module_t *module, rs_buffer_t *buf,
+                               size_t *function_offsets,
+                               rs_relocations_t *relocations) {
+  if (!module || !buf || !relocations) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL module, buffer or relocations\n");
+    return false;
+  }
+
+  if (module->rs.target != RS_TARGET_X86_64_LINUX_NASM) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "No binary encoder for target %d\n",
+            module->rs.target);
+    return false;
+  }
+
+  ptrdiff_t current = module->current_function;
+  size_t function_count = cvector_size(module->functions);
+  size_t *offsets = rs_calloc(function_count + 1, sizeof(size_t));
+  bool ok = true;
+  for (size_t i = 0; ok && i < function_count; i++) {
+    rs_t *rs = rs_module_position_at_function(module, i);
+    offsets[i] = cvector_size(*buf);
+    ok = rs_run_passes(rs) && rs_encode_x86_64(rs, buf, NULL, relocations);
+  }
+
+  for (size_t i = 0; ok && i < function_count; i++)
+    rs_resolve_x86_64(*buf, relocations, module->functions[i]->name,
+                      offsets[i]);
+
+  if (ok && function_offsets)
+    memcpy(function_offsets, offsets, function_count * sizeof(size_t));
+  free(offsets);
+  if (current >= 0)
+    rs_module_position_at_function(module, (size_t)current);
+  return ok;
+}
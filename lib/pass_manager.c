@@ -0,0 +1,358 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+static const char *stat_names[RS_PASS_STATS_COUNT] = {
+#define X(name, str) str,
+    RS_PASSES(X) RS_ANALYSES(X)
+#undef X
+};
+
+rs_pass_timer_t rs_pass_begin(void) {
+  return (rs_pass_timer_t){rs_trace_now(), rs_get_thread_alloc_stats()};
+}
+
+void rs_pass_end(rs_t *rs, size_t stat, rs_pass_timer_t timer) {
+  rs_alloc_stats_t alloc = rs_get_thread_alloc_stats();
+  rs_pass_stats_t *stats = &rs->pass_stats[stat];
+  stats->name = stat_names[stat];
+  stats->runs++;
+  stats->nanoseconds += rs_trace_now() - timer.start;
+  stats->allocations += alloc.count - timer.alloc.count;
+  stats->allocated_bytes += alloc.bytes - timer.alloc.bytes;
+  RS_TRACE_END(rs, stat_names[stat], timer.start);
+}
+
+const rs_pass_stats_t *rs_get_pass_stats(const rs_t *rs, size_t *count) {
+  *count = RS_PASS_STATS_COUNT;
+  return rs->pass_stats;
+}
+
+void rs_reset_pass_stats(rs_t *rs) {
+  memset(rs->pass_stats, 0, sizeof(rs->pass_stats));
+  for (size_t i = 0; i < RS_PASS_STATS_COUNT; i++)
+    rs->pass_stats[i].name = stat_names[i];
+}
+
+void rs_invalidate_analyses(rs_t *rs, unsigned analyses) {
+  // The pressure profile is derived from liveness.
+  if (analyses & RS_ANALYSIS_BIT(LIVENESS))
+    analyses |= RS_ANALYSIS_BIT(PRESSURE);
+  if (rs->analyses)
+    rs->analyses->valid &= ~analyses;
+}
+
+static void free_cfg(rs_cfg_t *cfg) {
+  rs_cfg_node_t *node_it;
+  cvector_for_each_in(node_it, *cfg) { cvector_free(node_it->predecessors); }
+  cvector_free(*cfg);
+  *cfg = NULL;
+}
+
+void rs_free_analyses(rs_t *rs) {
+  if (!rs->analyses)
+    return;
+
+  free_cfg(&rs->analyses->cfg);
+  rs_liveness_free(&rs->analyses->liveness);
+  cvector_free(rs->analyses->idom);
+  rs_pressure_free(&rs->analyses->pressure);
+  free(rs->analyses);
+  rs->analyses = NULL;
+}
+
+// Gets the cache, with `analysis` out of date if it has to be recomputed.
+static rs_analyses_t *cache(rs_t *rs, rs_analysis_t analysis,
+                            bool *up_to_date) {
+  if (!rs->analyses)
+    rs->analyses = rs_calloc(1, sizeof(rs_analyses_t));
+  if (!rs->analyses) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to allocate analyses\n");
+    return NULL;
+  }
+  *up_to_date = rs->analyses->valid & (1u << analysis);
+  return rs->analyses;
+}
+
+const rs_cfg_t *rs_get_cfg(rs_t *rs) {
+  bool up_to_date;
+  rs_analyses_t *analyses = cache(rs, RS_ANALYSIS_CFG, &up_to_date);
+  if (!analyses || up_to_date)
+    return analyses ? &analyses->cfg : NULL;
+
+  rs_pass_timer_t timer = rs_pass_begin();
+  size_t begin = rs->window_begin;
+  size_t block_count = rs->window_end - begin;
+  free_cfg(&analyses->cfg);
+  cvector_init(analyses->cfg, block_count, NULL);
+  for (size_t local = 0; local < block_count; local++) {
+    rs_cfg_node_t node = {.successor_count = 0, .predecessors = NULL};
+    rs_instructions_t instrs = rs->basic_blocks[begin + local]->instructions;
+    if (cvector_size(instrs) > 0)
+      node.successor_count = rs_instr_successors(
+          instrs[cvector_size(instrs) - 1], node.successors);
+    cvector_push_back(analyses->cfg, node);
+  }
+
+  for (size_t local = 0; local < block_count; local++) {
+    rs_cfg_node_t *node = &analyses->cfg[local];
+    for (size_t i = 0; i < node->successor_count; i++) {
+      size_t successor = node->successors[i];
+      if (successor >= begin && successor < rs->window_end)
+        cvector_push_back(analyses->cfg[successor - begin].predecessors,
+                          begin + local);
+    }
+  }
+
+  analyses->valid |= RS_ANALYSIS_BIT(CFG);
+  rs_pass_end(rs, RS_PASS_COUNT + RS_ANALYSIS_CFG, timer);
+  return &analyses->cfg;
+}
+
+const rs_def_use_t *rs_get_def_use(rs_t *rs) {
+  bool up_to_date;
+  rs_analyses_t *analyses = cache(rs, RS_ANALYSIS_DEF_USE, &up_to_date);
+  if (!analyses || up_to_date)
+    return analyses ? &analyses->def_use : NULL;
+
+  rs_pass_timer_t timer = rs_pass_begin();
+  rs_compute_def_use(rs, &analyses->def_use);
+  analyses->valid |= RS_ANALYSIS_BIT(DEF_USE);
+  rs_pass_end(rs, RS_PASS_COUNT + RS_ANALYSIS_DEF_USE, timer);
+  return &analyses->def_use;
+}
+
+const rs_liveness_t *rs_get_liveness(rs_t *rs) {
+  bool up_to_date;
+  rs_analyses_t *analyses = cache(rs, RS_ANALYSIS_LIVENESS, &up_to_date);
+  if (!analyses || up_to_date)
+    return analyses ? &analyses->liveness : NULL;
+
+  rs_pass_timer_t timer = rs_pass_begin();
+  rs_liveness_free(&analyses->liveness);
+  rs_compute_liveness(rs, &analyses->liveness);
+  analyses->valid |= RS_ANALYSIS_BIT(LIVENESS);
+  rs_pass_end(rs, RS_PASS_COUNT + RS_ANALYSIS_LIVENESS, timer);
+  return &analyses->liveness;
+}
+
+const rs_pressure_t *rs_get_pressure(rs_t *rs) {
+  bool up_to_date;
+  rs_analyses_t *analyses = cache(rs, RS_ANALYSIS_PRESSURE, &up_to_date);
+  if (!analyses || up_to_date)
+    return analyses ? &analyses->pressure : NULL;
+
+  const rs_liveness_t *liveness = rs_get_liveness(rs);
+  if (!liveness)
+    return NULL;
+
+  rs_pass_timer_t timer = rs_pass_begin();
+  rs_pressure_free(&analyses->pressure);
+  bool computed = rs_compute_pressure(rs, liveness, &analyses->pressure);
+  rs_pass_end(rs, RS_PASS_COUNT + RS_ANALYSIS_PRESSURE, timer);
+  if (!computed)
+    return NULL;
+  analyses->valid |= RS_ANALYSIS_BIT(PRESSURE);
+  return &analyses->pressure;
+}
+
+// Walks up the dominator tree from both blocks until they meet.
+static size_t intersect(const size_t *idom, const size_t *order, size_t a,
+                        size_t b) {
+  while (a != b) {
+    while (order[a] < order[b])
+      a = idom[a];
+    while (order[b] < order[a])
+      b = idom[b];
+  }
+  return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm over reverse postorder.
+const size_t *rs_get_dominators(rs_t *rs) {
+  bool up_to_date;
+  rs_analyses_t *analyses = cache(rs, RS_ANALYSIS_DOMINATORS, &up_to_date);
+  if (!analyses || up_to_date)
+    return analyses ? analyses->idom : NULL;
+
+  const rs_cfg_t *cfg = rs_get_cfg(rs);
+  if (!cfg)
+    return NULL;
+
+  rs_pass_timer_t timer = rs_pass_begin();
+  size_t begin = rs->window_begin;
+  size_t block_count = cvector_size(*cfg);
+  size_t *postorder = rs_calloc(block_count + 1, sizeof(size_t));
+  size_t *order = rs_calloc(block_count + 1, sizeof(size_t));
+  size_t *stack = rs_calloc(block_count + 1, sizeof(size_t));
+  size_t *next_edge = rs_calloc(block_count + 1, sizeof(size_t));
+  bool *visited = rs_calloc(block_count + 1, sizeof(bool));
+  if (!postorder || !order || !stack || !next_edge || !visited) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to allocate dominator analysis\n");
+    free(postorder);
+    free(order);
+    free(stack);
+    free(next_edge);
+    free(visited);
+    return NULL;
+  }
+
+  // Number the reachable blocks in postorder with an explicit stack.
+  size_t reachable = 0, depth = 0;
+  if (block_count > 0) {
+    stack[depth++] = 0;
+    visited[0] = true;
+  }
+  while (depth > 0) {
+    size_t local = stack[depth - 1];
+    const rs_cfg_node_t *node = &(*cfg)[local];
+    if (next_edge[local] < node->successor_count) {
+      size_t successor = node->successors[next_edge[local]++];
+      if (successor < begin || successor >= rs->window_end ||
+          visited[successor - begin])
+        continue;
+      visited[successor - begin] = true;
+      stack[depth++] = successor - begin;
+      continue;
+    }
+    order[local] = reachable;
+    postorder[reachable++] = local;
+    depth--;
+  }
+
+  // Blocks are named by their local index, and the entry by itself until
+  // the end, so that `intersect` can climb to it.
+  size_t *idom = analyses->idom;
+  cvector_clear(idom);
+  for (size_t local = 0; local < block_count; local++)
+    cvector_push_back(idom, SIZE_MAX);
+  if (block_count > 0)
+    idom[0] = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = reachable; i-- > 0;) {
+      size_t local = postorder[i];
+      if (local == 0)
+        continue;
+
+      size_t new_idom = SIZE_MAX;
+      size_t *predecessor_it;
+      cvector_for_each_in(predecessor_it, (*cfg)[local].predecessors) {
+        size_t predecessor = *predecessor_it - begin;
+        if (idom[predecessor] == SIZE_MAX)
+          continue;
+        new_idom = new_idom == SIZE_MAX
+                       ? predecessor
+                       : intersect(idom, order, predecessor, new_idom);
+      }
+      if (idom[local] != new_idom) {
+        idom[local] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // Report block IDs, with none for the entry.
+  for (size_t local = 0; local < block_count; local++) {
+    if (idom[local] != SIZE_MAX)
+      idom[local] += begin;
+  }
+  if (block_count > 0)
+    idom[0] = SIZE_MAX;
+  analyses->idom = idom;
+
+  free(postorder);
+  free(order);
+  free(stack);
+  free(next_edge);
+  free(visited);
+  analyses->valid |= RS_ANALYSIS_BIT(DOMINATORS);
+  rs_pass_end(rs, RS_PASS_COUNT + RS_ANALYSIS_DOMINATORS, timer);
+  return analyses->idom;
+}
+
+static bool always(const rs_t *rs) {
+  (void)rs;
+  return true;
+}
+
+static bool optimizes(const rs_t *rs) { return rs->opt_level > RS_OPT_O0; }
+
+// x86-64 arithmetic takes memory and immediate operands and overwrites its
+// first operand.
+static bool optimizes_x86_64(const rs_t *rs) {
+  return optimizes(rs) && rs->target == RS_TARGET_X86_64_LINUX_NASM;
+}
+
+// Only graph coloring spills its way out of the pressure scheduling adds.
+static bool schedules(const rs_t *rs) {
+  return optimizes(rs) && rs->regalloc == RS_REGALLOC_GRAPH;
+}
+
+static bool uses_stack(const rs_t *rs) {
+  return rs->regalloc == RS_REGALLOC_STACK;
+}
+
+static bool uses_linear(const rs_t *rs) {
+  return rs->regalloc == RS_REGALLOC_LINEAR;
+}
+
+static bool uses_graph(const rs_t *rs) {
+  return rs->regalloc == RS_REGALLOC_GRAPH;
+}
+
+typedef struct {
+  rs_pass_id_t id;
+  void (*run)(rs_t *rs);
+  bool (*applies)(const rs_t *rs); // Whether the pass runs for a state.
+  unsigned changes;                // Analyses the pass invalidates.
+} pass_t;
+
+static const pass_t pipeline[] = {
+    {RS_PASS_FINALIZE, rs_finalize, always, 0},
+    // Address matching keeps the def-use counts it prunes with up to date.
+    {RS_PASS_MATCH_ADDRESSES, rs_match_addresses, optimizes,
+     RS_ANALYSIS_BIT(LIVENESS)},
+    {RS_PASS_FOLD_OPERANDS, rs_fold_operands, optimizes_x86_64,
+     RS_ANALYSIS_BIT(DEF_USE) | RS_ANALYSIS_BIT(LIVENESS)},
+    {RS_PASS_SCHEDULE, rs_schedule, schedules,
+     RS_ANALYSIS_BIT(DEF_USE) | RS_ANALYSIS_BIT(PRESSURE)},
+    {RS_PASS_TIE_TWO_ADDRESS, rs_tie_two_address, optimizes_x86_64, 0},
+    {RS_PASS_ASSIGN_STACK_SLOTS, rs_assign_stack_slots, uses_stack,
+     RS_ANALYSIS_BIT(DEF_USE) | RS_ANALYSIS_BIT(LIVENESS)},
+    // Falls back to graph coloring, which rewrites spills, when registers run
+    // out.
+    {RS_PASS_ANALYZE_LIFETIMES, rs_analyze_lifetimes, uses_linear,
+     RS_ANALYSIS_BIT(DEF_USE) | RS_ANALYSIS_BIT(LIVENESS)},
+    {RS_PASS_COLOR_REGISTERS, rs_color_registers, uses_graph,
+     RS_ANALYSIS_BIT(DEF_USE) | RS_ANALYSIS_BIT(LIVENESS)},
+};
+
+bool rs_run_passes(rs_t *rs) {
+  rs_invalidate_analyses(rs, RS_ANALYSIS_ALL);
+  rs_alloc_report_begin(rs);
+  rs->failed = false;
+
+  for (size_t i = 0; i < sizeof(pipeline) / sizeof(pipeline[0]); i++) {
+    const pass_t *pass = &pipeline[i];
+    if (!pass->applies(rs))
+      continue;
+
+    rs_pass_timer_t timer = rs_pass_begin();
+    pass->run(rs);
+    rs_invalidate_analyses(rs, pass->changes);
+    rs_pass_end(rs, pass->id, timer);
+    if (rs->failed)
+      return false;
+  }
+  rs_alloc_report_end(rs);
+  debug_log("Ran passes over blocks %zu to %zu", rs->window_begin,
+            rs->window_end);
+  return true;
+}
@@ -0,0 +1,122 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <inttypes.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+/** Longest profile line, symbol included. */
+#define RS_PROFILE_LINE 512
+
+void rs_instrument_blocks(rs_t *rs, uint64_t *counters, size_t count,
+                          bool atomic) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  rs->block_counters = counters;
+  rs->block_counter_count = counters ? count : 0;
+  rs->atomic_counters = atomic;
+}
+
+void rs_render_block_counter(rs_t *rs, size_t block_id, rs_minstrs_t *out) {
+  if (!rs->block_counters || block_id >= rs->block_counter_count)
+    return;
+
+  const rs_isel_t *isel = rs_get_isel(rs->target);
+  rs_instr_t instr = {RS_OPCODE_MOVE, RS_OPERAND_NULL,
+                      RS_OPERAND_INT64(
+                          (int64_t)(uintptr_t)&rs->block_counters[block_id]),
+                      RS_OPERAND_NULL, RS_OPERAND_NULL};
+  rs_render_template(rs,
+                     rs->atomic_counters ? isel->atomic_counter
+                                         : isel->counter,
+                     &instr, 1, out);
+}
+
+bool rs_write_profile(const rs_t *rs, FILE *fp) {
+  if (!rs || !fp || !rs->block_counters) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                    "NULL Runestone state, file or block counters\n");
+    return false;
+  }
+
+  size_t count = cvector_size(rs->basic_blocks);
+  if (count > rs->block_counter_count)
+    count = rs->block_counter_count;
+  const char *symbol = rs_get_symbol(rs);
+  for (size_t block_id = 0; block_id < count; block_id++)
+    fprintf(fp, "%s %zu %" PRIu64 "\n", symbol, block_id,
+            rs->block_counters[block_id]);
+  return !ferror(fp);
+}
+
+bool rs_load_profile(rs_t *rs, FILE *fp) {
+  if (!rs || !fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state or file\n");
+    return false;
+  }
+
+  cvector_free(rs->block_frequencies);
+  rs->block_frequencies = NULL;
+
+  const char *symbol = rs_get_symbol(rs);
+  size_t symbol_length = strlen(symbol), records = 0;
+  char line[RS_PROFILE_LINE];
+  for (size_t number = 1; fgets(line, sizeof(line), fp); number++) {
+    size_t block_id;
+    uint64_t count;
+    int consumed = 0;
+    const char *fields = strchr(line, ' ');
+    if (!fields ||
+        sscanf(fields, " %zu %" SCNu64 " %n", &block_id, &count, &consumed) <
+            2 ||
+        fields[consumed] != '\0') {
+      fprintf(stderr,
+              RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                         "Malformed profile line %zu\n",
+              number);
+      cvector_free(rs->block_frequencies);
+      rs->block_frequencies = NULL;
+      return false;
+    }
+
+    // Other functions may share the file.
+    if ((size_t)(fields - line) != symbol_length ||
+        strncmp(line, symbol, symbol_length) != 0)
+      continue;
+
+    size_t block_count = cvector_size(rs->basic_blocks);
+    if (block_id >= block_count) {
+      fprintf(stderr,
+              RS_COLOR_RED RS_COLOR_BOLD
+              "Error: " RS_COLOR_RESET
+              "Malformed profile line %zu: block %zu of %zu\n",
+              number, block_id, block_count);
+      cvector_free(rs->block_frequencies);
+      rs->block_frequencies = NULL;
+      return false;
+    }
+
+    if (!rs->block_frequencies) {
+      cvector_reserve(rs->block_frequencies, block_count);
+      cvector_resize(rs->block_frequencies, block_count, 0);
+    }
+    rs->block_frequencies[block_id] = count;
+    records++;
+  }
+
+  debug_log("Loaded %zu block frequencies of '%s'", records, symbol);
+  return !ferror(fp);
+}
+
+uint64_t rs_get_block_frequency(const rs_t *rs, size_t block_id) {
+  if (!rs->block_frequencies)
+    return 1;
+  return block_id < cvector_size(rs->block_frequencies)
+             ? rs->block_frequencies[block_id]
+             : 0;
+}
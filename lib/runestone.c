@@ -4,6 +4,7 @@
 #include "cvector_utils.h"
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,11 +18,13 @@ void rs_set_debug(bool enabled, FILE *stream) {
   debug_stream = stream ? stream : stderr;
 }
 
-#define debug_log(...) _debug_log(__FILE__, __LINE__, __VA_ARGS__)
-static void _debug_log(const char *file, int line, const char *format, ...) {
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+void rs_debug_log(const char *file, int line, const char *format, ...) {
   if (!debug_enabled || !debug_stream)
     return;
 
+  flockfile(debug_stream);
   fprintf(debug_stream,
           RS_COLOR_BOLD "%s:%d: " RS_COLOR_CYAN "Debug: " RS_COLOR_RESET, file,
           line);
@@ -30,10 +33,10 @@ static void _debug_log(const char *file, int line, const char *format, ...) {
   vfprintf(debug_stream, format, args);
   va_end(args);
   fprintf(debug_stream, "\n");
-  fflush(debug_stream);
+  funlockfile(debug_stream);
 }
 
-static void free_basic_block(void *ptr) {
+void rs_free_basic_block(void *ptr) {
   if (!ptr)
     return;
 
@@ -67,7 +70,7 @@ void rs_init(rs_t *rs, rs_target_t target) {
   rs->target = target;
 
   rs->basic_blocks = NULL;
-  cvector_init(rs->basic_blocks, RS_MAX_BB, free_basic_block);
+  cvector_init(rs->basic_blocks, RS_MAX_BB, rs_free_basic_block);
   rs->current_basic_block = -1;
 
   for (size_t i = 0; i < RS_MAX_REGS; i++)
@@ -84,6 +87,26 @@ void rs_init(rs_t *rs, rs_target_t target) {
   rs_regmap_init(&rs->register_map);
   rs->stack_size = 0;
   rs->next_dst_vreg = 0;
+  rs->regalloc = RS_REGALLOC_LINEAR;
+  rs->opt_level = RS_OPT_O1;
+  rs->verbosity = RS_VERBOSITY_IR;
+  rs->emit_threads = 1;
+  rs->window_begin = rs->window_end = 0;
+  rs->stream = NULL;
+  rs->symbol = NULL;
+  rs->param_count = 0;
+  memset(rs->tied, RS_INVALID_VREG, sizeof(rs->tied));
+  memset(&rs->pressure_stats, 0, sizeof(rs->pressure_stats));
+  rs->trace = (rs_trace_t){.events = NULL, .capacity = 0, .recorded = 0};
+  rs->analyses = NULL;
+  rs->failed = false;
+  rs_reset_pass_stats(rs);
+  rs->alloc_report = false;
+  rs->alloc_reports = NULL;
+  rs->block_counters = NULL;
+  rs->block_counter_count = 0;
+  rs->atomic_counters = false;
+  rs->block_frequencies = NULL;
 }
 
 void rs_free(rs_t *rs) {
@@ -93,9 +116,73 @@ void rs_free(rs_t *rs) {
   cvector_free(rs->basic_blocks);
   cvector_free(rs->register_pool);
   rs_regmap_free(&rs->register_map);
+  free(rs->trace.events);
+  rs_free_analyses(rs);
+  cvector_free(rs->alloc_reports);
+  cvector_free(rs->block_frequencies);
   memset(rs, 0, sizeof(rs_t));
 }
 
+void rs_set_regalloc(rs_t *rs, rs_regalloc_t regalloc) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  static const char *names[] = {"linear", "graph", "stack"};
+  if ((size_t)regalloc >= sizeof(names) / sizeof(names[0])) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Invalid register allocator %d\n",
+            regalloc);
+    return;
+  }
+  debug_log("Using %s register allocator", names[regalloc]);
+  rs->regalloc = regalloc;
+}
+
+void rs_set_opt_level(rs_t *rs, rs_opt_level_t level) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  static const rs_regalloc_t regallocs[] = {
+      RS_REGALLOC_STACK, RS_REGALLOC_LINEAR, RS_REGALLOC_GRAPH};
+  if ((size_t)level >= sizeof(regallocs) / sizeof(regallocs[0])) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Invalid optimization level %d\n",
+            level);
+    return;
+  }
+  debug_log("Optimizing at O%d", level);
+  rs->opt_level = level;
+  rs_set_regalloc(rs, regallocs[level]);
+}
+
+void rs_set_verbosity(rs_t *rs, rs_verbosity_t verbosity) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  rs->verbosity = verbosity;
+}
+
+void rs_set_emit_threads(rs_t *rs, size_t threads) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  rs->emit_threads = threads;
+}
+
 size_t rs_append_basic_block(rs_t *rs, const char *name) {
   if (!rs) {
     fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
@@ -103,7 +190,7 @@ size_t rs_append_basic_block(rs_t *rs, const char *name) {
     return SIZE_MAX;
   }
 
-  rs_basic_block_t *bb = calloc(1, sizeof(rs_basic_block_t));
+  rs_basic_block_t *bb = rs_calloc(1, sizeof(rs_basic_block_t));
   if (!bb) {
     fprintf(stderr, "Failed to allocate memory for basic block: %s\n",
             strerror(errno));
@@ -131,9 +218,16 @@ size_t rs_append_basic_block(rs_t *rs, const char *name) {
 
   debug_log("Appending basic block '%s'", bb->name);
   cvector_push_back(rs->basic_blocks, bb);
+  // Streaming advances the window as blocks are flushed instead.
+  if (!rs->stream)
+    rs->window_end = cvector_size(rs->basic_blocks);
   return cvector_size(rs->basic_blocks) - 1;
 }
 
+const char *rs_get_symbol(const rs_t *rs) {
+  return rs->symbol ? rs->symbol : "_start";
+}
+
 void rs_position_at_basic_block(rs_t *rs, size_t block_id) {
   if (!rs) {
     fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
@@ -169,7 +263,11 @@ static bool is_valid_operand(rs_t *rs, rs_operand_t operand) {
     return rs && operand.bb_id < cvector_size(rs->basic_blocks);
   case RS_OPERAND_TYPE_INT64:
   case RS_OPERAND_TYPE_ADDR:
+  case RS_OPERAND_TYPE_SLOT:
+  case RS_OPERAND_TYPE_MEM:
     return true;
+  case RS_OPERAND_TYPE_SYM:
+    return operand.symbol != NULL;
   default:
     return false;
   }
@@ -205,6 +303,14 @@ void rs_build_instr(rs_t *rs, rs_instr_t instr) {
     return;
   }
 
+  if (bb->sealed) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Basic block '%s' is already sealed\n",
+            bb->name);
+    return;
+  }
+
   if (!is_valid_operand(rs, instr.dest) || !is_valid_operand(rs, instr.src1) ||
       !is_valid_operand(rs, instr.src2) || !is_valid_operand(rs, instr.src3)) {
     fprintf(stderr,
@@ -214,7 +320,7 @@ void rs_build_instr(rs_t *rs, rs_instr_t instr) {
     return;
   }
 
-  debug_log("Building instruction %s in block '%s'",
+  trace_log("Building instruction %s in block '%s'",
             rs_opcode_to_str(instr.opcode), bb->name);
   cvector_push_back(bb->instructions, instr);
 }
@@ -311,153 +417,49 @@ rs_operand_t rs_build_cmp_gt(rs_t *rs, rs_operand_t src1, rs_operand_t src2) {
   return dst;
 }
 
-bool rs_instr_is_terminator(rs_instr_t instr) {
-  return instr.opcode == RS_OPCODE_RET || instr.opcode == RS_OPCODE_BR ||
-         instr.opcode == RS_OPCODE_BR_IF;
-}
-
-// Add register allocation hints based on instruction type
-static rs_register_t rs_get_preferred_register(rs_t *rs, rs_opcode_t opcode) {
-  if (!rs)
-    return RS_REG_SPILL;
-
-  // Prefer specific registers for certain operations
-  switch (opcode) {
-  case RS_OPCODE_ADD:
-  case RS_OPCODE_SUB:
-  case RS_OPCODE_MULT:
-  case RS_OPCODE_DIV:
-    // Prefer registers that are good for arithmetic
-    for (size_t i = 0; i < rs_get_register_count(rs->target); i++) {
-      if (!is_valid_register(rs, i))
-        continue;
-      if (!rs->register_pool[i])
-        return i;
-    }
-    break;
-
-  case RS_OPCODE_LOAD:
-  case RS_OPCODE_STORE:
-    // Prefer registers that are good for memory operations
-    for (size_t i = rs_get_register_count(rs->target) - 1; i >= 0; i--) {
-      if (!is_valid_register(rs, i))
-        continue;
-      if (!rs->register_pool[i])
-        return i;
-    }
-    break;
-
-  default:
-    break;
-  }
-  return RS_REG_SPILL;
+rs_operand_t rs_build_call(rs_t *rs, rs_operand_t callee, rs_operand_t arg1,
+                           rs_operand_t arg2) {
+  rs_operand_t dst = RS_OPERAND_REG(rs->next_dst_vreg++);
+  rs_build_instr(rs, (rs_instr_t){RS_OPCODE_CALL, dst, callee, arg1, arg2});
+  return dst;
 }
 
-typedef struct {
-  size_t pressure;       // Current register pressure
-  size_t max_pressure;   // Maximum register pressure seen
-  size_t spill_count;    // Number of spills performed
-  size_t coalesce_count; // Number of coalescing opportunities found
-} rs_pressure_stats_t;
-
-static rs_pressure_stats_t pressure_stats = {0};
-
-static void rs_track_register_pressure(rs_t *rs, rs_basic_block_t *bb) {
-  if (!rs || !bb)
-    return;
-
-  size_t current_pressure = 0;
-  size_t max_pressure = 0;
-
-  // First pass: calculate pressure
-  for (size_t i = 0; i < cvector_size(bb->instructions); i++) {
-    // Count live registers at this point
-    for (size_t j = 0; j < RS_MAX_REGS; j++) {
-      rs_lifetime_t *lifetime = &rs->lifetimes[j];
-      if (lifetime->start != -1 && lifetime->end != -1 &&
-          (size_t)lifetime->start <= i && (size_t)lifetime->end > i) {
-        current_pressure++;
-      }
-    }
-
-    if (current_pressure > max_pressure) {
-      max_pressure = current_pressure;
-    }
-  }
-
-  pressure_stats.pressure = current_pressure;
-  if (max_pressure > pressure_stats.max_pressure) {
-    pressure_stats.max_pressure = max_pressure;
+rs_operand_t rs_build_param(rs_t *rs, size_t index) {
+  if (index >= RS_MAX_PARAMS) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Parameter %zu out of bounds (max: %d)\n",
+            index, RS_MAX_PARAMS - 1);
+    return RS_OPERAND_NULL;
   }
 
-  debug_log("Block '%s' pressure: current=%zu, max=%zu", bb->name,
-            current_pressure, max_pressure);
+  if (rs->param_count < index + 1)
+    rs->param_count = index + 1;
+  rs_operand_t dst = RS_OPERAND_REG(rs->next_dst_vreg++);
+  rs_build_instr(rs, (rs_instr_t){RS_OPCODE_PARAM, dst, RS_OPERAND_SLOT(index),
+                                  RS_OPERAND_NULL, RS_OPERAND_NULL});
+  return dst;
 }
 
-// Check if two virtual registers can be coalesced
-static bool rs_can_coalesce(rs_t *rs, size_t vreg1, size_t vreg2) {
-  if (!rs || vreg1 >= RS_MAX_REGS || vreg2 >= RS_MAX_REGS)
-    return false;
-
-  rs_lifetime_t *lifetime1 = &rs->lifetimes[vreg1];
-  rs_lifetime_t *lifetime2 = &rs->lifetimes[vreg2];
-
-  // Check if lifetimes overlap
-  if (lifetime1->start == -1 || lifetime1->end == -1 ||
-      lifetime2->start == -1 || lifetime2->end == -1) {
-    return false;
-  }
-
-  // If lifetimes don't overlap, we can coalesce
-  return (lifetime1->end <= lifetime2->start) ||
-         (lifetime2->end <= lifetime1->start);
+bool rs_instr_is_terminator(rs_instr_t instr) {
+  return instr.opcode == RS_OPCODE_RET || instr.opcode == RS_OPCODE_BR ||
+         instr.opcode == RS_OPCODE_BR_IF;
 }
 
-// Try to coalesce registers
-static void rs_try_coalesce(rs_t *rs, rs_basic_block_t *bb) {
-  if (!rs || !bb)
+static void rs_track_register_pressure(rs_t *rs,
+                                       const rs_pressure_t *pressure,
+                                       size_t block_id) {
+  if (!rs || !pressure)
     return;
 
-  for (size_t i = 0; i < cvector_size(bb->instructions); i++) {
-    rs_instr_t instr = bb->instructions[i];
-
-    // Look for move instructions that can be coalesced
-    if (instr.opcode == RS_OPCODE_MOVE &&
-        instr.dest.type == RS_OPERAND_TYPE_REG &&
-        instr.src1.type == RS_OPERAND_TYPE_REG) {
-
-      size_t dest_vreg = instr.dest.vreg;
-      size_t src_vreg = instr.src1.vreg;
-
-      if (rs_can_coalesce(rs, dest_vreg, src_vreg)) {
-        // Coalesce the registers
-        rs_lifetime_t *dest_lifetime = &rs->lifetimes[dest_vreg];
-        rs_lifetime_t *src_lifetime = &rs->lifetimes[src_vreg];
-
-        // Merge lifetimes
-        dest_lifetime->start = (dest_lifetime->start < src_lifetime->start)
-                                   ? dest_lifetime->start
-                                   : src_lifetime->start;
-        dest_lifetime->end = (dest_lifetime->end > src_lifetime->end)
-                                 ? dest_lifetime->end
-                                 : src_lifetime->end;
-
-        // Use the same physical register
-        if (src_lifetime->reg != RS_REG_SPILL) {
-          dest_lifetime->reg = src_lifetime->reg;
-          rs->register_pool[src_lifetime->reg] = true;
-        }
-
-        // Clear source lifetime
-        src_lifetime->start = -1;
-        src_lifetime->end = -1;
-        src_lifetime->reg = RS_REG_SPILL;
-
-        pressure_stats.coalesce_count++;
-        debug_log("Coalesced registers %zu and %zu", dest_vreg, src_vreg);
-      }
-    }
+  size_t max_pressure =
+      rs_pressure_block_max(pressure, block_id - rs->window_begin);
+  if (max_pressure > rs->pressure_stats.max_pressure) {
+    rs->pressure_stats.max_pressure = max_pressure;
   }
+
+  debug_log("Block '%s' pressure: max=%zu",
+            rs->basic_blocks[block_id]->name, max_pressure);
 }
 
 static rs_register_t rs_allocate_register(rs_t *rs) {
@@ -467,14 +469,7 @@ static rs_register_t rs_allocate_register(rs_t *rs) {
     return RS_REG_SPILL;
   }
 
-  // Check if we're under pressure
-  size_t reg_count = rs_get_register_count(rs->target);
-  if (pressure_stats.pressure >= reg_count * 0.8) { // 80% threshold
-    debug_log("High register pressure detected: %zu/%zu",
-              pressure_stats.pressure, reg_count);
-  }
-
-  // First try to find a completely free register
+  // Find a register no value has been given yet
   rs_register_t reg = rs_get_free_register(rs);
   if (reg != RS_REG_SPILL) {
     if (!is_valid_register(rs, reg)) {
@@ -484,95 +479,17 @@ static rs_register_t rs_allocate_register(rs_t *rs) {
               reg);
       return RS_REG_SPILL;
     }
-    debug_log("Found free register %d", reg);
+    trace_log("Found free register %d", reg);
     rs->register_pool[reg] = true;
     return reg;
   }
 
-  // If no free registers, try to find a register whose lifetime has ended
-  static size_t last_checked_reg = 0;
-  size_t start_reg = last_checked_reg;
-
-  do {
-    if (!is_valid_register(rs, last_checked_reg))
-      continue;
-
-    bool is_used = false;
-    for (size_t j = 0; j < RS_MAX_REGS; j++) {
-      rs_lifetime_t *lifetime = &rs->lifetimes[j];
-      if (lifetime->start != -1 && lifetime->end != -1 &&
-          lifetime->reg == last_checked_reg &&
-          lifetime->end > lifetime->start) {
-        is_used = true;
-        break;
-      }
-    }
-    if (!is_used) {
-      debug_log("Reusing register %zu", last_checked_reg);
-      rs->register_pool[last_checked_reg] = true;
-      return last_checked_reg;
-    }
-
-    last_checked_reg = (last_checked_reg + 1) % reg_count;
-  } while (last_checked_reg != start_reg);
-
-  // If still no registers available, try to spill the least recently used
-  // register
-  size_t lru_reg = 0;
-  ptrdiff_t lru_end = -1;
-
-  for (size_t i = 0; i < reg_count; i++) {
-    if (!is_valid_register(rs, i))
-      continue;
-
-    for (size_t j = 0; j < RS_MAX_REGS; j++) {
-      rs_lifetime_t *lifetime = &rs->lifetimes[j];
-      if (lifetime->start != -1 && lifetime->end != -1 && lifetime->reg == i &&
-          lifetime->end > lru_end) {
-        lru_reg = i;
-        lru_end = lifetime->end;
-      }
-    }
-  }
-
-  if (lru_end > 0) {
-    debug_log("Spilling register %zu", lru_reg);
-    rs->register_pool[lru_reg] = true;
-    pressure_stats.spill_count++;
-    return lru_reg;
-  }
-
-  fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
-          "Error: " RS_COLOR_RESET "No registers available for allocation\n");
+  // Every register in the pool holds a live value, and handing one out would
+  // clobber it.
+  debug_log("No registers available for allocation");
   return RS_REG_SPILL;
 }
 
-static void rs_free_register(rs_t *rs, rs_register_t reg) {
-  if (!rs) {
-    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
-            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
-    return;
-  }
-
-  if (!is_valid_register(rs, reg)) {
-    fprintf(stderr,
-            RS_COLOR_RED RS_COLOR_BOLD
-            "Error: " RS_COLOR_RESET "Attempting to free invalid register %d\n",
-            reg);
-    return;
-  }
-
-  // Check if register is actually allocated
-  if (!rs->register_pool[reg]) {
-    fprintf(stderr, "Warning: Attempting to free unallocated register %d\n",
-            reg);
-    return;
-  }
-
-  rs->register_pool[reg] = false;
-  debug_log("Freed register %d", reg);
-}
-
 rs_register_t rs_get_free_register(rs_t *rs) {
   if (!rs) {
     fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
@@ -584,7 +501,7 @@ rs_register_t rs_get_free_register(rs_t *rs) {
     if (!is_valid_register(rs, i))
       continue;
     if (!rs->register_pool[i]) {
-      debug_log("Found free register %zu", i);
+      trace_log("Found free register %zu", i);
       return i;
     }
   }
@@ -609,7 +526,7 @@ rs_register_t rs_get_register(rs_t *rs, size_t vreg) {
 
   if (rs_regmap_contains(&rs->register_map, vreg)) {
     rs_register_t reg = rs_regmap_get(&rs->register_map, vreg);
-    debug_log("Found existing mapping for vreg %zu -> preg %d", vreg, reg);
+    trace_log("Found existing mapping for vreg %zu -> preg %d", vreg, reg);
     return reg;
   }
 
@@ -624,13 +541,13 @@ rs_register_t rs_get_register(rs_t *rs, size_t vreg) {
   }
 
   rs_regmap_insert(&rs->register_map, vreg, reg);
-  debug_log("Created new mapping for vreg %zu -> preg %d", vreg, reg);
+  trace_log("Created new mapping for vreg %zu -> preg %d", vreg, reg);
   return reg;
 }
 
 size_t rs_get_register_count(rs_target_t target) {
   switch (target) {
-#define RS_TARGET(_, upper, count, ...)                                        \
+#define RS_TARGET(_, upper, count)                                             \
   case RS_TARGET_##upper:                                                      \
     return count;
     RS_TARGETS
@@ -654,98 +571,180 @@ const char **rs_get_register_names(rs_target_t target) {
   }
 }
 
-static void rs_alloc_and_free_lifetimes(rs_t *rs, rs_basic_block_t *block) {
-  if (!rs || !block) {
-    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
-            "Error: " RS_COLOR_RESET
-            "Invalid parameters for lifetime analysis\n");
+// A span of positions over which a virtual register holds a value. Every
+// instruction has two positions, the first where it reads its sources and the
+// second where it writes its result.
+typedef struct {
+  size_t start;
+  size_t end;
+} rs_live_range_t;
+
+typedef cvector(rs_live_range_t) rs_live_ranges_t;
+
+// Adds [start, end) to ranges built back to front, merging it into the last
+// one added when they touch.
+static void rs_add_live_range(rs_live_ranges_t *ranges, size_t start,
+                              size_t end) {
+  size_t count = cvector_size(*ranges);
+  if (count > 0 && end >= (*ranges)[count - 1].start) {
+    if (start < (*ranges)[count - 1].start)
+      (*ranges)[count - 1].start = start;
     return;
   }
+  rs_live_range_t range = {start, end};
+  cvector_push_back(*ranges, range);
+}
 
-  debug_log("Analyzing lifetimes in block '%s'", block->name);
+// Builds the live ranges of every register in the window, walking the blocks
+// and their instructions backwards from what is live out of each. A register
+// reused for unrelated values gets a hole between them, so the values do not
+// pin a register in between. A tied source that dies is read before its
+// destination is written and may share its register.
+static bool rs_build_live_ranges(rs_t *rs, rs_live_ranges_t *ranges) {
+  const rs_liveness_t *liveness = rs_get_liveness(rs);
+  if (!liveness) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to compute liveness\n");
+    return false;
+  }
 
-  for (size_t ip = 0; ip < cvector_size(block->instructions); ip++) {
-    // First free registers that are no longer needed
-    for (size_t lifetime_index = 0; lifetime_index < RS_MAX_REGS;
-         lifetime_index++) {
-      rs_lifetime_t *lifetime = &rs->lifetimes[lifetime_index];
-      if (lifetime->start == -1 || lifetime->end == -1)
-        continue;
+  size_t end = 0;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++)
+    end += cvector_size(rs->basic_blocks[block_id]->instructions);
 
-      if ((size_t)lifetime->end == ip) {
-        rs_free_register(rs, lifetime->reg);
-        debug_log("Freed register %d for vreg %zu at instruction %zu",
-                  lifetime->reg, lifetime_index, ip);
+  // End of the range being built for each register, or SIZE_MAX.
+  size_t open[RS_MAX_REGS];
+  for (size_t block_id = rs->window_end; block_id-- > rs->window_begin;) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    size_t local = block_id - rs->window_begin;
+    size_t count = cvector_size(bb->instructions);
+    size_t base = end - count;
+    for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++)
+      open[vreg] = rs_regset_contains(&liveness->live_out[local], vreg)
+                       ? 2 * end
+                       : SIZE_MAX;
+
+    for (size_t i = count; i-- > 0;) {
+      rs_instr_t instr = bb->instructions[i];
+      size_t write = 2 * (base + i) + 1;
+      uint8_t def;
+      bool has_def = rs_instr_def(instr, &def);
+      if (has_def) {
+        rs_add_live_range(&ranges[def], write,
+                          open[def] != SIZE_MAX ? open[def] : write + 1);
+        open[def] = SIZE_MAX;
       }
-    }
 
-    // Then allocate registers for new values
-    for (size_t lifetime_index = 0; lifetime_index < RS_MAX_REGS;
-         lifetime_index++) {
-      rs_lifetime_t *lifetime = &rs->lifetimes[lifetime_index];
-      if (lifetime->start == -1 || lifetime->end == -1)
-        continue;
-
-      if ((size_t)lifetime->start == ip) {
-        rs_register_t reg = rs_get_register(rs, lifetime->vreg);
-        if (reg == RS_REG_SPILL) {
-          fprintf(stderr,
-                  RS_COLOR_RED RS_COLOR_BOLD
-                  "Error: " RS_COLOR_RESET
-                  "Register allocation failed for vreg %zu at "
-                  "instruction %zu\n",
-                  lifetime_index, ip);
-          return;
-        }
+      uint8_t uses[RS_INSTR_MAX_USES];
+      size_t use_count = rs_instr_uses(instr, uses);
+      for (size_t u = 0; u < use_count; u++) {
+        if (open[uses[u]] != SIZE_MAX)
+          continue;
+        bool tied = has_def && rs_opcode_is_two_address(instr.opcode) &&
+                    instr.src1.type == RS_OPERAND_TYPE_REG &&
+                    instr.src1.vreg == uses[u] && rs->tied[def] == uses[u];
+        open[uses[u]] = tied ? write : write + 1;
+      }
 
-        rs_regmap_insert(&rs->register_map, lifetime_index, reg);
-        lifetime->reg = reg;
-        debug_log("Allocated register %d for vreg %zu at instruction %zu", reg,
-                  lifetime_index, ip);
+      // The temporary is scratch for its instruction alone.
+      rs_operand_t operands[] = {instr.dest, instr.src1, instr.src2,
+                                 instr.src3};
+      for (size_t o = 0; o < 4; o++) {
+        if (operands[o].type == RS_OPERAND_TYPE_REG &&
+            operands[o].vreg == RS_TEMPORARY_VREG) {
+          rs_add_live_range(&ranges[RS_TEMPORARY_VREG], write - 1, write + 1);
+          break;
+        }
       }
     }
+
+    for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++) {
+      if (open[vreg] != SIZE_MAX)
+        rs_add_live_range(&ranges[vreg], 2 * base, open[vreg]);
+    }
+    end = base;
   }
-}
 
-static void rs_analyze_operand(rs_t *rs, size_t i, rs_operand_t operand,
-                               rs_opcode_t opcode) {
-  if (!rs) {
-    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
-            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
-    return;
+  for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++) {
+    size_t count = cvector_size(ranges[vreg]);
+    for (size_t i = 0; i < count / 2; i++) {
+      rs_live_range_t range = ranges[vreg][i];
+      ranges[vreg][i] = ranges[vreg][count - 1 - i];
+      ranges[vreg][count - 1 - i] = range;
+    }
   }
+  return true;
+}
 
-  if (operand.type != RS_OPERAND_TYPE_REG)
-    return;
+// Whether two sorted lists of disjoint ranges share a position. `taken` is
+// searched for the first range that can overlap, since it holds every value
+// of a register and is usually much longer.
+static bool rs_live_ranges_intersect(const rs_live_ranges_t ranges,
+                                     const rs_live_ranges_t taken) {
+  size_t count = cvector_size(ranges), taken_count = cvector_size(taken);
+  if (count == 0)
+    return false;
 
-  if ((uint16_t)operand.vreg >= (uint16_t)RS_MAX_REGS) {
-    fprintf(stderr,
-            RS_COLOR_RED RS_COLOR_BOLD
-            "Error: " RS_COLOR_RESET
-            "Virtual register %d out of bounds (max: %d)\n",
-            operand.vreg, RS_MAX_REGS - 1);
-    return;
+  size_t lo = 0, hi = taken_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (taken[mid].end <= ranges[0].start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (size_t i = 0, j = lo; i < count && j < taken_count;) {
+    if (ranges[i].end <= taken[j].start)
+      i++;
+    else if (taken[j].end <= ranges[i].start)
+      j++;
+    else
+      return true;
   }
+  return false;
+}
 
-  rs_lifetime_t *lifetime = &rs->lifetimes[operand.vreg];
-  lifetime->vreg = operand.vreg;
-
-  // Optimize lifetime tracking by only updating when necessary
-  if (lifetime->start == -1) {
-    lifetime->start = i;
-    // Try to get a preferred register based on the operation
-    rs_register_t preferred_reg = rs_get_preferred_register(rs, opcode);
-    if (preferred_reg != RS_REG_SPILL) {
-      lifetime->reg = preferred_reg;
-      rs->register_pool[preferred_reg] = true;
+// Merges `ranges` into the sorted, disjoint ranges of `taken`, using
+// `scratch` for the result.
+static void rs_take_live_ranges(rs_live_ranges_t *taken,
+                                const rs_live_ranges_t ranges,
+                                rs_live_ranges_t *scratch) {
+  cvector_clear(*scratch);
+  size_t count = cvector_size(ranges), taken_count = cvector_size(*taken);
+  for (size_t i = 0, j = 0; i < count || j < taken_count;) {
+    rs_live_range_t next;
+    if (j == taken_count ||
+        (i < count && ranges[i].start < (*taken)[j].start))
+      next = ranges[i++];
+    else
+      next = (*taken)[j++];
+
+    size_t size = cvector_size(*scratch);
+    if (size > 0 && next.start <= (*scratch)[size - 1].end) {
+      if (next.end > (*scratch)[size - 1].end)
+        (*scratch)[size - 1].end = next.end;
+    } else {
+      cvector_push_back(*scratch, next);
     }
   }
-  if ((ptrdiff_t)(i + 1) > lifetime->end) {
-    lifetime->end = i + 1;
-  }
 
-  debug_log("Updated lifetime for vreg %d: start=%d, end=%d", operand.vreg,
-            lifetime->start, lifetime->end);
+  rs_live_ranges_t swap = *taken;
+  *taken = *scratch;
+  *scratch = swap;
+}
+
+typedef struct {
+  size_t start;
+  uint8_t vreg;
+} rs_live_order_t;
+
+static int rs_compare_live_order(const void *a, const void *b) {
+  const rs_live_order_t *x = a, *y = b;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return (x->vreg > y->vreg) - (x->vreg < y->vreg);
 }
 
 void rs_analyze_lifetimes(rs_t *rs) {
@@ -755,7 +754,15 @@ void rs_analyze_lifetimes(rs_t *rs) {
     return;
   }
 
-  memset(&pressure_stats, 0, sizeof(pressure_stats));
+  memset(&rs->pressure_stats, 0, sizeof(rs->pressure_stats));
+  rs->stack_size = rs->param_count * 8;
+  // Pressure only feeds the debug log, so skip the sweep unless someone looks.
+  const rs_pressure_t *pressure = NULL;
+  if (debug_enabled || rs->alloc_report || rs->trace.events)
+    pressure = rs_get_pressure(rs);
+  for (size_t block_id = rs->window_begin;
+       pressure && block_id < rs->window_end; block_id++)
+    rs_track_register_pressure(rs, pressure, block_id);
 
   memset(rs->lifetimes, 0, sizeof(rs->lifetimes));
   for (size_t i = 0; i < RS_MAX_REGS; i++) {
@@ -763,69 +770,93 @@ void rs_analyze_lifetimes(rs_t *rs) {
     rs->lifetimes[i].end = -1;
     rs->lifetimes[i].reg = RS_REG_SPILL;
   }
-
-  // Reset register pool using memset
   memset(rs->register_pool, 0, cvector_size(rs->register_pool) * sizeof(bool));
-
-  // Clear register map
   rs_regmap_free(&rs->register_map);
   rs_regmap_init(&rs->register_map);
 
   debug_log("Starting lifetime analysis");
 
-  // First pass: analyze all lifetimes
-  for (size_t block_id = 0; block_id < cvector_size(rs->basic_blocks);
-       block_id++) {
-    rs_basic_block_t *bb = rs->basic_blocks[block_id];
-    if (!bb) {
-      fprintf(stderr,
-              RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
-                                         "Invalid basic block at index %zu\n",
-              block_id);
-      continue;
-    }
-
-    debug_log("Analyzing lifetimes in block '%s'", bb->name);
-
-    // Process all instructions in the block
-    for (size_t i = 0; i < cvector_size(bb->instructions); i++) {
-      rs_instr_t instr = bb->instructions[i];
-
-      // Process all operands in a single loop
-      rs_operand_t operands[] = {instr.dest, instr.src1, instr.src2,
-                                 instr.src3};
-      for (size_t j = 0; j < 4; j++) {
-        if (operands[j].type == RS_OPERAND_TYPE_REG) {
-          rs_analyze_operand(rs, i, operands[j], instr.opcode);
-        }
-      }
-    }
-
-    rs_track_register_pressure(rs, bb);
+  size_t reg_count = rs_get_register_count(rs->target);
+  rs_live_ranges_t ranges[RS_MAX_REGS] = {NULL};
+  rs_live_ranges_t scratch = NULL;
+  rs_live_ranges_t *taken = rs_calloc(reg_count, sizeof(rs_live_ranges_t));
+  if (!taken) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                               "Out of memory\n");
+    rs->failed = true;
+    return;
   }
-
-  // Try to coalesce registers
-  for (size_t block_id = 0; block_id < cvector_size(rs->basic_blocks);
-       block_id++) {
-    rs_basic_block_t *bb = rs->basic_blocks[block_id];
-    if (!bb)
-      continue;
-    rs_try_coalesce(rs, bb);
+  if (!rs_build_live_ranges(rs, ranges)) {
+    rs->failed = true;
+    free(taken);
+    return;
   }
 
-  // Second pass: allocate registers
-  for (size_t block_id = 0; block_id < cvector_size(rs->basic_blocks);
-       block_id++) {
-    rs_basic_block_t *bb = rs->basic_blocks[block_id];
-    if (!bb)
-      continue;
-    rs_alloc_and_free_lifetimes(rs, bb);
+  // Scan the registers in the order their values start, giving each the
+  // register its tied source holds if that is free over all of its ranges,
+  // and otherwise the first one that is.
+  rs_live_order_t order[RS_MAX_REGS];
+  size_t order_count = 0;
+  for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++) {
+    if (cvector_size(ranges[vreg]) > 0)
+      order[order_count++] = (rs_live_order_t){ranges[vreg][0].start,
+                                               (uint8_t)vreg};
+  }
+  qsort(order, order_count, sizeof(order[0]), rs_compare_live_order);
+
+  bool allocated = true;
+  for (size_t n = 0; allocated && n < order_count; n++) {
+    uint8_t vreg = order[n].vreg;
+    rs_register_t reg = RS_REG_SPILL;
+    uint8_t tied = rs->tied[vreg];
+    if (tied != RS_INVALID_VREG &&
+        rs_regmap_contains(&rs->register_map, tied) &&
+        !rs_live_ranges_intersect(
+            ranges[vreg], taken[rs_regmap_get(&rs->register_map, tied)])) {
+      reg = rs_regmap_get(&rs->register_map, tied);
+      rs->pressure_stats.coalesce_count++;
+    }
+    for (size_t r = 0; reg == RS_REG_SPILL && r < reg_count; r++) {
+      if (!rs_live_ranges_intersect(ranges[vreg], taken[r]))
+        reg = (rs_register_t)r;
+    }
+    if (reg == RS_REG_SPILL) {
+      debug_log("Out of registers for vreg %d", vreg);
+      allocated = false;
+      break;
+    }
+
+    rs_take_live_ranges(&taken[reg], ranges[vreg], &scratch);
+    rs_regmap_insert(&rs->register_map, vreg, reg);
+    rs->register_pool[reg] = true;
+    rs_lifetime_t *lifetime = &rs->lifetimes[vreg];
+    lifetime->vreg = vreg;
+    lifetime->reg = reg;
+    lifetime->start = ranges[vreg][0].start / 2;
+    lifetime->end = (ranges[vreg][cvector_size(ranges[vreg]) - 1].end + 1) / 2;
+    trace_log("Allocated register %d for vreg %d over %zu ranges", reg, vreg,
+              cvector_size(ranges[vreg]));
+  }
+
+  for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++)
+    cvector_free(ranges[vreg]);
+  for (size_t r = 0; r < reg_count; r++)
+    cvector_free(taken[r]);
+  cvector_free(scratch);
+  free(taken);
+
+  // This allocator cannot spill, so a window that needs more registers than
+  // there are goes to graph coloring, which can.
+  if (!allocated) {
+    debug_log("Out of registers, falling back to graph coloring");
+    rs_color_registers(rs);
+    return;
   }
 
   debug_log("Lifetime analysis complete");
-  debug_log("Register pressure stats: max=%zu, spills=%zu, coalesces=%zu",
-            pressure_stats.max_pressure, pressure_stats.spill_count,
-            pressure_stats.coalesce_count);
+  debug_log("Register pressure stats: max=%zu, coalesces=%zu",
+            rs->pressure_stats.max_pressure,
+            rs->pressure_stats.coalesce_count);
 }
 
 void rs_finalize(rs_t *rs) {
@@ -836,7 +867,7 @@ void rs_finalize(rs_t *rs) {
   }
 
   bool has_error = false;
-  for (size_t i = 0; i < cvector_size(rs->basic_blocks); i++) {
+  for (size_t i = rs->window_begin; i < rs->window_end; i++) {
     rs_basic_block_t *bb = rs->basic_blocks[i];
     if (!bb) {
       fprintf(stderr,
@@ -871,76 +902,237 @@ void rs_finalize(rs_t *rs) {
     exit(1);
 }
 
-static void rs_operand_print(rs_t *rs, FILE *fp, rs_operand_t operand) {
+static void rs_operand_print(rs_t *rs, rs_emitter_t *out,
+                             rs_operand_t operand) {
   (void)rs;
   switch (operand.type) {
   case RS_OPERAND_TYPE_NULL:
-    fprintf(fp, "<null>");
+    rs_emit_str(out, "<null>");
     break;
   case RS_OPERAND_TYPE_INT64:
-    fprintf(fp, "%lld", operand.int64);
+    rs_emit_int(out, operand.int64);
     break;
   case RS_OPERAND_TYPE_ADDR:
-    fprintf(fp, "%p", (void *)operand.addr);
+    rs_emit_str(out, "0x");
+    rs_emit_uint(out, operand.addr, 16);
     break;
   case RS_OPERAND_TYPE_REG:
-    fprintf(fp, "%%%d", operand.vreg);
+    rs_emit_char(out, '%');
+    rs_emit_uint(out, operand.vreg, 10);
     break;
   case RS_OPERAND_TYPE_BB:
-    fprintf(fp, "bb_%zu", operand.bb_id);
+    rs_emit_str(out, "bb_");
+    rs_emit_uint(out, operand.bb_id, 10);
+    break;
+  case RS_OPERAND_TYPE_SLOT:
+    rs_emit_str(out, "slot_");
+    rs_emit_uint(out, operand.slot, 10);
+    break;
+  case RS_OPERAND_TYPE_MEM:
+    rs_emit_char(out, '[');
+    if (operand.mem.base != RS_INVALID_VREG) {
+      rs_emit_char(out, '%');
+      rs_emit_uint(out, operand.mem.base, 10);
+      rs_emit_str(out, " + ");
+    }
+    if (operand.mem.index != RS_INVALID_VREG) {
+      rs_emit_char(out, '%');
+      rs_emit_uint(out, operand.mem.index, 10);
+      rs_emit_char(out, '*');
+      rs_emit_uint(out, operand.mem.scale, 10);
+      rs_emit_str(out, " + ");
+    }
+    rs_emit_int(out, operand.mem.disp);
+    rs_emit_char(out, ']');
+    break;
+  case RS_OPERAND_TYPE_SYM:
+    rs_emit_char(out, '@');
+    rs_emit_str(out, operand.symbol);
     break;
   default:
     abort();
   }
 }
 
-void rs_dump_instr(rs_t *rs, FILE *fp, rs_instr_t instr) {
+void rs_emit_instr(rs_t *rs, rs_emitter_t *out, rs_instr_t instr) {
   if (instr.dest.type != RS_OPERAND_TYPE_NULL) {
-    rs_operand_print(rs, fp, instr.dest);
-    fprintf(fp, " = ");
+    rs_operand_print(rs, out, instr.dest);
+    rs_emit_str(out, " = ");
   }
-  fprintf(fp, "%s ", rs_opcode_to_str(instr.opcode));
+  rs_emit_str(out, rs_opcode_to_str(instr.opcode));
+  rs_emit_char(out, ' ');
   if (instr.src1.type != RS_OPERAND_TYPE_NULL)
-    rs_operand_print(rs, fp, instr.src1);
+    rs_operand_print(rs, out, instr.src1);
   if (instr.src2.type != RS_OPERAND_TYPE_NULL) {
-    fprintf(fp, ", ");
-    rs_operand_print(rs, fp, instr.src2);
+    rs_emit_str(out, ", ");
+    rs_operand_print(rs, out, instr.src2);
   }
   if (instr.src3.type != RS_OPERAND_TYPE_NULL) {
-    fprintf(fp, ", ");
-    rs_operand_print(rs, fp, instr.src3);
+    rs_emit_str(out, ", ");
+    rs_operand_print(rs, out, instr.src3);
+  }
+}
+
+static void emit_vreg_register(rs_t *rs, rs_emitter_t *out, uint8_t vreg) {
+  rs_emit_char(out, '%');
+  rs_emit_uint(out, vreg, 10);
+  rs_emit_str(out, ": ");
+  if (!rs_regmap_contains(&rs->register_map, vreg)) {
+    rs_emit_str(out, "unallocated");
+    return;
   }
+  rs_emit_str(out, rs_get_isel(rs->target)
+                       ->reg_names[rs_regmap_get(&rs->register_map, vreg)]);
+}
+
+void rs_emit_comment(rs_t *rs, rs_emitter_t *out, const char *prefix,
+                     rs_instr_t instr) {
+  if (rs->verbosity == RS_VERBOSITY_NONE)
+    return;
+
+  rs_emit_str(out, prefix);
+  rs_emit_instr(rs, out, instr);
+  if (rs->verbosity < RS_VERBOSITY_REGALLOC) {
+    rs_emit_char(out, '\n');
+    return;
+  }
+
+  // Spills and reloads are the allocator's own instructions, so show which
+  // way the value moves instead of listing registers.
+  if (instr.opcode == RS_OPCODE_SPILL) {
+    rs_emit_str(out, "  [");
+    emit_vreg_register(rs, out, instr.src1.vreg);
+    rs_emit_str(out, " -> slot_");
+    rs_emit_uint(out, instr.src2.slot, 10);
+    rs_emit_str(out, "]\n");
+    return;
+  }
+  if (instr.opcode == RS_OPCODE_RELOAD) {
+    rs_emit_str(out, "  [slot_");
+    rs_emit_uint(out, instr.src1.slot, 10);
+    rs_emit_str(out, " -> ");
+    emit_vreg_register(rs, out, instr.dest.vreg);
+    rs_emit_str(out, "]\n");
+    return;
+  }
+
+  uint8_t vregs[RS_INSTR_MAX_USES + 1];
+  size_t count = rs_instr_uses(instr, vregs);
+  uint8_t def;
+  if (rs_instr_def(instr, &def))
+    vregs[count++] = def;
+
+  const char *sep = "  [";
+  for (size_t i = 0; i < count; i++) {
+    bool seen = false;
+    for (size_t j = 0; j < i; j++)
+      seen = seen || vregs[j] == vregs[i];
+    if (seen)
+      continue;
+    rs_emit_str(out, sep);
+    emit_vreg_register(rs, out, vregs[i]);
+    sep = ", ";
+  }
+  if (*sep == ',')
+    rs_emit_char(out, ']');
+  rs_emit_char(out, '\n');
+}
+
+void rs_dump_instr(rs_t *rs, FILE *fp, rs_instr_t instr) {
+  rs_emitter_t out;
+  rs_emitter_init_file(&out, fp);
+  rs_emit_instr(rs, &out, instr);
+  rs_emitter_free(&out);
 }
 
 void rs_dump(rs_t *rs, FILE *fp) {
+  rs_emitter_t out;
+  rs_emitter_init_file(&out, fp);
   for (size_t block_id = 0; block_id < cvector_size(rs->basic_blocks);
        block_id++) {
     rs_basic_block_t *bb = rs->basic_blocks[block_id];
-    fprintf(fp, "%s:\n", bb->name);
+    rs_emit_str(&out, bb->name);
+    rs_emit_str(&out, ":\n");
 
     for (size_t i = 0; i < cvector_size(bb->instructions); i++) {
-      rs_instr_t instr = bb->instructions[i];
-      fprintf(fp, "  ");
-      rs_dump_instr(rs, fp, instr);
-      fprintf(fp, "\n");
+      rs_emit_str(&out, "  ");
+      rs_emit_instr(rs, &out, bb->instructions[i]);
+      rs_emit_char(&out, '\n');
     }
   }
+  rs_emitter_free(&out);
 }
 
-void rs_generate(rs_t *rs, FILE *fp) {
-  rs_finalize(rs);
-  rs_analyze_lifetimes(rs);
+bool rs_generate_to(rs_t *rs, rs_emitter_t *out) {
+  if (rs->stream) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Cannot generate code while streaming\n");
+    return false;
+  }
+
+  if (!rs_run_passes(rs))
+    return false;
 
+  rs_pass_timer_t timer = rs_pass_begin();
   switch (rs->target) {
   case RS_TARGET_X86_64_LINUX_NASM:
-    rs_generate_x86_64_linux_nasm(rs, fp);
+    rs_generate_x86_64_linux_nasm(rs, out);
     break;
   case RS_TARGET_AARCH64_MACOS_GAS:
-    rs_generate_aarch64_macos_gas(rs, fp);
+    rs_generate_aarch64_macos_gas(rs, out);
     break;
   case RS_TARGET_COUNT:
     break;
   }
+  rs_pass_end(rs, RS_PASS_EMIT, timer);
+  return rs_emitter_flush(out);
+}
+
+bool rs_generate(rs_t *rs, FILE *fp) {
+  rs_emitter_t out;
+  rs_emitter_init_file(&out, fp);
+  bool ok = rs_generate_to(rs, &out);
+  rs_emitter_free(&out);
+  return ok;
+}
+
+bool rs_generate_binary(rs_t *rs, rs_buffer_t *buf) {
+  if (!rs || !buf) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state or buffer\n");
+    return false;
+  }
+
+  if (rs->target != RS_TARGET_X86_64_LINUX_NASM) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "No binary encoder for target %d\n",
+            rs->target);
+    return false;
+  }
+
+  if (rs->stream) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Cannot encode while streaming\n");
+    return false;
+  }
+
+  if (!rs_run_passes(rs))
+    return false;
+  size_t start = cvector_size(*buf);
+  rs_relocations_t relocations = NULL;
+  bool ok = rs_encode_x86_64(rs, buf, NULL, &relocations);
+
+  // Only calls to the function itself can be resolved without a module.
+  rs_resolve_x86_64(*buf, &relocations, rs_get_symbol(rs), start);
+  if (ok && cvector_size(relocations) > 0) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Undefined symbol '%s'\n",
+            relocations[0].symbol);
+    ok = false;
+  }
+  cvector_free(relocations);
+  return ok;
 }
 
 void rs_regmap_init(rs_register_map_t *map) {
@@ -997,7 +1189,7 @@ void rs_regmap_insert(rs_register_map_t *map, size_t key, rs_register_t value) {
 
   rs_map_entry_t entry = {.key = key, .value = value};
   cvector_push_back(map->entries, entry);
-  debug_log("Inserted mapping vreg %zu -> preg %d", key, value);
+  trace_log("Inserted mapping vreg %zu -> preg %d", key, value);
 }
 
 rs_register_t rs_regmap_get(rs_register_map_t *map, size_t key) {
@@ -1019,12 +1211,12 @@ rs_register_t rs_regmap_get(rs_register_map_t *map, size_t key) {
   rs_map_entry_t *entry_it;
   cvector_for_each_in(entry_it, map->entries) {
     if (entry_it->key == key) {
-      debug_log("Found mapping vreg %zu -> preg %d", key, entry_it->value);
+      trace_log("Found mapping vreg %zu -> preg %d", key, entry_it->value);
       return entry_it->value;
     }
   }
 
-  debug_log("No mapping found for vreg %zu", key);
+  trace_log("No mapping found for vreg %zu", key);
   return RS_REG_SPILL;
 }
 
@@ -1047,12 +1239,12 @@ bool rs_regmap_contains(rs_register_map_t *map, size_t key) {
   rs_map_entry_t *entry_it;
   cvector_for_each_in(entry_it, map->entries) {
     if (entry_it->key == key) {
-      debug_log("Found mapping for vreg %zu", key);
+      trace_log("Found mapping for vreg %zu", key);
       return true;
     }
   }
 
-  debug_log("No mapping found for vreg %zu", key);
+  trace_log("No mapping found for vreg %zu", key);
   return false;
 }
 
@@ -1076,7 +1268,7 @@ void rs_regmap_remove(rs_register_map_t *map, size_t key) {
   size_t i = 0;
   cvector_for_each_in(entry_it, map->entries) {
     if (entry_it->key == key) {
-      debug_log("Removing mapping vreg %zu -> preg %d", key, entry_it->value);
+      trace_log("Removing mapping vreg %zu -> preg %d", key, entry_it->value);
       cvector_erase(map->entries, i);
       return;
     }
@@ -9,11 +9,58 @@
 #ifndef RUNESTONE_H
 #define RUNESTONE_H
 
-#include "cvector.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+
+/**
+ * @brief Allocates like `malloc`, counting the allocation on this thread.
+ * @param[in] size The number of bytes.
+ * @return The allocation, or NULL.
+ */
+void *rs_malloc(size_t size);
+
+/**
+ * @brief Allocates like `calloc`, counting the allocation on this thread.
+ * @param[in] count The number of elements.
+ * @param[in] size The size of an element.
+ * @return The zeroed allocation, or NULL.
+ */
+void *rs_calloc(size_t count, size_t size);
+
+/**
+ * @brief Reallocates like `realloc`, counting the allocation on this thread.
+ * @param[in] ptr The allocation to resize, or NULL.
+ * @param[in] size The new number of bytes.
+ * @return The resized allocation, or NULL.
+ */
+void *rs_realloc(void *ptr, size_t size);
+
+/**
+ * @brief Allocations counted on one thread.
+ */
+typedef struct {
+  uint64_t count; /**< Number of allocations and reallocations. */
+  uint64_t bytes; /**< Bytes they requested. */
+} rs_alloc_stats_t;
+
+/**
+ * @brief Gets the allocations made by Runestone on the calling thread.
+ * @return The running totals.
+ */
+rs_alloc_stats_t rs_get_thread_alloc_stats(void);
+
+// Count the growth of Runestone's vectors too, unless cvector was included
+// with other allocators first.
+#ifndef cvector_clib_malloc
+#include <stdlib.h>
+#define cvector_clib_free free
+#define cvector_clib_malloc rs_malloc
+#define cvector_clib_calloc rs_calloc
+#define cvector_clib_realloc rs_realloc
+#endif
+#include "cvector.h"
 /**
  * @defgroup Runestone Runestone IR API
  * @brief Core types and functions for the Runestone IR.
@@ -61,6 +108,8 @@
 #define RS_MAX_BB 1024
 /** Maximum number of registers. */
 #define RS_MAX_REGS 256
+/** Maximum number of function parameters. */
+#define RS_MAX_PARAMS 2
 /** Initial capacity for register map. */
 #define RS_REGMAP_INIT_CAPACITY 16
 
@@ -71,6 +120,44 @@
 /** Placeholder for temporary registers.  */
 #define RS_TEMPORARY_VREG RS_INVALID_VREG
 
+/** No tracing. */
+#define RS_TRACE_NONE 0
+/** Pass timings, recorded once `rs_trace_enable` is called. */
+#define RS_TRACE_PASSES 1
+/** Debug messages, printed once `rs_set_debug` enables them. */
+#define RS_TRACE_DEBUG 2
+/** Debug messages from inner loops, such as register map lookups. */
+#define RS_TRACE_VERBOSE 3
+
+/**
+ * Highest trace level compiled into the library. Anything above it costs
+ * nothing, not even the evaluation of its arguments.
+ */
+#ifndef RS_TRACE_LEVEL
+#define RS_TRACE_LEVEL RS_TRACE_DEBUG
+#endif
+
+/** Logs a debug message at trace level `level`. */
+#define RS_LOG(level, ...)                                                     \
+  do {                                                                         \
+    if ((level) <= RS_TRACE_LEVEL)                                             \
+      rs_debug_log(__FILE__, __LINE__, __VA_ARGS__);                           \
+  } while (0)
+
+#if RS_TRACE_LEVEL >= RS_TRACE_PASSES
+/** Starts timing a traced span of `rs`, returning its start time. */
+#define RS_TRACE_BEGIN(rs) ((rs)->trace.events ? rs_trace_now() : 0)
+/** Records the span `name` of `rs` started at `start`. */
+#define RS_TRACE_END(rs, name, start)                                          \
+  do {                                                                         \
+    if ((rs)->trace.events)                                                    \
+      rs_trace_record((rs), (name), (start));                                  \
+  } while (0)
+#else
+#define RS_TRACE_BEGIN(rs) ((void)(rs), (uint64_t)0)
+#define RS_TRACE_END(rs, name, start) ((void)(rs), (void)(name), (void)(start))
+#endif
+
 typedef uint8_t rs_register_t;
 
 /**
@@ -85,7 +172,10 @@ typedef uint8_t rs_register_t;
   X(INT64) /**< Immediate 64-bit integer. */                                   \
   X(ADDR)  /**< Address (e.g., label or absolute address). */                  \
   X(REG)   /**< Virtual register. */                                           \
-  X(BB)    /**< Basic block reference. */
+  X(BB)    /**< Basic block reference. */                                      \
+  X(SLOT)  /**< Stack slot index in the function frame. */                     \
+  X(MEM)   /**< Memory at `base + index * scale + disp`. */                    \
+  X(SYM)   /**< Symbol, such as the name of a function. */
 
 /**
  * @enum rs_operand_type_t
@@ -116,10 +206,19 @@ typedef enum {
 typedef struct {
   rs_operand_type_t type; /**< The type of the operand. */
   union {
-    int64_t int64; /**< 64-bit integer value. */
-    size_t addr;   /**< Address. */
-    uint8_t vreg;  /**< Virtual register index. */
-    size_t bb_id;  /**< Basic block ID. */
+    int64_t int64;      /**< 64-bit integer value. */
+    size_t addr;        /**< Address. */
+    uint8_t vreg;       /**< Virtual register index. */
+    size_t bb_id;       /**< Basic block ID. */
+    size_t slot;        /**< Stack slot index. */
+    const char *symbol; /**< Symbol name, owned by the caller. */
+    struct {
+      uint8_t base;  /**< Base virtual register, or `RS_INVALID_VREG` for an
+                        absolute address. */
+      uint8_t index; /**< Index virtual register, or `RS_INVALID_VREG`. */
+      uint8_t scale; /**< Index scale: 1, 2, 4 or 8. */
+      int32_t disp;  /**< Signed displacement. */
+    } mem;              /**< Memory reference. */
   };
 } rs_operand_t;
 
@@ -142,6 +241,27 @@ typedef struct {
 #define RS_OPERAND_BB(value)                                                   \
   ((rs_operand_t){.type = RS_OPERAND_TYPE_BB, .bb_id = (value)})
 
+/// @brief Operand constructor for memory at `base + index * scale + disp`.
+#define RS_OPERAND_MEM_INDEXED(base_vreg, index_vreg, index_scale,             \
+                               displacement)                                   \
+  ((rs_operand_t){.type = RS_OPERAND_TYPE_MEM,                                 \
+                  .mem = {.base = (base_vreg),                                 \
+                          .index = (index_vreg),                               \
+                          .scale = (index_scale),                              \
+                          .disp = (displacement)}})
+
+/// @brief Operand constructor for memory at `base + disp`.
+#define RS_OPERAND_MEM(base_vreg, displacement)                                \
+  RS_OPERAND_MEM_INDEXED(base_vreg, RS_INVALID_VREG, 1, displacement)
+
+/// @brief Operand constructor for stack slot.
+#define RS_OPERAND_SLOT(value)                                                 \
+  ((rs_operand_t){.type = RS_OPERAND_TYPE_SLOT, .slot = (value)})
+
+/// @brief Operand constructor for a symbol.
+#define RS_OPERAND_SYM(name)                                                   \
+  ((rs_operand_t){.type = RS_OPERAND_TYPE_SYM, .symbol = (name)})
+
 /**
  * @enum rs_opcode_t
  * @brief The available instructions in the Runestone IR.
@@ -165,7 +285,11 @@ typedef struct {
   X(BR_IF, "br_if")   /**< Branch if value != 0. */                            \
   X(CMP_EQ, "cmp_eq") /**< result = (a == b) */                                \
   X(CMP_LT, "cmp_lt") /**< result = (a < b) */                                 \
-  X(CMP_GT, "cmp_gt") /**< result = (a > b) */
+  X(CMP_GT, "cmp_gt") /**< result = (a > b) */                                 \
+  X(SPILL, "spill")   /**< Store a register to its stack slot. */              \
+  X(RELOAD, "reload") /**< Load a register from its stack slot. */             \
+  X(CALL, "call")     /**< result = src1(src2, src3) */                        \
+  X(PARAM, "param")   /**< result = parameter saved in stack slot src1 */
 
 /**
  * @enum rs_opcode_t
@@ -230,6 +354,7 @@ typedef struct {
                  labeling purposes. */
   rs_instructions_t instructions; /**< List of instructions in the basic block.
                          The instructions are executed sequentially. */
+  bool sealed; /**< Whether the block is complete, see `rs_seal_basic_block`. */
 } rs_basic_block_t;
 
 typedef cvector(rs_basic_block_t *) rs_basic_blocks_t;
@@ -255,6 +380,38 @@ typedef struct {
                       virtual register is used. */
 } rs_lifetime_t;
 
+/**
+ * @brief Register pressure statistics of the linear allocator.
+ */
+typedef struct {
+  size_t pressure;       /**< Current register pressure. */
+  size_t max_pressure;   /**< Maximum register pressure seen. */
+  size_t spill_count;    /**< Number of spills performed. */
+  size_t coalesce_count; /**< Number of coalescing opportunities found. */
+} rs_pressure_stats_t;
+
+/**
+ * @brief A completed span, in Chrome trace-event terms an `X` event.
+ */
+typedef struct {
+  const char *name;  /**< What ran, a string literal. */
+  uint64_t start;    /**< Monotonic start time in nanoseconds. */
+  uint64_t duration; /**< Duration in nanoseconds. */
+} rs_trace_event_t;
+
+/**
+ * @brief Ring buffer of the most recent trace events of a context.
+ *
+ * Only the thread compiling a context records into its buffer, so recording
+ * takes no lock.
+ */
+typedef struct {
+  rs_trace_event_t *events; /**< The ring, or NULL while tracing is off. */
+  size_t capacity;          /**< Number of events the ring holds. */
+  size_t recorded;          /**< Events recorded so far, including those
+                               overwritten. */
+} rs_trace_t;
+
 /**
  * @brief Structure representing a mapping entry between a virtual and physical
  * register.
@@ -355,49 +512,42 @@ bool rs_regmap_contains(rs_register_map_t *map, size_t key);
 void rs_regmap_remove(rs_register_map_t *map, size_t key);
 
 /**
- * @brief Define the supported targets and their associated register sets.
+ * @brief Define the supported targets and their allocatable register counts.
  *
  * This macro, `RS_TARGETS`, defines the output targets in the Runestone
  * project. Each target represents a specific combination of architecture,
- * operating system, and assembler, and includes a list of general-purpose
- * registers associated with that target. These registers are used for code
- * generation in assembly format, and each target is configured for a specific
- * assembly syntax (e.g., NASM for x86_64 on Linux, GAS for AArch64 on macOS).
+ * operating system, and assembler, and is configured for a specific assembly
+ * syntax (e.g., NASM for x86_64 on Linux, GAS for AArch64 on macOS).
  *
- * @note The list of registers includes general-purpose registers used for
- * assembly operations. Each target may support a different number of registers.
+ * @note The register names live with each target's code generator, in
+ * `rs_target_<lower>_reg_names`, where the first `count` are allocatable.
+ * Each target may support a different number of registers.
  *
  * @see RS_TARGET
  */
 #define RS_TARGETS                                                             \
-  RS_TARGET(x86_64_linux_nasm, X86_64_LINUX_NASM, 14, "rax", "rbx", "rcx",     \
-            "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13",       \
-            "r14", "r15")                                                      \
-  RS_TARGET(aarch64_macos_gas, AARCH64_MACOS_GAS, 17, "x9", "x10", "x11",      \
-            "x12", "x13", "x14", "x15", "x19", "x20", "x21", "x22", "x23",     \
-            "x24", "x25", "x26", "x27", "x28")
+  RS_TARGET(x86_64_linux_nasm, X86_64_LINUX_NASM, 14)                          \
+  RS_TARGET(aarch64_macos_gas, AARCH64_MACOS_GAS, 17)
 
 /**
- * @brief Define a target's register set.
+ * @brief Declare a target's register names.
  *
- * This macro defines the set of register names for a specific target. It
- * associates a target identifier with a list of register names, which will
- * be used during the code generation process to generate assembly code for
- * that target.
+ * This macro declares the register names of a specific target, which its code
+ * generator defines. The allocatable registers come first, followed by the
+ * ones the target reserves for itself.
  *
  * @param lower The lowercase identifier for the target (e.g.,
  * `x86_64_linux_nasm`).
- * @param count The total number of registers available for the target.
- * @param ... A list of register names that are available for the target.
+ * @param count The number of allocatable registers of the target.
  *
  * Example usage:
  * @code
- * RS_TARGET(x86_64_linux_nasm, X86_64_LINUX_NASM, 14, "rax", "rbx", ...);
+ * RS_TARGET(x86_64_linux_nasm, X86_64_LINUX_NASM, 14);
  * @endcode
  */
-#define RS_TARGET(lower, _, count, ...)                                        \
+#define RS_TARGET(lower, upper, count)                                         \
   /** Register names for target `lower`.*/                                     \
-  static const char *rs_target_##lower##_reg_names[] = {__VA_ARGS__};
+  extern const char *rs_target_##lower##_reg_names[];
 RS_TARGETS
 #undef RS_TARGET
 
@@ -419,7 +569,7 @@ RS_TARGETS
  */
 typedef enum {
 
-#define RS_TARGET(_1, x, _2, ...) RS_TARGET_##x,
+#define RS_TARGET(_1, x, _2) RS_TARGET_##x,
   RS_TARGETS
 #undef RS_TARGET
 
@@ -429,6 +579,194 @@ typedef enum {
 size_t rs_get_register_count(rs_target_t target);
 const char **rs_get_register_names(rs_target_t target);
 
+/**
+ * @enum rs_regalloc_t
+ * @brief Register allocation strategies.
+ *
+ * The linear allocator is cheap and is the default. The graph allocator runs
+ * Chaitin-Briggs style iterated register coalescing over an interference
+ * graph, which costs considerably more compile time but spills and copies
+ * less, making it a good fit for hot code that is compiled once and run for a
+ * long time. The stack allocator keeps every value in its own stack slot and
+ * needs no analysis at all.
+ */
+typedef enum {
+  RS_REGALLOC_LINEAR, /**< Fast lifetime based allocator. */
+  RS_REGALLOC_GRAPH,  /**< Graph coloring with iterated coalescing. */
+  RS_REGALLOC_STACK,  /**< A stack slot per virtual register. */
+} rs_regalloc_t;
+
+/**
+ * @enum rs_opt_level_t
+ * @brief Optimization levels, trading code quality for compile time.
+ *
+ * Each level picks the passes `rs_run_passes` runs and the register
+ * allocator. Cold code compiled and run once is best served by `O0`, hot code
+ * by `O2`.
+ */
+typedef enum {
+  RS_OPT_O0, /**< Stack slots, no analysis and no instruction fusion. */
+  RS_OPT_O1, /**< Operand folding and the linear allocator, the default. */
+  RS_OPT_O2, /**< Operand folding and the graph allocator. */
+} rs_opt_level_t;
+
+/**
+ * @brief Macro for defining the output sinks of an emitter.
+ */
+#define RS_SINKS(X)                                                            \
+  X(FILE)   /**< A stdio stream. */                                            \
+  X(BUFFER) /**< A growable in-memory buffer. */                               \
+  X(FD)     /**< A file descriptor written with large `write` calls. */
+
+/**
+ * @enum rs_sink_t
+ * @brief Output sinks of an `rs_emitter_t`.
+ */
+typedef enum {
+#define X(name) RS_SINK_##name,
+  RS_SINKS(X)
+#undef X
+} rs_sink_t;
+
+/**
+ * @brief Buffered text output of the code generators.
+ *
+ * Text is staged in `data` and written to the sink in large chunks. With the
+ * `RS_SINK_BUFFER` sink nothing is written out, and `data` holds the first
+ * `length` bytes of output until `rs_emitter_free`.
+ */
+typedef struct {
+  rs_sink_t sink;  /**< Where the text goes. */
+  FILE *fp;        /**< Stream of the `RS_SINK_FILE` sink. */
+  int fd;          /**< Descriptor of the `RS_SINK_FD` sink. */
+  char *data;      /**< Staged text. */
+  size_t length;   /**< Bytes staged in `data`. */
+  size_t capacity; /**< Size of `data`. */
+  bool failed;     /**< Whether an allocation or write failed. */
+} rs_emitter_t;
+
+/**
+ * @enum rs_verbosity_t
+ * @brief How much commentary the assembly backends emit.
+ */
+typedef enum {
+  RS_VERBOSITY_NONE,     /**< Instructions only. */
+  RS_VERBOSITY_IR,       /**< Each IR instruction as a comment. The default. */
+  RS_VERBOSITY_REGALLOC, /**< IR comments with the register of every vreg and
+                            spill and reload markers. */
+  RS_VERBOSITY_COST,     /**< Register comments, and the estimated cost of
+                            every block, see `rs_estimate_block_cost`. */
+} rs_verbosity_t;
+
+/**
+ * @brief Passes whose cost `rs_get_pass_stats` reports, with their names.
+ *
+ * `rs_run_passes` runs all but the last two in order, skipping those that do
+ * not apply to the target and register allocator. `emit` and `encode` measure
+ * assembly and machine code generation.
+ */
+#define RS_PASSES(X)                                                           \
+  X(FINALIZE, "finalize")                                                      \
+  X(MATCH_ADDRESSES, "match_addresses")                                        \
+  X(FOLD_OPERANDS, "fold_operands")                                            \
+  X(SCHEDULE, "schedule")                                                      \
+  X(TIE_TWO_ADDRESS, "tie_two_address")                                        \
+  X(ASSIGN_STACK_SLOTS, "assign_stack_slots")                                  \
+  X(ANALYZE_LIFETIMES, "analyze_lifetimes")                                    \
+  X(COLOR_REGISTERS, "color_registers")                                        \
+  X(EMIT, "emit")                                                              \
+  X(ENCODE, "encode")
+
+/**
+ * @enum rs_pass_id_t
+ * @brief Identifies a pass.
+ */
+typedef enum {
+#define X(name, str) RS_PASS_##name,
+  RS_PASSES(X)
+#undef X
+      RS_PASS_COUNT
+} rs_pass_id_t;
+
+/**
+ * @brief Analyses cached between passes, with their names.
+ */
+#define RS_ANALYSES(X)                                                         \
+  X(CFG, "cfg")                                                                \
+  X(DEF_USE, "def_use")                                                        \
+  X(LIVENESS, "liveness")                                                      \
+  X(DOMINATORS, "dominators")                                                  \
+  X(PRESSURE, "pressure")
+
+/**
+ * @enum rs_analysis_t
+ * @brief Identifies an analysis.
+ */
+typedef enum {
+#define X(name, str) RS_ANALYSIS_##name,
+  RS_ANALYSES(X)
+#undef X
+      RS_ANALYSIS_COUNT
+} rs_analysis_t;
+
+/** Bit of an analysis in a mask of analyses. */
+#define RS_ANALYSIS_BIT(analysis) (1u << RS_ANALYSIS_##analysis)
+/** Mask of every analysis. */
+#define RS_ANALYSIS_ALL ((1u << RS_ANALYSIS_COUNT) - 1)
+
+/** Entries of `rs_get_pass_stats`: every pass, then every analysis. */
+#define RS_PASS_STATS_COUNT (RS_PASS_COUNT + RS_ANALYSIS_COUNT)
+
+/**
+ * @brief The accumulated cost of a pass or analysis.
+ *
+ * The cost of a pass includes the analyses it computes. Allocations are
+ * those made on the compiling thread.
+ */
+typedef struct {
+  const char *name;         /**< Name of the pass or analysis. */
+  size_t runs;              /**< Number of times it ran. */
+  uint64_t nanoseconds;     /**< Total wall time. */
+  uint64_t allocations;     /**< Allocations made while it ran. */
+  uint64_t allocated_bytes; /**< Bytes those allocations requested. */
+} rs_pass_stats_t;
+
+/**
+ * @brief Register allocation quality of a block, or of a whole function.
+ *
+ * Spills and reloads are the instructions the allocator inserted. A copy is
+ * a `move` between registers or a source tied by `rs_tie_two_address`: it is
+ * coalesced when both ends got the same register, and remains otherwise.
+ */
+typedef struct {
+  size_t max_pressure;    /**< Most virtual registers live at once. */
+  size_t spills;          /**< Stores to stack slots. */
+  size_t reloads;         /**< Loads from stack slots. */
+  size_t remats;          /**< Constants recomputed instead of reloaded. */
+  size_t coalesced_moves; /**< Copies that cost nothing. */
+  size_t moves;           /**< Copies left for the backend to emit. */
+} rs_regalloc_stats_t;
+
+typedef cvector(rs_regalloc_stats_t) rs_regalloc_stats_vec_t;
+
+/**
+ * @brief Register allocation quality of one compiled function.
+ */
+typedef struct {
+  char *name;                     /**< Symbol of the function. */
+  rs_regalloc_t regalloc;         /**< Allocator that ran. */
+  size_t frame_size;              /**< Bytes of stack frame. */
+  size_t first_block;             /**< ID of the first block. */
+  rs_regalloc_stats_t total;      /**< Sums over the blocks, with the
+                                     maximum of their pressure. */
+  rs_regalloc_stats_vec_t blocks; /**< Blocks from `first_block` on. */
+} rs_alloc_report_t;
+
+typedef cvector(rs_alloc_report_t) rs_alloc_reports_t;
+
+/** Cached analyses, see `rs_get_def_use`. */
+typedef struct rs_analyses rs_analyses_t;
+
 /**
  * @struct rs_t
  * @brief Represents the entire state of the Runestone IR, including target,
@@ -458,16 +796,170 @@ typedef struct {
 
   size_t next_dst_vreg; /**< The index for the next destination virtual
                            register. */
+
+  rs_regalloc_t regalloc; /**< The register allocation strategy. */
+  rs_opt_level_t opt_level; /**< Which passes run before emission. */
+
+  rs_verbosity_t verbosity; /**< Commentary in generated assembly. */
+
+  size_t emit_threads; /**< Workers rendering blocks in parallel, 1 for
+                          serial emission, 0 for one per online CPU. */
+
+  size_t window_begin; /**< First block the passes and backends process. */
+  size_t window_end;   /**< One past the last block they process. Follows the
+                          block count unless streaming. */
+  rs_emitter_t *stream; /**< Output of `rs_stream_begin`, or NULL. */
+
+  const char *symbol; /**< Name of the function being built, `_start` if
+                         NULL. */
+  size_t param_count; /**< Parameters read by `rs_build_param`, which occupy
+                         the first stack slots. */
+
+  uint8_t tied[RS_MAX_REGS]; /**< Source register each destination is tied to
+                                by `rs_tie_two_address`, or
+                                `RS_INVALID_VREG`. */
+
+  rs_pressure_stats_t pressure_stats; /**< Statistics of the last linear
+                                         allocation. */
+
+  rs_trace_t trace; /**< Trace events, see `rs_trace_enable`. */
+
+  rs_analyses_t *analyses; /**< Cached analyses, allocated on first use. */
+  bool failed; /**< Whether a pass of the last `rs_run_passes` failed. */
+  rs_pass_stats_t pass_stats[RS_PASS_STATS_COUNT]; /**< Cost of every pass
+                                                      and analysis. */
+  bool alloc_report; /**< Whether compiling records allocation reports, see
+                        `rs_alloc_report_enable`. */
+  rs_alloc_reports_t alloc_reports; /**< One report per compilation. */
+  uint64_t *block_counters;   /**< Counters generated code increments, see
+                                 `rs_instrument_blocks`, or NULL. */
+  size_t block_counter_count; /**< Number of block counters. */
+  bool atomic_counters;       /**< Whether the increments are atomic. */
+  cvector(uint64_t) block_frequencies; /**< Executions of each block in the
+                                          loaded profile, or NULL. */
 } rs_t;
 
+/** Number of 64-bit words in a virtual register set. */
+#define RS_REGSET_WORDS (RS_MAX_REGS / 64)
+
+/**
+ * @struct rs_regset_t
+ * @brief A fixed-size bit set with one bit per virtual register.
+ */
+typedef struct {
+  uint64_t words[RS_REGSET_WORDS]; /**< Membership bits. */
+} rs_regset_t;
+
+typedef cvector(rs_regset_t) rs_regsets_t;
+
+/** @brief Adds a virtual register to a register set. */
+static inline void rs_regset_add(rs_regset_t *set, uint8_t vreg) {
+  set->words[vreg / 64] |= (uint64_t)1 << (vreg % 64);
+}
+
+/** @brief Removes a virtual register from a register set. */
+static inline void rs_regset_remove(rs_regset_t *set, uint8_t vreg) {
+  set->words[vreg / 64] &= ~((uint64_t)1 << (vreg % 64));
+}
+
+/** @brief Checks whether a virtual register is in a register set. */
+static inline bool rs_regset_contains(const rs_regset_t *set, uint8_t vreg) {
+  return (set->words[vreg / 64] >> (vreg % 64)) & 1;
+}
+
+/**
+ * @brief Merges @p src into @p dst.
+ * @return `true` if @p dst gained any new members.
+ */
+static inline bool rs_regset_union(rs_regset_t *dst, const rs_regset_t *src) {
+  bool changed = false;
+  for (size_t i = 0; i < RS_REGSET_WORDS; i++) {
+    uint64_t merged = dst->words[i] | src->words[i];
+    changed |= merged != dst->words[i];
+    dst->words[i] = merged;
+  }
+  return changed;
+}
+
+/**
+ * @struct rs_liveness_t
+ * @brief Per-block live-in and live-out sets of virtual registers.
+ *
+ * Computed by `rs_compute_liveness` with a backward dataflow over the control
+ * flow graph implied by the block terminators. The sets are indexed by block
+ * ID minus `rs_t::window_begin`.
+ */
+typedef struct {
+  rs_regsets_t live_in;  /**< Registers live on entry to each block. */
+  rs_regsets_t live_out; /**< Registers live on exit from each block. */
+} rs_liveness_t;
+
 /**
  * @brief Sets debug logging options.
+ *
+ * The options are process-wide, so set them before compiling on several
+ * threads. Each message is written to the stream in one piece.
+ *
  * @param[in] enabled Whether debug logging should be enabled.
  * @param[in] stream The file stream to write debug messages to (NULL for
  * stderr).
  */
 void rs_set_debug(bool enabled, FILE *stream);
 
+/**
+ * @brief Writes a debug message if debug logging is enabled.
+ * @param[in] file The source file the message originates from.
+ * @param[in] line The source line the message originates from.
+ * @param[in] format A printf-style format string.
+ */
+void rs_debug_log(const char *file, int line, const char *format, ...);
+
+/**
+ * @brief Starts recording trace events for a context.
+ *
+ * Does nothing when the library is built with `RS_TRACE_LEVEL` below
+ * `RS_TRACE_PASSES`. Once the ring is full, new events overwrite the oldest.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] capacity The number of events to keep.
+ * @return `false` if the ring could not be allocated.
+ */
+bool rs_trace_enable(rs_t *rs, size_t capacity);
+
+/**
+ * @brief Returns the monotonic time in nanoseconds.
+ * @return The current time.
+ */
+uint64_t rs_trace_now(void);
+
+/**
+ * @brief Records a completed span, see `RS_TRACE_BEGIN`.
+ * @param[inout] rs The Runestone state, whose tracing is enabled.
+ * @param[in] name What ran, a string literal.
+ * @param[in] start When it started, from `rs_trace_now`.
+ */
+void rs_trace_record(rs_t *rs, const char *name, uint64_t start);
+
+/**
+ * @brief Writes the recorded events in Chrome trace-event JSON.
+ *
+ * Each context becomes a thread named after its symbol, so the output of
+ * `rs_compile_batch` can be inspected in Perfetto or `chrome://tracing`.
+ *
+ * @param[in] contexts The contexts whose events to write.
+ * @param[in] count The number of contexts.
+ * @param[inout] fp The file to write to.
+ * @return `false` if writing failed.
+ */
+bool rs_trace_write_json(rs_t *const *contexts, size_t count, FILE *fp);
+
+/**
+ * @brief Writes a string as a quoted, escaped JSON string.
+ * @param[inout] fp The file to write to.
+ * @param[in] text The string.
+ */
+void rs_json_write_string(FILE *fp, const char *text);
+
 /**
  * @brief Initializes the Runestone IR state.
  * @param[inout] rs The Runestone state to initialize.
@@ -489,6 +981,19 @@ void rs_free(rs_t *rs);
  */
 size_t rs_append_basic_block(rs_t *rs, const char *name);
 
+/**
+ * @brief Frees a basic block, the destructor of `rs_basic_blocks_t` elements.
+ * @param[in] ptr Pointer to the `rs_basic_block_t *` to free.
+ */
+void rs_free_basic_block(void *ptr);
+
+/**
+ * @brief Returns the symbol of the function being built.
+ * @param[in] rs The Runestone state.
+ * @return `rs_t::symbol`, or `_start` if it is NULL.
+ */
+const char *rs_get_symbol(const rs_t *rs);
+
 /**
  * @brief Positions the cursor at the specified basic block.
  * @param[inout] rs The Runestone state.
@@ -624,6 +1129,33 @@ rs_operand_t rs_build_cmp_lt(rs_t *rs, rs_operand_t src1, rs_operand_t src2);
  */
 rs_operand_t rs_build_cmp_gt(rs_t *rs, rs_operand_t src1, rs_operand_t src2);
 
+/**
+ * @brief Builds a call instruction.
+ *
+ * The callee follows the SysV calling convention and takes up to two
+ * arguments. The registers a call clobbers are saved around it.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] callee The called function, a `RS_OPERAND_SYM`.
+ * @param[in] arg1 The first argument, or `RS_OPERAND_NULL`.
+ * @param[in] arg2 The second argument, or `RS_OPERAND_NULL`.
+ * @return The operand holding the returned value.
+ */
+rs_operand_t rs_build_call(rs_t *rs, rs_operand_t callee, rs_operand_t arg1,
+                           rs_operand_t arg2);
+
+/**
+ * @brief Builds an instruction reading a parameter of the function.
+ *
+ * The prologue saves the parameter registers in the first stack slots, so
+ * parameters can be read anywhere in the function.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] index The parameter, below `RS_MAX_PARAMS`.
+ * @return The operand holding the parameter.
+ */
+rs_operand_t rs_build_param(rs_t *rs, size_t index);
+
 /**
  * @brief Checks if an instruction is a terminator.
  * @param[in] instr The instruction to check.
@@ -648,78 +1180,1373 @@ rs_register_t rs_get_register(rs_t *rs, size_t vreg);
 /**
  * @brief Analyzes and determines the lifetimes of virtual registers for
  * allocation.
+ *
+ * Builds the live ranges of each virtual register from block liveness, with
+ * holes where a reused register holds nothing, and scans them in order of
+ * their start, giving each register the first physical register free over
+ * all of its ranges. Tied two-address sources are preferred. The scan has no
+ * spill code, so a window that needs more registers than there are is handed
+ * to `rs_color_registers` instead. Sets `rs_t::failed` if liveness cannot be
+ * computed.
+ *
  * @param[inout] rs The Runestone state.
  */
 void rs_analyze_lifetimes(rs_t *rs);
 
 /**
- * @brief Finalizes the given Runestone instance.
+ * @brief Selects the register allocation strategy used by `rs_generate`.
+ * @param[inout] rs The Runestone state.
+ * @param[in] regalloc The allocator to use.
+ */
+void rs_set_regalloc(rs_t *rs, rs_regalloc_t regalloc);
+
+/**
+ * @brief Selects the optimization level used by `rs_generate`.
  *
- * This function performs any necessary cleanup and resource deallocation for
- * the given Runestone instance. It is typically called when the Runestone
- * instance is no longer needed to ensure all resources are properly freed and
- * any other finalization tasks are completed.
+ * Also selects the level's register allocator, which `rs_set_regalloc` can
+ * override afterwards.
  *
- * @param rs A pointer to the Runestone instance that is to be finalized.
+ * @param[inout] rs The Runestone state.
+ * @param[in] level The optimization level.
  */
-void rs_finalize(rs_t *rs);
+void rs_set_opt_level(rs_t *rs, rs_opt_level_t level);
 
 /**
- * @brief Dumps the disassembled representation of a single instruction.
+ * @brief Selects how much commentary `rs_generate` emits.
+ * @param[inout] rs The Runestone state.
+ * @param[in] verbosity The verbosity level.
+ */
+void rs_set_verbosity(rs_t *rs, rs_verbosity_t verbosity);
+
+/**
+ * @brief Selects how many threads render the blocks of a function.
+ * @param[inout] rs The Runestone state.
+ * @param[in] threads The number of workers, 1 for serial emission (the
+ *            default), 0 for one per online CPU.
+ */
+void rs_set_emit_threads(rs_t *rs, size_t threads);
+
+/** Maximum number of virtual registers a single instruction can read. */
+#define RS_INSTR_MAX_USES 8
+
+/**
+ * @brief Collects the virtual registers read by an instruction.
  *
- * This function formats and outputs the disassembled representation of a single
- * instruction from the given Runestone instance. The instruction is written to
- * the provided file stream.
+ * Besides register sources this includes the base registers of memory
+ * operands, wherever they appear.
  *
- * @param rs A pointer to the Runestone instance containing the instruction.
- * @param fp A pointer to the `FILE` object where the disassembled instruction
- *           will be written.
- * @param instr The instruction to be dumped, which is part of the Runestone
- *              instance.
+ * @param[in] instr The instruction to inspect.
+ * @param[out] uses Receives the used virtual registers.
+ * @return The number of virtual registers written to @p uses.
  */
-void rs_dump_instr(rs_t *rs, FILE *fp, rs_instr_t instr);
+size_t rs_instr_uses(rs_instr_t instr, uint8_t uses[RS_INSTR_MAX_USES]);
+
 /**
- * @brief Dumps the entire Runestone instance.
+ * @brief Collects pointers to the virtual register fields an instruction
+ * reads, so that passes can rename them in place.
+ * @param[in] instr The instruction to inspect.
+ * @param[out] refs Receives pointers into @p instr.
+ * @return The number of pointers written to @p refs.
+ */
+size_t rs_instr_use_refs(rs_instr_t *instr,
+                         uint8_t *refs[RS_INSTR_MAX_USES]);
+
+/**
+ * @brief Gets the virtual register written by an instruction.
+ * @param[in] instr The instruction to inspect.
+ * @param[out] vreg Receives the defined virtual register.
+ * @return `true` if the instruction defines a virtual register.
+ */
+bool rs_instr_def(rs_instr_t instr, uint8_t *vreg);
+
+/**
+ * @brief Collects the successor blocks of a terminator instruction.
+ * @param[in] instr The instruction to inspect.
+ * @param[out] successors Receives up to two successor block IDs.
+ * @return The number of successors written to @p successors.
+ */
+size_t rs_instr_successors(rs_instr_t instr, size_t successors[2]);
+
+/**
+ * @struct rs_def_use_t
+ * @brief Definition and use counts of every virtual register.
+ */
+typedef struct {
+  size_t use_count[RS_MAX_REGS]; /**< Number of reads of each register. */
+  size_t def_count[RS_MAX_REGS]; /**< Number of writes to each register. */
+  size_t def_block[RS_MAX_REGS]; /**< Block of the last definition. */
+  size_t def_index[RS_MAX_REGS]; /**< Index of the last definition within
+                                    its block. */
+} rs_def_use_t;
+
+/**
+ * @brief Counts definitions and uses of every virtual register.
+ * @param[in] rs The Runestone state.
+ * @param[out] def_use The counts to fill in.
+ */
+void rs_compute_def_use(rs_t *rs, rs_def_use_t *def_use);
+
+/**
+ * @brief Gets the unique instruction defining a virtual register.
+ * @param[in] rs The Runestone state.
+ * @param[in] def_use Counts from `rs_compute_def_use`.
+ * @param[in] vreg The virtual register.
+ * @return The defining instruction, or NULL if @p vreg is not defined
+ * exactly once.
+ */
+rs_instr_t *rs_unique_def(rs_t *rs, const rs_def_use_t *def_use,
+                          uint8_t vreg);
+
+/**
+ * @brief Computes live-in and live-out sets for the blocks in the window.
+ * @param[in] rs The Runestone state.
+ * @param[out] liveness The liveness information to fill in. Must be released
+ * with `rs_liveness_free`.
+ */
+void rs_compute_liveness(rs_t *rs, rs_liveness_t *liveness);
+
+/**
+ * @brief Frees the memory held by liveness information.
+ * @param[inout] liveness The liveness information to free.
+ */
+void rs_liveness_free(rs_liveness_t *liveness);
+
+/**
+ * @struct rs_pressure_t
+ * @brief Register pressure at every instruction of the window.
  *
- * This function outputs a complete dump of the Runestone instance to the
- * specified file stream, including its internal state, instructions, and any
- * relevant information for debugging or analysis.
+ * A register counts from its first to its last occurrence in a block, or
+ * from the block's start or to its end when it is live in or out, so a
+ * source dying at an instruction and that instruction's result both count.
+ */
+typedef struct {
+  cvector(size_t) points; /**< Pressure at each instruction, block after
+                             block. */
+  cvector(size_t) block_start; /**< Index into `points` of each block's first
+                                  instruction, indexed like the control flow
+                                  graph, with one extra entry for the end. */
+  size_t max; /**< Highest pressure in the window. */
+} rs_pressure_t;
+
+/**
+ * @brief Computes the pressure profile of the window.
  *
- * @param rs A pointer to the Runestone instance to be dumped.
- * @param fp A pointer to the `FILE` object where the dump will be written.
+ * Each register contributes a start and an end event, bucketed by
+ * instruction, so one sweep per block yields the profile in time linear in
+ * its instructions and registers.
+ *
+ * @param[in] rs The Runestone state.
+ * @param[in] liveness Live sets of the window.
+ * @param[out] pressure The profile to fill in. Must be released with
+ * `rs_pressure_free`.
+ * @return `false` if the profile could not be allocated, leaving it empty.
  */
-void rs_dump(rs_t *rs, FILE *fp);
+bool rs_compute_pressure(rs_t *rs, const rs_liveness_t *liveness,
+                         rs_pressure_t *pressure);
 
 /**
- * @brief Generates target-specific code.
- * @param[inout] rs The Runestone state.
- * @param[out] fp The file to write the generated code to.
+ * @brief Frees the memory held by a pressure profile.
+ * @param[inout] pressure The profile to free.
+ */
+void rs_pressure_free(rs_pressure_t *pressure);
+
+/**
+ * @brief Gets the pressure at an instruction.
+ * @param[in] pressure A profile from `rs_compute_pressure`.
+ * @param[in] local The block ID minus `rs_t::window_begin`.
+ * @param[in] index The index of the instruction within its block.
+ * @return The number of registers live there.
+ */
+static inline size_t rs_pressure_at(const rs_pressure_t *pressure,
+                                    size_t local, size_t index) {
+  return pressure->points[pressure->block_start[local] + index];
+}
+
+/**
+ * @brief Gets the highest pressure within a block.
+ * @param[in] pressure A profile from `rs_compute_pressure`.
+ * @param[in] local The block ID minus `rs_t::window_begin`.
+ * @return The maximum over the block's instructions, 0 if it is empty.
+ */
+size_t rs_pressure_block_max(const rs_pressure_t *pressure, size_t local);
+
+/**
+ * @struct rs_cfg_node_t
+ * @brief The edges of a block in the control flow graph.
+ */
+typedef struct {
+  size_t successors[2];         /**< Successor block IDs. */
+  size_t successor_count;       /**< Number of successors. */
+  cvector(size_t) predecessors; /**< Predecessor block IDs in the window. */
+} rs_cfg_node_t;
+
+/** Control flow graph, indexed by block ID minus `rs_t::window_begin`. */
+typedef cvector(rs_cfg_node_t) rs_cfg_t;
+
+/**
+ * @brief Analyses of the window, computed on demand.
+ */
+struct rs_analyses {
+  unsigned valid;         /**< Mask of the analyses that are up to date. */
+  rs_cfg_t cfg;           /**< See `rs_get_cfg`. */
+  rs_def_use_t def_use;   /**< See `rs_get_def_use`. */
+  rs_liveness_t liveness; /**< See `rs_get_liveness`. */
+  cvector(size_t) idom;   /**< See `rs_get_dominators`. */
+  rs_pressure_t pressure; /**< See `rs_get_pressure`. */
+};
+
+/**
+ * @brief Gets the control flow graph of the window.
+ *
+ * Like every cached analysis, it stays valid until a pass declaring that it
+ * changes it runs, `rs_invalidate_analyses` is called, or `rs_run_passes`
+ * starts over.
+ *
+ * @param[inout] rs The Runestone state.
+ * @return The graph, or NULL if it could not be allocated.
+ */
+const rs_cfg_t *rs_get_cfg(rs_t *rs);
+
+/**
+ * @brief Gets the definition and use counts of the window.
+ * @param[inout] rs The Runestone state.
+ * @return The counts, or NULL if they could not be allocated.
+ */
+const rs_def_use_t *rs_get_def_use(rs_t *rs);
+
+/**
+ * @brief Gets the liveness of the window.
+ * @param[inout] rs The Runestone state.
+ * @return The live sets, or NULL if they could not be allocated.
+ */
+const rs_liveness_t *rs_get_liveness(rs_t *rs);
+
+/**
+ * @brief Gets the immediate dominators of the window's blocks.
+ *
+ * The first block of the window is the entry.
+ *
+ * @param[inout] rs The Runestone state.
+ * @return The immediate dominator of each block, indexed like the control
+ * flow graph, with `SIZE_MAX` for the entry and unreachable blocks. NULL if
+ * it could not be allocated.
+ */
+const size_t *rs_get_dominators(rs_t *rs);
+
+/**
+ * @brief Gets the register pressure profile of the window.
+ *
+ * It is derived from liveness, and goes out of date with it.
+ *
+ * @param[inout] rs The Runestone state.
+ * @return The profile, or NULL if it could not be allocated.
+ */
+const rs_pressure_t *rs_get_pressure(rs_t *rs);
+
+/**
+ * @brief Marks cached analyses as out of date.
+ * @param[inout] rs The Runestone state.
+ * @param[in] analyses A mask of `RS_ANALYSIS_BIT`s.
+ */
+void rs_invalidate_analyses(rs_t *rs, unsigned analyses);
+
+/**
+ * @brief Frees the cached analyses.
+ * @param[inout] rs The Runestone state.
+ */
+void rs_free_analyses(rs_t *rs);
+
+/**
+ * @brief Measures a pass, see `rs_pass_end`.
+ */
+typedef struct {
+  uint64_t start;         /**< Monotonic start time in nanoseconds. */
+  rs_alloc_stats_t alloc; /**< Allocations of the thread at the start. */
+} rs_pass_timer_t;
+
+/**
+ * @brief Starts measuring a pass or analysis.
+ * @return The measurement to pass to `rs_pass_end`.
+ */
+rs_pass_timer_t rs_pass_begin(void);
+
+/**
+ * @brief Adds the cost of a pass or analysis to its statistics and trace.
+ * @param[inout] rs The Runestone state.
+ * @param[in] stat The `rs_pass_id_t`, or `RS_PASS_COUNT` plus the
+ *            `rs_analysis_t`.
+ * @param[in] timer The measurement from `rs_pass_begin`.
+ */
+void rs_pass_end(rs_t *rs, size_t stat, rs_pass_timer_t timer);
+
+/**
+ * @brief Gets the accumulated cost of every pass and analysis.
+ * @param[in] rs The Runestone state.
+ * @param[out] count Receives `RS_PASS_STATS_COUNT`.
+ * @return The statistics, passes in `RS_PASSES` order, then analyses in
+ * `RS_ANALYSES` order.
+ */
+const rs_pass_stats_t *rs_get_pass_stats(const rs_t *rs, size_t *count);
+
+/**
+ * @brief Clears the statistics of every pass and analysis.
+ * @param[inout] rs The Runestone state.
+ */
+void rs_reset_pass_stats(rs_t *rs);
+
+/**
+ * @brief Starts recording register allocation reports for a context.
+ *
+ * Every later compilation, `rs_run_passes` included, appends a report of the
+ * function it compiled. Streamed windows extend the report of their
+ * function. Recording costs a pressure analysis per compilation.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_alloc_report_enable(rs_t *rs);
+
+/**
+ * @brief Gets the register allocation reports recorded so far.
+ * @param[in] rs The Runestone state.
+ * @param[out] count Receives the number of reports.
+ * @return The reports, oldest first.
+ */
+const rs_alloc_report_t *rs_get_alloc_report(const rs_t *rs, size_t *count);
+
+/**
+ * @brief Discards the recorded register allocation reports.
+ * @param[inout] rs The Runestone state.
+ */
+void rs_reset_alloc_report(rs_t *rs);
+
+/**
+ * @brief Writes the recorded register allocation reports as JSON.
+ * @param[in] rs The Runestone state.
+ * @param[inout] fp The file to write to.
+ * @return `false` if writing failed.
+ */
+bool rs_alloc_report_write_json(const rs_t *rs, FILE *fp);
+
+/**
+ * @brief Opens the report of the window about to be compiled, when recording.
+ * @param[inout] rs The Runestone state.
+ */
+void rs_alloc_report_begin(rs_t *rs);
+
+/**
+ * @brief Counts the allocated window into its report, when recording.
+ * @param[inout] rs The Runestone state.
+ */
+void rs_alloc_report_end(rs_t *rs);
+
+/**
+ * @brief Gets the statistics of a block in the report being recorded.
+ *
+ * Allocators count what only they know, like rematerializations, here.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] block_id A block of the window being compiled.
+ * @return The statistics, or NULL when no report is being recorded.
+ */
+rs_regalloc_stats_t *rs_alloc_report_block(rs_t *rs, size_t block_id);
+
+/**
+ * @brief Makes generated code count the executions of every block.
+ *
+ * Code generated afterwards increments `counters[block_id]` on entry to each
+ * block below `count`, atomically (`lock inc` on x86-64) when `atomic` and
+ * with a plain increment otherwise. The counters stay owned by the caller and
+ * must outlive the code. Passing NULL stops instrumenting.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] counters One counter per block, or NULL.
+ * @param[in] count Number of counters.
+ * @param[in] atomic Whether threads may run the code concurrently.
+ */
+void rs_instrument_blocks(rs_t *rs, uint64_t *counters, size_t count,
+                          bool atomic);
+
+/**
+ * @brief Writes the block counters of the current function as a profile.
+ *
+ * Each block gets a line of its function symbol, block ID and count, so the
+ * profiles of several functions can share a file.
+ *
+ * @param[in] rs The Runestone state, instrumented by `rs_instrument_blocks`.
+ * @param[inout] fp The file to write to.
+ * @return `false` if the state is not instrumented or writing failed.
+ */
+bool rs_write_profile(const rs_t *rs, FILE *fp);
+
+/**
+ * @brief Loads the block frequencies of the current function from a profile.
+ *
+ * Reads the lines `rs_write_profile` wrote for `rs_get_symbol`, replacing any
+ * profile loaded before. Graph coloring then weighs spill costs by how often
+ * each block ran, and the scheduler leaves blocks that never ran alone.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[inout] fp The file to read.
+ * @return `false` if the profile is malformed.
+ */
+bool rs_load_profile(rs_t *rs, FILE *fp);
+
+/**
+ * @brief Gets how often a block ran according to the loaded profile.
+ * @param[in] rs The Runestone state.
+ * @param[in] block_id The block.
+ * @return The count, 0 for blocks the profile does not mention, or 1 for every
+ *         block when no profile is loaded.
+ */
+uint64_t rs_get_block_frequency(const rs_t *rs, size_t block_id);
+
+/**
+ * @brief Checks whether a memory operand can be encoded by a target.
+ * @param[in] target The code generation target.
+ * @param[in] operand A memory operand.
+ * @return `true` if the target's load and store instructions accept the
+ * combination of base, index, scale and displacement.
+ */
+bool rs_target_supports_address(rs_target_t target, rs_operand_t operand);
+
+/**
+ * @brief Folds address arithmetic into the memory operands of loads and
+ * stores.
+ *
+ * Walks the definitions of each `load` and `store` address through `add` of
+ * registers, `add` or `sub` of constants and `mult` by 1, 2, 4 or 8, building
+ * a `base + index * scale + disp` operand as long as the target can encode
+ * it. Arithmetic left without other users is deleted.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_match_addresses(rs_t *rs);
+
+/**
+ * @brief Folds immediates and single-use loads into x86-64 operands.
+ *
+ * Instruction selection for x86-64 targets, run before register allocation.
+ * Single-use loads feeding the second source of `add`, `sub`, `mult` or a
+ * comparison are folded into a memory operand (`add reg, [addr]`), and
+ * single-use immediate loads are folded as immediates when they fit in a
+ * sign-extended 32-bit field. Immediates that do not fit are materialized
+ * with a `move` into a fresh register, which is the only case that still
+ * costs a separate instruction. Comparisons with an immediate first operand
+ * are mirrored so the immediate ends up second.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_fold_operands(rs_t *rs);
+
+/**
+ * @brief Checks whether an opcode is lowered to a two-address instruction
+ * whose destination doubles as its first source on two-address targets.
+ * @param[in] opcode The opcode to check.
+ * @return `true` for `add`, `sub` and `mult`.
+ */
+bool rs_opcode_is_two_address(rs_opcode_t opcode);
+
+/**
+ * @brief Ties destinations of two-address operations to a dying source.
+ *
+ * For every `add`, `sub` and `mult` the destination is tied to `src1` when
+ * `src1` is not live after the instruction. When only `src2` dies and the
+ * operation is commutative the sources are swapped first, as they are when
+ * `src1` is an immediate. The register allocators honor the ties in
+ * `rs_t::tied` by giving both registers the same physical register where they
+ * can, letting the backend emit a single instruction instead of a copy
+ * followed by the operation.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_tie_two_address(rs_t *rs);
+
+/**
+ * @brief Reorders the instructions of each block to hide latencies.
+ *
+ * Builds a dependency graph per block from register definitions and uses and
+ * from memory accesses (loads may pass loads, nothing passes a store or a
+ * call) and list schedules it, preferring the instruction with the longest
+ * latency-weighted path to the end of the block. Once the live registers reach
+ * `rs_get_register_count` it picks the ready instruction that frees the most
+ * registers instead, so scheduling does not cause spills on its own. The
+ * terminator stays last, and the comparison right before a conditional branch
+ * stays with it so the backend can still fuse them.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_schedule(rs_t *rs);
+
+/**
+ * @brief Allocates registers by graph coloring.
+ *
+ * Builds an interference graph from block liveness and runs iterated register
+ * coalescing (simplify, coalesce, freeze and spill with optimistic coloring).
+ * Registers that cannot be colored are assigned stack slots and the affected
+ * instructions are rewritten with `spill` and `reload` before retrying. The
+ * results are written to the register map, replacing whatever
+ * `rs_analyze_lifetimes` would have produced.
+ *
+ * Spill costs are weighted by the loaded profile, or without one by the loop
+ * nesting of each block, found from `rs_get_dominators`. Sets `rs_t::failed`
+ * if liveness cannot be computed or the spills do not resolve.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_color_registers(rs_t *rs);
+
+/**
+ * @brief Allocates a stack slot to every virtual register.
+ *
+ * The allocator behind `RS_OPT_O0`. Every virtual register lives in the
+ * slot after the parameters' at its own index. Instructions are rewritten to
+ * reload their sources into scratch registers and spill their result, so the
+ * scratch registers never outlive an instruction and need no liveness.
+ *
+ * @param[inout] rs The Runestone state.
+ */
+void rs_assign_stack_slots(rs_t *rs);
+
+/**
+ * @brief Finalizes the given Runestone instance.
+ *
+ * This function performs any necessary cleanup and resource deallocation for
+ * the given Runestone instance. It is typically called when the Runestone
+ * instance is no longer needed to ensure all resources are properly freed and
+ * any other finalization tasks are completed.
+ *
+ * @param rs A pointer to the Runestone instance that is to be finalized.
+ */
+void rs_finalize(rs_t *rs);
+
+/**
+ * @brief Dumps the disassembled representation of a single instruction.
+ *
+ * This function formats and outputs the disassembled representation of a single
+ * instruction from the given Runestone instance. The instruction is written to
+ * the provided file stream.
+ *
+ * @param rs A pointer to the Runestone instance containing the instruction.
+ * @param fp A pointer to the `FILE` object where the disassembled instruction
+ *           will be written.
+ * @param instr The instruction to be dumped, which is part of the Runestone
+ *              instance.
+ */
+void rs_dump_instr(rs_t *rs, FILE *fp, rs_instr_t instr);
+/**
+ * @brief Dumps the entire Runestone instance.
+ *
+ * This function outputs a complete dump of the Runestone instance to the
+ * specified file stream, including its internal state, instructions, and any
+ * relevant information for debugging or analysis.
+ *
+ * @param rs A pointer to the Runestone instance to be dumped.
+ * @param fp A pointer to the `FILE` object where the dump will be written.
+ */
+void rs_dump(rs_t *rs, FILE *fp);
+
+/**
+ * @brief Operand kinds that instruction selection patterns can accept.
+ *
+ * A pattern constrains each operand of the instructions it covers with a
+ * bitmask of these kinds. An integer operand matches every immediate kind
+ * whose range it fits in.
+ */
+#define RS_KINDS(X)                                                            \
+  X(NULL, 0)    /**< No operand. */                                            \
+  X(REG, 1)     /**< Virtual register. */                                      \
+  X(IMM, 2)     /**< Any 64-bit immediate. */                                  \
+  X(IMM32, 3)   /**< Immediate that sign-extends from 32 bits. */              \
+  X(IMM12, 4)   /**< Immediate in `[0, 4095]`. */                              \
+  X(ADDR, 5)    /**< Absolute address. */                                      \
+  X(MEM, 6)     /**< Memory operand. */                                        \
+  X(SLOT, 7)    /**< Stack slot. */                                            \
+  X(BB, 8)      /**< Basic block reference. */                                 \
+  X(LINK, 9)    /**< Register defined by the first instruction of a fused      \
+                     pattern. */                                               \
+  X(ADDR32, 10) /**< Absolute address that sign-extends from 32 bits. */       \
+  X(SYM, 11)    /**< Symbol. */
+
+/**
+ * @enum rs_kind_t
+ * @brief Bit flags for the operand kinds in `RS_KINDS`.
+ */
+typedef enum {
+#define X(name, bit) RS_KIND_##name = 1u << (bit),
+  RS_KINDS(X)
+#undef X
+} rs_kind_t;
+
+/**
+ * @brief Extra conditions a pattern places on the registers of the
+ *        instruction it covers, after allocation.
+ */
+#define RS_PATTERN_PREDICATES(X)                                               \
+  X(NONE)           /**< No condition. */                                      \
+  X(TIED_SRC1)      /**< `dest` and `src1` share a register. */                \
+  X(TIED_SRC2)      /**< `dest` and `src2` share a register. */                \
+  X(DEST_FREE1)     /**< `src1` does not read `dest`'s register. */            \
+  X(DEST_FREE2)     /**< `src2` does not read `dest`'s register. */            \
+  X(NEGATABLE_SRC2) /**< `-src2` is still a 32-bit immediate. */
+
+/**
+ * @enum rs_pattern_predicate_t
+ * @brief The predicates in `RS_PATTERN_PREDICATES`.
+ */
+typedef enum {
+#define X(name) RS_PATTERN_##name,
+  RS_PATTERN_PREDICATES(X)
+#undef X
+} rs_pattern_predicate_t;
+
+/**
+ * @struct rs_pattern_t
+ * @brief An instruction selection pattern.
+ *
+ * A pattern covers one instruction, or two adjacent instructions where the
+ * second is the only user of the first one's result. Its template is a list
+ * of machine instructions, one per line, written in the target's syntax with
+ * these placeholders:
+ *
+ * - `$d`, `$1`, `$2`, `$3`: the operands of the last covered instruction.
+ * - `$fd`, `$f1`, `$f2`, `$f3`: the operands of the first instruction of a
+ *   fused pattern.
+ * - `$b`: the low byte of `$d`'s register.
+ * - `$F`: the size of the stack frame.
+ * - `$ad`, `$a1`, `$a2`, `$a3`: like `$d` to `$3`, but a caller-saved
+ *   register is replaced by its slot in the save area pushed by `<` lines.
+ * - `$r`: the caller-saved register of a `<` or `>` line.
+ * - `[...]`: a memory operand summing registers, placeholders and integers.
+ * - `=$1`: a constant loaded from the literal pool.
+ *
+ * Lines starting with `?` are only emitted when the function has a frame,
+ * and lines starting with a digit `n` when it reads at least `n` parameters.
+ * Lines starting with `<` are emitted once per `rs_isel_t::caller_saved`
+ * register in order, and lines starting with `>` in reverse order.
+ */
+typedef struct {
+  rs_opcode_t opcodes[2]; /**< Covered opcodes, first `RS_OPCODE_COUNT` for
+                               single-instruction patterns. */
+  uint16_t kinds[2][4];   /**< Accepted `rs_kind_t` masks for `dest`, `src1`,
+                               `src2` and `src3` of each instruction. */
+  rs_pattern_predicate_t predicate; /**< Condition on the last instruction. */
+  uint8_t cost;                     /**< Relative cost of the template. */
+  const char *template;             /**< Machine instructions to emit. */
+} rs_pattern_t;
+
+/// @brief Pattern operand kinds for `dest`, `src1`, `src2` and `src3`.
+#define RS_PATTERN_KINDS(dest, src1, src2, src3) {dest, src1, src2, src3}
+
+/// @brief Declares a pattern covering a single instruction.
+#define RS_PATTERN(opcode, kinds, predicate, cost, template)                   \
+  {{RS_OPCODE_COUNT, RS_OPCODE_##opcode},                                      \
+   {{0}, RS_PATTERN_KINDS kinds},                                              \
+   RS_PATTERN_##predicate,                                                     \
+   cost,                                                                       \
+   template},
+
+/// @brief Declares a pattern fusing two instructions.
+#define RS_FUSED_PATTERN(first, first_kinds, opcode, kinds, predicate, cost,   \
+                         template)                                             \
+  {{RS_OPCODE_##first, RS_OPCODE_##opcode},                                    \
+   {RS_PATTERN_KINDS first_kinds, RS_PATTERN_KINDS kinds},                     \
+   RS_PATTERN_##predicate,                                                     \
+   cost,                                                                       \
+   template},
+
+/**
+ * @brief Machine operand types produced by rendering a pattern template.
+ */
+#define RS_MOPERAND_TYPES(X)                                                   \
+  X(NONE)    /**< No operand. */                                               \
+  X(REG)     /**< Machine register. */                                         \
+  X(REG8)    /**< Low byte of a machine register. */                           \
+  X(IMM)     /**< Immediate. */                                                \
+  X(MEM)     /**< Memory at `base + index * scale + disp`. */                  \
+  X(LABEL)   /**< Basic block label. */                                        \
+  X(SYMBOL)  /**< Symbol such as a function name. */                           \
+  X(POOL)    /**< Constant loaded from the literal pool. */                    \
+  X(LITERAL) /**< Target-specific token such as a condition code. */
+
+/**
+ * @enum rs_moperand_type_t
+ * @brief The machine operand types in `RS_MOPERAND_TYPES`.
+ */
+typedef enum {
+#define X(name) RS_MOPERAND_##name,
+  RS_MOPERAND_TYPES(X)
+#undef X
+} rs_moperand_type_t;
+
+/** Value representing the absence of a machine register. */
+#define RS_NO_MREG UINT8_MAX
+
+/**
+ * @struct rs_moperand_t
+ * @brief An operand of a machine instruction.
+ *
+ * Machine registers index the target's `rs_isel_t::reg_names`, where the
+ * `RS_TARGETS` count of allocatable registers comes first.
+ */
+typedef struct {
+  rs_moperand_type_t type; /**< The type of the operand. */
+  union {
+    uint8_t reg;        /**< Machine register. */
+    int64_t imm;        /**< Immediate or literal pool value. */
+    struct {
+      uint8_t base;  /**< Base register, or `RS_NO_MREG`. */
+      uint8_t index; /**< Index register, or `RS_NO_MREG`. */
+      uint8_t scale; /**< Index scale: 1, 2, 4 or 8. */
+      int64_t disp;  /**< Signed displacement. */
+    } mem;              /**< Memory reference. */
+    size_t label;       /**< Basic block ID. */
+    const char *symbol; /**< Symbol name. */
+    struct {
+      const char *text; /**< Start of the token in the template. */
+      size_t length;    /**< Length of the token. */
+    } literal;          /**< Literal token. */
+  };
+} rs_moperand_t;
+
+/** Maximum number of operands of a machine instruction. */
+#define RS_MINSTR_MAX_OPERANDS 3
+
+/**
+ * @struct rs_minstr_t
+ * @brief A selected machine instruction.
+ */
+typedef struct {
+  char mnemonic[8];                               /**< Mnemonic. */
+  uint8_t operand_count;                          /**< Operands in use. */
+  bool lock;                                      /**< Has a `lock` prefix. */
+  rs_moperand_t operands[RS_MINSTR_MAX_OPERANDS]; /**< The operands. */
+} rs_minstr_t;
+
+typedef cvector(rs_minstr_t) rs_minstrs_t;
+
+/**
+ * @struct rs_isel_t
+ * @brief Instruction selection description of a target.
+ */
+typedef struct {
+  const rs_pattern_t *patterns; /**< Pattern table. */
+  size_t pattern_count;         /**< Number of patterns. */
+  const char **reg_names;       /**< Machine register names. */
+  size_t reg_count;             /**< Number of machine registers. */
+  const char **byte_reg_names;  /**< Low byte register names, or NULL. */
+  uint8_t stack_reg;            /**< Stack pointer register. */
+  size_t frame_alignment;       /**< Alignment of the stack frame. */
+  const char *prologue;         /**< Template emitted on function entry. */
+  const uint8_t *caller_saved;  /**< Allocatable registers a call clobbers. */
+  size_t caller_saved_count;    /**< Number of caller-saved registers. */
+  const char *counter;          /**< Template incrementing the block counter
+                                   at address `$1`. */
+  const char *atomic_counter;   /**< The same, safe against other threads. */
+} rs_isel_t;
+
+/**
+ * @brief Returns the instruction selection description of a target.
+ * @param[in] target The target.
+ * @return The target's description, or NULL for an invalid target.
+ */
+const rs_isel_t *rs_get_isel(rs_target_t target);
+
+/**
+ * @brief Returns the size of the stack frame, aligned for the target.
+ * @param[in] rs The Runestone state.
+ * @return The frame size in bytes.
+ */
+size_t rs_frame_size(rs_t *rs);
+
+/**
+ * @brief Selects the cheapest pattern covering an instruction.
+ *
+ * Considers every single-instruction pattern for `instrs[0]` and every fused
+ * pattern covering `instrs[0]` and `instrs[1]`, and prefers a fused pattern
+ * when it is cheaper than covering both instructions separately.
+ *
+ * @param[in] rs The Runestone state, after register allocation.
+ * @param[in] def_use Use counts of the function, or NULL to disable fusion.
+ * @param[in] instrs The remaining instructions of the basic block.
+ * @param[in] count Number of remaining instructions.
+ * @param[out] length The number of instructions covered.
+ * @return The selected pattern, or NULL if no pattern matches.
+ */
+const rs_pattern_t *rs_select_pattern(rs_t *rs, const rs_def_use_t *def_use,
+                                      const rs_instr_t *instrs, size_t count,
+                                      size_t *length);
+
+/**
+ * @brief Renders a pattern template into machine instructions.
+ * @param[in] rs The Runestone state, after register allocation.
+ * @param[in] template The template to render.
+ * @param[in] instrs The covered instructions, the last one being the root.
+ * @param[in] count Number of covered instructions.
+ * @param[inout] out The machine instructions are appended here.
+ */
+void rs_render_template(rs_t *rs, const char *template,
+                        const rs_instr_t *instrs, size_t count,
+                        rs_minstrs_t *out);
+
+/**
+ * @brief Renders the counter increment of a block, when instrumenting.
+ * @param[in] rs The Runestone state.
+ * @param[in] block_id The block being rendered.
+ * @param[inout] out The machine instructions are appended here.
+ */
+void rs_render_block_counter(rs_t *rs, size_t block_id, rs_minstrs_t *out);
+
+/**
+ * @brief Lowers an IR operand to a machine operand.
+ * @param[in] rs The Runestone state, after register allocation.
+ * @param[in] operand The operand to lower.
+ * @param[in] dereference Whether to produce the memory at the operand.
+ * @return The machine operand.
+ */
+rs_moperand_t rs_lower_operand(rs_t *rs, rs_operand_t operand,
+                               bool dereference);
+
+/** Execution ports of the x86-64 cost model. */
+#define RS_COST_PORTS 8
+
+/**
+ * @struct rs_block_cost_t
+ * @brief Static cost estimate of the machine code of a block.
+ *
+ * Models a Skylake-class core: four micro-ops issue per cycle, to ports 0, 1,
+ * 5 and 6 for arithmetic, 2 and 3 for loads and addresses, 4 for store data
+ * and 7 for store addresses. Each micro-op goes to the least busy port
+ * that can run it.
+ */
+typedef struct {
+  size_t instructions; /**< Machine instructions. */
+  size_t uops;         /**< Fused-domain micro-ops. */
+  size_t latency;      /**< Cycles along the longest dependency chain through
+                          registers, flags and forwarded stores. */
+  double throughput;   /**< Reciprocal throughput in cycles: the busiest
+                          port, or the issue width if that binds first. */
+  double ports[RS_COST_PORTS]; /**< Micro-ops sent to each port. */
+} rs_block_cost_t;
+
+/**
+ * @brief Estimates the cost of the machine code of a block.
+ *
+ * The block is lowered as the backend would emit it, so the passes must have
+ * run. Only x86-64 targets have a cost model.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] block_id The block.
+ * @param[out] cost The estimate.
+ * @return `false` if the target has no cost model or a pattern is missing.
+ */
+bool rs_estimate_block_cost(rs_t *rs, size_t block_id, rs_block_cost_t *cost);
+
+/**
+ * @brief Estimates the cost of x86-64 machine instructions.
+ * @param[in] minstrs The instructions, in program order.
+ * @param[in] count The number of instructions.
+ * @param[out] cost The estimate.
+ */
+void rs_x86_64_minstrs_cost(const rs_minstr_t *minstrs, size_t count,
+                            rs_block_cost_t *cost);
+
+/**
+ * @brief Lowers a block like the backend and estimates its cost.
+ * @param[inout] rs The Runestone state.
+ * @param[in] def_use Use counts for fusion, or NULL as at O0.
+ * @param[in] block_id The block.
+ * @param[out] cost The estimate.
+ * @return `false` if a pattern is missing.
+ */
+bool rs_x86_64_block_cost(rs_t *rs, const rs_def_use_t *def_use,
+                          size_t block_id, rs_block_cost_t *cost);
+
+/**
+ * @brief Initializes an emitter writing to a stdio stream.
+ * @param[out] out The emitter.
+ * @param[in] fp The stream.
+ */
+void rs_emitter_init_file(rs_emitter_t *out, FILE *fp);
+
+/**
+ * @brief Initializes an emitter collecting text in memory.
+ * @param[out] out The emitter.
+ */
+void rs_emitter_init_buffer(rs_emitter_t *out);
+
+/**
+ * @brief Initializes an emitter writing to a file descriptor.
+ * @param[out] out The emitter.
+ * @param[in] fd The descriptor, which the emitter does not close.
+ */
+void rs_emitter_init_fd(rs_emitter_t *out, int fd);
+
+/**
+ * @brief Writes the staged text to the sink.
+ * @param[inout] out The emitter.
+ * @return `false` if any write or allocation has failed.
+ */
+bool rs_emitter_flush(rs_emitter_t *out);
+
+/**
+ * @brief Flushes the emitter and releases its buffer.
+ * @param[inout] out The emitter.
+ * @return `false` if any write or allocation has failed.
+ */
+bool rs_emitter_free(rs_emitter_t *out);
+
+/**
+ * @brief Emits `length` bytes of text.
+ * @param[inout] out The emitter.
+ * @param[in] text The text.
+ * @param[in] length The number of bytes to emit.
+ */
+void rs_emit(rs_emitter_t *out, const char *text, size_t length);
+
+/**
+ * @brief Emits a NUL-terminated string.
+ * @param[inout] out The emitter.
+ * @param[in] text The string.
+ */
+void rs_emit_str(rs_emitter_t *out, const char *text);
+
+/**
+ * @brief Emits a single character.
+ * @param[inout] out The emitter.
+ * @param[in] c The character.
+ */
+void rs_emit_char(rs_emitter_t *out, char c);
+
+/**
+ * @brief Emits an unsigned integer without a prefix.
+ * @param[inout] out The emitter.
+ * @param[in] value The integer.
+ * @param[in] base The base, from 2 to 16.
+ */
+void rs_emit_uint(rs_emitter_t *out, uint64_t value, unsigned base);
+
+/**
+ * @brief Emits a signed decimal integer.
+ * @param[inout] out The emitter.
+ * @param[in] value The integer.
+ */
+void rs_emit_int(rs_emitter_t *out, int64_t value);
+
+/**
+ * @brief Emits an instruction in the format of `rs_dump`.
+ * @param[in] rs The Runestone state.
+ * @param[inout] out The emitter.
+ * @param[in] instr The instruction.
+ */
+void rs_emit_instr(rs_t *rs, rs_emitter_t *out, rs_instr_t instr);
+
+/**
+ * @brief Emits the comment describing an instruction, as `rs->verbosity`
+ *        asks for.
+ *
+ * At `RS_VERBOSITY_REGALLOC` the registers must already be allocated, so
+ * backends call this after rendering the instruction's template.
+ *
+ * @param[in] rs The Runestone state.
+ * @param[inout] out The emitter.
+ * @param[in] prefix The indentation and comment marker of the target.
+ * @param[in] instr The instruction.
+ */
+void rs_emit_comment(rs_t *rs, rs_emitter_t *out, const char *prefix,
+                     rs_instr_t instr);
+
+/**
+ * @brief Runs the passes that prepare a function for emission.
+ *
+ * Finalizes the IR, matches addressing modes, applies the target's operand
+ * folding and allocates registers, skipping the rewrites at `RS_OPT_O0`.
+ * `rs_generate` and `rs_generate_binary`
+ * call it before emitting code. The cached analyses are discarded first,
+ * since the IR may have changed since the last run, and each pass then
+ * invalidates those it declares to change. A pass that fails, like graph
+ * coloring running out of vregs for its spill temporaries, stops the run.
+ *
+ * @param[inout] rs The Runestone state.
+ * @return `false` if a pass failed, leaving nothing fit to emit.
+ */
+bool rs_run_passes(rs_t *rs);
+
+/**
+ * @brief Generates target-specific code.
+ * @param[inout] rs The Runestone state.
+ * @param[out] fp The file to write the generated code to.
+ * @return `false` if a pass failed or the code could not be written.
+ */
+bool rs_generate(rs_t *rs, FILE *fp);
+
+/** Number of ready blocks that makes `rs_seal_basic_block` flush them. */
+#define RS_STREAM_WINDOW 64
+
+/**
+ * @brief Starts generating code while the function is being built.
+ *
+ * Instead of building the whole function and calling `rs_generate`, the
+ * frontend seals blocks with `rs_seal_basic_block` as it completes them. The
+ * passes run over a window of sealed blocks whose successors have all been
+ * appended, the window is emitted, and its instructions are freed, so memory
+ * stays bounded however many blocks the function has.
+ *
+ * Values must not stay in virtual registers across a flush, since their
+ * numbers are reused afterwards; pass them through memory instead. Streaming
+ * uses the linear register allocator and only produces text.
+ *
+ * @param[inout] rs The Runestone state, without any blocks.
+ * @param[inout] out The emitter to write the generated code to. It must stay
+ *               valid until `rs_stream_end`.
+ * @return `false` if streaming cannot start.
+ */
+bool rs_stream_begin(rs_t *rs, rs_emitter_t *out);
+
+/**
+ * @brief Marks a basic block as complete.
+ *
+ * A sealed block must end with a terminator and may no longer be built into.
+ * While streaming, this flushes the ready blocks once there are
+ * `RS_STREAM_WINDOW` of them.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[in] block_id The block to seal.
+ */
+void rs_seal_basic_block(rs_t *rs, size_t block_id);
+
+/**
+ * @brief Generates code for every ready block and frees their instructions.
+ *
+ * A block is ready once it and all blocks before it are sealed and all its
+ * successors have been appended.
+ *
+ * @param[inout] rs The Runestone state.
+ * @return `false` if writing the code failed.
+ */
+bool rs_stream_flush(rs_t *rs);
+
+/**
+ * @brief Flushes the remaining blocks and stops streaming.
+ * @param[inout] rs The Runestone state, with every block sealed.
+ * @return `false` if a block is not sealed or writing the code failed.
+ */
+bool rs_stream_end(rs_t *rs);
+
+/**
+ * @brief Generates target-specific code into an emitter.
+ *
+ * `rs_generate` is this function with a `RS_SINK_FILE` emitter. The emitter
+ * is flushed but stays initialized.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[inout] out The emitter to write the generated code to.
+ * @return `false` if a pass failed or writing the code failed.
+ */
+bool rs_generate_to(rs_t *rs, rs_emitter_t *out);
+
+/** A growable buffer of machine code bytes. */
+typedef cvector(uint8_t) rs_buffer_t;
+
+/**
+ * @struct rs_relocation_t
+ * @brief A call whose target was not known when it was encoded.
+ */
+typedef struct {
+  size_t offset;      /**< Position of the `rel32` in the buffer. */
+  const char *symbol; /**< The called symbol. */
+} rs_relocation_t;
+
+typedef cvector(rs_relocation_t) rs_relocations_t;
+
+/**
+ * @brief Generates machine code for the target without an assembler.
+ *
+ * Only `RS_TARGET_X86_64_LINUX_NASM` has an encoder. The code is appended to
+ * `buf`, which the caller releases with `cvector_free`.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[inout] buf The buffer to append the machine code to.
+ * @return `true` on success, `false` if a pass failed or an instruction could
+ *         not be encoded.
+ */
+bool rs_generate_binary(rs_t *rs, rs_buffer_t *buf);
+
+/**
+ * @brief Encodes the selected x86-64 instructions of a function.
+ *
+ * Instructions are selected with the x86-64 pattern table and encoded with
+ * REX, ModRM and SIB bytes. Branches between blocks start out as `rel8` and
+ * are widened to `rel32` until every displacement fits. The callee-saved
+ * registers in use are pushed on entry and popped before every `ret`, so the
+ * code can be called as a SysV function returning in `rax`.
+ *
+ * Calls are encoded with a zero `rel32` and recorded in `relocations`, which
+ * `rs_resolve_x86_64` patches once the callee's position is known.
+ *
+ * @param[in] rs The Runestone state, after `rs_run_passes`.
+ * @param[inout] buf The buffer to append the machine code to.
+ * @param[out] block_offsets Offset of each basic block from the start of the
+ *             code, or NULL.
+ * @param[inout] relocations The list to append the calls to.
+ * @return `true` on success, `false` if an instruction could not be encoded.
+ */
+bool rs_encode_x86_64(rs_t *rs, rs_buffer_t *buf, size_t *block_offsets,
+                      rs_relocations_t *relocations);
+
+/**
+ * @brief Points the calls to a symbol at its position in the buffer.
+ *
+ * The resolved calls are removed from `relocations`.
+ *
+ * @param[inout] buf The encoded code.
+ * @param[inout] relocations The unresolved calls.
+ * @param[in] symbol The symbol to resolve.
+ * @param[in] offset Position of the symbol in `buf`.
+ */
+void rs_resolve_x86_64(rs_buffer_t buf, rs_relocations_t *relocations,
+                       const char *symbol, size_t offset);
+
+/**
+ * @brief Writes an ELF64 relocatable object file.
+ *
+ * The object has `.text`, `.rela.text`, `.symtab` and `.strtab` sections. The
+ * function is a global symbol named after `rs_t::symbol`, and every basic
+ * block is a local symbol named like the NASM local label,
+ * `<function>.<block>`. Calls to other symbols are left undefined and
+ * relocated with `R_X86_64_PLT32`. Only `RS_TARGET_X86_64_LINUX_NASM` is
+ * supported.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[inout] fp The file to write the object to, opened in binary mode.
+ * @return `true` on success, `false` on an encoding or write failure.
+ */
+bool rs_generate_object(rs_t *rs, FILE *fp);
+
+/** A function compiled by `rs_jit_compile`. */
+typedef int64_t (*rs_jit_fn_t)(void);
+
+/**
+ * @brief Compiles the function into executable memory.
+ *
+ * The code is encoded with `rs_generate_binary` into pages mapped read-write,
+ * which are then remapped read-execute. The function takes no arguments and
+ * returns its `ret` value following the SysV calling convention. Only
+ * available for `RS_TARGET_X86_64_LINUX_NASM` on Linux x86-64 hosts.
+ *
+ * @param[inout] rs The Runestone state.
+ * @return The compiled function, or NULL on failure. Release it with
+ *         `rs_jit_free`.
+ */
+rs_jit_fn_t rs_jit_compile(rs_t *rs);
+
+/**
+ * @brief Releases a function compiled by `rs_jit_compile`.
+ * @param[in] fn The compiled function, or NULL.
+ */
+void rs_jit_free(rs_jit_fn_t fn);
+
+/**
+ * @struct rs_function_t
+ * @brief A function of a module, holding only what differs per function.
+ */
+typedef struct {
+  char *name;                     /**< Symbol of the function. */
+  rs_basic_blocks_t basic_blocks; /**< The function's basic blocks. */
+  ptrdiff_t current_basic_block;  /**< Selected block, or -1. */
+  size_t next_dst_vreg;           /**< Next virtual register to define. */
+  size_t param_count;             /**< Parameters the function reads. */
+  rs_opt_level_t opt_level;       /**< Optimization level it compiles at. */
+  rs_regalloc_t regalloc;         /**< Register allocator it compiles with. */
+} rs_function_t;
+
+typedef cvector(rs_function_t *) rs_functions_t;
+
+/**
+ * @struct rs_module_t
+ * @brief A set of functions sharing one Runestone state.
+ *
+ * The lifetimes, register pool and other pass state of `rs` are only needed
+ * while a function is compiled, so every function uses the same ones. The
+ * selected function's blocks and virtual registers are swapped into `rs`,
+ * where the usual builder functions extend them.
+ */
+typedef struct {
+  rs_t rs;                    /**< State of the selected function. */
+  rs_functions_t functions;   /**< Every function of the module. */
+  ptrdiff_t current_function; /**< Function swapped into `rs`, or -1. */
+} rs_module_t;
+
+/**
+ * @brief Initializes an empty module.
+ * @param[out] module The module to initialize.
+ * @param[in] target The target architecture.
+ */
+void rs_module_init(rs_module_t *module, rs_target_t target);
+
+/**
+ * @brief Frees a module and all of its functions.
+ * @param[inout] module The module to free.
+ */
+void rs_module_free(rs_module_t *module);
+
+/**
+ * @brief Adds a function to a module.
+ * @param[inout] module The module.
+ * @param[in] name The function's symbol, which calls refer to.
+ * @return The ID of the new function, or `SIZE_MAX` on failure.
+ *
+ * The function compiles at the module's current optimization level and
+ * register allocator. Setting either while it is selected changes just it.
+ */
+size_t rs_module_add_function(rs_module_t *module, const char *name);
+
+/**
+ * @brief Selects the function that the builder functions extend.
+ * @param[inout] module The module.
+ * @param[in] function_id The function to select.
+ * @return The state to build the function with, or NULL on failure.
+ */
+rs_t *rs_module_position_at_function(rs_module_t *module, size_t function_id);
+
+/**
+ * @brief Generates the code of every function into an emitter.
+ * @param[inout] module The module.
+ * @param[inout] out The emitter to write the generated code to.
+ * @return `false` if writing the code failed.
+ */
+bool rs_module_generate_to(rs_module_t *module, rs_emitter_t *out);
+
+/**
+ * @brief Generates the code of every function.
+ * @param[inout] module The module.
+ * @param[out] fp The file to write the generated code to.
+ */
+void rs_module_generate(rs_module_t *module, FILE *fp);
+
+/**
+ * @brief Encodes every function of a module one after the other.
+ *
+ * Calls between the functions are resolved. Calls to other symbols are left
+ * in `relocations`.
+ *
+ * @param[inout] module The module.
+ * @param[inout] buf The buffer to append the machine code to.
+ * @param[out] function_offsets Offset of each function in `buf`, or NULL.
+ * @param[inout] relocations The list to append the unresolved calls to.
+ * @return `true` on success, `false` if an instruction could not be encoded.
+ */
+bool rs_module_generate_binary(rs_module_t *module, rs_buffer_t *buf,
+                               size_t *function_offsets,
+                               rs_relocations_t *relocations);
+
+/**
+ * @brief Writes an ELF64 relocatable object file with every function.
+ *
+ * Like `rs_generate_object`, with one global symbol per function.
+ *
+ * @param[inout] module The module.
+ * @param[inout] fp The file to write the object to, opened in binary mode.
+ * @return `true` on success, `false` on an encoding or write failure.
+ */
+bool rs_module_generate_object(rs_module_t *module, FILE *fp);
+
+/**
+ * @brief Compiles every function of a module into executable memory.
+ *
+ * Every call must target a function of the module.
+ *
+ * @param[inout] module The module.
+ * @param[out] functions Receives the compiled function of each function ID.
+ *             They share one mapping, released by passing `functions[0]` to
+ *             `rs_jit_free`.
+ * @return `true` on success.
+ */
+bool rs_jit_compile_module(rs_module_t *module, rs_jit_fn_t *functions);
+
+/**
+ * @brief A unit of work for `rs_compile_batch`.
+ *
+ * Items must not share a Runestone state or module.
+ */
+typedef struct {
+  rs_t *rs;            /**< A function to compile, or NULL. */
+  rs_module_t *module; /**< A module to compile when `rs` is NULL. */
+} rs_batch_item_t;
+
+/**
+ * @brief Generates code for independent functions and modules in parallel.
+ *
+ * Each worker starts with an equal share of the items and steals from the
+ * others once it runs out. Every item is generated into its own buffer, and
+ * the buffers are written to `out` in item order, so the output does not
+ * depend on the number of threads.
+ *
+ * @param[inout] items The functions and modules to compile.
+ * @param[in] count The number of items.
+ * @param[in] threads The number of workers, 0 for one per online CPU.
+ * @param[inout] out The emitter to write the generated code to.
+ * @return `false` if an item failed or writing the code failed.
+ */
+bool rs_compile_batch(rs_batch_item_t *items, size_t count, size_t threads,
+                      rs_emitter_t *out);
+
+/** Fewest blocks `rs_emit_blocks` hands to a worker at a time. */
+#define RS_EMIT_CHUNK_BLOCKS 32
+
+/**
+ * @brief Renders one block of the window.
+ * @param[in] rs The Runestone state, which must not be modified.
+ * @param[inout] out The emitter to write the block to.
+ * @param[in] context The context passed to `rs_emit_blocks`.
+ * @param[in] block_id The block to render.
+ */
+typedef void (*rs_block_emitter_t)(rs_t *rs, rs_emitter_t *out,
+                                   const void *context, size_t block_id);
+
+/**
+ * @brief Renders the blocks of the window in layout order.
+ *
+ * With several `rs_t::emit_threads` and at least two runs of
+ * `RS_EMIT_CHUNK_BLOCKS` blocks, the workers render runs of blocks into
+ * separate buffers, which are then spliced in order. This requires a
+ * register for every vreg, since the linear allocator assigns missing ones
+ * while rendering; otherwise, the blocks are rendered serially. Either way,
+ * the output is the same.
+ *
+ * @param[inout] rs The Runestone state.
+ * @param[inout] out The emitter to write the blocks to.
+ * @param[in] emit_block Renders one block.
+ * @param[in] context Passed to `emit_block`.
  */
-void rs_generate(rs_t *rs, FILE *fp);
+void rs_emit_blocks(rs_t *rs, rs_emitter_t *out, rs_block_emitter_t emit_block,
+                    const void *context);
 
 #define RS_TARGET(lower, ...)                                                  \
   /**                                                                          \
     @brief Generates code for for target `lower`.                              \
     @param[inout] rs The Runestone state.                                      \
-    @param[out] fp The file to write the generated code to.                    \
+    @param[out] out The emitter to write the generated code to.                \
    */                                                                          \
-  void rs_generate_##lower(rs_t *rs, FILE *fp);                                \
+  void rs_generate_##lower(rs_t *rs, rs_emitter_t *out);                       \
   /**                                                                          \
     @brief Generates an instruction for target `lower`.                        \
     @param[inout] rs The Runestone state.                                      \
-    @param[out] fp The file to write the instruction to.                       \
+    @param[out] out The emitter to write the instruction to.                   \
     @param[in] instr The instruction to generate.                              \
    */                                                                          \
-  void rs_generate_instr_##lower(rs_t *rs, FILE *fp, rs_instr_t instr);        \
+  void rs_generate_instr_##lower(rs_t *rs, rs_emitter_t *out,                  \
+                                 rs_instr_t instr);                            \
   /**                                                                          \
     @brief Generates an operand for for target `lower`.                        \
     @param[inout] rs The Runestone state.                                      \
-    @param[out] fp The file to write the operand to.                           \
+    @param[out] out The emitter to write the operand to.                       \
     @param[in] operand The operand to generate.                                \
     @param[in] dereference Whether to dereference the operand.                 \
    */                                                                          \
-  void rs_generate_operand_##lower(rs_t *rs, FILE *fp, rs_operand_t operand,   \
-                                   bool dereference);
+  void rs_generate_operand_##lower(rs_t *rs, rs_emitter_t *out,                \
+                                   rs_operand_t operand, bool dereference);    \
+  /** @brief Instruction selection description of target `lower`. */           \
+  extern const rs_isel_t rs_isel_##lower;
 RS_TARGETS
 #undef RS_TARGET
 
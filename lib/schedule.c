@@ -0,0 +1,446 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+
+/** Marks the absence of a node. */
+#define NO_NODE SIZE_MAX
+
+/** Cycles until a load's result is ready, also added to folded loads. */
+#define RS_SCHED_LOAD_LATENCY 5
+
+typedef struct {
+  size_t to;      /**< The dependent instruction. */
+  size_t latency; /**< Cycles it waits after the first one issues. */
+} edge_t;
+
+typedef cvector(edge_t) edges_t;
+
+typedef struct {
+  size_t count;    /**< Instructions being scheduled. */
+  edges_t *succs;  /**< Dependents of each instruction. */
+  size_t *preds;   /**< Unscheduled dependencies of each instruction. */
+  size_t *height;  /**< Cycles from issue to the end of the block. */
+  size_t *earliest; /**< Cycle at which all inputs are ready. */
+  int *delta;      /**< Change in pressure if scheduled now. */
+} dag_t;
+
+static size_t latency(rs_instr_t instr) {
+  size_t folded = instr.opcode != RS_OPCODE_LOAD &&
+                          instr.opcode != RS_OPCODE_STORE &&
+                          (instr.src1.type == RS_OPERAND_TYPE_MEM ||
+                           instr.src2.type == RS_OPERAND_TYPE_MEM)
+                      ? RS_SCHED_LOAD_LATENCY
+                      : 0;
+  switch (instr.opcode) {
+  case RS_OPCODE_LOAD:
+  case RS_OPCODE_COPY:
+    return RS_SCHED_LOAD_LATENCY;
+  case RS_OPCODE_MULT:
+    return folded + 3;
+  case RS_OPCODE_DIV:
+    return folded + 26;
+  case RS_OPCODE_CALL:
+    return 20;
+  default:
+    return folded + 1;
+  }
+}
+
+static bool reads_memory(rs_instr_t instr) {
+  return instr.opcode == RS_OPCODE_LOAD || instr.opcode == RS_OPCODE_COPY ||
+         instr.opcode == RS_OPCODE_CALL ||
+         (instr.opcode != RS_OPCODE_STORE &&
+          (instr.src1.type == RS_OPERAND_TYPE_MEM ||
+           instr.src2.type == RS_OPERAND_TYPE_MEM));
+}
+
+static bool writes_memory(rs_instr_t instr) {
+  return instr.opcode == RS_OPCODE_STORE || instr.opcode == RS_OPCODE_COPY ||
+         instr.opcode == RS_OPCODE_CALL;
+}
+
+static void add_edge(dag_t *dag, size_t from, size_t to, size_t latency) {
+  cvector_push_back(dag->succs[from], ((edge_t){to, latency}));
+  dag->preds[to]++;
+}
+
+// Orders the first `count` instructions by their register and memory
+// dependencies.
+static void build_dag(const rs_instr_t *instrs, size_t count, dag_t *dag) {
+  size_t last_def[RS_MAX_REGS];
+  for (size_t v = 0; v < RS_MAX_REGS; v++)
+    last_def[v] = NO_NODE;
+  size_t last_store = NO_NODE;
+  cvector(size_t) loads = NULL;
+
+  for (size_t i = 0; i < count; i++) {
+    uint8_t uses[RS_INSTR_MAX_USES];
+    size_t use_count = rs_instr_uses(instrs[i], uses);
+    for (size_t u = 0; u < use_count; u++) {
+      if (last_def[uses[u]] != NO_NODE)
+        add_edge(dag, last_def[uses[u]], i,
+                 latency(instrs[last_def[uses[u]]]));
+    }
+
+    uint8_t def;
+    if (rs_instr_def(instrs[i], &def)) {
+      // A redefinition waits for the earlier value and its readers.
+      size_t since = last_def[def] == NO_NODE ? 0 : last_def[def];
+      if (last_def[def] != NO_NODE)
+        add_edge(dag, last_def[def], i, 0);
+      for (size_t j = since; j < i; j++) {
+        uint8_t others[RS_INSTR_MAX_USES];
+        size_t other_count = rs_instr_uses(instrs[j], others);
+        for (size_t u = 0; u < other_count; u++) {
+          if (others[u] == def) {
+            add_edge(dag, j, i, 0);
+            break;
+          }
+        }
+      }
+      last_def[def] = i;
+    }
+
+    // Loads may pass each other but not a store.
+    if (writes_memory(instrs[i])) {
+      if (last_store != NO_NODE)
+        add_edge(dag, last_store, i, 0);
+      size_t *load_it;
+      cvector_for_each_in(load_it, loads) { add_edge(dag, *load_it, i, 0); }
+      cvector_clear(loads);
+      last_store = i;
+    } else if (reads_memory(instrs[i])) {
+      if (last_store != NO_NODE)
+        add_edge(dag, last_store, i, 1);
+      cvector_push_back(loads, i);
+    }
+  }
+  cvector_free(loads);
+
+  // Edges point forward, so heights follow in one backward sweep.
+  for (size_t i = count; i-- > 0;) {
+    dag->height[i] = latency(instrs[i]);
+    edge_t *edge_it;
+    cvector_for_each_in(edge_it, dag->succs[i]) {
+      size_t height = edge_it->latency + dag->height[edge_it->to];
+      if (height > dag->height[i])
+        dag->height[i] = height;
+    }
+  }
+}
+
+/**
+ * @brief Instructions whose dependencies are scheduled, as a binary heap.
+ */
+typedef struct {
+  size_t *nodes;
+  size_t count;
+  const dag_t *dag;
+  bool by_height; /**< Tallest first, else earliest first. */
+} heap_t;
+
+static bool before(const heap_t *heap, size_t a, size_t b) {
+  const dag_t *dag = heap->dag;
+  if (heap->by_height && dag->height[a] != dag->height[b])
+    return dag->height[a] > dag->height[b];
+  if (!heap->by_height && dag->earliest[a] != dag->earliest[b])
+    return dag->earliest[a] < dag->earliest[b];
+  return a < b; // Keep the build order among equals.
+}
+
+static void swap_nodes(heap_t *heap, size_t i, size_t j) {
+  size_t node = heap->nodes[i];
+  heap->nodes[i] = heap->nodes[j];
+  heap->nodes[j] = node;
+}
+
+static void sift_up(heap_t *heap, size_t i) {
+  while (i > 0 && before(heap, heap->nodes[i], heap->nodes[(i - 1) / 2])) {
+    swap_nodes(heap, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void sift_down(heap_t *heap, size_t i) {
+  for (;;) {
+    size_t best = i;
+    for (size_t child = 2 * i + 1; child <= 2 * i + 2; child++) {
+      if (child < heap->count &&
+          before(heap, heap->nodes[child], heap->nodes[best]))
+        best = child;
+    }
+    if (best == i)
+      return;
+    swap_nodes(heap, i, best);
+    i = best;
+  }
+}
+
+static void heap_push(heap_t *heap, size_t node) {
+  heap->nodes[heap->count++] = node;
+  sift_up(heap, heap->count - 1);
+}
+
+static size_t heap_remove(heap_t *heap, size_t i) {
+  size_t node = heap->nodes[i];
+  heap->nodes[i] = heap->nodes[--heap->count];
+  if (i < heap->count) {
+    sift_up(heap, i);
+    sift_down(heap, i);
+  }
+  return node;
+}
+
+// Finds the ready instruction that frees the most registers, the tallest
+// among those.
+static bool find_relief(const heap_t *heap, size_t *found) {
+  bool any = false;
+  for (size_t i = 0; i < heap->count; i++) {
+    size_t node = heap->nodes[i], best = heap->nodes[*found];
+    const dag_t *dag = heap->dag;
+    if (!any || dag->delta[node] < dag->delta[best] ||
+        (dag->delta[node] == dag->delta[best] &&
+         dag->height[node] > dag->height[best])) {
+      *found = i;
+      any = true;
+    }
+  }
+  return any;
+}
+
+typedef struct {
+  size_t remaining[RS_MAX_REGS]; /**< Unscheduled uses in the block. */
+  rs_regset_t live_out;          /**< Registers needed after the block. */
+  size_t pressure;               /**< Registers live at this point. */
+} pressure_t;
+
+static int pressure_delta(const pressure_t *p, rs_instr_t instr) {
+  int delta = 0;
+  uint8_t def;
+  if (rs_instr_def(instr, &def) &&
+      (p->remaining[def] > 0 || rs_regset_contains(&p->live_out, def)))
+    delta++;
+
+  uint8_t uses[RS_INSTR_MAX_USES];
+  size_t use_count = rs_instr_uses(instr, uses);
+  for (size_t u = 0; u < use_count; u++) {
+    size_t occurrences = 0;
+    for (size_t o = 0; o < use_count; o++)
+      occurrences += uses[o] == uses[u];
+    bool first = true;
+    for (size_t o = 0; o < u; o++)
+      first &= uses[o] != uses[u];
+    if (first && p->remaining[uses[u]] == occurrences &&
+        !rs_regset_contains(&p->live_out, uses[u]))
+      delta--;
+  }
+  return delta;
+}
+
+static void update_pressure(pressure_t *p, rs_instr_t instr) {
+  p->pressure = (size_t)((ptrdiff_t)p->pressure + pressure_delta(p, instr));
+  uint8_t uses[RS_INSTR_MAX_USES];
+  size_t use_count = rs_instr_uses(instr, uses);
+  for (size_t u = 0; u < use_count; u++)
+    p->remaining[uses[u]]--;
+}
+
+// Lists the instructions in scheduling order, returning false if memory ran
+// out.
+static bool schedule(const rs_instr_t *instrs, size_t count, dag_t *dag,
+                     pressure_t *p, size_t limit, size_t *order) {
+  size_t *nodes = rs_calloc(2 * count + 1, sizeof(size_t));
+  if (!nodes)
+    return false;
+  heap_t available = {nodes, 0, dag, true};
+  heap_t pending = {nodes + count, 0, dag, false};
+
+  for (size_t i = 0; i < count; i++) {
+    if (dag->preds[i] == 0)
+      heap_push(&available, i);
+  }
+
+  size_t cycle = 0;
+  for (size_t scheduled = 0; scheduled < count; scheduled++) {
+    while (pending.count > 0 && dag->earliest[pending.nodes[0]] <= cycle)
+      heap_push(&available, heap_remove(&pending, 0));
+
+    size_t node;
+    if (p->pressure >= limit) {
+      // Out of registers: take whatever is ready and frees the most,
+      // stalling if need be.
+      for (size_t i = 0; i < available.count; i++)
+        dag->delta[available.nodes[i]] =
+            pressure_delta(p, instrs[available.nodes[i]]);
+      for (size_t i = 0; i < pending.count; i++)
+        dag->delta[pending.nodes[i]] =
+            pressure_delta(p, instrs[pending.nodes[i]]);
+
+      size_t in_available = 0, in_pending = 0;
+      bool from_available = find_relief(&available, &in_available);
+      bool from_pending = find_relief(&pending, &in_pending);
+      if (from_available && from_pending) {
+        size_t a = available.nodes[in_available];
+        size_t b = pending.nodes[in_pending];
+        from_available = dag->delta[a] < dag->delta[b] ||
+                         (dag->delta[a] == dag->delta[b] &&
+                          dag->height[a] >= dag->height[b]);
+      }
+      node = from_available ? heap_remove(&available, in_available)
+                            : heap_remove(&pending, in_pending);
+    } else {
+      if (available.count == 0) {
+        cycle = dag->earliest[pending.nodes[0]];
+        heap_push(&available, heap_remove(&pending, 0));
+      }
+      node = heap_remove(&available, 0);
+    }
+
+    if (dag->earliest[node] > cycle)
+      cycle = dag->earliest[node];
+    order[scheduled] = node;
+    update_pressure(p, instrs[node]);
+
+    edge_t *edge_it;
+    cvector_for_each_in(edge_it, dag->succs[node]) {
+      size_t ready = cycle + edge_it->latency;
+      if (ready > dag->earliest[edge_it->to])
+        dag->earliest[edge_it->to] = ready;
+      if (--dag->preds[edge_it->to] == 0)
+        heap_push(&pending, edge_it->to);
+    }
+    cycle++;
+  }
+
+  free(nodes);
+  return true;
+}
+
+// Counts the instructions kept in place at the end of a block: the
+// terminator, and the comparison it branches on, which isel fuses with it.
+static size_t count_pinned(const rs_instr_t *instrs, size_t count,
+                           const rs_regset_t *live_out) {
+  if (count == 0 || !rs_instr_is_terminator(instrs[count - 1]))
+    return 0;
+
+  rs_instr_t term = instrs[count - 1];
+  if (term.opcode != RS_OPCODE_BR_IF ||
+      term.src1.type != RS_OPERAND_TYPE_REG || count < 2 ||
+      rs_regset_contains(live_out, term.src1.vreg))
+    return 1;
+
+  // Only a comparison right before the branch, defining its condition.
+  size_t cmp = count - 2;
+  uint8_t def;
+  if (!rs_instr_def(instrs[cmp], &def) || def != term.src1.vreg)
+    return 1;
+
+  rs_opcode_t opcode = instrs[cmp].opcode;
+  bool is_cmp = opcode == RS_OPCODE_CMP_EQ || opcode == RS_OPCODE_CMP_LT ||
+                opcode == RS_OPCODE_CMP_GT;
+  return is_cmp ? 2 : 1;
+}
+
+static void schedule_block(rs_t *rs, rs_basic_block_t *bb,
+                           const rs_regset_t *live_in,
+                           const rs_regset_t *live_out, size_t *reordered) {
+  size_t total = cvector_size(bb->instructions);
+  size_t count = total - count_pinned(bb->instructions, total, live_out);
+  if (count < 2)
+    return;
+
+  dag_t dag;
+  dag.count = count;
+  dag.succs = rs_calloc(count, sizeof(edges_t));
+  dag.preds = rs_calloc(count, sizeof(size_t));
+  dag.height = rs_calloc(count, sizeof(size_t));
+  dag.earliest = rs_calloc(count, sizeof(size_t));
+  dag.delta = rs_calloc(count, sizeof(int));
+  size_t *order = rs_calloc(count, sizeof(size_t));
+  pressure_t *p = rs_calloc(1, sizeof(pressure_t));
+  if (!dag.succs || !dag.preds || !dag.height || !dag.earliest ||
+      !dag.delta || !order || !p) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                               "Out of memory\n");
+    goto out;
+  }
+
+  build_dag(bb->instructions, count, &dag);
+
+  // Every use in the block keeps its register busy until it is scheduled,
+  // the pinned tail's included.
+  p->live_out = *live_out;
+  for (size_t i = 0; i < total; i++) {
+    uint8_t uses[RS_INSTR_MAX_USES];
+    size_t use_count = rs_instr_uses(bb->instructions[i], uses);
+    for (size_t u = 0; u < use_count; u++)
+      p->remaining[uses[u]]++;
+  }
+  for (size_t v = 0; v < RS_MAX_REGS; v++)
+    p->pressure += rs_regset_contains(live_in, (uint8_t)v);
+
+  if (!schedule(bb->instructions, count, &dag, p,
+                rs_get_register_count(rs->target), order)) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                               "Out of memory\n");
+    goto out;
+  }
+
+  bool moved = false;
+  for (size_t i = 0; i < count; i++)
+    moved |= order[i] != i;
+  if (moved) {
+    rs_instr_t *scheduled = rs_malloc(count * sizeof(rs_instr_t));
+    if (!scheduled)
+      goto out;
+    for (size_t i = 0; i < count; i++)
+      scheduled[i] = bb->instructions[order[i]];
+    memcpy(bb->instructions, scheduled, count * sizeof(rs_instr_t));
+    free(scheduled);
+    (*reordered)++;
+    trace_log("Scheduled block '%s', critical path %zu cycles", bb->name,
+              count > 0 ? dag.height[order[0]] : 0);
+  }
+
+out:
+  for (size_t i = 0; dag.succs && i < count; i++)
+    cvector_free(dag.succs[i]);
+  free(dag.succs);
+  free(dag.preds);
+  free(dag.height);
+  free(dag.earliest);
+  free(dag.delta);
+  free(order);
+  free(p);
+}
+
+void rs_schedule(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  const rs_liveness_t *liveness = rs_get_liveness(rs);
+  if (!liveness)
+    return;
+
+  size_t reordered = 0;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    // Blocks a profile never saw run are not worth the effort.
+    if (rs_get_block_frequency(rs, block_id) == 0)
+      continue;
+
+    size_t local = block_id - rs->window_begin;
+    schedule_block(rs, rs->basic_blocks[block_id], &liveness->live_in[local],
+                   &liveness->live_out[local], &reordered);
+  }
+
+  debug_log("Scheduled %zu of %zu blocks", reordered,
+            rs->window_end - rs->window_begin);
+}
@@ -0,0 +1,117 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+// Scratch registers take the virtual registers just below the temporary one,
+// so that code rewritten by an earlier run can be recognized and kept.
+static uint8_t scratch_vreg(size_t scratch) {
+  return (uint8_t)(RS_TEMPORARY_VREG - 1 - scratch);
+}
+
+static bool is_scratch(uint8_t vreg, size_t scratch_count) {
+  return vreg < RS_TEMPORARY_VREG &&
+         vreg >= RS_TEMPORARY_VREG - scratch_count;
+}
+
+// Rewrites one instruction to reload its sources into scratch registers and
+// spill its result.
+static bool rewrite_instr(rs_t *rs, rs_instr_t instr,
+                          rs_instructions_t *rewritten,
+                          size_t scratch_count) {
+  uint8_t *refs[RS_INSTR_MAX_USES];
+  size_t ref_count = rs_instr_use_refs(&instr, refs);
+  uint8_t def;
+  bool has_def = rs_instr_def(instr, &def);
+
+  bool rewritten_before = !has_def || is_scratch(def, scratch_count);
+  for (size_t i = 0; i < ref_count; i++)
+    rewritten_before &= is_scratch(*refs[i], scratch_count);
+  if (rewritten_before) {
+    cvector_push_back(*rewritten, instr);
+    return true;
+  }
+  if (ref_count + has_def > scratch_count)
+    return false;
+
+  for (size_t i = 0; i < ref_count; i++) {
+    rs_instr_t reload = {RS_OPCODE_RELOAD, RS_OPERAND_REG(scratch_vreg(i)),
+                         RS_OPERAND_SLOT(rs->param_count + *refs[i]),
+                         RS_OPERAND_NULL, RS_OPERAND_NULL};
+    cvector_push_back(*rewritten, reload);
+    *refs[i] = scratch_vreg(i);
+  }
+
+  // The result gets a register of its own, since backends may write it
+  // before reading the last source.
+  if (has_def)
+    instr.dest = RS_OPERAND_REG(scratch_vreg(ref_count));
+  cvector_push_back(*rewritten, instr);
+
+  if (has_def) {
+    rs_instr_t spill = {RS_OPCODE_SPILL, RS_OPERAND_NULL, instr.dest,
+                        RS_OPERAND_SLOT(rs->param_count + def),
+                        RS_OPERAND_NULL};
+    cvector_push_back(*rewritten, spill);
+  }
+  return true;
+}
+
+void rs_assign_stack_slots(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  size_t scratch_count = rs_get_register_count(rs->target);
+  if (rs->next_dst_vreg + scratch_count > RS_TEMPORARY_VREG) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Too many virtual registers for O0\n");
+    rs->failed = true;
+    return;
+  }
+  rs->stack_size = (rs->param_count + rs->next_dst_vreg) * 8;
+  memset(rs->tied, RS_INVALID_VREG, sizeof(rs->tied));
+
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    rs_instructions_t rewritten = NULL;
+    cvector_init(rewritten, cvector_size(bb->instructions) * 3, NULL);
+
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, bb->instructions) {
+      if (!rewrite_instr(rs, *instr_it, &rewritten, scratch_count)) {
+        fprintf(stderr,
+                RS_COLOR_RED RS_COLOR_BOLD
+                "Error: " RS_COLOR_RESET
+                "Too many operands for scratch registers in block '%s'\n",
+                bb->name);
+        cvector_free(rewritten);
+        rs->failed = true;
+        return;
+      }
+    }
+
+    cvector_free(bb->instructions);
+    bb->instructions = rewritten;
+  }
+
+  rs_regmap_free(&rs->register_map);
+  rs_regmap_init(&rs->register_map);
+  memset(rs->register_pool, 0, cvector_size(rs->register_pool) * sizeof(bool));
+  for (size_t n = 0; n < RS_MAX_REGS; n++)
+    rs->lifetimes[n].reg = RS_REG_SPILL;
+  for (size_t reg = 0; reg < scratch_count; reg++) {
+    uint8_t vreg = scratch_vreg(reg);
+    rs->lifetimes[vreg].vreg = vreg;
+    rs->lifetimes[vreg].reg = reg;
+    rs->register_pool[reg] = true;
+    rs_regmap_insert(&rs->register_map, vreg, reg);
+  }
+
+  debug_log("Assigned %zu stack slots, frame size %zu", rs->next_dst_vreg,
+            rs->stack_size);
+}
@@ -0,0 +1,147 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+bool rs_stream_begin(rs_t *rs, rs_emitter_t *out) {
+  if (!rs || !out) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state or emitter\n");
+    return false;
+  }
+
+  if (cvector_size(rs->basic_blocks) > 0) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Streaming must start before any block "
+                                       "is appended\n");
+    return false;
+  }
+
+  // Graph coloring needs the whole function to build its interference graph.
+  if (rs->regalloc != RS_REGALLOC_LINEAR) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET
+            "Streaming requires the linear register allocator\n");
+    return false;
+  }
+
+  debug_log("Streaming code generation in windows of %d blocks",
+            RS_STREAM_WINDOW);
+  rs->stream = out;
+  rs->window_begin = rs->window_end = 0;
+  return true;
+}
+
+// Counts the blocks after the window that can be flushed now.
+static size_t count_ready(rs_t *rs) {
+  size_t block_count = cvector_size(rs->basic_blocks);
+  size_t ready = 0;
+  for (size_t block_id = rs->window_begin; block_id < block_count;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    if (!bb->sealed)
+      break;
+
+    size_t successors[2];
+    size_t successor_count = rs_instr_successors(
+        bb->instructions[cvector_size(bb->instructions) - 1], successors);
+    bool appended = true;
+    for (size_t i = 0; i < successor_count; i++)
+      appended &= successors[i] < block_count;
+    if (!appended)
+      break;
+    ready++;
+  }
+  return ready;
+}
+
+void rs_seal_basic_block(rs_t *rs, size_t block_id) {
+  if (!rs || block_id >= cvector_size(rs->basic_blocks)) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Invalid basic block at index %zu\n",
+            block_id);
+    return;
+  }
+
+  rs_basic_block_t *bb = rs->basic_blocks[block_id];
+  if (cvector_size(bb->instructions) == 0 ||
+      !rs_instr_is_terminator(
+          bb->instructions[cvector_size(bb->instructions) - 1])) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET
+            "Missing terminator instruction in basic block '%s'\n",
+            bb->name);
+    return;
+  }
+
+  bb->sealed = true;
+  if (rs->stream && count_ready(rs) >= RS_STREAM_WINDOW)
+    rs_stream_flush(rs);
+}
+
+bool rs_stream_flush(rs_t *rs) {
+  if (!rs || !rs->stream) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Runestone state is not streaming\n");
+    return false;
+  }
+
+  size_t ready = count_ready(rs);
+  if (ready == 0)
+    return !rs->stream->failed;
+
+  rs->window_end = rs->window_begin + ready;
+  debug_log("Flushing blocks %zu to %zu", rs->window_begin,
+            rs->window_end - 1);
+  if (!rs_run_passes(rs)) {
+    rs->stream->failed = true;
+    return false;
+  }
+  rs_pass_timer_t timer = rs_pass_begin();
+  switch (rs->target) {
+  case RS_TARGET_X86_64_LINUX_NASM:
+    rs_generate_x86_64_linux_nasm(rs, rs->stream);
+    break;
+  case RS_TARGET_AARCH64_MACOS_GAS:
+    rs_generate_aarch64_macos_gas(rs, rs->stream);
+    break;
+  case RS_TARGET_COUNT:
+    break;
+  }
+  rs_pass_end(rs, RS_PASS_EMIT, timer);
+
+  // Only the block headers stay behind; branches still refer to them by ID.
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    cvector_free(rs->basic_blocks[block_id]->instructions);
+    rs->basic_blocks[block_id]->instructions = NULL;
+  }
+  rs->window_begin = rs->window_end;
+  rs->next_dst_vreg = 0;
+  return rs_emitter_flush(rs->stream);
+}
+
+bool rs_stream_end(rs_t *rs) {
+  if (!rs || !rs->stream) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Runestone state is not streaming\n");
+    return false;
+  }
+
+  bool ok = rs_stream_flush(rs);
+  size_t block_count = cvector_size(rs->basic_blocks);
+  if (rs->window_begin < block_count) {
+    fprintf(stderr,
+            RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                       "Basic block '%s' was never flushed\n",
+            rs->basic_blocks[rs->window_begin]->name);
+    ok = false;
+  }
+
+  rs->stream = NULL;
+  rs->window_end = block_count;
+  return ok;
+}
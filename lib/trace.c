@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+#include "runestone.h"
+#include <stdlib.h>
+#include <time.h>
+
+bool rs_trace_enable(rs_t *rs, size_t capacity) {
+  if (!rs || capacity == 0) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state or empty trace\n");
+    return false;
+  }
+
+#if RS_TRACE_LEVEL >= RS_TRACE_PASSES
+  rs_trace_event_t *events = rs_calloc(capacity, sizeof(rs_trace_event_t));
+  if (!events) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "Failed to allocate trace events\n");
+    return false;
+  }
+
+  free(rs->trace.events);
+  rs->trace.events = events;
+  rs->trace.capacity = capacity;
+  rs->trace.recorded = 0;
+#endif
+  return true;
+}
+
+uint64_t rs_trace_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void rs_trace_record(rs_t *rs, const char *name, uint64_t start) {
+  rs_trace_t *trace = &rs->trace;
+  rs_trace_event_t *event = &trace->events[trace->recorded % trace->capacity];
+  event->name = name;
+  event->start = start;
+  event->duration = rs_trace_now() - start;
+  trace->recorded++;
+}
+
+// Prints nanoseconds as the microseconds trace-event JSON expects.
+static void print_us(FILE *fp, uint64_t ns) {
+  fprintf(fp, "%llu.%03u", (unsigned long long)(ns / 1000),
+          (unsigned)(ns % 1000));
+}
+
+void rs_json_write_string(FILE *fp, const char *text) {
+  fputc('"', fp);
+  for (; *text; text++) {
+    if (*text == '"' || *text == '\\')
+      fputc('\\', fp);
+    fputc(*text, fp);
+  }
+  fputc('"', fp);
+}
+
+bool rs_trace_write_json(rs_t *const *contexts, size_t count, FILE *fp) {
+  if ((!contexts && count > 0) || !fp) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL trace contexts or file\n");
+    return false;
+  }
+
+  // Times are written relative to the earliest event.
+  uint64_t origin = UINT64_MAX;
+  for (size_t i = 0; i < count; i++) {
+    const rs_trace_t *trace = &contexts[i]->trace;
+    size_t kept = trace->recorded < trace->capacity ? trace->recorded
+                                                    : trace->capacity;
+    for (size_t e = 0; e < kept; e++) {
+      if (trace->events[e].start < origin)
+        origin = trace->events[e].start;
+    }
+  }
+
+  fputs("{\"traceEvents\":[", fp);
+  bool first = true;
+  for (size_t i = 0; i < count; i++) {
+    const rs_trace_t *trace = &contexts[i]->trace;
+    fprintf(fp,
+            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%zu,\"args\":{\"name\":",
+            first ? "" : ",", i);
+    rs_json_write_string(fp, rs_get_symbol(contexts[i]));
+    fputs("}}", fp);
+    first = false;
+
+    // Oldest first, starting after the newest once the ring wrapped.
+    size_t kept = trace->recorded;
+    size_t begin = 0;
+    if (kept > trace->capacity) {
+      begin = trace->recorded % trace->capacity;
+      kept = trace->capacity;
+    }
+    for (size_t e = 0; e < kept; e++) {
+      const rs_trace_event_t *event =
+          &trace->events[(begin + e) % trace->capacity];
+      fputs(",\n{\"name\":", fp);
+      rs_json_write_string(fp, event->name);
+      fputs(",\"cat\":\"runestone\",\"ph\":\"X\",\"ts\":", fp);
+      print_us(fp, event->start - origin);
+      fputs(",\"dur\":", fp);
+      print_us(fp, event->duration);
+      fprintf(fp, ",\"pid\":1,\"tid\":%zu}", i);
+    }
+  }
+  fputs("\n]}\n", fp);
+  return !ferror(fp);
+}
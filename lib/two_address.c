@@ -0,0 +1,81 @@
+#include "runestone.h"
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+#define trace_log(...) RS_LOG(RS_TRACE_VERBOSE, __VA_ARGS__)
+
+bool rs_opcode_is_two_address(rs_opcode_t opcode) {
+  return opcode == RS_OPCODE_ADD || opcode == RS_OPCODE_SUB ||
+         opcode == RS_OPCODE_MULT;
+}
+
+static bool is_commutative(rs_opcode_t opcode) {
+  return opcode == RS_OPCODE_ADD || opcode == RS_OPCODE_MULT;
+}
+
+static bool dies_here(const rs_regset_t *live_after, rs_operand_t operand) {
+  return operand.type == RS_OPERAND_TYPE_REG &&
+         operand.vreg != RS_TEMPORARY_VREG &&
+         !rs_regset_contains(live_after, operand.vreg);
+}
+
+void rs_tie_two_address(rs_t *rs) {
+  if (!rs) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "NULL Runestone state pointer\n");
+    return;
+  }
+
+  memset(rs->tied, RS_INVALID_VREG, sizeof(rs->tied));
+
+  const rs_liveness_t *liveness = rs_get_liveness(rs);
+  if (!liveness)
+    return;
+
+  size_t tie_count = 0;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_basic_block_t *bb = rs->basic_blocks[block_id];
+    rs_regset_t live = liveness->live_out[block_id - rs->window_begin];
+
+    for (size_t i = cvector_size(bb->instructions); i-- > 0;) {
+      rs_instr_t *instr = &bb->instructions[i];
+
+      if (rs_opcode_is_two_address(instr->opcode) &&
+          instr->dest.type == RS_OPERAND_TYPE_REG) {
+        bool src1_dies = dies_here(&live, instr->src1);
+        bool src2_dies = dies_here(&live, instr->src2);
+
+        // Put the dying register (or failing that, any register rather than
+        // an immediate) in the tied position.
+        if (is_commutative(instr->opcode) && !src1_dies &&
+            (src2_dies || (instr->src1.type != RS_OPERAND_TYPE_REG &&
+                           instr->src2.type == RS_OPERAND_TYPE_REG))) {
+          rs_operand_t tmp = instr->src1;
+          instr->src1 = instr->src2;
+          instr->src2 = tmp;
+          src1_dies = src2_dies;
+          trace_log("Commuted %s in block '%s' at %zu",
+                    rs_opcode_to_str(instr->opcode), bb->name, i);
+        }
+
+        if (src1_dies) {
+          rs->tied[instr->dest.vreg] = instr->src1.vreg;
+          tie_count++;
+          trace_log("Tied vreg %d to vreg %d", instr->dest.vreg,
+                    instr->src1.vreg);
+        }
+      }
+
+      uint8_t def;
+      if (rs_instr_def(*instr, &def))
+        rs_regset_remove(&live, def);
+      uint8_t uses[RS_INSTR_MAX_USES];
+      size_t use_count = rs_instr_uses(*instr, uses);
+      for (size_t u = 0; u < use_count; u++)
+        rs_regset_add(&live, uses[u]);
+    }
+  }
+
+  debug_log("Tied %zu two-address instructions", tie_count);
+}
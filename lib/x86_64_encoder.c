@@ -0,0 +1,595 @@
+#include "cvector_utils.h"
+#include "runestone.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_log(...) RS_LOG(RS_TRACE_DEBUG, __VA_ARGS__)
+
+/** Hardware numbers of the registers in `rs_isel_x86_64_linux_nasm`. */
+static const uint8_t x86_64_hw_regs[] = {0,  3,  1,  2,  6,  7,  8, 9,
+                                         10, 11, 12, 13, 14, 15, 4, 5};
+
+/** Hardware numbers of the registers SysV callers expect to be preserved. */
+static const uint8_t x86_64_callee_saved[] = {3, 5, 12, 13, 14, 15};
+
+/** Condition codes of the `jcc` and `setcc` mnemonic suffixes. */
+static const struct {
+  const char *suffix;
+  uint8_t cc;
+} x86_64_conditions[] = {{"e", 0x4},  {"z", 0x4},  {"ne", 0x5}, {"nz", 0x5},
+                         {"b", 0x2},  {"ae", 0x3}, {"be", 0x6}, {"a", 0x7},
+                         {"l", 0xC},  {"ge", 0xD}, {"le", 0xE}, {"g", 0xF}};
+
+/** Marks an unconditional branch in `item_t`. */
+#define X86_64_JMP 0xFF
+
+typedef struct {
+  size_t start;       // Bytes of a plain instruction in the scratch buffer.
+  size_t length;
+  bool branch;
+  uint8_t cc;         // Condition code, or X86_64_JMP.
+  size_t target;      // Target block of a branch.
+  bool wide;          // Whether the branch needs a rel32.
+  bool ret;           // Whether the callee-saved registers are restored first.
+  const char *symbol; // Callee of a call, whose rel32 ends the item.
+} item_t;
+
+typedef struct {
+  size_t offset; // Position of the displacement in the output.
+  size_t width;  // 1 or 4 bytes.
+  size_t target; // Target block.
+} fixup_t;
+
+static bool fits_int8(int64_t value) { return value >= -128 && value <= 127; }
+
+static bool fits_int32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static void emit8(rs_buffer_t *buf, uint8_t byte) {
+  cvector_push_back(*buf, byte);
+}
+
+static void emit32(rs_buffer_t *buf, int64_t value) {
+  uint32_t bits = (uint32_t)value;
+  for (size_t i = 0; i < 4; i++)
+    emit8(buf, (uint8_t)(bits >> (8 * i)));
+}
+
+static void emit64(rs_buffer_t *buf, int64_t value) {
+  uint64_t bits = (uint64_t)value;
+  for (size_t i = 0; i < 8; i++)
+    emit8(buf, (uint8_t)(bits >> (8 * i)));
+}
+
+static uint8_t hw(uint8_t reg) { return x86_64_hw_regs[reg]; }
+
+/**
+ * Emits REX, the opcode and the ModRM, SIB and displacement bytes for an
+ * instruction whose ModRM.reg field is `reg` and whose r/m operand is `rm`.
+ * `reg` is either a hardware register or an opcode extension.
+ */
+static bool emit_rm(rs_buffer_t *buf, bool wide, const uint8_t *opcode,
+                    size_t opcode_length, uint8_t reg, bool reg_is_byte,
+                    rs_moperand_t rm) {
+  uint8_t rex = wide ? 0x48 : 0;
+  if (reg >= 8)
+    rex |= 0x44;
+  // spl, bpl, sil and dil are only reachable with a REX prefix.
+  if (reg_is_byte && reg >= 4)
+    rex |= 0x40;
+
+  uint8_t base = 0, index = 4;
+  bool has_base = false, has_index = false;
+  switch (rm.type) {
+  case RS_MOPERAND_REG:
+  case RS_MOPERAND_REG8:
+    base = hw(rm.reg);
+    if (rm.type == RS_MOPERAND_REG8 && base >= 4)
+      rex |= 0x40;
+    break;
+  case RS_MOPERAND_MEM:
+    if (!fits_int32(rm.mem.disp))
+      return false;
+    if (rm.mem.base != RS_NO_MREG) {
+      base = hw(rm.mem.base);
+      has_base = true;
+    }
+    if (rm.mem.index != RS_NO_MREG) {
+      index = hw(rm.mem.index);
+      has_index = true;
+      if (index == 4) // rsp cannot be an index.
+        return false;
+    }
+    if (has_index && index >= 8)
+      rex |= 0x42;
+    break;
+  default:
+    return false;
+  }
+  if (base >= 8)
+    rex |= 0x41;
+
+  if (rex)
+    emit8(buf, rex);
+  for (size_t i = 0; i < opcode_length; i++)
+    emit8(buf, opcode[i]);
+
+  uint8_t reg_field = (uint8_t)((reg & 7) << 3);
+  if (rm.type != RS_MOPERAND_MEM) {
+    emit8(buf, 0xC0 | reg_field | (base & 7));
+    return true;
+  }
+
+  int64_t disp = rm.mem.disp;
+  uint8_t scale_bits = !has_index          ? 0
+                       : rm.mem.scale == 8 ? 3
+                       : rm.mem.scale == 4 ? 2
+                       : rm.mem.scale == 2 ? 1
+                                           : 0;
+
+  // Without a base, mod 00 with a SIB base of 101 means disp32 only. The
+  // plain rm 101 would be RIP-relative in 64-bit mode.
+  if (!has_base) {
+    emit8(buf, 0x04 | reg_field);
+    emit8(buf, (uint8_t)(scale_bits << 6 | (index & 7) << 3 | 5));
+    emit32(buf, disp);
+    return true;
+  }
+
+  // rbp and r13 have no mod 00 form, they need an explicit zero disp8.
+  uint8_t mod = disp == 0 && (base & 7) != 5 ? 0x00
+                : fits_int8(disp)            ? 0x40
+                                             : 0x80;
+  if (has_index || (base & 7) == 4) {
+    emit8(buf, mod | reg_field | 4);
+    emit8(buf, (uint8_t)(scale_bits << 6 | (index & 7) << 3 | (base & 7)));
+  } else {
+    emit8(buf, mod | reg_field | (base & 7));
+  }
+
+  if (mod == 0x40)
+    emit8(buf, (uint8_t)disp);
+  else if (mod == 0x80)
+    emit32(buf, disp);
+  return true;
+}
+
+static bool is_reg(rs_moperand_t operand) {
+  return operand.type == RS_MOPERAND_REG;
+}
+
+static bool is_rm(rs_moperand_t operand) {
+  return operand.type == RS_MOPERAND_REG || operand.type == RS_MOPERAND_MEM;
+}
+
+static bool is_imm(rs_moperand_t operand) {
+  return operand.type == RS_MOPERAND_IMM;
+}
+
+static bool condition_code(const char *suffix, uint8_t *cc) {
+  for (size_t i = 0;
+       i < sizeof(x86_64_conditions) / sizeof(x86_64_conditions[0]); i++) {
+    if (strcmp(suffix, x86_64_conditions[i].suffix) == 0) {
+      *cc = x86_64_conditions[i].cc;
+      return true;
+    }
+  }
+  return false;
+}
+
+// add, sub and cmp share their encodings, differing in the opcode base and the
+// extension used with immediates.
+static bool encode_alu(rs_buffer_t *buf, uint8_t opcode_base, uint8_t ext,
+                       rs_moperand_t dst, rs_moperand_t src) {
+  if (is_rm(dst) && is_reg(src)) {
+    uint8_t opcode = opcode_base + 1;
+    return emit_rm(buf, true, &opcode, 1, hw(src.reg), false, dst);
+  }
+  if (is_reg(dst) && src.type == RS_MOPERAND_MEM) {
+    uint8_t opcode = opcode_base + 3;
+    return emit_rm(buf, true, &opcode, 1, hw(dst.reg), false, src);
+  }
+  if (is_rm(dst) && is_imm(src) && fits_int8(src.imm)) {
+    uint8_t opcode = 0x83;
+    if (!emit_rm(buf, true, &opcode, 1, ext, false, dst))
+      return false;
+    emit8(buf, (uint8_t)src.imm);
+    return true;
+  }
+  if (is_rm(dst) && is_imm(src) && fits_int32(src.imm)) {
+    uint8_t opcode = 0x81;
+    if (!emit_rm(buf, true, &opcode, 1, ext, false, dst))
+      return false;
+    emit32(buf, src.imm);
+    return true;
+  }
+  return false;
+}
+
+static bool encode_mov(rs_buffer_t *buf, rs_moperand_t dst,
+                       rs_moperand_t src) {
+  if (is_rm(dst) && is_reg(src)) {
+    uint8_t opcode = 0x89;
+    return emit_rm(buf, true, &opcode, 1, hw(src.reg), false, dst);
+  }
+  if (is_reg(dst) && src.type == RS_MOPERAND_MEM) {
+    uint8_t opcode = 0x8B;
+    return emit_rm(buf, true, &opcode, 1, hw(dst.reg), false, src);
+  }
+  if (is_rm(dst) && is_imm(src) && fits_int32(src.imm)) {
+    uint8_t opcode = 0xC7;
+    if (!emit_rm(buf, true, &opcode, 1, 0, false, dst))
+      return false;
+    emit32(buf, src.imm);
+    return true;
+  }
+  if (is_reg(dst) && is_imm(src)) {
+    uint8_t reg = hw(dst.reg);
+    emit8(buf, reg >= 8 ? 0x49 : 0x48);
+    emit8(buf, 0xB8 + (reg & 7));
+    emit64(buf, src.imm);
+    return true;
+  }
+  return false;
+}
+
+static bool encode_imul(rs_buffer_t *buf, const rs_minstr_t *minstr) {
+  rs_moperand_t dst = minstr->operands[0], src = minstr->operands[1];
+  if (minstr->operand_count == 2 && is_reg(dst) && is_rm(src)) {
+    static const uint8_t opcode[] = {0x0F, 0xAF};
+    return emit_rm(buf, true, opcode, 2, hw(dst.reg), false, src);
+  }
+
+  rs_moperand_t imm = minstr->operands[2];
+  if (minstr->operand_count == 3 && is_reg(dst) && is_rm(src) && is_imm(imm) &&
+      fits_int32(imm.imm)) {
+    bool short_imm = fits_int8(imm.imm);
+    uint8_t opcode = short_imm ? 0x6B : 0x69;
+    if (!emit_rm(buf, true, &opcode, 1, hw(dst.reg), false, src))
+      return false;
+    if (short_imm)
+      emit8(buf, (uint8_t)imm.imm);
+    else
+      emit32(buf, imm.imm);
+    return true;
+  }
+  return false;
+}
+
+static bool encode(rs_buffer_t *buf, const rs_minstr_t *minstr) {
+  const char *m = minstr->mnemonic;
+  rs_moperand_t a = minstr->operands[0], b = minstr->operands[1];
+  size_t n = minstr->operand_count;
+  uint8_t cc;
+
+  if (strcmp(m, "mov") == 0 && n == 2)
+    return encode_mov(buf, a, b);
+  if (strcmp(m, "add") == 0 && n == 2)
+    return encode_alu(buf, 0x00, 0, a, b);
+  if (strcmp(m, "sub") == 0 && n == 2)
+    return encode_alu(buf, 0x28, 5, a, b);
+  if (strcmp(m, "cmp") == 0 && n == 2)
+    return encode_alu(buf, 0x38, 7, a, b);
+  if (strcmp(m, "and") == 0 && n == 2)
+    return encode_alu(buf, 0x20, 4, a, b);
+  if (strcmp(m, "imul") == 0)
+    return encode_imul(buf, minstr);
+
+  if (strcmp(m, "lea") == 0 && n == 2 && is_reg(a) &&
+      b.type == RS_MOPERAND_MEM) {
+    uint8_t opcode = 0x8D;
+    return emit_rm(buf, true, &opcode, 1, hw(a.reg), false, b);
+  }
+  if (strcmp(m, "inc") == 0 && n == 1 && is_rm(a)) {
+    uint8_t opcode = 0xFF;
+    if (minstr->lock)
+      emit8(buf, 0xF0);
+    return emit_rm(buf, true, &opcode, 1, 0, false, a);
+  }
+  if (strcmp(m, "idiv") == 0 && n == 1 && is_rm(a)) {
+    uint8_t opcode = 0xF7;
+    return emit_rm(buf, true, &opcode, 1, 7, false, a);
+  }
+  if (strcmp(m, "cqo") == 0 && n == 0) {
+    emit8(buf, 0x48);
+    emit8(buf, 0x99);
+    return true;
+  }
+  if (strcmp(m, "neg") == 0 && n == 1 && is_rm(a)) {
+    uint8_t opcode = 0xF7;
+    return emit_rm(buf, true, &opcode, 1, 3, false, a);
+  }
+  if (strcmp(m, "test") == 0 && n == 2 && is_rm(a) && is_reg(b)) {
+    uint8_t opcode = 0x85;
+    return emit_rm(buf, true, &opcode, 1, hw(b.reg), false, a);
+  }
+  if (strcmp(m, "movzx") == 0 && n == 2 && is_reg(a) &&
+      b.type == RS_MOPERAND_REG8) {
+    static const uint8_t opcode[] = {0x0F, 0xB6};
+    return emit_rm(buf, true, opcode, 2, hw(a.reg), false, b);
+  }
+  if (strncmp(m, "set", 3) == 0 && condition_code(m + 3, &cc) && n == 1 &&
+      a.type == RS_MOPERAND_REG8) {
+    uint8_t opcode[] = {0x0F, (uint8_t)(0x90 | cc)};
+    return emit_rm(buf, false, opcode, 2, 0, false, a);
+  }
+  if ((strcmp(m, "push") == 0 || strcmp(m, "pop") == 0) && n == 1 &&
+      is_reg(a)) {
+    uint8_t reg = hw(a.reg);
+    if (reg >= 8)
+      emit8(buf, 0x41);
+    emit8(buf, (uint8_t)((m[1] == 'u' ? 0x50 : 0x58) + (reg & 7)));
+    return true;
+  }
+  if (strcmp(m, "call") == 0 && n == 1 && a.type == RS_MOPERAND_SYMBOL) {
+    // The displacement is filled in once the callee is placed.
+    emit8(buf, 0xE8);
+    emit32(buf, 0);
+    return true;
+  }
+  if (strcmp(m, "ret") == 0 && n == 0) {
+    emit8(buf, 0xC3);
+    return true;
+  }
+  return false;
+}
+
+static bool branch_item(const rs_minstr_t *minstr, item_t *item) {
+  if (minstr->operand_count != 1 ||
+      minstr->operands[0].type != RS_MOPERAND_LABEL ||
+      minstr->mnemonic[0] != 'j')
+    return false;
+
+  const char *suffix = minstr->mnemonic + 1;
+  if (strcmp(suffix, "mp") == 0)
+    item->cc = X86_64_JMP;
+  else if (!condition_code(suffix, &item->cc))
+    return false;
+
+  item->branch = true;
+  item->target = minstr->operands[0].label;
+  return true;
+}
+
+static size_t item_size(const item_t *item, size_t restore_size) {
+  if (item->ret)
+    return restore_size + item->length;
+  if (!item->branch)
+    return item->length;
+  if (!item->wide)
+    return 2;
+  return item->cc == X86_64_JMP ? 5 : 6;
+}
+
+static void report(const rs_minstr_t *minstr) {
+  fprintf(stderr,
+          RS_COLOR_RED RS_COLOR_BOLD "Error: " RS_COLOR_RESET
+                                     "Cannot encode x86-64 '%s' with %zu "
+                                     "operands\n",
+          minstr->mnemonic, (size_t)minstr->operand_count);
+}
+
+// Records the hardware registers an instruction touches.
+static void mark_used(const rs_minstr_t *minstr, uint16_t *used) {
+  for (size_t i = 0; i < minstr->operand_count; i++) {
+    rs_moperand_t operand = minstr->operands[i];
+    if (operand.type == RS_MOPERAND_REG || operand.type == RS_MOPERAND_REG8)
+      *used |= 1u << hw(operand.reg);
+    if (operand.type == RS_MOPERAND_MEM && operand.mem.base != RS_NO_MREG)
+      *used |= 1u << hw(operand.mem.base);
+    if (operand.type == RS_MOPERAND_MEM && operand.mem.index != RS_NO_MREG)
+      *used |= 1u << hw(operand.mem.index);
+  }
+}
+
+// Encodes the rendered instructions into items, leaving branches for later.
+static bool flush_items(rs_minstrs_t *minstrs, rs_buffer_t *scratch,
+                        item_t **items, uint16_t *used) {
+  rs_minstr_t *minstr_it;
+  cvector_for_each_in(minstr_it, *minstrs) {
+    item_t item;
+    memset(&item, 0, sizeof(item));
+    mark_used(minstr_it, used);
+    item.ret = strcmp(minstr_it->mnemonic, "ret") == 0;
+    if (strcmp(minstr_it->mnemonic, "call") == 0 &&
+        minstr_it->operands[0].type == RS_MOPERAND_SYMBOL)
+      item.symbol = minstr_it->operands[0].symbol;
+    if (!branch_item(minstr_it, &item)) {
+      item.start = cvector_size(*scratch);
+      if (!encode(scratch, minstr_it)) {
+        report(minstr_it);
+        return false;
+      }
+      item.length = cvector_size(*scratch) - item.start;
+    }
+    cvector_push_back(*items, item);
+  }
+  cvector_clear(*minstrs);
+  return true;
+}
+
+// Selects and encodes every instruction, recording where each block starts.
+static bool collect_items(rs_t *rs, rs_buffer_t *scratch, item_t **items,
+                          size_t *block_first, uint16_t *used) {
+  const rs_isel_t *isel = rs_get_isel(rs->target);
+  const rs_def_use_t *def_use =
+      rs->opt_level == RS_OPT_O0 ? NULL : rs_get_def_use(rs);
+
+  rs_minstrs_t minstrs = NULL;
+  rs_render_template(rs, isel->prologue, NULL, 0, &minstrs);
+  bool ok = flush_items(&minstrs, scratch, items, used);
+
+  for (size_t block_id = 0; ok && block_id < cvector_size(rs->basic_blocks);
+       block_id++) {
+    block_first[block_id] = cvector_size(*items);
+    rs_render_block_counter(rs, block_id, &minstrs);
+    rs_instructions_t instrs = rs->basic_blocks[block_id]->instructions;
+    for (size_t i = 0; ok && i < cvector_size(instrs);) {
+      size_t length;
+      const rs_pattern_t *pattern = rs_select_pattern(
+          rs, def_use, &instrs[i], cvector_size(instrs) - i, &length);
+      if (!pattern) {
+        fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+                "Error: " RS_COLOR_RESET "No x86-64 pattern matches '");
+        rs_dump_instr(rs, stderr, instrs[i]);
+        fprintf(stderr, "'\n");
+        ok = false;
+        break;
+      }
+      rs_render_template(rs, pattern->template, &instrs[i], length, &minstrs);
+      i += length;
+    }
+    ok = ok && flush_items(&minstrs, scratch, items, used);
+  }
+
+  cvector_free(minstrs);
+  return ok;
+}
+
+bool rs_encode_x86_64(rs_t *rs, rs_buffer_t *buf, size_t *block_offsets,
+                      rs_relocations_t *relocations) {
+  size_t block_count = cvector_size(rs->basic_blocks);
+  size_t *block_first = rs_calloc(block_count + 1, sizeof(size_t));
+  size_t *offsets = rs_calloc(block_count + 1, sizeof(size_t));
+  rs_buffer_t scratch = NULL, saves = NULL, restores = NULL;
+  item_t *items = NULL;
+  bool ok = false;
+
+  rs_pass_timer_t timer = rs_pass_begin();
+  uint16_t used = 0;
+  if (!collect_items(rs, &scratch, &items, block_first, &used))
+    goto out;
+
+  // SysV callers expect rbx, rbp and r12-r15 to survive the call, so the ones
+  // in use are pushed on entry and popped before every ret.
+  size_t saved_count = sizeof(x86_64_callee_saved);
+  for (size_t i = 0; i < saved_count; i++) {
+    uint8_t reg = x86_64_callee_saved[i];
+    if (!(used & (1u << reg)))
+      continue;
+    if (reg >= 8)
+      emit8(&saves, 0x41);
+    emit8(&saves, 0x50 + (reg & 7));
+  }
+  for (size_t i = saved_count; i-- > 0;) {
+    uint8_t reg = x86_64_callee_saved[i];
+    if (!(used & (1u << reg)))
+      continue;
+    if (reg >= 8)
+      emit8(&restores, 0x41);
+    emit8(&restores, 0x58 + (reg & 7));
+  }
+  size_t save_size = cvector_size(saves);
+  size_t restore_size = cvector_size(restores);
+
+  // Widen branches until every displacement fits. Widening only grows the
+  // code, so this terminates.
+  size_t iterations = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    iterations++;
+
+    size_t offset = save_size, block_id = 0;
+    for (size_t i = 0; i <= cvector_size(items); i++) {
+      while (block_id < block_count && block_first[block_id] == i)
+        offsets[block_id++] = offset;
+      if (i < cvector_size(items))
+        offset += item_size(&items[i], restore_size);
+    }
+
+    offset = save_size;
+    for (size_t i = 0; i < cvector_size(items); i++) {
+      item_t *item = &items[i];
+      offset += item_size(item, restore_size);
+      if (!item->branch || item->wide)
+        continue;
+      int64_t disp = (int64_t)offsets[item->target] - (int64_t)offset;
+      if (!fits_int8(disp)) {
+        item->wide = true;
+        changed = true;
+      }
+    }
+  }
+
+  size_t base = cvector_size(*buf);
+  fixup_t *fixups = NULL;
+  for (size_t b = 0; b < save_size; b++)
+    emit8(buf, saves[b]);
+  for (size_t i = 0; i < cvector_size(items); i++) {
+    item_t *item = &items[i];
+    if (item->ret) {
+      for (size_t b = 0; b < restore_size; b++)
+        emit8(buf, restores[b]);
+    }
+    if (!item->branch) {
+      for (size_t b = 0; b < item->length; b++)
+        emit8(buf, scratch[item->start + b]);
+      if (item->symbol) {
+        rs_relocation_t relocation = {cvector_size(*buf) - 4, item->symbol};
+        cvector_push_back(*relocations, relocation);
+      }
+      continue;
+    }
+
+    if (item->cc == X86_64_JMP) {
+      emit8(buf, item->wide ? 0xE9 : 0xEB);
+    } else if (item->wide) {
+      emit8(buf, 0x0F);
+      emit8(buf, 0x80 | item->cc);
+    } else {
+      emit8(buf, 0x70 | item->cc);
+    }
+
+    fixup_t fixup = {cvector_size(*buf), item->wide ? 4 : 1, item->target};
+    cvector_push_back(fixups, fixup);
+    for (size_t b = 0; b < fixup.width; b++)
+      emit8(buf, 0);
+  }
+
+  fixup_t *fixup_it;
+  cvector_for_each_in(fixup_it, fixups) {
+    int64_t disp = (int64_t)(base + offsets[fixup_it->target]) -
+                   (int64_t)(fixup_it->offset + fixup_it->width);
+    for (size_t b = 0; b < fixup_it->width; b++)
+      (*buf)[fixup_it->offset + b] = (uint8_t)((uint64_t)disp >> (8 * b));
+  }
+
+  debug_log("Encoded %zu bytes with %zu branches after %zu relaxation passes",
+            cvector_size(*buf) - base, cvector_size(fixups), iterations);
+  if (block_offsets)
+    memcpy(block_offsets, offsets, block_count * sizeof(size_t));
+  cvector_free(fixups);
+  ok = true;
+  rs_pass_end(rs, RS_PASS_ENCODE, timer);
+
+out:
+  cvector_free(items);
+  cvector_free(scratch);
+  cvector_free(saves);
+  cvector_free(restores);
+  free(offsets);
+  free(block_first);
+  return ok;
+}
+
+void rs_resolve_x86_64(rs_buffer_t buf, rs_relocations_t *relocations,
+                       const char *symbol, size_t offset) {
+  size_t kept = 0;
+  for (size_t i = 0; i < cvector_size(*relocations); i++) {
+    rs_relocation_t relocation = (*relocations)[i];
+    if (strcmp(relocation.symbol, symbol) != 0) {
+      (*relocations)[kept++] = relocation;
+      continue;
+    }
+
+    // rel32 is relative to the end of the call.
+    int64_t disp = (int64_t)offset - (int64_t)(relocation.offset + 4);
+    for (size_t b = 0; b < 4; b++)
+      buf[relocation.offset + b] = (uint8_t)((uint64_t)disp >> (8 * b));
+  }
+  while (cvector_size(*relocations) > kept)
+    cvector_pop_back(*relocations);
+}
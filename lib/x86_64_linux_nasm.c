@@ -1,150 +1,505 @@
 #include "cvector_utils.h"
 #include "runestone.h"
-#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
-void rs_generate_x86_64_linux_nasm(rs_t *rs, FILE *fp) {
-  fprintf(fp, "section .text\n");
-  fprintf(fp, "global _start:\n");
-  fprintf(fp, "_start:\n");
+/**
+ * The `RS_TARGETS` count of allocatable registers, then the reserved ones.
+ */
+#define X86_64_REGS(X)                                                         \
+  X(rax) X(rbx) X(rcx) X(rdx) X(rsi) X(rdi) X(r8) X(r9) X(r10) X(r11) X(r12)   \
+  X(r13) X(r14) X(r15) X(rsp) X(rbp)
 
-  rs_basic_block_t **bb_it;
-  cvector_for_each_in(bb_it, rs->basic_blocks) {
-    fprintf(fp, ".%s:\n", (*bb_it)->name);
+/** Low byte names of the allocatable registers, in the same order. */
+#define X86_64_BYTE_REGS(X)                                                    \
+  X(al) X(bl) X(cl) X(dl) X(sil) X(dil) X(r8b) X(r9b) X(r10b) X(r11b) X(r12b)  \
+  X(r13b) X(r14b) X(r15b)
 
-    rs_instr_t *instr_it;
-    cvector_for_each_in(instr_it, (*bb_it)->instructions) {
-      rs_generate_instr_x86_64_linux_nasm(rs, fp, *instr_it);
-    }
-  }
-}
+#define X(name) #name,
+const char *rs_target_x86_64_linux_nasm_reg_names[] = {X86_64_REGS(X)};
+static const char *x86_64_byte_reg_names[] = {X86_64_BYTE_REGS(X)};
+#undef X
 
-void rs_generate_instr_x86_64_linux_nasm(rs_t *rs, FILE *fp, rs_instr_t instr) {
-  fprintf(fp, "  ; ");
-  rs_dump_instr(rs, fp, instr);
-  fprintf(fp, "\n");
-  switch (instr.opcode) {
-  /*
-   * mov dst, src
-   **/
-  case RS_OPCODE_MOVE:
-    fprintf(fp, "  mov ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.dest, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, false);
-    fprintf(fp, "\n");
-    break;
+// Name lengths, so that emitting a register needs no strlen.
+#define X(name) sizeof(#name) - 1,
+static const uint8_t x86_64_reg_name_lengths[] = {X86_64_REGS(X)};
+static const uint8_t x86_64_byte_reg_name_lengths[] = {X86_64_BYTE_REGS(X)};
+#undef X
 
-  /*
-   * mov %0, [src]
-   * mov [dst], %0
-   **/
-  case RS_OPCODE_COPY:
-    fprintf(fp, "  mov ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src2, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, true);
-    fprintf(fp, "\n");
-    fprintf(fp, "  mov ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.dest, true);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
-    break;
+/**
+ * Index of `rsp` in `rs_target_x86_64_linux_nasm_reg_names`. `rbp` follows it
+ * and is only used as a scratch register by the patterns that access 64-bit
+ * absolute addresses.
+ */
+#define X86_64_RSP 14
+/** Index of `rbp` in `rs_target_x86_64_linux_nasm_reg_names`. */
+#define X86_64_RBP (X86_64_RSP + 1)
 
-  /*
-   * mov dst, [src]
-   **/
-  case RS_OPCODE_LOAD:
-    fprintf(fp, "  mov ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.dest, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, true);
-    fprintf(fp, "\n");
-    break;
+/** Register or 32-bit immediate source. */
+#define X86_64_RI (RS_KIND_REG | RS_KIND_IMM32)
+/** Register or memory source. */
+#define X86_64_RM (RS_KIND_REG | RS_KIND_MEM)
+/** Register, 32-bit immediate or memory source. */
+#define X86_64_RIM (RS_KIND_REG | RS_KIND_IMM32 | RS_KIND_MEM)
+/** Operand that can be dereferenced. */
+#define X86_64_ADDRESS (RS_KIND_REG | RS_KIND_ADDR32 | RS_KIND_MEM)
+/** Call argument. */
+#define X86_64_ARG (RS_KIND_REG | RS_KIND_IMM)
 
-  /*
-   * mov [dst], src
-   **/
-  case RS_OPCODE_STORE:
-    fprintf(fp, "  mov ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.dest, true);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, false);
-    fprintf(fp, "\n");
-    break;
+/** Indices of the allocatable registers a SysV callee may clobber. */
+static const uint8_t x86_64_caller_saved[] = {0, 2, 3, 4, 5, 6, 7, 8, 9};
 
-  /*
-   * mov dst, src1
-   * add dst, src2
-   **/
-  case RS_OPCODE_ADD:
-    fprintf(fp, "  mov ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.dest, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, false);
-    fprintf(fp, "\n");
-    fprintf(fp, "  add ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.dest, false);
-    fprintf(fp, ", ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src2, false);
-    fprintf(fp, "\n");
-    break;
+/** Indices of the registers a SysV callee must preserve, in push order. */
+static const uint8_t x86_64_callee_saved[] = {1, X86_64_RBP, 10, 11, 12, 13};
 
-  case RS_OPCODE_SUB:
-  case RS_OPCODE_MULT:
-  case RS_OPCODE_DIV:
-    assert(false && "unimplemented");
-    break;
+/**
+ * @brief Comparison patterns, materializing the flag or branching on it.
+ */
+#define X86_64_CMP_PATTERNS(P, F, opcode, cc)                                  \
+  P(opcode, (RS_KIND_REG, RS_KIND_REG, X86_64_RIM, RS_KIND_NULL), NONE, 3,     \
+    "cmp $1, $2\nset" cc " $b\nmovzx $d, $b")                                  \
+  P(opcode, (RS_KIND_REG, RS_KIND_IMM32, X86_64_RI, RS_KIND_NULL), DEST_FREE2, \
+    4, "mov $d, $1\ncmp $d, $2\nset" cc " $b\nmovzx $d, $b")                   \
+  F(opcode, (RS_KIND_REG, RS_KIND_REG, X86_64_RIM, RS_KIND_NULL), BR_IF,       \
+    (RS_KIND_NULL, RS_KIND_LINK, RS_KIND_BB, RS_KIND_BB), NONE, 3,             \
+    "cmp $f1, $f2\nj" cc " $2\njmp $3")
 
-  case RS_OPCODE_RET:
-    if (instr.src1.type != RS_OPERAND_TYPE_NULL) {
-      fprintf(fp, "  mov rax, ");
-      rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, false);
-      fprintf(fp, "\n");
-    }
-    fprintf(fp, "  ret\n");
-    break;
+/**
+ * @brief Calls passing `args` in `rdi` and `rsi`.
+ *
+ * Neither allocator knows which registers a call clobbers, so every
+ * caller-saved register is pushed around it and the arguments are read from
+ * the pushed copies. `rbp` is callee-saved and keeps the stack pointer while
+ * it is realigned to 16 bytes. The result is stored into the pushed copy of
+ * `$d` so that popping delivers it.
+ */
+#define X86_64_CALL_PATTERN(P, arg1, arg2, moves)                              \
+  P(CALL, (RS_KIND_REG, RS_KIND_SYM, arg1, arg2), NONE, 24,                    \
+    "<push $r\n" moves "push rbp\nmov rbp, rsp\nand rsp, -16\ncall $1\n"       \
+    "mov rsp, rbp\npop rbp\nmov $ad, rax\n>pop $r")
 
-  case RS_OPCODE_BR:
-    fprintf(fp, "  jmp ");
-    rs_generate_operand_x86_64_linux_nasm(rs, fp, instr.src1, false);
-    fprintf(fp, "\n");
-    break;
+/**
+ * @brief Signed division through `rdx:rax`.
+ *
+ * The allocators do not reserve `rax` and `rdx`, so both are saved below the
+ * divisor and restored before the quotient reaches `$d`, which may be either
+ * of them. The sources are read before anything is overwritten.
+ */
+#define X86_64_DIV_PATTERN(P)                                                  \
+  P(DIV, (RS_KIND_REG, RS_KIND_REG | RS_KIND_IMM, X86_64_RI, RS_KIND_NULL),    \
+    NONE, 11,                                                                  \
+    "push rdx\npush rax\nsub rsp, 8\nmov [rsp], $2\nmov rax, $1\ncqo\n"        \
+    "idiv [rsp]\nmov [rsp], rax\nmov rax, [rsp + 8]\nmov rdx, [rsp + 16]\n"    \
+    "mov $d, [rsp]\nadd rsp, 24")
 
-  case RS_OPCODE_BR_IF:
-  case RS_OPCODE_CMP_EQ:
-  case RS_OPCODE_CMP_LT:
-  case RS_OPCODE_CMP_GT:
-    assert(false && "unimplemented");
-    break;
+/**
+ * @brief Arithmetic with a single-use load folded into its second operand.
+ */
+#define X86_64_LOAD_OP_PATTERNS(F, opcode, mnemonic)                           \
+  F(LOAD, (RS_KIND_REG, X86_64_ADDRESS, RS_KIND_NULL, RS_KIND_NULL), opcode,   \
+    (RS_KIND_REG, RS_KIND_REG, RS_KIND_LINK, RS_KIND_NULL), TIED_SRC1, 1,      \
+    mnemonic " $d, [$f1]")
 
-  case RS_OPCODE_COUNT:
-    assert(false && "unreachable");
-    break;
-  }
+/**
+ * @brief The x86-64 instruction selection patterns.
+ *
+ * `P` declares a pattern covering one instruction and `F` one fusing two, see
+ * `RS_PATTERN` and `RS_FUSED_PATTERN`. The cheapest matching pattern wins,
+ * and the first one listed among equally cheap ones.
+ */
+#define X86_64_PATTERNS(P, F)                                                  \
+  P(MOVE, (RS_KIND_REG, RS_KIND_REG, RS_KIND_NULL, RS_KIND_NULL), TIED_SRC1,   \
+    0, "")                                                                     \
+  P(MOVE,                                                                      \
+    (RS_KIND_REG, RS_KIND_REG | RS_KIND_IMM | RS_KIND_ADDR, RS_KIND_NULL,      \
+     RS_KIND_NULL),                                                            \
+    NONE, 1, "mov $d, $1")                                                     \
+  P(COPY, (RS_KIND_REG, X86_64_ADDRESS, RS_KIND_REG, RS_KIND_NULL), NONE, 2,   \
+    "mov $2, [$1]\nmov [$d], $2")                                              \
+  P(LOAD, (RS_KIND_REG, RS_KIND_IMM, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,     \
+    "mov $d, $1")                                                              \
+  P(LOAD, (RS_KIND_REG, X86_64_ADDRESS, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,  \
+    "mov $d, [$1]")                                                            \
+  P(LOAD, (RS_KIND_REG, RS_KIND_ADDR, RS_KIND_NULL, RS_KIND_NULL), NONE, 2,    \
+    "mov $d, $1\nmov $d, [$d]")                                                \
+  P(STORE, (RS_KIND_NULL, X86_64_RI, X86_64_ADDRESS, RS_KIND_NULL), NONE, 1,   \
+    "mov [$2], $1")                                                            \
+  P(STORE, (RS_KIND_NULL, X86_64_RI, RS_KIND_ADDR, RS_KIND_NULL), NONE, 2,     \
+    "mov rbp, $2\nmov [rbp], $1")                                              \
+  P(ADD, (RS_KIND_REG, RS_KIND_REG, X86_64_RIM, RS_KIND_NULL), TIED_SRC1, 1,   \
+    "add $d, $2")                                                              \
+  P(ADD, (RS_KIND_REG, X86_64_RIM, RS_KIND_REG, RS_KIND_NULL), TIED_SRC2, 1,   \
+    "add $d, $1")                                                              \
+  P(ADD, (RS_KIND_REG, RS_KIND_REG, X86_64_RI, RS_KIND_NULL), NONE, 1,         \
+    "lea $d, [$1 + $2]")                                                       \
+  P(ADD, (RS_KIND_REG, X86_64_RIM, X86_64_RIM, RS_KIND_NULL), DEST_FREE2, 2,   \
+    "mov $d, $1\nadd $d, $2")                                                  \
+  P(ADD, (RS_KIND_REG, X86_64_RIM, X86_64_RIM, RS_KIND_NULL), DEST_FREE1, 2,   \
+    "mov $d, $2\nadd $d, $1")                                                  \
+  P(SUB, (RS_KIND_REG, RS_KIND_REG, X86_64_RIM, RS_KIND_NULL), TIED_SRC1, 1,   \
+    "sub $d, $2")                                                              \
+  P(SUB, (RS_KIND_REG, RS_KIND_REG, RS_KIND_IMM32, RS_KIND_NULL),              \
+    NEGATABLE_SRC2, 1, "lea $d, [$1 - $2]")                                    \
+  P(SUB, (RS_KIND_REG, X86_64_RIM, RS_KIND_REG, RS_KIND_NULL), TIED_SRC2, 2,   \
+    "neg $d\nadd $d, $1")                                                      \
+  P(SUB, (RS_KIND_REG, X86_64_RIM, X86_64_RIM, RS_KIND_NULL), DEST_FREE2, 2,   \
+    "mov $d, $1\nsub $d, $2")                                                  \
+  P(MULT, (RS_KIND_REG, X86_64_RM, RS_KIND_IMM32, RS_KIND_NULL), NONE, 1,      \
+    "imul $d, $1, $2")                                                         \
+  P(MULT, (RS_KIND_REG, RS_KIND_REG, X86_64_RM, RS_KIND_NULL), TIED_SRC1, 1,   \
+    "imul $d, $2")                                                             \
+  P(MULT, (RS_KIND_REG, X86_64_RM, RS_KIND_REG, RS_KIND_NULL), TIED_SRC2, 1,   \
+    "imul $d, $1")                                                             \
+  P(MULT, (RS_KIND_REG, X86_64_RIM, X86_64_RM, RS_KIND_NULL), DEST_FREE2, 2,   \
+    "mov $d, $1\nimul $d, $2")                                                 \
+  P(MULT, (RS_KIND_REG, RS_KIND_IMM32, RS_KIND_IMM32, RS_KIND_NULL), NONE, 2,  \
+    "mov $d, $1\nimul $d, $d, $2")                                             \
+  X86_64_DIV_PATTERN(P)                                                        \
+  P(RET, (RS_KIND_NULL, RS_KIND_NULL, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,    \
+    "?add rsp, $F\nret")                                                       \
+  P(RET,                                                                       \
+    (RS_KIND_NULL, RS_KIND_REG | RS_KIND_IMM | RS_KIND_MEM, RS_KIND_NULL,      \
+     RS_KIND_NULL),                                                            \
+    NONE, 2, "mov rax, $1\n?add rsp, $F\nret")                                 \
+  P(BR, (RS_KIND_NULL, RS_KIND_BB, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,       \
+    "jmp $1")                                                                  \
+  P(BR_IF, (RS_KIND_NULL, RS_KIND_REG, RS_KIND_BB, RS_KIND_BB), NONE, 3,       \
+    "test $1, $1\njnz $2\njmp $3")                                             \
+  X86_64_CALL_PATTERN(P, RS_KIND_NULL, RS_KIND_NULL, "")                       \
+  X86_64_CALL_PATTERN(P, X86_64_ARG, RS_KIND_NULL, "mov rdi, $a2\n")           \
+  X86_64_CALL_PATTERN(P, X86_64_ARG, X86_64_ARG,                               \
+                      "mov rdi, $a2\nmov rsi, $a3\n")                          \
+  X86_64_CMP_PATTERNS(P, F, CMP_EQ, "e")                                       \
+  X86_64_CMP_PATTERNS(P, F, CMP_LT, "l")                                       \
+  X86_64_CMP_PATTERNS(P, F, CMP_GT, "g")                                       \
+  X86_64_LOAD_OP_PATTERNS(F, ADD, "add")                                       \
+  X86_64_LOAD_OP_PATTERNS(F, SUB, "sub")                                       \
+  X86_64_LOAD_OP_PATTERNS(F, MULT, "imul")                                     \
+  P(SPILL, (RS_KIND_NULL, RS_KIND_REG, RS_KIND_SLOT, RS_KIND_NULL), NONE, 1,   \
+    "mov $2, $1")                                                              \
+  P(RELOAD, (RS_KIND_REG, RS_KIND_SLOT, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,  \
+    "mov $d, $1")                                                              \
+  P(PARAM, (RS_KIND_REG, RS_KIND_SLOT, RS_KIND_NULL, RS_KIND_NULL), NONE, 1,   \
+    "mov $d, $1")
+
+static const rs_pattern_t x86_64_patterns[] = {
+    X86_64_PATTERNS(RS_PATTERN, RS_FUSED_PATTERN)};
+
+const rs_isel_t rs_isel_x86_64_linux_nasm = {
+    x86_64_patterns,
+    sizeof(x86_64_patterns) / sizeof(x86_64_patterns[0]),
+    rs_target_x86_64_linux_nasm_reg_names,
+    sizeof(rs_target_x86_64_linux_nasm_reg_names) /
+        sizeof(rs_target_x86_64_linux_nasm_reg_names[0]),
+    x86_64_byte_reg_names,
+    X86_64_RSP,
+    8,
+    "?sub rsp, $F\n1mov [rsp], rdi\n2mov [rsp + 8], rsi",
+    x86_64_caller_saved,
+    sizeof(x86_64_caller_saved),
+    "mov rbp, $1\ninc [rbp]",
+    "mov rbp, $1\nlock inc [rbp]"};
+
+static void emit_reg(rs_emitter_t *out, uint8_t reg) {
+  rs_emit(out, rs_target_x86_64_linux_nasm_reg_names[reg],
+          x86_64_reg_name_lengths[reg]);
 }
-void rs_generate_operand_x86_64_linux_nasm(rs_t *rs, FILE *fp,
-                                           rs_operand_t operand,
-                                           bool dereference) {
+
+static void print_moperand(rs_t *rs, rs_emitter_t *out, const char *mnemonic,
+                           rs_moperand_t operand) {
   switch (operand.type) {
-  case RS_OPERAND_TYPE_NULL:
+  case RS_MOPERAND_NONE:
+    break;
+  case RS_MOPERAND_REG:
+    emit_reg(out, operand.reg);
+    break;
+  case RS_MOPERAND_REG8:
+    rs_emit(out, x86_64_byte_reg_names[operand.reg],
+            x86_64_byte_reg_name_lengths[operand.reg]);
     break;
-  case RS_OPERAND_TYPE_INT64:
-    fprintf(fp, "%lld", operand.int64);
+  case RS_MOPERAND_IMM:
+  case RS_MOPERAND_POOL:
+    rs_emit_int(out, operand.imm);
     break;
-  case RS_OPERAND_TYPE_ADDR:
-    fprintf(fp, "%zu", operand.addr);
+  case RS_MOPERAND_MEM: {
+    bool first = true;
+    // lea computes the address without accessing memory.
+    if (strcmp(mnemonic, "lea") == 0)
+      rs_emit_char(out, '[');
+    else
+      rs_emit(out, "qword [", 7);
+    if (operand.mem.base != RS_NO_MREG) {
+      emit_reg(out, operand.mem.base);
+      first = false;
+    }
+    if (operand.mem.index != RS_NO_MREG) {
+      if (!first)
+        rs_emit(out, " + ", 3);
+      emit_reg(out, operand.mem.index);
+      if (operand.mem.scale != 1) {
+        rs_emit_char(out, '*');
+        rs_emit_uint(out, operand.mem.scale, 10);
+      }
+      first = false;
+    }
+    int64_t disp = operand.mem.disp;
+    if (first) {
+      rs_emit_int(out, disp);
+    } else if (disp != 0) {
+      rs_emit(out, disp < 0 ? " - " : " + ", 3);
+      rs_emit_uint(out, disp < 0 ? 0 - (uint64_t)disp : (uint64_t)disp, 10);
+    }
+    rs_emit_char(out, ']');
     break;
-  case RS_OPERAND_TYPE_REG:
-    fprintf(
-        fp, "%s%s%s", dereference ? "[" : "",
-        rs_get_register_names(rs->target)[rs_get_register(rs, operand.vreg)],
-        dereference ? "]" : "");
+  }
+  case RS_MOPERAND_LABEL:
+    rs_emit_char(out, '.');
+    rs_emit_str(out, rs->basic_blocks[operand.label]->name);
     break;
-  case RS_OPERAND_TYPE_BB:
-    fprintf(fp, ".%s", rs->basic_blocks[operand.bb_id]->name);
+  case RS_MOPERAND_SYMBOL:
+    rs_emit_str(out, operand.symbol);
     break;
-  case RS_OPERAND_TYPE_COUNT:
+  case RS_MOPERAND_LITERAL:
+    rs_emit(out, operand.literal.text, operand.literal.length);
     break;
   }
 }
+
+// Pops the saved callee-saved registers in reverse order of the prologue.
+static void emit_restores(rs_emitter_t *out, uint16_t saved) {
+  for (size_t i = sizeof(x86_64_callee_saved); i-- > 0;) {
+    uint8_t reg = x86_64_callee_saved[i];
+    if (!(saved & (1u << reg)))
+      continue;
+    rs_emit_str(out, "  pop ");
+    emit_reg(out, reg);
+    rs_emit_char(out, '\n');
+  }
+}
+
+static void print_minstrs(rs_t *rs, rs_emitter_t *out, rs_minstrs_t minstrs,
+                          uint16_t saved) {
+  rs_minstr_t *minstr_it;
+  cvector_for_each_in(minstr_it, minstrs) {
+    if (saved && strcmp(minstr_it->mnemonic, "ret") == 0)
+      emit_restores(out, saved);
+    rs_emit(out, "  ", 2);
+    if (minstr_it->lock)
+      rs_emit(out, "lock ", 5);
+    rs_emit_str(out, minstr_it->mnemonic);
+    for (size_t i = 0; i < minstr_it->operand_count; i++) {
+      if (i == 0)
+        rs_emit_char(out, ' ');
+      else
+        rs_emit(out, ", ", 2);
+      print_moperand(rs, out, minstr_it->mnemonic, minstr_it->operands[i]);
+    }
+    rs_emit_char(out, '\n');
+  }
+}
+
+static void generate_template(rs_t *rs, rs_emitter_t *out,
+                              const char *template, const rs_instr_t *instrs,
+                              size_t count) {
+  rs_minstrs_t minstrs = NULL;
+  rs_render_template(rs, template, instrs, count, &minstrs);
+  print_minstrs(rs, out, minstrs, 0);
+  cvector_free(minstrs);
+}
+
+static void generate_pattern(rs_t *rs, rs_emitter_t *out,
+                             const rs_pattern_t *pattern,
+                             const rs_instr_t *instrs, size_t count,
+                             uint16_t saved) {
+  // Rendering allocates the registers the comments may describe.
+  rs_minstrs_t minstrs = NULL;
+  if (pattern)
+    rs_render_template(rs, pattern->template, instrs, count, &minstrs);
+
+  for (size_t i = 0; i < count; i++)
+    rs_emit_comment(rs, out, "  ; ", instrs[i]);
+
+  if (!pattern) {
+    fprintf(stderr, RS_COLOR_RED RS_COLOR_BOLD
+            "Error: " RS_COLOR_RESET "No x86-64 pattern matches '");
+    rs_dump_instr(rs, stderr, instrs[0]);
+    fprintf(stderr, "'\n");
+    return;
+  }
+  print_minstrs(rs, out, minstrs, saved);
+  cvector_free(minstrs);
+}
+
+// Comments the estimated cost of a block under its label.
+static void emit_block_cost(rs_t *rs, rs_emitter_t *out, const void *def_use,
+                            size_t block_id) {
+  rs_block_cost_t cost;
+  if (!rs_x86_64_block_cost(rs, def_use, block_id, &cost))
+    return;
+
+  uint64_t hundredths = (uint64_t)(cost.throughput * 100 + 0.5);
+  rs_emit_str(out, "  ; cost: ");
+  rs_emit_uint(out, cost.uops, 10);
+  rs_emit_str(out, " uops, latency ");
+  rs_emit_uint(out, cost.latency, 10);
+  rs_emit_str(out, ", throughput ");
+  rs_emit_uint(out, hundredths / 100, 10);
+  rs_emit_char(out, '.');
+  rs_emit_char(out, (char)('0' + hundredths / 10 % 10));
+  rs_emit_char(out, (char)('0' + hundredths % 10));
+  rs_emit_char(out, '\n');
+}
+
+/** What the blocks of a function are generated with. */
+typedef struct {
+  const rs_def_use_t *def_use; /**< Def-use chains, or NULL at O0. */
+  uint16_t saved;              /**< Callee-saved registers to restore. */
+} function_t;
+
+static void generate_block(rs_t *rs, rs_emitter_t *out, const void *context,
+                           size_t block_id) {
+  const function_t *function = context;
+  rs_basic_block_t *bb = rs->basic_blocks[block_id];
+  rs_emit_char(out, '.');
+  rs_emit_str(out, bb->name);
+  rs_emit(out, ":\n", 2);
+  if (rs->verbosity >= RS_VERBOSITY_COST)
+    emit_block_cost(rs, out, function->def_use, block_id);
+
+  rs_minstrs_t counter = NULL;
+  rs_render_block_counter(rs, block_id, &counter);
+  print_minstrs(rs, out, counter, 0);
+  cvector_free(counter);
+
+  rs_instructions_t instrs = bb->instructions;
+  for (size_t i = 0; i < cvector_size(instrs);) {
+    size_t length;
+    const rs_pattern_t *pattern = rs_select_pattern(
+        rs, function->def_use, &instrs[i], cvector_size(instrs) - i, &length);
+    generate_pattern(rs, out, pattern, &instrs[i], length, function->saved);
+    i += length;
+  }
+}
+
+// Declares the called symbols. NASM treats those also defined in the file as
+// global, so functions of the same module need no special casing.
+static void emit_externs(rs_t *rs, rs_emitter_t *out) {
+  cvector(const char *) declared = NULL;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, rs->basic_blocks[block_id]->instructions) {
+      if (instr_it->opcode != RS_OPCODE_CALL ||
+          instr_it->src1.type != RS_OPERAND_TYPE_SYM)
+        continue;
+
+      bool seen = false;
+      for (size_t i = 0; !seen && i < cvector_size(declared); i++)
+        seen = strcmp(declared[i], instr_it->src1.symbol) == 0;
+      if (seen)
+        continue;
+      cvector_push_back(declared, instr_it->src1.symbol);
+      rs_emit_str(out, "extern ");
+      rs_emit_str(out, instr_it->src1.symbol);
+      rs_emit_char(out, '\n');
+    }
+  }
+  cvector_free(declared);
+}
+
+static void mark_operand(const rs_register_t *reg_of, rs_operand_t operand,
+                         uint16_t *used) {
+  if (operand.type == RS_OPERAND_TYPE_REG) {
+    *used |= 1u << reg_of[operand.vreg];
+  } else if (operand.type == RS_OPERAND_TYPE_MEM) {
+    if (operand.mem.base != RS_INVALID_VREG)
+      *used |= 1u << reg_of[operand.mem.base];
+    if (operand.mem.index != RS_INVALID_VREG)
+      *used |= 1u << reg_of[operand.mem.index];
+  }
+}
+
+// Finds the callee-saved registers the function writes, like the encoder
+// does. A streamed function is headed before its later windows are built, so
+// it saves all of them.
+static uint16_t callee_saved_in_use(rs_t *rs) {
+  uint16_t all = 0;
+  for (size_t i = 0; i < sizeof(x86_64_callee_saved); i++)
+    all |= 1u << x86_64_callee_saved[i];
+  if (rs->stream)
+    return all;
+
+  // Unmapped vregs land on rsp, which is never saved.
+  rs_register_t reg_of[RS_MAX_REGS];
+  memset(reg_of, X86_64_RSP, sizeof(reg_of));
+  rs_map_entry_t *entry_it;
+  cvector_for_each_in(entry_it, rs->register_map.entries) {
+    if (entry_it->value < X86_64_RSP)
+      reg_of[entry_it->key] = entry_it->value;
+  }
+
+  // rbp is the scratch register of block counters and of stores to 64-bit
+  // addresses. Calls save it themselves.
+  uint16_t used = rs->block_counters ? 1u << X86_64_RBP : 0;
+  for (size_t block_id = rs->window_begin; block_id < rs->window_end;
+       block_id++) {
+    rs_instr_t *instr_it;
+    cvector_for_each_in(instr_it, rs->basic_blocks[block_id]->instructions) {
+      mark_operand(reg_of, instr_it->dest, &used);
+      mark_operand(reg_of, instr_it->src1, &used);
+      mark_operand(reg_of, instr_it->src2, &used);
+      mark_operand(reg_of, instr_it->src3, &used);
+      if (instr_it->opcode == RS_OPCODE_STORE &&
+          instr_it->src2.type == RS_OPERAND_TYPE_ADDR &&
+          instr_it->src2.addr > INT32_MAX)
+        used |= 1u << X86_64_RBP;
+    }
+  }
+  return used & all;
+}
+
+void rs_generate_x86_64_linux_nasm(rs_t *rs, rs_emitter_t *out) {
+  emit_externs(rs, out);
+
+  function_t function = {
+      // O0 skips the analysis, and with it instruction fusion.
+      .def_use = rs->opt_level == RS_OPT_O0 ? NULL : rs_get_def_use(rs),
+      .saved = callee_saved_in_use(rs),
+  };
+
+  // A streamed function gets its header with the first window only.
+  if (rs->window_begin == 0) {
+    rs_emit_str(out, "section .text\n"
+                     "global ");
+    rs_emit_str(out, rs_get_symbol(rs));
+    rs_emit(out, ":\n", 2);
+    rs_emit_str(out, rs_get_symbol(rs));
+    rs_emit(out, ":\n", 2);
+
+    // SysV callers expect rbx, rbp and r12-r15 to survive the call.
+    for (size_t i = 0; i < sizeof(x86_64_callee_saved); i++) {
+      uint8_t reg = x86_64_callee_saved[i];
+      if (!(function.saved & (1u << reg)))
+        continue;
+      rs_emit_str(out, "  push ");
+      emit_reg(out, reg);
+      rs_emit_char(out, '\n');
+    }
+    generate_template(rs, out, rs_isel_x86_64_linux_nasm.prologue, NULL, 0);
+  }
+
+  rs_emit_blocks(rs, out, generate_block, &function);
+}
+
+void rs_generate_instr_x86_64_linux_nasm(rs_t *rs, rs_emitter_t *out,
+                                         rs_instr_t instr) {
+  size_t length;
+  generate_pattern(rs, out, rs_select_pattern(rs, NULL, &instr, 1, &length),
+                   &instr, 1, 0);
+}
+
+void rs_generate_operand_x86_64_linux_nasm(rs_t *rs, rs_emitter_t *out,
+                                           rs_operand_t operand,
+                                           bool dereference) {
+  print_moperand(rs, out, "", rs_lower_operand(rs, operand, dereference));
+}
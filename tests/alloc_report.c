@@ -0,0 +1,169 @@
+/**
+ * @file alloc_report.c
+ * @brief Register allocation reports of compiled and streamed functions.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Values the entry block keeps live at once. */
+#define REPORT_WIDTH 5
+
+/** Blocks of the streamed chain, more than one window. */
+#define REPORT_STREAM_BLOCKS 80
+
+/** Bytes of JSON read back. */
+#define REPORT_JSON 65536
+
+static int64_t cells[REPORT_WIDTH];
+
+// Builds a function summing `REPORT_WIDTH` loaded values in its entry block,
+// then adding one to the sum in each of two more blocks.
+static void build_sum(rs_t *rs) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t middle = rs_append_basic_block(rs, "middle");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_position_at_basic_block(rs, entry);
+  rs_operand_t values[REPORT_WIDTH];
+  for (size_t i = 0; i < REPORT_WIDTH; i++)
+    values[i] = rs_build_load(rs, CELL(cells[i]));
+  rs_operand_t sum = values[0];
+  for (size_t i = 1; i < REPORT_WIDTH; i++)
+    sum = rs_build_add(rs, sum, values[i]);
+  rs_build_br(rs, RS_OPERAND_BB(middle));
+  rs_position_at_basic_block(rs, middle);
+  sum = rs_build_add(rs, sum, RS_OPERAND_INT64(1));
+  rs_build_br(rs, RS_OPERAND_BB(exit));
+  rs_position_at_basic_block(rs, exit);
+  rs_build_ret(rs, rs_build_add(rs, sum, RS_OPERAND_INT64(1)));
+}
+
+// Checks that the totals of `report` sum up its blocks.
+static void check_totals(const rs_alloc_report_t *report) {
+  rs_regalloc_stats_t sum;
+  memset(&sum, 0, sizeof(sum));
+  for (size_t b = 0; b < cvector_size(report->blocks); b++) {
+    const rs_regalloc_stats_t *stats = &report->blocks[b];
+    if (stats->max_pressure > sum.max_pressure)
+      sum.max_pressure = stats->max_pressure;
+    sum.spills += stats->spills;
+    sum.reloads += stats->reloads;
+    sum.remats += stats->remats;
+    sum.coalesced_moves += stats->coalesced_moves;
+    sum.moves += stats->moves;
+  }
+  CHECK(memcmp(&sum, &report->total, sizeof(sum)) == 0);
+}
+
+// Reports the sum at `level` and checks what the report says about it.
+static void check_level(rs_opt_level_t level) {
+  static const rs_regalloc_t regallocs[] = {
+      RS_REGALLOC_STACK, RS_REGALLOC_LINEAR, RS_REGALLOC_GRAPH};
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  rs_alloc_report_enable(&rs);
+  build_sum(&rs);
+  FILE *fp = tmpfile();
+  CHECK(fp && rs_generate(&rs, fp));
+  if (fp)
+    fclose(fp);
+
+  size_t count = 0;
+  const rs_alloc_report_t *report = rs_get_alloc_report(&rs, &count);
+  CHECK(count == 1);
+  if (count == 1) {
+    CHECK(strcmp(report->name, rs_get_symbol(&rs)) == 0);
+    CHECK(report->regalloc == regallocs[level]);
+    CHECK(report->first_block == 0 && cvector_size(report->blocks) == 3);
+    CHECK(report->total.max_pressure == report->blocks[0].max_pressure);
+    check_totals(report);
+    if (level == RS_OPT_O0) {
+      // Every value waits in its own slot rather than in a register.
+      CHECK(report->frame_size >= REPORT_WIDTH * 8);
+      CHECK(report->blocks[0].max_pressure < REPORT_WIDTH);
+    } else {
+      // Small enough to spill nothing, with the tied adds coalesced.
+      CHECK(report->blocks[0].max_pressure >= REPORT_WIDTH);
+      CHECK(report->total.spills == 0 && report->total.reloads == 0);
+      CHECK(report->total.coalesced_moves > 0);
+    }
+  }
+
+  // The JSON has the function and one record per block.
+  static char json[REPORT_JSON];
+  size_t length = 0;
+  fp = tmpfile();
+  CHECK(fp && rs_alloc_report_write_json(&rs, fp));
+  if (fp) {
+    rewind(fp);
+    length = fread(json, 1, sizeof(json) - 1, fp);
+    fclose(fp);
+  }
+  json[length] = '\0';
+  static const char *regalloc_names[] = {"\"regalloc\":\"stack\"",
+                                         "\"regalloc\":\"linear\"",
+                                         "\"regalloc\":\"graph\""};
+  CHECK(strstr(json, regalloc_names[level]) != NULL);
+  CHECK(strstr(json, "{\"id\":2,") != NULL && !strstr(json, "{\"id\":3,"));
+
+  rs_reset_alloc_report(&rs);
+  rs_get_alloc_report(&rs, &count);
+  CHECK(count == 0);
+  rs_free(&rs);
+}
+
+// Streams a chain of blocks, which must extend a single report.
+static void check_stream(void) {
+  rs_t rs;
+  rs_emitter_t out;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_alloc_report_enable(&rs);
+  rs_emitter_init_buffer(&out);
+  CHECK(rs_stream_begin(&rs, &out));
+  size_t block = rs_append_basic_block(&rs, "entry");
+  rs_position_at_basic_block(&rs, block);
+  for (size_t b = 0; b < REPORT_STREAM_BLOCKS; b++) {
+    size_t next = rs_append_basic_block(&rs, NULL);
+    rs_operand_t value = rs_build_load(&rs, CELL(cells[0]));
+    rs_build_store(&rs, rs_build_add(&rs, value, RS_OPERAND_INT64(1)),
+                   CELL(cells[0]));
+    rs_build_br(&rs, RS_OPERAND_BB(next));
+    rs_seal_basic_block(&rs, block);
+    rs_position_at_basic_block(&rs, next);
+    block = next;
+  }
+  rs_build_ret(&rs, RS_OPERAND_INT64(0));
+  rs_seal_basic_block(&rs, block);
+  CHECK(rs_stream_end(&rs));
+
+  size_t count = 0;
+  const rs_alloc_report_t *report = rs_get_alloc_report(&rs, &count);
+  CHECK(count == 1);
+  if (count == 1) {
+    CHECK(cvector_size(report->blocks) == REPORT_STREAM_BLOCKS + 1);
+    CHECK(report->regalloc == RS_REGALLOC_LINEAR);
+    check_totals(report);
+  }
+  rs_emitter_free(&out);
+  rs_free(&rs);
+}
+
+int main(void) {
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++)
+    check_level((rs_opt_level_t)level);
+  check_stream();
+
+  // Nothing is recorded unless asked for.
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  build_sum(&rs);
+  FILE *fp = tmpfile();
+  CHECK(fp && rs_generate(&rs, fp));
+  if (fp)
+    fclose(fp);
+  size_t count = 1;
+  rs_get_alloc_report(&rs, &count);
+  CHECK(count == 0);
+  rs_free(&rs);
+  return TEST_RESULT();
+}
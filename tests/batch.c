@@ -0,0 +1,117 @@
+/**
+ * @file batch.c
+ * @brief Batch compilation against compiling the items one by one.
+ *
+ * The output of `rs_compile_batch` must not depend on the number of threads
+ * or on the run: it is the code of every item generated on its own, in item
+ * order.
+ */
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Functions in the batch, besides its modules. */
+#define BATCH_FUNCTIONS 24
+
+/** Modules in the batch. */
+#define BATCH_MODULES 2
+
+/** Items in the batch. */
+#define BATCH_ITEMS (BATCH_FUNCTIONS + BATCH_MODULES)
+
+/** Runs at every thread count. */
+#define BATCH_RUNS 2
+
+static int64_t cells[2];
+
+// Builds a function of `index + 1` dependent steps over the cells, with a
+// branch every few steps so that functions differ in blocks too.
+static void build_function(rs_t *rs, size_t index) {
+  rs_set_opt_level(rs, (rs_opt_level_t)(index % 3));
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t value = rs_build_load(rs, CELL(cells[0]));
+  for (size_t i = 0; i <= index; i++) {
+    rs_operand_t other = rs_build_load(rs, CELL(cells[1]));
+    value = i % 2 ? rs_build_mult(rs, value, other)
+                  : rs_build_sub(rs, value, RS_OPERAND_INT64((int64_t)i));
+    if (i % 4 == 3) {
+      size_t next = rs_append_basic_block(rs, NULL);
+      rs_build_store(rs, value, CELL(cells[0]));
+      rs_build_br(rs, RS_OPERAND_BB(next));
+      rs_position_at_basic_block(rs, next);
+      value = rs_build_load(rs, CELL(cells[0]));
+    }
+  }
+  rs_build_ret(rs, value);
+}
+
+// Builds a module whose `caller` calls `callee`.
+static void build_module(rs_module_t *module, size_t index) {
+  rs_module_init(module, RS_TARGET_X86_64_LINUX_NASM);
+  size_t callee = rs_module_add_function(module, "callee");
+  size_t caller = rs_module_add_function(module, "caller");
+  rs_t *rs = rs_module_position_at_function(module, callee);
+  build_function(rs, index);
+  rs = rs_module_position_at_function(module, caller);
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t result = rs_build_call(rs, RS_OPERAND_SYM("callee"),
+                                      RS_OPERAND_INT64(1), RS_OPERAND_NULL);
+  rs_build_ret(rs, rs_build_add(rs, result, RS_OPERAND_INT64(2)));
+}
+
+// The items of the batch, built afresh for every compilation.
+typedef struct {
+  rs_t functions[BATCH_FUNCTIONS];
+  rs_module_t modules[BATCH_MODULES];
+  rs_batch_item_t items[BATCH_ITEMS];
+} batch_t;
+
+static void build_batch(batch_t *batch) {
+  for (size_t i = 0; i < BATCH_FUNCTIONS; i++) {
+    rs_init(&batch->functions[i], RS_TARGET_X86_64_LINUX_NASM);
+    build_function(&batch->functions[i], i);
+    batch->items[i] = (rs_batch_item_t){&batch->functions[i], NULL};
+  }
+  for (size_t i = 0; i < BATCH_MODULES; i++) {
+    build_module(&batch->modules[i], i * 5);
+    batch->items[BATCH_FUNCTIONS + i] =
+        (rs_batch_item_t){NULL, &batch->modules[i]};
+  }
+}
+
+static void free_batch(batch_t *batch) {
+  for (size_t i = 0; i < BATCH_FUNCTIONS; i++)
+    rs_free(&batch->functions[i]);
+  for (size_t i = 0; i < BATCH_MODULES; i++)
+    rs_module_free(&batch->modules[i]);
+}
+
+int main(void) {
+  static batch_t batch;
+
+  // The reference: every item generated on its own, in order.
+  rs_emitter_t expected;
+  rs_emitter_init_buffer(&expected);
+  build_batch(&batch);
+  for (size_t i = 0; i < BATCH_FUNCTIONS; i++)
+    CHECK(rs_generate_to(&batch.functions[i], &expected));
+  for (size_t i = 0; i < BATCH_MODULES; i++)
+    CHECK(rs_module_generate_to(&batch.modules[i], &expected));
+  free_batch(&batch);
+
+  static const size_t threads[] = {1, 2, 3, 4, 8, 0};
+  for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+    for (int run = 0; run < BATCH_RUNS; run++) {
+      rs_emitter_t out;
+      rs_emitter_init_buffer(&out);
+      build_batch(&batch);
+      CHECK(rs_compile_batch(batch.items, BATCH_ITEMS, threads[t], &out));
+      CHECK(out.length == expected.length &&
+            memcmp(out.data, expected.data, out.length) == 0);
+      free_batch(&batch);
+      rs_emitter_free(&out);
+    }
+  }
+  rs_emitter_free(&expected);
+  return TEST_RESULT();
+}
@@ -0,0 +1,169 @@
+/**
+ * @file cost_model.c
+ * @brief The x86-64 cost model on sequences with known answers.
+ *
+ * Machine registers are plain numbers here, since the model only tells
+ * them apart.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Instructions in the longest sequence. */
+#define COST_MAX_MINSTRS 16
+
+static int64_t cells[4];
+
+static rs_moperand_t reg(uint8_t r) {
+  rs_moperand_t operand = {.type = RS_MOPERAND_REG, .reg = r};
+  return operand;
+}
+
+static rs_moperand_t imm(int64_t value) {
+  rs_moperand_t operand = {.type = RS_MOPERAND_IMM, .imm = value};
+  return operand;
+}
+
+static rs_moperand_t mem(uint8_t base, int64_t disp) {
+  rs_moperand_t operand = {.type = RS_MOPERAND_MEM};
+  operand.mem.base = base;
+  operand.mem.index = RS_NO_MREG;
+  operand.mem.scale = 1;
+  operand.mem.disp = disp;
+  return operand;
+}
+
+// Appends `mnemonic` with its first `operand_count` of `a` and `b`.
+static void append(rs_minstr_t *minstrs, size_t *count, const char *mnemonic,
+                   size_t operand_count, rs_moperand_t a, rs_moperand_t b) {
+  rs_minstr_t *minstr = &minstrs[(*count)++];
+  memset(minstr, 0, sizeof(*minstr));
+  strncpy(minstr->mnemonic, mnemonic, sizeof(minstr->mnemonic) - 1);
+  minstr->operand_count = (uint8_t)operand_count;
+  minstr->operands[0] = a;
+  minstr->operands[1] = b;
+}
+
+static rs_block_cost_t cost_of(const rs_minstr_t *minstrs, size_t count) {
+  rs_block_cost_t cost;
+  rs_x86_64_minstrs_cost(minstrs, count, &cost);
+  return cost;
+}
+
+static void check_sequences(void) {
+  rs_minstr_t minstrs[COST_MAX_MINSTRS];
+  size_t count = 0;
+
+  // Eight independent adds issue four per cycle over four ports.
+  for (uint8_t r = 0; r < 8; r++)
+    append(minstrs, &count, "add", 2, reg(r), imm(1));
+  rs_block_cost_t cost = cost_of(minstrs, count);
+  CHECK(cost.instructions == 8 && cost.uops == 8);
+  CHECK(cost.latency == 1 && cost.throughput == 2.0);
+  CHECK(cost.ports[0] == 2 && cost.ports[1] == 2 && cost.ports[5] == 2 &&
+        cost.ports[6] == 2);
+
+  // The same adds on one register form a chain.
+  count = 0;
+  for (int i = 0; i < 8; i++)
+    append(minstrs, &count, "add", 2, reg(0), imm(1));
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency == 8 && cost.throughput == 2.0);
+
+  // Multiplies only run on port 1, three cycles each.
+  count = 0;
+  for (int i = 0; i < 3; i++)
+    append(minstrs, &count, "imul", 2, reg(0), reg(1));
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency == 9 && cost.ports[1] == 3 && cost.throughput == 3.0);
+
+  // Independent loads share the two load ports.
+  count = 0;
+  for (uint8_t r = 0; r < 12; r++)
+    append(minstrs, &count, "mov", 2, reg(r), mem(15, 8 * r));
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency == 5 && cost.ports[2] == 6 && cost.ports[3] == 6);
+  CHECK(cost.throughput == 6.0);
+
+  // A load waits for the store it reads, forwarded, but not for another. The
+  // store's address and the load share ports 2, 3 and 7, its data takes 4.
+  count = 0;
+  append(minstrs, &count, "imul", 2, reg(0), reg(0));
+  append(minstrs, &count, "mov", 2, mem(1, 0), reg(0));
+  append(minstrs, &count, "mov", 2, reg(2), mem(1, 0));
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency == 3 + 5);
+  CHECK(cost.ports[4] == 1 &&
+        cost.ports[2] + cost.ports[3] + cost.ports[7] == 2);
+  minstrs[2].operands[1] = mem(1, 8);
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency == 5);
+
+  // Division dominates the latency of what depends on its flags.
+  count = 0;
+  append(minstrs, &count, "cqo", 0, reg(0), reg(0));
+  append(minstrs, &count, "idiv", 1, reg(1), reg(0));
+  append(minstrs, &count, "setl", 1, reg(2), reg(0));
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency >= 42 && cost.ports[0] >= 1);
+
+  // A locked increment drains the store buffer.
+  count = 0;
+  append(minstrs, &count, "inc", 1, mem(1, 0), reg(0));
+  minstrs[0].lock = true;
+  cost = cost_of(minstrs, count);
+  CHECK(cost.latency >= 18 && cost.uops == 2);
+}
+
+// Builds a block of `length` multiplies, chained through one value when
+// `dependent` and each of a fresh load otherwise.
+static void build_block(rs_t *rs, size_t length, bool dependent) {
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t value = rs_build_load(rs, CELL(cells[0]));
+  for (size_t i = 0; i < length; i++) {
+    rs_operand_t source = dependent ? value : rs_build_load(rs, CELL(cells[1]));
+    rs_operand_t product = rs_build_mult(rs, source, source);
+    rs_build_store(rs, product, CELL(cells[2 + i % 2]));
+    value = dependent ? product : value;
+  }
+  rs_build_ret(rs, value);
+}
+
+// Estimates the block built at `level`.
+static bool estimate(rs_opt_level_t level, size_t length, bool dependent,
+                     rs_block_cost_t *cost) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_block(&rs, length, dependent);
+  bool ok = rs_run_passes(&rs) && rs_estimate_block_cost(&rs, 0, cost);
+  rs_free(&rs);
+  return ok;
+}
+
+static void check_blocks(void) {
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+    rs_block_cost_t chain, parallel;
+    CHECK(estimate((rs_opt_level_t)level, 8, true, &chain));
+    CHECK(estimate((rs_opt_level_t)level, 8, false, &parallel));
+    // Eight multiplies in a row take at least their latencies.
+    CHECK(chain.latency >= 8 * 3);
+    CHECK(parallel.latency < chain.latency);
+    CHECK(chain.ports[1] >= 8 && parallel.ports[1] >= 8);
+    CHECK(chain.instructions > 8 && chain.uops >= chain.instructions);
+  }
+
+  // Only x86-64 has a model, and only for blocks that exist.
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_AARCH64_MACOS_GAS);
+  build_block(&rs, 1, true);
+  rs_block_cost_t cost;
+  CHECK(!rs_estimate_block_cost(&rs, 0, &cost));
+  CHECK(!rs_estimate_block_cost(&rs, 1, &cost));
+  rs_free(&rs);
+}
+
+int main(void) {
+  check_sequences();
+  check_blocks();
+  return TEST_RESULT();
+}
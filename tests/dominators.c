@@ -0,0 +1,144 @@
+/**
+ * @file dominators.c
+ * @brief Dominator trees, and the spill weights graph coloring derives from
+ * them.
+ */
+#include "test.h"
+
+/** Values live across the loop of `build_loop_pressure`. */
+#define DOMINATORS_WIDTH 20
+
+static int64_t counter, cells[DOMINATORS_WIDTH];
+
+// Builds a diamond, `entry` to `then` or `else` and both to `join`, feeding a
+// loop from `header` through `body` back to `header` and out to `exit`.
+static void build_diamond_loop(rs_t *rs) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t then = rs_append_basic_block(rs, "then");
+  size_t otherwise = rs_append_basic_block(rs, "else");
+  size_t join = rs_append_basic_block(rs, "join");
+  size_t header = rs_append_basic_block(rs, "header");
+  size_t body = rs_append_basic_block(rs, "body");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_append_basic_block(rs, "unreachable");
+  rs_position_at_basic_block(rs, entry);
+  rs_operand_t x = rs_build_param(rs, 0);
+  rs_build_br_if(rs, x, RS_OPERAND_BB(then), RS_OPERAND_BB(otherwise));
+  rs_position_at_basic_block(rs, then);
+  rs_build_br(rs, RS_OPERAND_BB(join));
+  rs_position_at_basic_block(rs, otherwise);
+  rs_build_br(rs, RS_OPERAND_BB(join));
+  rs_position_at_basic_block(rs, join);
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, header);
+  rs_build_br_if(rs, x, RS_OPERAND_BB(body), RS_OPERAND_BB(exit));
+  rs_position_at_basic_block(rs, body);
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, exit);
+  rs_build_ret(rs, x);
+  rs_position_at_basic_block(rs, 7);
+  rs_build_br(rs, RS_OPERAND_BB(body));
+}
+
+static void check_dominators(void) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  build_diamond_loop(&rs);
+
+  const rs_cfg_t *cfg = rs_get_cfg(&rs);
+  CHECK(cfg && cvector_size(*cfg) == 8);
+  if (cfg && cvector_size(*cfg) == 8) {
+    CHECK((*cfg)[0].successor_count == 2);
+    CHECK(cvector_size((*cfg)[3].predecessors) == 2);
+    // The header is entered from `join` and from the back edge of `body`.
+    CHECK(cvector_size((*cfg)[4].predecessors) == 2);
+  }
+
+  const size_t *idom = rs_get_dominators(&rs);
+  CHECK(idom);
+  if (idom) {
+    static const size_t expected[] = {SIZE_MAX, 0, 0, 0, 3, 4, 4, SIZE_MAX};
+    for (size_t block_id = 0; block_id < 8; block_id++)
+      CHECK(idom[block_id] == expected[block_id]);
+  }
+
+  // Cached until invalidated.
+  size_t count;
+  const rs_pass_stats_t *stats = rs_get_pass_stats(&rs, &count);
+  size_t runs = stats[RS_PASS_COUNT + RS_ANALYSIS_DOMINATORS].runs;
+  CHECK(rs_get_dominators(&rs) == idom);
+  CHECK(stats[RS_PASS_COUNT + RS_ANALYSIS_DOMINATORS].runs == runs);
+  rs_invalidate_analyses(&rs, RS_ANALYSIS_BIT(DOMINATORS));
+  CHECK(rs_get_dominators(&rs));
+  CHECK(stats[RS_PASS_COUNT + RS_ANALYSIS_DOMINATORS].runs == runs + 1);
+  rs_free(&rs);
+}
+
+// Keeps `DOMINATORS_WIDTH` values live across a loop whose body reads the
+// first four of them. Outside the loop every value is read as often, so only
+// the loop nesting tells the allocator to spill the others.
+static void build_loop_pressure(rs_t *rs) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t header = rs_append_basic_block(rs, "header");
+  size_t body = rs_append_basic_block(rs, "body");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_position_at_basic_block(rs, entry);
+  rs_operand_t values[DOMINATORS_WIDTH];
+  for (size_t i = 0; i < DOMINATORS_WIDTH; i++)
+    values[i] = rs_build_load(rs, CELL(cells[i]));
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(counter));
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, header);
+  rs_operand_t i = rs_build_load(rs, CELL(counter));
+  rs_build_br_if(rs, rs_build_cmp_lt(rs, i, RS_OPERAND_INT64(10)),
+                 RS_OPERAND_BB(body), RS_OPERAND_BB(exit));
+  rs_position_at_basic_block(rs, body);
+  rs_operand_t step = values[0];
+  for (size_t v = 1; v < 4; v++)
+    step = rs_build_add(rs, step, values[v]);
+  rs_build_store(rs, rs_build_add(rs, rs_build_load(rs, CELL(counter)), step),
+                 CELL(counter));
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, exit);
+  rs_operand_t total = rs_build_load(rs, CELL(counter));
+  for (size_t v = 4; v < DOMINATORS_WIDTH; v++)
+    total = rs_build_add(rs, total, values[v]);
+  for (size_t v = 4; v < DOMINATORS_WIDTH; v++)
+    total = rs_build_add(rs, total, values[v]);
+  rs_build_ret(rs, total);
+}
+
+static void check_loop_weights(void) {
+  for (size_t i = 0; i < DOMINATORS_WIDTH; i++)
+    cells[i] = 1;
+
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, RS_OPT_O2);
+  rs_alloc_report_enable(&rs);
+  build_loop_pressure(&rs);
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn);
+  // The body adds 4 per iteration: 12 after three of them, then 2 * 16.
+  CHECK(fn && fn() == 12 + 2 * (DOMINATORS_WIDTH - 4));
+  rs_jit_free(fn);
+
+  size_t count;
+  const rs_alloc_report_t *report = rs_get_alloc_report(&rs, &count);
+  CHECK(count == 1);
+  if (count == 1) {
+    CHECK(report->total.spills > 0);
+    CHECK(cvector_size(report->blocks) == 4);
+    if (cvector_size(report->blocks) == 4) {
+      CHECK(report->blocks[1].reloads == 0);
+      CHECK(report->blocks[2].reloads == 0);
+    }
+  }
+  rs_free(&rs);
+}
+
+int main(void) {
+  check_dominators();
+  check_loop_weights();
+  return TEST_RESULT();
+}
@@ -0,0 +1,78 @@
+/**
+ * @file emit_threads.c
+ * @brief Blocks rendered in parallel against rendering them serially.
+ *
+ * The text of a function must not depend on how many threads render its
+ * blocks, at any opt level and verbosity.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Blocks of the function, several runs of `RS_EMIT_CHUNK_BLOCKS`. */
+#define EMIT_BLOCKS 100
+
+/** Runs at every thread count. */
+#define EMIT_RUNS 2
+
+static int64_t cell;
+
+// Builds a chain of blocks adding their index to `cell`, every third one
+// branching on the value it loaded.
+static void build_chain(rs_t *rs) {
+  size_t block = rs_append_basic_block(rs, "entry");
+  rs_position_at_basic_block(rs, block);
+  for (size_t b = 1; b <= EMIT_BLOCKS; b++) {
+    size_t next = rs_append_basic_block(rs, NULL);
+    rs_operand_t value = rs_build_load(rs, CELL(cell));
+    rs_build_store(rs, rs_build_add(rs, value, RS_OPERAND_INT64((int64_t)b)),
+                   CELL(cell));
+    if (b % 3 == 0)
+      rs_build_br_if(rs, rs_build_cmp_lt(rs, value, RS_OPERAND_INT64(0)),
+                     RS_OPERAND_BB(next), RS_OPERAND_BB(next));
+    else
+      rs_build_br(rs, RS_OPERAND_BB(next));
+    rs_position_at_basic_block(rs, next);
+  }
+  rs_build_ret(rs, rs_build_load(rs, CELL(cell)));
+}
+
+// Generates the chain with `threads` workers into `out`.
+static void generate(rs_opt_level_t level, rs_verbosity_t verbosity,
+                     size_t threads, rs_emitter_t *out) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  rs_set_verbosity(&rs, verbosity);
+  rs_set_emit_threads(&rs, threads);
+  rs_emitter_init_buffer(out);
+  build_chain(&rs);
+  CHECK(rs_generate_to(&rs, out));
+  rs_free(&rs);
+}
+
+int main(void) {
+  static const rs_verbosity_t verbosities[] = {
+      RS_VERBOSITY_NONE, RS_VERBOSITY_IR, RS_VERBOSITY_REGALLOC,
+      RS_VERBOSITY_COST};
+  static const size_t threads[] = {2, 3, 4, 0};
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+    for (size_t v = 0; v < sizeof(verbosities) / sizeof(verbosities[0]);
+         v++) {
+      rs_emitter_t serial;
+      generate((rs_opt_level_t)level, verbosities[v], 1, &serial);
+      CHECK(serial.length > 0);
+      for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        for (int run = 0; run < EMIT_RUNS; run++) {
+          rs_emitter_t parallel;
+          generate((rs_opt_level_t)level, verbosities[v], threads[t],
+                   &parallel);
+          CHECK(parallel.length == serial.length &&
+                memcmp(parallel.data, serial.data, serial.length) == 0);
+          rs_emitter_free(&parallel);
+        }
+      }
+      rs_emitter_free(&serial);
+    }
+  }
+  return TEST_RESULT();
+}
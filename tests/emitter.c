@@ -0,0 +1,140 @@
+/**
+ * @file emitter.c
+ * @brief The sinks of the buffered emitter against each other.
+ *
+ * The same text, and the same generated function, go through the file,
+ * buffer and descriptor sinks, and must come out identical.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Lines emitted, enough to flush and grow past the staging buffer. */
+#define EMITTER_LINES 20000
+
+/** Twice the 64 KiB staging buffer, which the lines must exceed. */
+#define EMITTER_MIN_TEXT (128 * 1024)
+
+/** Bytes of output read back. */
+#define EMITTER_OUTPUT (4 * 1024 * 1024)
+
+static int64_t cell;
+
+// Emits text mixing every kind of `rs_emit` call, the same at any level.
+static void emit_text(rs_emitter_t *out, rs_opt_level_t level) {
+  (void)level;
+  for (int64_t i = 0; i < EMITTER_LINES; i++) {
+    rs_emit_str(out, "  mov rax, ");
+    rs_emit_int(out, i % 2 ? -i : i);
+    rs_emit(out, " ; 0x", 5);
+    rs_emit_uint(out, (uint64_t)i * 2654435761u, 16);
+    rs_emit_char(out, '\n');
+  }
+}
+
+// Emits a small branching function at `level`.
+static void emit_function(rs_emitter_t *out, rs_opt_level_t level) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  size_t entry = rs_append_basic_block(&rs, "entry");
+  size_t small = rs_append_basic_block(&rs, "small");
+  size_t large = rs_append_basic_block(&rs, "large");
+  rs_position_at_basic_block(&rs, entry);
+  rs_operand_t x = rs_build_load(&rs, CELL(cell));
+  rs_build_br_if(&rs, rs_build_cmp_lt(&rs, x, RS_OPERAND_INT64(10)),
+                 RS_OPERAND_BB(small), RS_OPERAND_BB(large));
+  rs_position_at_basic_block(&rs, small);
+  rs_build_ret(&rs, rs_build_mult(&rs, x, RS_OPERAND_INT64(3)));
+  rs_position_at_basic_block(&rs, large);
+  rs_build_ret(&rs, rs_build_sub(&rs, x, RS_OPERAND_INT64(10)));
+  CHECK(rs_generate_to(&rs, out));
+  rs_free(&rs);
+}
+
+// Reads what was written to `fd` from the start into `text`.
+static size_t read_back(int fd, char *text) {
+  size_t length = 0;
+  ssize_t n;
+  lseek(fd, 0, SEEK_SET);
+  while (length < EMITTER_OUTPUT &&
+         (n = read(fd, text + length, EMITTER_OUTPUT - length)) > 0)
+    length += (size_t)n;
+  return length;
+}
+
+// Sends what `emit` emits through every sink and compares the outputs.
+static void check_sinks(void (*emit)(rs_emitter_t *, rs_opt_level_t),
+                        rs_opt_level_t level, size_t min_length) {
+  static char from_file[EMITTER_OUTPUT], from_fd[EMITTER_OUTPUT];
+
+  rs_emitter_t buffer;
+  rs_emitter_init_buffer(&buffer);
+  emit(&buffer, level);
+  CHECK(rs_emitter_flush(&buffer));
+  CHECK(buffer.length >= min_length);
+
+  FILE *fp = tmpfile();
+  CHECK(fp);
+  if (!fp) {
+    rs_emitter_free(&buffer);
+    return;
+  }
+  rs_emitter_t file;
+  rs_emitter_init_file(&file, fp);
+  emit(&file, level);
+  CHECK(rs_emitter_free(&file));
+  fflush(fp);
+  size_t file_length = read_back(fileno(fp), from_file);
+  fclose(fp);
+
+  char path[] = "/tmp/runestone-emitter-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  size_t fd_length = 0;
+  if (fd >= 0) {
+    unlink(path);
+    rs_emitter_t descriptor;
+    rs_emitter_init_fd(&descriptor, fd);
+    emit(&descriptor, level);
+    CHECK(rs_emitter_free(&descriptor));
+    fd_length = read_back(fd, from_fd);
+    close(fd);
+  }
+
+  CHECK(file_length == buffer.length && fd_length == buffer.length);
+  CHECK(memcmp(from_file, buffer.data, file_length) == 0);
+  CHECK(memcmp(from_fd, buffer.data, fd_length) == 0);
+  rs_emitter_free(&buffer);
+}
+
+int main(void) {
+  rs_emitter_t out;
+  rs_emitter_init_buffer(&out);
+  rs_emit_int(&out, INT64_MIN);
+  rs_emit_char(&out, ' ');
+  rs_emit_int(&out, 0);
+  rs_emit_char(&out, ' ');
+  rs_emit_uint(&out, UINT64_MAX, 16);
+  rs_emit_char(&out, ' ');
+  rs_emit_uint(&out, 5, 2);
+  static const char numbers[] =
+      "-9223372036854775808 0 ffffffffffffffff 101";
+  CHECK(out.length == sizeof(numbers) - 1 &&
+        memcmp(out.data, numbers, out.length) == 0);
+  rs_emitter_free(&out);
+
+  check_sinks(emit_text, RS_OPT_O0, EMITTER_MIN_TEXT);
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++)
+    check_sinks(emit_function, (rs_opt_level_t)level, 1);
+
+  // A write that fails is reported, and keeps being reported.
+  rs_emitter_init_fd(&out, -1);
+  rs_emit_str(&out, "lost\n");
+  CHECK(!rs_emitter_flush(&out));
+  rs_emit_str(&out, "lost\n");
+  CHECK(!rs_emitter_free(&out));
+  return TEST_RESULT();
+}
@@ -0,0 +1,208 @@
+/**
+ * @file encoder.c
+ * @brief Machine code from the encoder against an assembler's.
+ *
+ * The NASM text of a function is rewritten into GNU `as` Intel syntax and
+ * assembled, and its bytes must equal those `rs_generate_binary` encodes for
+ * the same function, branches relaxed the same way. That comparison is
+ * skipped when `as` or `objcopy` is missing; the other checks need neither.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Steps in a loop body long enough to need `rel32` branches. */
+#define ENCODER_LONG_BODY 40
+
+/** Iterations of the loop. */
+#define ENCODER_ITERATIONS 10
+
+/** Bytes of code read back from the assembler. */
+#define ENCODER_CODE 65536
+
+static int64_t counter, accumulator;
+
+// Builds a loop running `length` steps of `value * 3 - i` over `accumulator`
+// per iteration, returning the accumulator divided by 7. The header branches
+// forward over the body and the body back to the header.
+static void build_loop(rs_t *rs, size_t length) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t header = rs_append_basic_block(rs, "header");
+  size_t body = rs_append_basic_block(rs, "body");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_position_at_basic_block(rs, entry);
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(counter));
+  rs_build_store(rs, RS_OPERAND_INT64(5), CELL(accumulator));
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, header);
+  rs_operand_t i = rs_build_load(rs, CELL(counter));
+  rs_operand_t last = RS_OPERAND_INT64(ENCODER_ITERATIONS - 1);
+  rs_build_br_if(rs, rs_build_cmp_gt(rs, i, last), RS_OPERAND_BB(exit),
+                 RS_OPERAND_BB(body));
+  rs_position_at_basic_block(rs, body);
+  i = rs_build_load(rs, CELL(counter));
+  rs_operand_t value = rs_build_load(rs, CELL(accumulator));
+  for (size_t k = 0; k < length; k++)
+    value = rs_build_sub(rs, rs_build_mult(rs, value, RS_OPERAND_INT64(3)), i);
+  rs_build_store(rs, value, CELL(accumulator));
+  rs_build_store(rs, rs_build_add(rs, i, RS_OPERAND_INT64(1)), CELL(counter));
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, exit);
+  rs_build_ret(rs, rs_build_div(rs, rs_build_load(rs, CELL(accumulator)),
+                                RS_OPERAND_INT64(7)));
+}
+
+// Computes what the loop of `length` returns, wrapping like the machine.
+static int64_t expected_loop(size_t length) {
+  uint64_t value = 5;
+  for (uint64_t i = 0; i < ENCODER_ITERATIONS; i++)
+    for (size_t k = 0; k < length; k++)
+      value = value * 3 - i;
+  return (int64_t)value / 7;
+}
+
+// Checks the result of the loop at `level`.
+static void check_result(size_t length, rs_opt_level_t level) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_loop(&rs, length);
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn);
+  if (fn)
+    CHECK(fn() == expected_loop(length));
+  rs_jit_free(fn);
+  rs_free(&rs);
+}
+
+// Checks that the branches of the loop got `rel8` displacements, or `rel32`
+// ones when `wide`. The forward branch to the exit is a `jg` ending the
+// header before its `jmp` to the body, the back edge a `jmp` ending the body.
+static void check_relaxation(size_t length, bool wide) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  build_loop(&rs, length);
+  CHECK(rs_run_passes(&rs));
+  rs_buffer_t buf = NULL;
+  rs_relocations_t relocations = NULL;
+  size_t offsets[4];
+  CHECK(rs_encode_x86_64(&rs, &buf, offsets, &relocations));
+  size_t body = offsets[2], exit = offsets[3];
+  CHECK(buf[body - 2] == 0xEB && buf[body - 1] == 0x00);
+  if (wide) {
+    CHECK(buf[body - 8] == 0x0F && buf[body - 7] == 0x8F);
+    CHECK(buf[exit - 5] == 0xE9);
+  } else {
+    CHECK(buf[body - 4] == 0x7F);
+    CHECK(buf[exit - 2] == 0xEB);
+  }
+  cvector_free(relocations);
+  cvector_free(buf);
+  rs_free(&rs);
+}
+
+// Rewrites NASM text from `in` into GNU `as` Intel syntax in `out`.
+static void to_gas(FILE *in, FILE *out) {
+  fprintf(out, ".intel_syntax noprefix\n");
+  char line[256];
+  while (fgets(line, sizeof(line), in)) {
+    if (strncmp(line, "section", 7) == 0 || strncmp(line, "global", 6) == 0)
+      continue;
+    char *comment = strchr(line, ';');
+    if (comment)
+      strcpy(comment, "\n");
+    for (char *s = line; *s; s++) {
+      if (strncmp(s, "qword [", 7) == 0) {
+        fputs("qword ptr ", out);
+        s += 5;
+      }
+      fputc(*s, out);
+    }
+  }
+}
+
+// Assembles the NASM text of the loop at `level` with `as`, and compares the
+// code with what the encoder makes of the same function.
+static void check_assembled(const char *base, size_t length,
+                            rs_opt_level_t level) {
+  char text[64], source[64], object[64], code[64], command[512];
+  snprintf(text, sizeof(text), "%s.asm", base);
+  snprintf(source, sizeof(source), "%s.s", base);
+  snprintf(object, sizeof(object), "%s.o", base);
+  snprintf(code, sizeof(code), "%s.bin", base);
+
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_loop(&rs, length);
+  FILE *fp = fopen(text, "w");
+  CHECK(fp && rs_generate(&rs, fp));
+  if (fp)
+    fclose(fp);
+  rs_free(&rs);
+
+  FILE *in = fopen(text, "r"), *out = fopen(source, "w");
+  CHECK(in && out);
+  if (in && out)
+    to_gas(in, out);
+  if (in)
+    fclose(in);
+  if (out)
+    fclose(out);
+  snprintf(command, sizeof(command),
+           "as %s -o %s 2>/dev/null && objcopy -O binary -j .text %s %s",
+           source, object, object, code);
+  CHECK(system(command) == 0);
+
+  static uint8_t assembled[ENCODER_CODE];
+  size_t size = 0;
+  fp = fopen(code, "rb");
+  if (fp) {
+    size = fread(assembled, 1, sizeof(assembled), fp);
+    fclose(fp);
+  }
+
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_loop(&rs, length);
+  rs_buffer_t buf = NULL;
+  CHECK(rs_generate_binary(&rs, &buf));
+  CHECK(size > 0 && cvector_size(buf) == size &&
+        memcmp(buf, assembled, size) == 0);
+  cvector_free(buf);
+  rs_free(&rs);
+
+  unlink(text);
+  unlink(source);
+  unlink(object);
+  unlink(code);
+}
+
+int main(void) {
+  static const size_t lengths[] = {1, ENCODER_LONG_BODY};
+  for (size_t l = 0; l < 2; l++) {
+    check_relaxation(lengths[l], lengths[l] == ENCODER_LONG_BODY);
+    for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++)
+      check_result(lengths[l], (rs_opt_level_t)level);
+  }
+
+  if (system("as --version >/dev/null 2>&1") != 0 ||
+      system("objcopy --version >/dev/null 2>&1") != 0) {
+    fprintf(stderr, "encoder: as or objcopy missing, skipped\n");
+    return TEST_RESULT();
+  }
+
+  char base[] = "/tmp/runestone-encoder-XXXXXX";
+  int fd = mkstemp(base);
+  CHECK(fd >= 0);
+  if (fd < 0)
+    return TEST_RESULT();
+  close(fd);
+  for (size_t l = 0; l < 2; l++)
+    for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++)
+      check_assembled(base, lengths[l], (rs_opt_level_t)level);
+  unlink(base);
+  return TEST_RESULT();
+}
@@ -0,0 +1,94 @@
+/**
+ * @file graph_coloring.c
+ * @brief Graph coloring, spilling and rematerialization, run and counted.
+ *
+ * Results of the compiled functions are checked against C, and what the
+ * allocator did is read back from the allocation report.
+ */
+#include "test.h"
+
+/** Loaded values, and as many constants, live at once when many are. */
+#define COLORING_MAX_WIDTH 24
+
+static int64_t cells[COLORING_MAX_WIDTH];
+
+// Gets a constant too wide to be folded into an immediate operand.
+static int64_t constant(size_t i) { return ((int64_t)i + 1) << 33; }
+
+// Builds a function keeping `width` loaded values and `width` constants live
+// until they are summed, across a branch when `branch`.
+static void build_wide(rs_t *rs, size_t width, bool branch) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_position_at_basic_block(rs, entry);
+  rs_operand_t loaded[COLORING_MAX_WIDTH], constants[COLORING_MAX_WIDTH];
+  for (size_t i = 0; i < width; i++) {
+    loaded[i] = rs_build_load(rs, CELL(cells[i]));
+    constants[i] = rs_build_move(rs, RS_OPERAND_INT64(constant(i)));
+  }
+  if (branch) {
+    rs_build_br(rs, RS_OPERAND_BB(exit));
+    rs_position_at_basic_block(rs, exit);
+  }
+  rs_operand_t sum = RS_OPERAND_INT64(0);
+  for (size_t i = 0; i < width; i++) {
+    sum = rs_build_add(rs, loaded[i], sum);
+    sum = rs_build_add(rs, sum, constants[i]);
+  }
+  if (!branch) {
+    rs_build_br(rs, RS_OPERAND_BB(exit));
+    rs_position_at_basic_block(rs, exit);
+  }
+  rs_build_ret(rs, sum);
+}
+
+// Compiles and runs the wide function at O2, checking its result and leaving
+// the allocation report's totals in `total`.
+static void check_wide(size_t width, bool branch, rs_regalloc_stats_t *total) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, RS_OPT_O2);
+  rs_alloc_report_enable(&rs);
+  build_wide(&rs, width, branch);
+
+  int64_t expected = 0;
+  for (size_t i = 0; i < width; i++) {
+    cells[i] = (int64_t)i * 7 + 1;
+    expected += cells[i] + constant(i);
+  }
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn);
+  if (fn)
+    CHECK(fn() == expected);
+  rs_jit_free(fn);
+
+  size_t count = 0;
+  const rs_alloc_report_t *report = rs_get_alloc_report(&rs, &count);
+  CHECK(count == 1);
+  if (count == 1) {
+    CHECK(report->regalloc == RS_REGALLOC_GRAPH);
+    *total = report->total;
+  }
+  rs_free(&rs);
+}
+
+int main(void) {
+  size_t registers = rs_get_register_count(RS_TARGET_X86_64_LINUX_NASM);
+  CHECK(2 * COLORING_MAX_WIDTH > registers);
+  for (int branch = 0; branch <= 1; branch++) {
+    // Few enough values to color without spilling.
+    rs_regalloc_stats_t total = {0};
+    check_wide(2, branch, &total);
+    CHECK(total.spills == 0 && total.reloads == 0 && total.remats == 0);
+
+    // Too many. Within a block the scheduler moves the loads and constants
+    // next to their uses, so only across the branch must they spill.
+    check_wide(COLORING_MAX_WIDTH, branch, &total);
+    if (branch) {
+      // Loaded values are spilled and reloaded, constants recomputed.
+      CHECK(total.spills > 0 && total.reloads >= total.spills);
+      CHECK(total.remats > 0);
+    }
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,84 @@
+/**
+ * @file isel.c
+ * @brief Instruction selection of the x86-64 patterns the backend lacks
+ * native registers for.
+ *
+ * Division needs `rdx:rax`, which neither allocator reserves, so it is
+ * checked with every register holding a live value and with the quotient,
+ * dividend and divisor in every position.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Values kept live across each division. */
+#define ISEL_LIVE 12
+
+static int64_t cells[ISEL_LIVE + 2];
+
+// Divides `dividend` by `divisor`, loaded or as an immediate, while
+// `ISEL_LIVE` other values stay live, and returns the quotient plus their sum.
+static int64_t divide(rs_opt_level_t level, int64_t dividend, int64_t divisor,
+                      bool immediate) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  rs_position_at_basic_block(&rs, rs_append_basic_block(&rs, "entry"));
+  rs_operand_t live[ISEL_LIVE];
+  for (size_t i = 0; i < ISEL_LIVE; i++)
+    live[i] = rs_build_load(&rs, CELL(cells[i]));
+  cells[ISEL_LIVE] = dividend;
+  cells[ISEL_LIVE + 1] = divisor;
+  rs_operand_t x = rs_build_load(&rs, CELL(cells[ISEL_LIVE]));
+  rs_operand_t y = immediate ? RS_OPERAND_INT64(divisor)
+                             : rs_build_load(&rs, CELL(cells[ISEL_LIVE + 1]));
+  rs_operand_t total = rs_build_div(&rs, x, y);
+  for (size_t i = 0; i < ISEL_LIVE; i++)
+    total = rs_build_add(&rs, total, live[i]);
+  rs_build_ret(&rs, total);
+
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn);
+  int64_t result = fn ? fn() : INT64_MIN;
+  rs_jit_free(fn);
+  rs_free(&rs);
+  return result;
+}
+
+int main(void) {
+  int64_t live_sum = 0;
+  for (size_t i = 0; i < ISEL_LIVE; i++) {
+    cells[i] = (int64_t)(i + 1) * 1000;
+    live_sum += cells[i];
+  }
+
+  static const int64_t cases[][2] = {
+      {100, 7}, {-100, 7}, {100, -7}, {7, 100}, {INT64_MAX, 3}, {-9, -3}};
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+      int64_t expected = cases[c][0] / cases[c][1] + live_sum;
+      CHECK(divide((rs_opt_level_t)level, cases[c][0], cases[c][1], false) ==
+            expected);
+      CHECK(divide((rs_opt_level_t)level, cases[c][0], cases[c][1], true) ==
+            expected);
+    }
+  }
+
+  // The text and the encoded bytes agree on the lowering.
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_position_at_basic_block(&rs, rs_append_basic_block(&rs, "entry"));
+  rs_build_ret(&rs, rs_build_div(&rs, rs_build_param(&rs, 0),
+                                 rs_build_param(&rs, 1)));
+  char text[4096] = {0};
+  FILE *fp = tmpfile();
+  CHECK(fp && rs_generate(&rs, fp));
+  if (fp) {
+    rewind(fp);
+    size_t length = fread(text, 1, sizeof(text) - 1, fp);
+    text[length] = '\0';
+    fclose(fp);
+  }
+  CHECK(strstr(text, "  cqo\n") && strstr(text, "  idiv qword [rsp]\n"));
+  rs_free(&rs);
+  return TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+/**
+ * @file jit.c
+ * @brief Results of JIT-compiled code under register pressure.
+ *
+ * Loads `width` values and sums them, in the same block or in the next one so
+ * that all of them are live across the branch. Every level must get them
+ * right, `RS_OPT_O1` by leaving the sums that outgrow its linear allocator to
+ * graph coloring.
+ */
+#include "test.h"
+
+/** Widest sum checked. */
+#define JIT_MAX_WIDTH 100
+
+/** If-else diamonds in a row, enough to number the vregs from zero again. */
+#define JIT_DIAMONDS 40
+
+/** Adds in each arm of a diamond. */
+#define JIT_ARM_LENGTH 8
+
+static int64_t cells[JIT_MAX_WIDTH];
+
+static bool sum_of_cells(rs_opt_level_t level, size_t width, bool branch,
+                         int64_t *result) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  size_t entry = rs_append_basic_block(&rs, "entry");
+  rs_position_at_basic_block(&rs, entry);
+  rs_operand_t values[JIT_MAX_WIDTH];
+  for (size_t i = 0; i < width; i++)
+    values[i] = rs_build_load(&rs, CELL(cells[i]));
+  if (branch) {
+    size_t sum = rs_append_basic_block(&rs, "sum");
+    rs_build_br(&rs, RS_OPERAND_BB(sum));
+    rs_position_at_basic_block(&rs, sum);
+  }
+  rs_operand_t total = values[0];
+  for (size_t i = 1; i < width; i++)
+    total = rs_build_add(&rs, total, values[i]);
+  rs_build_ret(&rs, total);
+
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  if (fn)
+    *result = fn();
+  rs_jit_free(fn);
+  rs_free(&rs);
+  return fn != NULL;
+}
+
+// Runs a row of diamonds whose arms add different amounts, passing the value
+// on through memory and numbering the vregs from zero again as the benchmarks
+// do, so that every vreg holds many unrelated values.
+static bool diamonds(rs_opt_level_t level, int64_t *result) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  rs_position_at_basic_block(&rs, rs_append_basic_block(&rs, "entry"));
+  rs_operand_t x = rs_build_load(&rs, CELL(cells[0]));
+  for (size_t d = 0; d < JIT_DIAMONDS; d++) {
+    size_t arms[] = {rs_append_basic_block(&rs, NULL),
+                     rs_append_basic_block(&rs, NULL)};
+    size_t join = rs_append_basic_block(&rs, NULL);
+    rs_operand_t c = rs_build_cmp_lt(&rs, x, RS_OPERAND_INT64((int64_t)d));
+    rs_build_br_if(&rs, c, RS_OPERAND_BB(arms[0]), RS_OPERAND_BB(arms[1]));
+    for (size_t a = 0; a < 2; a++) {
+      rs_position_at_basic_block(&rs, arms[a]);
+      rs_operand_t y = x;
+      for (size_t i = 0; i < JIT_ARM_LENGTH; i++)
+        y = rs_build_add(&rs, y, RS_OPERAND_INT64((int64_t)(a + i)));
+      rs_build_store(&rs, y, CELL(cells[1]));
+      rs_build_br(&rs, RS_OPERAND_BB(join));
+    }
+    rs_position_at_basic_block(&rs, join);
+    if (rs.next_dst_vreg > 128)
+      rs.next_dst_vreg = 0;
+    x = rs_build_load(&rs, CELL(cells[1]));
+  }
+  rs_build_ret(&rs, x);
+
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  if (fn)
+    *result = fn();
+  rs_jit_free(fn);
+  rs_free(&rs);
+  return fn != NULL;
+}
+
+int main(void) {
+  for (size_t i = 0; i < JIT_MAX_WIDTH; i++)
+    cells[i] = (int64_t)i + 1;
+
+  static const size_t widths[] = {2, 6, 10, 13, 14, 20, 50, JIT_MAX_WIDTH};
+  for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+    size_t width = widths[w];
+    int64_t expected = (int64_t)(width * (width + 1) / 2);
+    for (rs_opt_level_t level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+      for (int branch = 0; branch < 2; branch++) {
+        int64_t result = 0;
+        CHECK(sum_of_cells(level, width, branch, &result));
+        CHECK(result == expected);
+      }
+    }
+  }
+
+  // Starting below zero takes the first arm for a while and then the second.
+  cells[0] = -200;
+  int64_t expected = cells[0];
+  for (int64_t d = 0; d < JIT_DIAMONDS; d++) {
+    int64_t arm = expected < d ? 0 : 1;
+    for (int64_t i = 0; i < JIT_ARM_LENGTH; i++)
+      expected += arm + i;
+  }
+  // `RS_OPT_O0` gives every vreg a single slot, so it is left out.
+  for (rs_opt_level_t level = RS_OPT_O1; level <= RS_OPT_O2; level++) {
+    int64_t result = 0;
+    CHECK(diamonds(level, &result));
+    CHECK(result == expected);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,58 @@
+/**
+ * @file module.c
+ * @brief Calls between the functions of a JIT-compiled module.
+ */
+#include "test.h"
+
+static int64_t cells[2];
+
+// Builds `square(x, y) = x * x + y` and a caller that keeps a value live
+// across the call and a branch, returning `square(v, 3) + v + 100`.
+static bool check_calls(rs_opt_level_t level) {
+  rs_module_t module;
+  rs_module_init(&module, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&module.rs, level);
+  size_t square = rs_module_add_function(&module, "square");
+  size_t caller = rs_module_add_function(&module, "caller");
+
+  rs_t *rs = rs_module_position_at_function(&module, square);
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t x = rs_build_param(rs, 0);
+  rs_build_ret(rs, rs_build_add(rs, rs_build_mult(rs, x, x),
+                                rs_build_param(rs, 1)));
+
+  rs = rs_module_position_at_function(&module, caller);
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_position_at_basic_block(rs, entry);
+  rs_operand_t value = rs_build_load(rs, CELL(cells[0]));
+  rs_operand_t offset = rs_build_add(rs, value, RS_OPERAND_INT64(100));
+  rs_operand_t result = rs_build_call(rs, RS_OPERAND_SYM("square"), value,
+                                      RS_OPERAND_INT64(3));
+  rs_build_br(rs, RS_OPERAND_BB(exit));
+  rs_position_at_basic_block(rs, exit);
+  rs_operand_t total = rs_build_add(rs, result, offset);
+  rs_build_store(rs, total, CELL(cells[1]));
+  rs_build_ret(rs, total);
+
+  rs_jit_fn_t functions[2];
+  bool compiled = rs_jit_compile_module(&module, functions);
+  CHECK(compiled);
+  bool correct = false;
+  if (compiled) {
+    cells[0] = 5;
+    cells[1] = 0;
+    int64_t returned = functions[caller]();
+    correct = returned == 5 * 5 + 3 + 105 && cells[1] == returned;
+    rs_jit_free(functions[0]);
+  }
+  rs_module_free(&module);
+  return correct;
+}
+
+int main(void) {
+  CHECK(check_calls(RS_OPT_O0));
+  CHECK(check_calls(RS_OPT_O1));
+  CHECK(check_calls(RS_OPT_O2));
+  return TEST_RESULT();
+}
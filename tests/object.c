@@ -0,0 +1,123 @@
+/**
+ * @file object.c
+ * @brief ELF objects read back by binutils.
+ *
+ * Writes the object of a function and of a module, and checks the sections,
+ * symbols and relocations `readelf` finds and that `objdump` disassembles the
+ * code. It passes without checking when either tool is missing.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Output of one tool run read back. */
+#define OBJECT_OUTPUT 65536
+
+// Runs `tool` on `path`, returning its output or NULL if it did not succeed.
+static const char *run(const char *tool, const char *path) {
+  static char output[OBJECT_OUTPUT];
+  char command[256];
+  snprintf(command, sizeof(command), "%s %s 2>/dev/null", tool, path);
+  FILE *pipe = popen(command, "r");
+  if (!pipe)
+    return NULL;
+  size_t length = fread(output, 1, sizeof(output) - 1, pipe);
+  output[length] = '\0';
+  return pclose(pipe) == 0 ? output : NULL;
+}
+
+// Builds `f(x) = x < 3 ? ext(x) : 7` over three blocks.
+static void build_branchy(rs_t *rs) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t call = rs_append_basic_block(rs, "call");
+  size_t constant = rs_append_basic_block(rs, "constant");
+  rs_position_at_basic_block(rs, entry);
+  rs_operand_t x = rs_build_param(rs, 0);
+  rs_build_br_if(rs, rs_build_cmp_lt(rs, x, RS_OPERAND_INT64(3)),
+                 RS_OPERAND_BB(call), RS_OPERAND_BB(constant));
+  rs_position_at_basic_block(rs, call);
+  rs_build_ret(rs, rs_build_call(rs, RS_OPERAND_SYM("ext"), x,
+                                 RS_OPERAND_NULL));
+  rs_position_at_basic_block(rs, constant);
+  rs_build_ret(rs, RS_OPERAND_INT64(7));
+}
+
+static void check_function(const char *path, rs_opt_level_t level) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_branchy(&rs);
+  FILE *fp = fopen(path, "wb");
+  CHECK(fp && rs_generate_object(&rs, fp));
+  if (fp)
+    fclose(fp);
+  rs_free(&rs);
+
+  const char *sections = run("readelf -SW", path);
+  CHECK(sections && strstr(sections, ".text") &&
+        strstr(sections, ".rela.text") && strstr(sections, ".symtab") &&
+        strstr(sections, ".strtab"));
+  const char *symbols = run("readelf -sW", path);
+  CHECK(symbols && strstr(symbols, "FUNC    GLOBAL DEFAULT    1 _start"));
+  CHECK(symbols && strstr(symbols, "LOCAL  DEFAULT    1 _start.entry") &&
+        strstr(symbols, "LOCAL  DEFAULT    1 _start.call") &&
+        strstr(symbols, "LOCAL  DEFAULT    1 _start.constant"));
+  CHECK(symbols && strstr(symbols, "GLOBAL DEFAULT  UND ext"));
+  const char *relocations = run("readelf -rW", path);
+  CHECK(relocations && strstr(relocations, "R_X86_64_PLT32") &&
+        strstr(relocations, "ext - 4"));
+  const char *disassembly = run("objdump -d", path);
+  CHECK(disassembly && strstr(disassembly, "<_start>:") &&
+        strstr(disassembly, "ret") && !strstr(disassembly, "(bad)"));
+}
+
+static void check_module(const char *path) {
+  rs_module_t module;
+  rs_module_init(&module, RS_TARGET_X86_64_LINUX_NASM);
+  size_t square = rs_module_add_function(&module, "square");
+  size_t caller = rs_module_add_function(&module, "caller");
+  rs_t *rs = rs_module_position_at_function(&module, square);
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t x = rs_build_param(rs, 0);
+  rs_build_ret(rs, rs_build_mult(rs, x, x));
+  rs = rs_module_position_at_function(&module, caller);
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_build_ret(rs, rs_build_call(rs, RS_OPERAND_SYM("square"),
+                                 RS_OPERAND_INT64(6), RS_OPERAND_NULL));
+  FILE *fp = fopen(path, "wb");
+  CHECK(fp && rs_module_generate_object(&module, fp));
+  if (fp)
+    fclose(fp);
+  rs_module_free(&module);
+
+  const char *symbols = run("readelf -sW", path);
+  CHECK(symbols && strstr(symbols, "FUNC    GLOBAL DEFAULT    1 square") &&
+        strstr(symbols, "FUNC    GLOBAL DEFAULT    1 caller"));
+  CHECK(symbols && !strstr(symbols, "UND square"));
+  const char *disassembly = run("objdump -d", path);
+  CHECK(disassembly && strstr(disassembly, "<square>:") &&
+        strstr(disassembly, "<caller>:") && !strstr(disassembly, "(bad)"));
+}
+
+int main(void) {
+  if (system("readelf --version >/dev/null 2>&1") != 0 ||
+      system("objdump --version >/dev/null 2>&1") != 0) {
+    fprintf(stderr, "object: readelf or objdump missing, skipped\n");
+    return 0;
+  }
+
+  char path[] = "/tmp/runestone-object-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  if (fd < 0)
+    return TEST_RESULT();
+  close(fd);
+
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++)
+    check_function(path, (rs_opt_level_t)level);
+  check_module(path);
+  unlink(path);
+  return TEST_RESULT();
+}
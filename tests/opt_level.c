@@ -0,0 +1,83 @@
+/**
+ * @file opt_level.c
+ * @brief Optimization levels, allocator selection and their failure modes.
+ */
+#include "test.h"
+
+static int64_t cell;
+
+/**
+ * Additions in a chain, too many for O0 to find a scratch virtual register
+ * per target register above them.
+ */
+#define OPT_LEVEL_LONG_CHAIN 245
+
+// Builds `cell + 1 + 1 + ...` with `length` additions.
+static void build_chain(rs_t *rs, int length) {
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t sum = rs_build_load(rs, CELL(cell));
+  for (int i = 0; i < length; i++)
+    sum = rs_build_add(rs, sum, RS_OPERAND_INT64(1));
+  rs_build_ret(rs, sum);
+}
+
+// Values out of range leave the level and allocator as they were.
+static void check_selection(void) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, RS_OPT_O2);
+  CHECK(rs.opt_level == RS_OPT_O2 && rs.regalloc == RS_REGALLOC_GRAPH);
+  rs_set_opt_level(&rs, (rs_opt_level_t)7);
+  CHECK(rs.opt_level == RS_OPT_O2 && rs.regalloc == RS_REGALLOC_GRAPH);
+  rs_set_regalloc(&rs, (rs_regalloc_t)9);
+  CHECK(rs.regalloc == RS_REGALLOC_GRAPH);
+  rs_set_regalloc(&rs, RS_REGALLOC_LINEAR);
+  CHECK(rs.opt_level == RS_OPT_O2 && rs.regalloc == RS_REGALLOC_LINEAR);
+  rs_set_opt_level(&rs, RS_OPT_O0);
+  CHECK(rs.regalloc == RS_REGALLOC_STACK);
+  rs_free(&rs);
+}
+
+// Compiles a chain of `length` additions at `level`, returning whether it
+// compiled and leaving its result in `result`.
+static bool run_chain(rs_opt_level_t level, int length, int64_t *result) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_chain(&rs, length);
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  cell = 1000;
+  if (fn)
+    *result = fn();
+  rs_jit_free(fn);
+  rs_free(&rs);
+  return fn != NULL;
+}
+
+int main(void) {
+  check_selection();
+
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+    int64_t result = 0;
+    CHECK(run_chain((rs_opt_level_t)level, 20, &result));
+    CHECK(result == 1020);
+  }
+
+  // O0 fails without emitting code once its scratch registers no longer fit
+  // below the temporary, while O1 needs none.
+  int64_t result = 0;
+  CHECK(!run_chain(RS_OPT_O0, OPT_LEVEL_LONG_CHAIN, &result));
+  CHECK(run_chain(RS_OPT_O1, OPT_LEVEL_LONG_CHAIN, &result));
+  CHECK(result == 1000 + OPT_LEVEL_LONG_CHAIN);
+
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, RS_OPT_O0);
+  build_chain(&rs, OPT_LEVEL_LONG_CHAIN);
+  FILE *fp = tmpfile();
+  CHECK(fp && !rs_generate(&rs, fp));
+  if (fp)
+    fclose(fp);
+  rs_free(&rs);
+  return TEST_RESULT();
+}
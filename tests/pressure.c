@@ -0,0 +1,131 @@
+/**
+ * @file pressure.c
+ * @brief Register pressure profiles against a direct count.
+ *
+ * A register is live at an instruction between its first and last
+ * occurrence in the block, stretched to the block's start when it is live
+ * in and to its end when it is live out.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Blocks of the generated functions. */
+#define PRESSURE_BLOCKS 4
+
+/** Instructions generated per block, before its terminator. */
+#define PRESSURE_BLOCK_LENGTH 40
+
+static int64_t cell;
+
+// Counts the registers live at instruction `index` of a block the slow way.
+static size_t live_at(const rs_t *rs, const rs_liveness_t *liveness,
+                      size_t local, size_t index) {
+  rs_instructions_t instrs = rs->basic_blocks[local]->instructions;
+  size_t count = cvector_size(instrs), live = 0;
+  for (size_t vreg = 0; vreg < RS_MAX_REGS; vreg++) {
+    size_t first = SIZE_MAX, last = 0;
+    if (rs_regset_contains(&liveness->live_in[local], (uint8_t)vreg))
+      first = 0;
+    if (rs_regset_contains(&liveness->live_out[local], (uint8_t)vreg))
+      last = count - 1;
+    for (size_t i = 0; i < count; i++) {
+      uint8_t regs[RS_INSTR_MAX_USES + 1];
+      size_t reg_count = rs_instr_uses(instrs[i], regs);
+      reg_count += rs_instr_def(instrs[i], &regs[reg_count]);
+      for (size_t r = 0; r < reg_count; r++) {
+        if (regs[r] != vreg)
+          continue;
+        first = i < first ? i : first;
+        last = i > last ? i : last;
+      }
+    }
+    live += first <= index && index <= last;
+  }
+  return live;
+}
+
+// Builds blocks of loads and sums over values picked by `seed`, some of them
+// defined in earlier blocks, chained by a loop back from the last block.
+static void build_random(rs_t *rs, uint32_t seed) {
+  size_t blocks[PRESSURE_BLOCKS];
+  for (size_t b = 0; b < PRESSURE_BLOCKS; b++)
+    blocks[b] = rs_append_basic_block(rs, NULL);
+
+  rs_operand_t values[PRESSURE_BLOCKS * PRESSURE_BLOCK_LENGTH];
+  size_t value_count = 0;
+  for (size_t b = 0; b < PRESSURE_BLOCKS; b++) {
+    rs_position_at_basic_block(rs, blocks[b]);
+    for (size_t i = 0; i < PRESSURE_BLOCK_LENGTH; i++) {
+      seed = seed * 1103515245 + 12345;
+      if (value_count < 2 || (seed >> 16) % 3 == 0) {
+        values[value_count++] = rs_build_load(rs, CELL(cell));
+        continue;
+      }
+      rs_operand_t left = values[(seed >> 8) % value_count];
+      rs_operand_t right = values[(seed >> 20) % value_count];
+      values[value_count++] = rs_build_add(rs, left, right);
+    }
+    if (b + 1 < PRESSURE_BLOCKS) {
+      rs_build_br(rs, RS_OPERAND_BB(blocks[b + 1]));
+    } else {
+      rs_build_br_if(rs, values[value_count - 1], RS_OPERAND_BB(blocks[1]),
+                     RS_OPERAND_BB(blocks[0]));
+    }
+  }
+}
+
+static void check_against_count(uint32_t seed) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  build_random(&rs, seed);
+  const rs_liveness_t *liveness = rs_get_liveness(&rs);
+  const rs_pressure_t *pressure = rs_get_pressure(&rs);
+  CHECK(liveness && pressure);
+  if (!liveness || !pressure) {
+    rs_free(&rs);
+    return;
+  }
+
+  size_t max = 0;
+  for (size_t local = 0; local < PRESSURE_BLOCKS; local++) {
+    size_t block_max = 0;
+    size_t count = cvector_size(rs.basic_blocks[local]->instructions);
+    for (size_t i = 0; i < count; i++) {
+      size_t expected = live_at(&rs, liveness, local, i);
+      CHECK(rs_pressure_at(pressure, local, i) == expected);
+      block_max = expected > block_max ? expected : block_max;
+    }
+    CHECK(rs_pressure_block_max(pressure, local) == block_max);
+    max = block_max > max ? block_max : max;
+  }
+  CHECK(pressure->max == max);
+  rs_free(&rs);
+}
+
+// Three loads summed in turn: 1, 2 and 3 live, then 4 at the first add, whose
+// result joins its sources, 3 at the second and 1 at the return.
+static void check_straight_line(void) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_position_at_basic_block(&rs, rs_append_basic_block(&rs, "entry"));
+  rs_operand_t a = rs_build_load(&rs, CELL(cell));
+  rs_operand_t b = rs_build_load(&rs, CELL(cell));
+  rs_operand_t c = rs_build_load(&rs, CELL(cell));
+  rs_build_ret(&rs, rs_build_add(&rs, rs_build_add(&rs, a, b), c));
+  const rs_pressure_t *pressure = rs_get_pressure(&rs);
+  CHECK(pressure);
+  if (pressure) {
+    static const size_t expected[] = {1, 2, 3, 4, 3, 1};
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+      CHECK(rs_pressure_at(pressure, 0, i) == expected[i]);
+    CHECK(pressure->max == 4);
+  }
+  rs_free(&rs);
+}
+
+int main(void) {
+  check_straight_line();
+  for (uint32_t seed = 1; seed <= 20; seed++)
+    check_against_count(seed);
+  return TEST_RESULT();
+}
@@ -0,0 +1,105 @@
+/**
+ * @file profile.c
+ * @brief Block counters and the profiles written from them.
+ */
+#include "test.h"
+
+static int64_t counter, accumulator;
+
+/** Blocks of the loop `build_loop` builds. */
+#define PROFILE_BLOCKS 4
+
+// Builds `for (counter = 0; counter < 10; counter++) accumulator += counter`,
+// returning the accumulator.
+static void build_loop(rs_t *rs) {
+  size_t entry = rs_append_basic_block(rs, "entry");
+  size_t header = rs_append_basic_block(rs, "header");
+  size_t body = rs_append_basic_block(rs, "body");
+  size_t exit = rs_append_basic_block(rs, "exit");
+  rs_position_at_basic_block(rs, entry);
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(counter));
+  rs_build_store(rs, RS_OPERAND_INT64(0), CELL(accumulator));
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, header);
+  rs_operand_t i = rs_build_load(rs, CELL(counter));
+  rs_build_br_if(rs, rs_build_cmp_lt(rs, i, RS_OPERAND_INT64(10)),
+                 RS_OPERAND_BB(body), RS_OPERAND_BB(exit));
+  rs_position_at_basic_block(rs, body);
+  i = rs_build_load(rs, CELL(counter));
+  rs_build_store(rs, rs_build_add(rs, rs_build_load(rs, CELL(accumulator)), i),
+                 CELL(accumulator));
+  rs_build_store(rs, rs_build_add(rs, i, RS_OPERAND_INT64(1)), CELL(counter));
+  rs_build_br(rs, RS_OPERAND_BB(header));
+  rs_position_at_basic_block(rs, exit);
+  rs_build_ret(rs, rs_build_load(rs, CELL(accumulator)));
+}
+
+// Counts two runs of the loop into `profile`.
+static void record(bool atomic, FILE *profile) {
+  uint64_t counts[PROFILE_BLOCKS] = {0};
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  build_loop(&rs);
+  rs_instrument_blocks(&rs, counts, PROFILE_BLOCKS, atomic);
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn);
+  if (fn) {
+    CHECK(fn() == 45);
+    CHECK(fn() == 45);
+  }
+  CHECK(counts[0] == 2 && counts[1] == 22 && counts[2] == 20 &&
+        counts[3] == 2);
+  CHECK(rs_write_profile(&rs, profile));
+  rs_jit_free(fn);
+  rs_free(&rs);
+}
+
+// Loads `text` as the profile of the loop.
+static bool load(const char *text, rs_t *rs) {
+  FILE *fp = tmpfile();
+  if (!fp)
+    return false;
+  fputs(text, fp);
+  rewind(fp);
+  bool loaded = rs_load_profile(rs, fp);
+  fclose(fp);
+  return loaded;
+}
+
+int main(void) {
+  FILE *profile = tmpfile();
+  CHECK(profile);
+  if (!profile)
+    return TEST_RESULT();
+  record(false, profile);
+  record(true, profile);
+  // Lines of other functions are skipped.
+  fputs("other 0 7\n", profile);
+  rewind(profile);
+
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, RS_OPT_O2);
+  build_loop(&rs);
+  CHECK(rs_get_block_frequency(&rs, 1) == 1);
+  CHECK(rs_load_profile(&rs, profile));
+  CHECK(rs_get_block_frequency(&rs, 0) == 2);
+  CHECK(rs_get_block_frequency(&rs, 1) == 22);
+  CHECK(rs_get_block_frequency(&rs, 2) == 20);
+  CHECK(rs_get_block_frequency(&rs, 3) == 2);
+  CHECK(rs_get_block_frequency(&rs, PROFILE_BLOCKS) == 0);
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn && fn() == 45);
+  rs_jit_free(fn);
+  fclose(profile);
+
+  // A rejected profile leaves no frequencies behind.
+  CHECK(!load("_start x 1\n", &rs));
+  CHECK(rs_get_block_frequency(&rs, 1) == 1);
+  CHECK(!load("_start 1 2 3\n", &rs));
+  CHECK(!load("_start 4 1\n", &rs));
+  CHECK(!load("_start 18446744073709551000 1\n", &rs));
+  CHECK(rs_get_block_frequency(&rs, 1) == 1);
+  rs_free(&rs);
+  return TEST_RESULT();
+}
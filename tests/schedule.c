@@ -0,0 +1,67 @@
+/**
+ * @file schedule.c
+ * @brief Scheduled code against unscheduled code.
+ *
+ * Only `RS_OPT_O2` reorders instructions, so its results and memory effects
+ * must match those of `RS_OPT_O0` and `RS_OPT_O1` on programs whose loads and
+ * stores alias.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Cells the programs read and write. */
+#define SCHEDULE_CELLS 4
+
+static int64_t cells[SCHEDULE_CELLS];
+
+static const int64_t initial[SCHEDULE_CELLS] = {3, 5, 7, 11};
+
+// Chains stores and reloads of the same cells between independent arithmetic
+// the scheduler is free to move.
+static void build_aliasing(rs_t *rs) {
+  rs_position_at_basic_block(rs, rs_append_basic_block(rs, "entry"));
+  rs_operand_t a = rs_build_load(rs, CELL(cells[0]));
+  rs_operand_t b = rs_build_load(rs, CELL(cells[1]));
+  rs_operand_t product = rs_build_mult(rs, a, b);
+  rs_build_store(rs, rs_build_add(rs, a, RS_OPERAND_INT64(1)),
+                 CELL(cells[0]));
+  rs_operand_t reloaded = rs_build_load(rs, CELL(cells[0]));
+  rs_operand_t c = rs_build_load(rs, CELL(cells[2]));
+  rs_build_store(rs, rs_build_mult(rs, reloaded, c), CELL(cells[1]));
+  rs_operand_t difference = rs_build_sub(rs, product, c);
+  rs_build_store(rs, difference, CELL(cells[0]));
+  rs_operand_t b2 = rs_build_load(rs, CELL(cells[1]));
+  rs_operand_t d = rs_build_load(rs, CELL(cells[3]));
+  rs_build_store(rs, rs_build_add(rs, b2, d), CELL(cells[3]));
+  rs_build_store(rs, product, CELL(cells[2]));
+  rs_operand_t a2 = rs_build_load(rs, CELL(cells[0]));
+  rs_operand_t d2 = rs_build_load(rs, CELL(cells[3]));
+  rs_build_ret(rs, rs_build_add(rs, rs_build_mult(rs, a2, d2), reloaded));
+}
+
+// Runs the program at `level`, leaving its memory effects in `memory`.
+static int64_t run(rs_opt_level_t level, int64_t memory[SCHEDULE_CELLS]) {
+  rs_t rs;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_opt_level(&rs, level);
+  build_aliasing(&rs);
+  memcpy(cells, initial, sizeof(cells));
+  rs_jit_fn_t fn = rs_jit_compile(&rs);
+  CHECK(fn);
+  int64_t result = fn ? fn() : -1;
+  memcpy(memory, cells, sizeof(cells));
+  rs_jit_free(fn);
+  rs_free(&rs);
+  return result;
+}
+
+int main(void) {
+  // a = 3, b = 5: cells become {15 - 7, 4 * 7, 15, 28 + 11}.
+  static const int64_t expected[SCHEDULE_CELLS] = {8, 28, 15, 39};
+  int64_t memory[SCHEDULE_CELLS];
+  for (int level = RS_OPT_O0; level <= RS_OPT_O2; level++) {
+    CHECK(run((rs_opt_level_t)level, memory) == 8 * 39 + 4);
+    CHECK(memcmp(memory, expected, sizeof(expected)) == 0);
+  }
+  return TEST_RESULT();
+}
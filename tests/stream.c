@@ -0,0 +1,121 @@
+/**
+ * @file stream.c
+ * @brief Streamed code generation against generating the whole function.
+ *
+ * A streamed function is headed before its later windows are built, so it
+ * saves every callee-saved register. Apart from those saves its code must
+ * be what `rs_generate_to` makes of the same function.
+ */
+#include "test.h"
+#include <string.h>
+
+/** Blocks of the longest function, more than one window. */
+#define STREAM_MAX_BLOCKS 80
+
+/** Bytes of generated code compared. */
+#define STREAM_OUTPUT (256 * 1024)
+
+static int64_t cell;
+
+static const char *callee_saved[] = {"rbx", "rbp", "r12", "r13", "r14", "r15"};
+
+// Builds a chain of `count` blocks, each adding its index to `cell` and
+// branching on the old value, sealing every block once its successor exists
+// when `seal`.
+static void build_chain(rs_t *rs, size_t count, bool seal) {
+  size_t block = rs_append_basic_block(rs, "entry");
+  rs_position_at_basic_block(rs, block);
+  for (size_t b = 1; b <= count; b++) {
+    size_t next = rs_append_basic_block(rs, NULL);
+    rs_operand_t value = rs_build_load(rs, CELL(cell));
+    rs_build_store(rs, rs_build_add(rs, value, RS_OPERAND_INT64((int64_t)b)),
+                   CELL(cell));
+    rs_build_br_if(rs, rs_build_cmp_lt(rs, value, RS_OPERAND_INT64(0)),
+                   RS_OPERAND_BB(next), RS_OPERAND_BB(next));
+    if (seal)
+      rs_seal_basic_block(rs, block);
+    rs_position_at_basic_block(rs, next);
+    block = next;
+  }
+  rs_build_ret(rs, rs_build_load(rs, CELL(cell)));
+  if (seal)
+    rs_seal_basic_block(rs, block);
+}
+
+// Whether `line` saves or restores a callee-saved register.
+static bool is_save(const char *line, size_t length) {
+  for (size_t i = 0; i < sizeof(callee_saved) / sizeof(callee_saved[0]); i++) {
+    char save[16];
+    int n = snprintf(save, sizeof(save), "  push %s", callee_saved[i]);
+    if ((size_t)n == length && memcmp(line, save, length) == 0)
+      return true;
+    n = snprintf(save, sizeof(save), "  pop %s", callee_saved[i]);
+    if ((size_t)n == length && memcmp(line, save, length) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Copies the emitted text to `text` without saves and restores, counting
+// those in `saves`.
+static size_t strip_saves(const rs_emitter_t *out, char *text, size_t *saves) {
+  size_t length = 0;
+  *saves = 0;
+  for (size_t start = 0; start < out->length;) {
+    const char *end = memchr(out->data + start, '\n', out->length - start);
+    size_t line = end ? (size_t)(end - out->data) - start : out->length - start;
+    if (is_save(out->data + start, line)) {
+      (*saves)++;
+    } else if (length + line + 1 <= STREAM_OUTPUT) {
+      memcpy(text + length, out->data + start, line);
+      length += line;
+      text[length++] = '\n';
+    }
+    start += line + 1;
+  }
+  return length;
+}
+
+// Streams and generates a chain of `count` blocks and compares the code.
+static void check_chain(size_t count) {
+  static char whole_text[STREAM_OUTPUT], streamed_text[STREAM_OUTPUT];
+
+  rs_t rs;
+  rs_emitter_t whole;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_verbosity(&rs, RS_VERBOSITY_NONE);
+  rs_emitter_init_buffer(&whole);
+  build_chain(&rs, count, false);
+  CHECK(rs_generate_to(&rs, &whole));
+  rs_free(&rs);
+
+  rs_emitter_t streamed;
+  rs_init(&rs, RS_TARGET_X86_64_LINUX_NASM);
+  rs_set_verbosity(&rs, RS_VERBOSITY_NONE);
+  rs_emitter_init_buffer(&streamed);
+  CHECK(rs_stream_begin(&rs, &streamed));
+  build_chain(&rs, count, true);
+  CHECK(rs_stream_end(&rs));
+  for (size_t b = 0; b < cvector_size(rs.basic_blocks); b++)
+    CHECK(cvector_size(rs.basic_blocks[b]->instructions) == 0);
+  rs_free(&rs);
+
+  size_t whole_saves, streamed_saves;
+  size_t whole_length = strip_saves(&whole, whole_text, &whole_saves);
+  size_t streamed_length =
+      strip_saves(&streamed, streamed_text, &streamed_saves);
+  CHECK(whole_length > 0 && whole_length == streamed_length &&
+        memcmp(whole_text, streamed_text, whole_length) == 0);
+  CHECK(streamed_saves == 2 * sizeof(callee_saved) / sizeof(callee_saved[0]));
+  CHECK(whole_saves <= streamed_saves);
+  rs_emitter_free(&whole);
+  rs_emitter_free(&streamed);
+}
+
+int main(void) {
+  static const size_t counts[] = {1, RS_STREAM_WINDOW - 1, RS_STREAM_WINDOW,
+                                  RS_STREAM_WINDOW + 1, STREAM_MAX_BLOCKS};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    check_chain(counts[i]);
+  return TEST_RESULT();
+}
@@ -0,0 +1,33 @@
+/**
+ * @file test.h
+ * @brief Checks shared by the tests.
+ *
+ * Every test is a program that exits with a nonzero status when a check
+ * failed, after reporting each failed check on stderr.
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include "../lib/runestone.h"
+#include <stdio.h>
+
+/** Checks that failed so far. */
+static int test_failures;
+
+/** Reports `condition` with its location when it does not hold. */
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,         \
+              #condition);                                                     \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+/** The exit status of a test. */
+#define TEST_RESULT() (test_failures ? 1 : 0)
+
+/** Wraps the address of `cell` into an operand. */
+#define CELL(cell) RS_OPERAND_ADDR((uintptr_t) & (cell))
+
+#endif